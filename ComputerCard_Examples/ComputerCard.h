@@ -1,7 +1,7 @@
 /*
 ComputerCard  - by Chris Johnson
 
-version 0.2.7   -  2025/03/08
+version 0.3.0   -  2026/10/18
 
 ComputerCard is a header-only C++ library, providing a class that
 manages the hardware aspects of the Music Thing Modular Workshop
@@ -20,6 +20,9 @@ See examples/ directory
 
 #include "hardware/gpio.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "hardware/structs/sio.h"
+#include "SPSCQueue.h"
 
 #define PULSE_1_RAW_OUT 8
 #define PULSE_2_RAW_OUT 9
@@ -30,6 +33,103 @@ See examples/ directory
 // USB host status pin
 #define USB_HOST_STATUS 20
 
+
+/** \brief Queue of 32-bit values using the RP2040 SIO inter-core FIFO
+
+    Same interface as SPSCQueue, but backed by the 8-entry hardware FIFO
+    between the two cores, so needs no shared memory. Push must be called on
+    one core and Pop on the other. The FIFO is also used by
+    multicore_launch_core1 and multicore_lockout, so do not use these
+    at the same time as this queue.
+*/
+template <typename T = uint32_t>
+class SIOFIFOQueue
+{
+	static_assert(sizeof(T) <= sizeof(uint32_t), "SIOFIFOQueue values must fit in 32 bits");
+
+public:
+	bool __not_in_flash_func(Push)(const T &value)
+	{
+		if (!(sio_hw->fifo_st & SIO_FIFO_ST_RDY_BITS))
+		{
+			overflows++;
+			return false;
+		}
+		uint32_t word = 0;
+		__builtin_memcpy(&word, &value, sizeof(T));
+		sio_hw->fifo_wr = word;
+		__sev(); // wake other core, if waiting for event
+		return true;
+	}
+
+	bool __not_in_flash_func(Pop)(T &value)
+	{
+		if (!(sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS))
+			return false;
+		uint32_t word = sio_hw->fifo_rd;
+		__builtin_memcpy(&value, &word, sizeof(T));
+		return true;
+	}
+
+	/// True if there is a value to Pop, on this core
+	bool __not_in_flash_func(Empty)() const {return !(sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS);}
+
+	/// True if Push would fail, on this core
+	bool __not_in_flash_func(Full)() const {return !(sio_hw->fifo_st & SIO_FIFO_ST_RDY_BITS);}
+
+	uint32_t Overflows() const {return overflows;}
+
+	static constexpr uint32_t Capacity() {return 8;}
+
+private:
+	volatile uint32_t overflows = 0;
+};
+
+
+/** \brief Double-buffered block of parameters, published with an atomic swap
+
+    For passing a set of values (such as filter coefficients calculated in
+    ProcessControl) to ProcessSample, so that the reader always sees a
+    complete, consistent set. One writer fills the back buffer with Write()
+    then calls Publish(); the reader calls Read() to get the front buffer.
+
+    The writer starts to overwrite a buffer one Publish() after it was
+    swapped out, so each Read() must finish using the values before then
+    (always true when reading in ProcessSample and publishing at control rate).
+*/
+template <typename T>
+class DoubleBuffer
+{
+public:
+	/// Back buffer, to be filled in then published. Writer only.
+	T &Write() {return buffer[1 - front];}
+
+	/// Make the back buffer visible to the reader. Writer only.
+	void __not_in_flash_func(Publish)()
+	{
+		__dmb(); // buffer contents written before swap
+		front = 1 - front;
+		version++;
+	}
+
+	/// Most recently published values. Reader only.
+	const T &__not_in_flash_func(Read)() const
+	{
+		uint32_t f = front;
+		__dmb(); // swap read before buffer contents
+		return buffer[f];
+	}
+
+	/// Number of times Publish has been called, to detect new values
+	uint32_t Version() const {return version;}
+
+private:
+	T buffer[2] = {};
+	volatile uint32_t front = 0;
+	volatile uint32_t version = 0;
+};
+
+
 class ComputerCard
 {
 	constexpr static int numLeds = 6;
@@ -46,6 +146,34 @@ public:
 	enum HardwareVersion_t {Proto1=0x2a, Proto2_Rev1=0x30, Rev1_1=0x0C, Unknown=0xFF};
 	/// USB Power state
 	enum USBPowerState_t {DFP, UFP, Unsupported};
+	/// Where deferred work is run, used by SetDeferredWorker
+	enum DeferredWorker_t {Core0Loop, Core1Loop, UserLoop};
+	/// Function run by Defer, with the context and argument passed to Defer
+	typedef void (*DeferredFunction)(void *context, uint32_t arg);
+	/// One sample of jack inputs, passed to ProcessBlock
+	struct InputFrame
+	{
+		int16_t audio[2]; // -2048 to 2047
+		int16_t cv[2]; // -2048 to 2047
+		bool pulse[2];
+	};
+	/// One sample of jack outputs, filled in by ProcessBlock
+	struct OutputFrame
+	{
+		int16_t audio[2]; // -2048 to 2047
+		int16_t cv[2]; // -2048 to 2047
+		bool pulse[2];
+	};
+	/// Time taken by each step of the ComputerCard constructor, in microseconds
+	struct BootProfile_t
+	{
+		uint32_t hardwareInit; // GPIO, PWM, ADC, SPI and I2C setup
+		uint32_t probe; // hardware version probe
+		uint32_t eeprom; // calibration read from EEPROM (or flash cache)
+		uint32_t uniqueID; // flash unique ID read and hashing
+		uint32_t total;
+		bool calibrationCached; // true if calibration was taken from flash cache
+	};
 
 	ComputerCard();
 
@@ -62,6 +190,44 @@ public:
 
 	/// Use before Run() to enable Connected/Disconnected detection
 	void EnableNormalisationProbe() {useNormProbe = true;}
+
+	/// Use before Run() to render audio in blocks on core 1, with ProcessBlock.
+	/// Outputs are delayed by latencyBlocks blocks; rendering each block must take
+	/// less than (latencyBlocks-1) blocks of time. Returns false if parameters invalid.
+	bool EnableBlockRendering(int blockSize = 32, int latencyBlocks = 2);
+
+	/// Use before Run() to call ProcessSampleCore1 on core 1 in parallel with ProcessSample,
+	/// every sample. Cannot be used with block rendering. Returns false if that is enabled.
+	bool EnableParallelProcessing();
+
+	/// Use before Run() to call ProcessControl at rateHz (1 to 48000), from the
+	/// main loop on core 0 so that it is interrupted by audio processing.
+	/// Returns false if rateHz is out of range.
+	bool EnableControlRate(uint32_t rateHz = 1000);
+
+	/// Use before Run() to choose where work passed to Defer is run: in the main loop on
+	/// core 0 (default), on core 1 by RunCore1 (not with parallel processing), or by
+	/// calling ServiceDeferred from a loop in the card's own code
+	void SetDeferredWorker(DeferredWorker_t worker) {deferredWorker = worker;}
+
+	/// Run all deferred work that has been queued by Defer. Only call from the
+	/// worker chosen with SetDeferredWorker. Returns number of functions run.
+	uint32_t ServiceDeferred();
+
+	/// Number of samples processed since Run() was called; within ProcessSample,
+	/// the index of the current sample. Can be read from any core, e.g. to timestamp events.
+	uint32_t __not_in_flash_func(SampleCounter)() const {return sampleCounter;}
+
+	/// Entry point for core 1, e.g. multicore_launch_core1(ComputerCard::RunCore1)
+	/// Waits for Run() to be called, then runs ProcessBlock or ProcessSampleCore1 as required. Never returns.
+	static void RunCore1();
+
+	/// Set LED gamma curve, brightness = value^gamma (default gamma = 2)
+	void SetLedGamma(float gamma);
+
+	/// Set LED gamma table directly, from 257 PWM levels (0-65535)
+	/// for LED brightness values 0, 16, 32, ... 4096
+	void SetLedGammaTable(const uint16_t *table);
 	
 	static ComputerCard *ThisPtr() {return thisptr;}
 
@@ -69,6 +235,64 @@ protected:
 	/// Callback, called once per sample at 48kHz
 	virtual void ProcessSample() = 0;
 
+	/// Callback for block rendering (see EnableBlockRendering), called on core 1.
+	/// Fill out[0..numFrames-1] from in[0..numFrames-1]. Outputs are applied to
+	/// the jacks before ProcessSample is called, so ProcessSample may override them.
+	virtual void ProcessBlock(const InputFrame *in, OutputFrame *out, int numFrames)
+	{
+		(void)in; (void)out; (void)numFrames;
+	}
+
+	/// Callback for parallel processing (see EnableParallelProcessing), called on core 1
+	/// at the same time as ProcessSample on core 0. Both must return before the audio
+	/// outputs are sent to the DAC, so may set different outputs, e.g. one audio channel each.
+	virtual void ProcessSampleCore1() {}
+
+	/// Callback run repeatedly at thread level on core 0 (the core calling Run),
+	/// interrupted by audio processing. Called once after every audio sample
+	/// interrupt or event, with core 0 sleeping in between, so should return promptly.
+	/// Use for USB, LEDs and other housekeeping in cards that do not use core 1.
+	virtual void BackgroundTask() {}
+
+	/// Callback for control-rate processing (see EnableControlRate), called on core 0
+	/// outside the audio interrupt. Use for slower calculations such as mapping knobs
+	/// to coefficients, and pass results to ProcessSample with a DoubleBuffer.
+	virtual void ProcessControl() {}
+
+	/// Number of control-rate ticks skipped because ProcessControl was still running
+	uint32_t ControlOverruns() const {return controlOverruns;}
+
+	/** \brief Queue fn(context, arg) to be run outside the audio interrupt
+
+	    For slow work started from ProcessSample, such as sending MIDI or writing
+	    flash. Call from ProcessSample only. No memory is allocated; returns 0 if
+	    the queue is full, otherwise a ticket for DeferredComplete.
+	*/
+	uint32_t __not_in_flash_func(Defer)(DeferredFunction fn, void *context = nullptr, uint32_t arg = 0)
+	{
+		if (!deferredQueue.Push({fn, context, arg})) return 0;
+		uint32_t depth = deferredQueue.Count();
+		if (depth > deferredMaxDepth) deferredMaxDepth = depth;
+		__sev(); // wake worker, if waiting for event
+		return ++deferredTicket;
+	}
+
+	/// True once the work with this ticket (returned by Defer) has finished
+	bool __not_in_flash_func(DeferredComplete)(uint32_t ticket) const
+	{
+		return int32_t(deferredCompleted - ticket) >= 0;
+	}
+
+	/// Number of deferred functions waiting to run
+	uint32_t DeferredPending() const {return deferredQueue.Count();}
+	/// Largest number of deferred functions that have been waiting at once
+	uint32_t DeferredMaxDepth() const {return deferredMaxDepth;}
+	/// Number of calls to Defer rejected because the queue was full
+	uint32_t DeferredOverflows() const {return deferredQueue.Overflows();}
+
+	/// Number of samples where no rendered block was ready in time
+	uint32_t BlockUnderruns() const {return blockUnderruns;}
+
 
 
 
@@ -168,6 +392,24 @@ protected:
 		cvValue[1] = MIDIToDAC(noteNum, 1);
 	}
 
+	/// Set CV output from calibrated MIDI note number in 1/256ths of a semitone (values 0 to 127*256)
+	void __not_in_flash_func(CVOutMIDINotePrecise)(int i, int32_t note)
+	{
+		cvValue[i] = MIDIToDACPrecise(note, i);
+	}
+
+	/// Set CV 1 output from calibrated MIDI note number in 1/256ths of a semitone (values 0 to 127*256)
+	void __not_in_flash_func(CVOut1MIDINotePrecise)(int32_t note)
+	{
+		cvValue[0] = MIDIToDACPrecise(note, 0);
+	}
+
+	/// Set CV 2 output from calibrated MIDI note number in 1/256ths of a semitone (values 0 to 127*256)
+	void __not_in_flash_func(CVOut2MIDINotePrecise)(int32_t note)
+	{
+		cvValue[1] = MIDIToDACPrecise(note, 1);
+	}
+
 	
 	/// Set CV 1 output from calibrated MIDI note number (values 0 to 127)
 	bool __not_in_flash_func(CVOutMillivolts)(int i, int32_t millivolts)
@@ -263,21 +505,66 @@ protected:
 	// 0 1
 	// 2 3
 	// 4 5
+	// Values are stored in the LED framebuffer, and written to the
+	// PWM hardware (through the gamma table) at the LED refresh rate.
+	// The brightest value set since the last refresh is shown, so that
+	// pulses shorter than the refresh period are not missed.
 	void __not_in_flash_func(LedBrightness)(uint32_t index, uint16_t value)
 	{
-		pwm_set_gpio_level(leds[index], (value*value)>>8);
+		if (value > 4095) value = 4095;
+		ledMode[index] = LedStatic;
+		ledValue[index] = value;
+		if (value > ledHeld[index]) ledHeld[index] = value;
 	}
 	
 	/// Turn LED on/off
 	void __not_in_flash_func(LedOn)(uint32_t index, bool value = true)
 	{
-		pwm_set_gpio_level(leds[index], value?65535:0);
+		ledMode[index] = LedStatic;
+		ledValue[index] = value?ledFull:0;
+		if (value) ledHeld[index] = ledFull;
 	}
 
 	/// Turn LED off
 	void __not_in_flash_func(LedOff)(uint32_t index)
 	{
-		pwm_set_gpio_level(leds[index], 0);
+		ledMode[index] = LedStatic;
+		ledValue[index] = 0;
+	}
+
+	/// Blink LED, on for onMs out of every periodMs milliseconds
+	void __not_in_flash_func(LedBlink)(uint32_t index, uint32_t periodMs, uint32_t onMs, uint16_t value = ledFull)
+	{
+		ledMode[index] = LedStatic; // stop pattern while its parameters change
+		ledPatternA[index] = MsToLedTicks(periodMs);
+		ledPatternB[index] = MsToLedTicks(onMs);
+		ledPatternC[index] = value;
+		ledPatternPos[index] = 0;
+		ledMode[index] = LedBlinking;
+	}
+
+	/// Fade LED from its current brightness to value (0-4095) over durationMs milliseconds
+	void __not_in_flash_func(LedFade)(uint32_t index, uint16_t value, uint32_t durationMs)
+	{
+		if (value > 4095) value = 4095;
+		ledMode[index] = LedStatic;
+		ledPatternA[index] = MsToLedTicks(durationMs);
+		ledPatternB[index] = ledValue[index];
+		ledPatternC[index] = value;
+		ledPatternPos[index] = 0;
+		ledMode[index] = LedFading;
+	}
+
+	/// Display magnitude of val (0-2047) as a bar graph on the
+	/// left (i=0) or right (i=1) column of LEDs, with peak hold and decay.
+	/// Cheap enough to call every sample, e.g. LedMeter(0, AudioIn1())
+	void __not_in_flash_func(LedMeter)(int i, int32_t val)
+	{
+		if (val < 0) val = -val;
+		if (val > meterPeak[i]) meterPeak[i] = val;
+		ledMode[i] = LedMetering;
+		ledMode[i+2] = LedMetering;
+		ledMode[i+4] = LedMetering;
 	}
 
 	// Return power state of USB port
@@ -310,10 +597,27 @@ protected:
 		return cvOutsCalibrated;
 	}
 
+	/// Return time taken by each step of the constructor
+	const BootProfile_t &BootProfile() const
+	{
+		return bootProfile;
+	}
+
 	
 	void Abort();
 
-	uint16_t CRCencode(const uint8_t *data, int length);
+	/// CRC-16-CCITT (polynomial 0x1021) of data, continuing from crc
+	static uint16_t CRCencode(const uint8_t *data, int length, uint16_t crc = 0xFFFF);
+
+	/// Start CRC-16-CCITT of a region of memory (e.g. flash) in the background,
+	/// using DMA and the DMA sniffer. Returns false if a background CRC is already running.
+	bool StartBackgroundCRC(const void *data, uint32_t length);
+
+	/// Return true while a background CRC is running
+	bool BackgroundCRCBusy();
+
+	/// Return result of background CRC, once BackgroundCRCBusy() returns false
+	uint16_t BackgroundCRCResult();
 
 private:
 	
@@ -340,11 +644,26 @@ private:
 
 	uint64_t uniqueID;
 	
-	uint8_t ReadByteFromEEPROM(unsigned int eeAddress);
-	int ReadIntFromEEPROM(unsigned int eeAddress);
+	// Validated calibration, as cached in flash (if COMPUTERCARD_CAL_CACHE_OFFSET is defined)
+	typedef struct
+	{
+		uint32_t magic;
+		uint16_t eepromCRC; // CRC stored in EEPROM that this cache was made from
+		uint16_t cacheCRC; // CRC of the remainder of this struct
+		uint8_t numCalibrationPoints[calMaxChannels];
+		CalPoint calibrationTable[calMaxChannels][calMaxPoints];
+		CalCoeffs calCoeffs[calMaxChannels];
+	} CalCache;
+
+	BootProfile_t bootProfile;
+
+	bool ReadBlockFromEEPROM(unsigned int eeAddress, uint8_t *data, unsigned int length);
+	bool ReadCalibrationCache(uint16_t eepromCRC);
+	void WriteCalibrationCache(uint16_t eepromCRC);
 	void CalcCalCoeffs(int channel);
 	int ReadEEPROM();
 	uint32_t MIDIToDAC(int midiNote, int channel);
+	uint32_t MIDIToDACPrecise(int32_t note, int channel);
 	uint32_t MillivoltsToDAC(int millivolts, int channel, bool &limited);
 	
 	HardwareVersion_t hw;
@@ -360,6 +679,31 @@ private:
 
 	volatile uint8_t mxPos = 0; // external multiplexer value
 
+	// LED framebuffer, applied to PWM hardware at ledRefreshRate
+	static constexpr uint16_t ledFull = 4096; // brightness for LedOn, maps to PWM level 65535
+	static constexpr int ledRefreshRate = 100; // Hz
+	static constexpr int ledRefreshSamples = 48000 / ledRefreshRate;
+	static constexpr int ledGammaSize = 257;
+	enum LedMode_t : uint8_t {LedStatic, LedBlinking, LedFading, LedMetering};
+
+	volatile uint16_t ledValue[numLeds];
+	volatile uint16_t ledHeld[numLeds]; // brightest static value since the LED was last written
+	volatile LedMode_t ledMode[numLeds];
+	volatile uint32_t ledPatternA[numLeds], ledPatternB[numLeds], ledPatternC[numLeds], ledPatternPos[numLeds];
+	volatile int32_t meterPeak[2] = {0, 0};
+	int32_t meterLevel[2] = {0, 0};
+	uint16_t ledGamma[ledGammaSize];
+	int ledRefreshCount = 0;
+
+	static uint32_t MsToLedTicks(uint32_t ms)
+	{
+		uint32_t ticks = ms / (1000 / ledRefreshRate);
+		return ticks ? ticks : 1;
+	}
+	uint16_t LedGamma(uint32_t value) const;
+	void UpdateLedPatterns();
+	void UpdateLeds();
+
 	volatile int32_t plug_state[6] = {0,0,0,0,0,0};
 	volatile bool connected[6] = {0,0,0,0,0,0};
 	bool useNormProbe;
@@ -376,6 +720,31 @@ private:
 
 	uint8_t adc_dma, spi_dma; // DMA ids
 
+	// Background CRC state
+	int crc_dma = -1;
+	uint32_t crcDummy; // DMA write target for sniffed data
+	const uint8_t *crcTail; // bytes after last whole word, done in software
+	uint32_t crcTailLength;
+	uint16_t crcHead; // CRC of bytes before first whole word, if no DMA needed
+
+	struct CRCTable_t
+	{
+		uint16_t t[256];
+		constexpr CRCTable_t() : t()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				uint16_t crc = i << 8;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+				}
+				t[i] = crc;
+			}
+		}
+	};
+	static const CRCTable_t crcTable;
+
 
 
 	uint8_t dmaPhase = 0;
@@ -395,6 +764,49 @@ private:
 	void BufferFull();
 
 	void AudioWorker();
+
+	// Block rendering state, in static storage set up by EnableBlockRendering
+	static constexpr int blockRingSize = 512; // frames
+	static constexpr int maxBlockSize = 128;
+	struct BlockRenderer
+	{
+		SPSCQueue<InputFrame, blockRingSize> in;
+		SPSCQueue<OutputFrame, blockRingSize> out;
+		InputFrame inBlock[maxBlockSize];
+		OutputFrame outBlock[maxBlockSize];
+		int blockSize;
+	};
+	BlockRenderer *blockRenderer = nullptr;
+	volatile uint32_t blockUnderruns = 0;
+	void BlockFrame();
+	void Core1Worker();
+
+	// Parallel processing state
+	bool parallelProcessing = false;
+	volatile bool core1Ready = false;
+	void ParallelWorker();
+
+	// Deferred work queue, from ProcessSample to the chosen worker
+	static constexpr uint32_t deferredQueueSize = 16;
+	struct DeferredJob
+	{
+		DeferredFunction fn;
+		void *context;
+		uint32_t arg;
+	};
+	SPSCQueue<DeferredJob, deferredQueueSize> deferredQueue;
+	DeferredWorker_t deferredWorker = Core0Loop;
+	uint32_t deferredTicket = 0; // written by ISR only
+	volatile uint32_t deferredCompleted = 0; // written by worker only
+	volatile uint32_t deferredMaxDepth = 0;
+
+	volatile uint32_t sampleCounter = 0;
+
+	// Control-rate state: the audio ISR sets controlPending every controlSamples samples
+	uint32_t controlSamples = 0;
+	uint32_t controlCounter = 0;
+	volatile bool controlPending = false;
+	volatile uint32_t controlOverruns = 0;
 	
 	static void AudioCallback()
 	{
@@ -429,6 +841,11 @@ private:
 #include "hardware/i2c.h"
 #include "hardware/irq.h"
 #include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+#include <cmath>
+#include <cstring>
 
 // Input normalisation probe pin
 #define NORMALISATION_PROBE 4
@@ -483,6 +900,8 @@ private:
 
 #define EEPROM_PAGE_ADDRESS 0x50
 
+#define CAL_CACHE_MAGIC 0x4C414343 // 'CCAL'
+
 
 // Initialise CV output delta-sigma target to half-way (near 0V)
 volatile uint32_t ComputerCard::cvValue[2] = {262144,262144};
@@ -565,6 +984,21 @@ void __not_in_flash_func(ComputerCard::AudioWorker)()
 
 	while (1)
 	{
+		// Run control-rate processing, interrupted by audio
+		if (controlPending)
+		{
+			controlPending = false;
+			ProcessControl();
+		}
+
+		// Run deferred work from ProcessSample
+		if (deferredWorker == Core0Loop)
+		{
+			ServiceDeferred();
+		}
+
+		BackgroundTask();
+
 		// If ready to restart
 		if (runADCMode == RUN_ADC_MODE_REQUEST_ADC_RESTART)
 		{
@@ -587,8 +1021,13 @@ void __not_in_flash_func(ComputerCard::AudioWorker)()
 			irq_remove_handler(PWM_IRQ_WRAP, ComputerCard::OnCVPWMWrap);
 			break;
 		}
-		   
 
+		// Sleep until the next audio interrupt (or other interrupt/event),
+		// unless more control-rate processing is already due
+		if (!controlPending)
+		{
+			__wfe();
+		}
 	}
 }
 
@@ -719,9 +1158,30 @@ void __not_in_flash_func(ComputerCard::BufferFull)()
 	}
 	
 	////////////////////////////////////////
-	// Run the DSP
+	// Exchange frames with block renderer on core 1
+	if (blockRenderer) BlockFrame();
+
+	////////////////////////////////////////
+	// Run the DSP, starting core 1 first if processing in parallel
+	bool parallel = parallelProcessing && core1Ready;
+	if (parallel)
+	{
+		sio_hw->fifo_wr = 0;
+		__sev();
+	}
+
 	ProcessSample();
 
+	// Wait for core 1 to finish before using outputs
+	if (parallel)
+	{
+		while (!(sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS))
+		{
+			tight_loop_contents();
+		}
+		(void)sio_hw->fifo_rd;
+	}
+
 	////////////////////////////////////////
 	// Collect DSP outputs and put them in the DAC SPI buffer
 	// CV/Pulse outputs are done immediately in ProcessSample
@@ -730,7 +1190,19 @@ void __not_in_flash_func(ComputerCard::BufferFull)()
 	SPI_Buffer[cpuPhase][0] = dacval(-dacOut[0], DAC_CHANNEL_A);
 	SPI_Buffer[cpuPhase][1] = dacval(-dacOut[1], DAC_CHANNEL_B);
 
+	// Apply LED framebuffer to PWM at a low rate
+	UpdateLeds();
+
+	// Schedule control-rate processing
+	if (controlSamples && ++controlCounter >= controlSamples)
+	{
+		controlCounter = 0;
+		if (controlPending) controlOverruns++;
+		controlPending = true;
+	}
+
 	mux_state = next_mux_state;
+	sampleCounter = sampleCounter + 1;
 
 	// If Abort called, stop ADC and DMA
 	if (runADCMode == RUN_ADC_MODE_REQUEST_ADC_STOP)
@@ -757,6 +1229,240 @@ void __not_in_flash_func(ComputerCard::BufferFull)()
 	if (startupCounter) startupCounter--;
 }
 
+// Look up PWM level for LED brightness (0-4096), interpolating the gamma table
+uint16_t __not_in_flash_func(ComputerCard::LedGamma)(uint32_t value) const
+{
+	uint32_t ind = value >> 4;
+	if (ind >= ledGammaSize - 1) return ledGamma[ledGammaSize - 1];
+	int32_t r = value & 0xF;
+	return ledGamma[ind] + (((ledGamma[ind+1] - ledGamma[ind]) * r) >> 4);
+}
+
+// Advance blink/fade/meter patterns, once per LED refresh period
+void __not_in_flash_func(ComputerCard::UpdateLedPatterns)()
+{
+	for (int i=0; i<numLeds; i++)
+	{
+		switch (ledMode[i])
+		{
+		case LedBlinking:
+			ledValue[i] = (ledPatternPos[i] < ledPatternB[i]) ? ledPatternC[i] : 0;
+			if (++ledPatternPos[i] >= ledPatternA[i]) ledPatternPos[i] = 0;
+			break;
+
+		case LedFading:
+			if (ledPatternPos[i] < ledPatternA[i]) ledPatternPos[i]++;
+			ledValue[i] = ledPatternB[i] + ((int32_t)(ledPatternC[i] - ledPatternB[i]) * (int32_t)ledPatternPos[i]) / (int32_t)ledPatternA[i];
+			if (ledPatternPos[i] >= ledPatternA[i]) ledMode[i] = LedStatic;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// Meters: peak since last refresh, or decay of previous level
+	for (int m=0; m<2; m++)
+	{
+		int32_t peak = meterPeak[m];
+		meterPeak[m] = 0;
+		meterLevel[m] -= meterLevel[m] >> 3;
+		if (peak > meterLevel[m]) meterLevel[m] = peak;
+
+		// Bottom LED covers first third of range, then middle, then top
+		for (int row=0; row<3; row++)
+		{
+			int ind = m + 4 - 2*row;
+			if (ledMode[ind] != LedMetering) continue;
+			int32_t v = meterLevel[m] * 6 - row * 4096;
+			if (v < 0) v = 0;
+			if (v > 4095) v = 4095;
+			ledValue[ind] = v;
+		}
+	}
+}
+
+// Called every sample. Spreads LED updates over the first few samples
+// of each refresh period, so that no one sample does all the PWM writes.
+void __not_in_flash_func(ComputerCard::UpdateLeds)()
+{
+	if (ledRefreshCount == 0)
+	{
+		UpdateLedPatterns();
+	}
+	else if (ledRefreshCount <= numLeds)
+	{
+		int i = ledRefreshCount - 1;
+		uint16_t value = ledValue[i];
+		if (ledMode[i] == LedStatic && ledHeld[i] > value) value = ledHeld[i];
+		ledHeld[i] = 0;
+		pwm_set_gpio_level(leds[i], LedGamma(value));
+	}
+
+	if (++ledRefreshCount >= ledRefreshSamples) ledRefreshCount = 0;
+}
+
+void ComputerCard::SetLedGamma(float gamma)
+{
+	for (int i=0; i<ledGammaSize; i++)
+	{
+		ledGamma[i] = uint16_t(65535.0f * powf(i / float(ledGammaSize - 1), gamma) + 0.5f);
+	}
+}
+
+void ComputerCard::SetLedGammaTable(const uint16_t *table)
+{
+	for (int i=0; i<ledGammaSize; i++)
+	{
+		ledGamma[i] = table[i];
+	}
+}
+
+bool ComputerCard::EnableBlockRendering(int blockSize, int latencyBlocks)
+{
+	if (blockRenderer || parallelProcessing || blockSize < 1 || blockSize > maxBlockSize || latencyBlocks < 2
+		|| (latencyBlocks + 1) * blockSize > blockRingSize)
+		return false;
+
+	// Only linked in (about 13KB of RAM) by cards that use block rendering
+	static BlockRenderer storage;
+	BlockRenderer *br = &storage;
+	br->blockSize = blockSize;
+
+	// Prefill outputs with silence, to give core 1 its latency budget
+	OutputFrame silence = {};
+	for (int i = 0; i < latencyBlocks * blockSize; i++)
+	{
+		br->out.Push(silence);
+	}
+	blockRenderer = br;
+	return true;
+}
+
+// Called by audio ISR: send this sample's inputs to core 1, and apply next rendered outputs
+void __not_in_flash_func(ComputerCard::BlockFrame)()
+{
+	InputFrame in;
+	in.audio[0] = adcInL;
+	in.audio[1] = adcInR;
+	in.cv[0] = cv[0];
+	in.cv[1] = cv[1];
+	in.pulse[0] = pulse[0];
+	in.pulse[1] = pulse[1];
+	blockRenderer->in.Push(in);
+	__sev(); // wake core 1
+
+	OutputFrame out;
+	if (blockRenderer->out.Pop(out))
+	{
+		AudioOut1(out.audio[0]);
+		AudioOut2(out.audio[1]);
+		CVOut1(out.cv[0]);
+		CVOut2(out.cv[1]);
+		PulseOut1(out.pulse[0]);
+		PulseOut2(out.pulse[1]);
+	}
+	else
+	{
+		blockUnderruns++;
+	}
+}
+
+void ComputerCard::RunCore1()
+{
+	// Wait for Run() to set the active card
+	while (*(ComputerCard * volatile *)&thisptr == nullptr)
+	{
+		tight_loop_contents();
+	}
+	thisptr->Core1Worker();
+}
+
+void __not_in_flash_func(ComputerCard::Core1Worker)()
+{
+	if (parallelProcessing) ParallelWorker();
+
+	while (1)
+	{
+		BlockRenderer *br = blockRenderer;
+		if (br && br->in.Count() >= (uint32_t)br->blockSize && br->out.Space() >= (uint32_t)br->blockSize)
+		{
+			int n = br->blockSize;
+			for (int i = 0; i < n; i++)
+			{
+				br->in.Pop(br->inBlock[i]);
+			}
+			ProcessBlock(br->inBlock, br->outBlock, n);
+			for (int i = 0; i < n; i++)
+			{
+				br->out.Push(br->outBlock[i]);
+			}
+		}
+		else if (deferredWorker == Core1Loop && ServiceDeferred())
+		{
+			// ran deferred work, check for blocks again
+		}
+		else
+		{
+			__wfe(); // sleep until audio ISR sends another frame, or Defer is called
+		}
+	}
+}
+
+uint32_t ComputerCard::ServiceDeferred()
+{
+	uint32_t n = 0;
+	DeferredJob job;
+	while (deferredQueue.Pop(job))
+	{
+		job.fn(job.context, job.arg);
+		deferredCompleted = deferredCompleted + 1;
+		n++;
+	}
+	return n;
+}
+
+bool ComputerCard::EnableControlRate(uint32_t rateHz)
+{
+	if (rateHz < 1 || rateHz > 48000) return false;
+	controlSamples = 48000 / rateHz;
+	controlCounter = 0;
+	return true;
+}
+
+bool ComputerCard::EnableParallelProcessing()
+{
+	if (blockRenderer) return false;
+	parallelProcessing = true;
+	return true;
+}
+
+// Core 1 loop for parallel processing: the audio ISR sends a word through
+// the SIO FIFO to start each sample, and waits for a word back
+void __not_in_flash_func(ComputerCard::ParallelWorker)()
+{
+	// Discard anything left in the FIFO, then tell audio ISR that core 1 is running
+	while (sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS)
+	{
+		(void)sio_hw->fifo_rd;
+	}
+	core1Ready = true;
+
+	while (1)
+	{
+		while (!(sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS))
+		{
+			__wfe();
+		}
+		(void)sio_hw->fifo_rd;
+
+		ProcessSampleCore1();
+
+		sio_hw->fifo_wr = 0;
+		__sev();
+	}
+}
+
 ComputerCard::HardwareVersion_t ComputerCard::ProbeHardwareVersion()
 {
 	// Enable pull-downs, and measure
@@ -798,6 +1504,9 @@ ComputerCard::HardwareVersion_t ComputerCard::ProbeHardwareVersion()
 
 ComputerCard::ComputerCard()
 {
+	uint32_t bootStart = time_us_32();
+	bootProfile.calibrationCached = false;
+
 	runADCMode = RUN_ADC_MODE_RUNNING;
 
 	adc_run(false);
@@ -811,6 +1520,20 @@ ComputerCard::ComputerCard()
 	}
 
 	
+	////////////////////////////////////////
+	// Initialise LED framebuffer, with square-law default gamma table
+	for (int i = 0; i < numLeds; i++)
+	{
+		ledValue[i] = 0;
+		ledHeld[i] = 0;
+		ledMode[i] = LedStatic;
+	}
+	for (int i = 0; i < ledGammaSize; i++)
+	{
+		uint32_t level = i * i;
+		ledGamma[i] = level > 65535 ? 65535 : level;
+	}
+
 	////////////////////////////////////////
 	// Initialise LEDs (PWM, set up in pairs due pinout and PWM hardware)
 	for (int i = 0; i < numLeds; i+=2)
@@ -927,8 +1650,8 @@ ComputerCard::ComputerCard()
 	gpio_set_dir(NORMALISATION_PROBE, GPIO_OUT);
 	gpio_put(NORMALISATION_PROBE, false);
 	
-	// Initialise EEPROM (I2C)
-	i2c_init(i2c0, 100 * 1000);
+	// Initialise EEPROM (I2C), in 400kHz fast mode
+	i2c_init(i2c0, 400 * 1000);
 	gpio_set_function(EEPROM_SDA, GPIO_FUNC_I2C);
 	gpio_set_function(EEPROM_SCL, GPIO_FUNC_I2C);
 
@@ -943,11 +1666,18 @@ ComputerCard::ComputerCard()
 	gpio_set_dir(DEBUG_2, GPIO_OUT);
 #endif
 
+	uint32_t t = time_us_32();
+	bootProfile.hardwareInit = t - bootStart;
+
 	// Read hardware version
 	hw = ProbeHardwareVersion();
+	bootProfile.probe = time_us_32() - t;
+	t += bootProfile.probe;
 	
 	// Read EEPROM calibration values
 	cvOutsCalibrated = (ReadEEPROM() == 0);
+	bootProfile.eeprom = time_us_32() - t;
+	t += bootProfile.eeprom;
 	
 	// Read unique card ID
 	flash_get_unique_id((uint8_t *) &uniqueID);
@@ -958,52 +1688,158 @@ ComputerCard::ComputerCard()
 	{
 		uniqueID = uniqueID * 6364136223846793005ULL + 1442695040888963407ULL;
 	}
+	bootProfile.uniqueID = time_us_32() - t;
+	bootProfile.total = time_us_32() - bootStart;
 }
 
 
 
-// Read a byte from EEPROM
-uint8_t ComputerCard::ReadByteFromEEPROM(unsigned int eeAddress)
+// Read a block of bytes from EEPROM, with a single sequential read
+// Returns false if the EEPROM did not respond
+bool ComputerCard::ReadBlockFromEEPROM(unsigned int eeAddress, uint8_t *data, unsigned int length)
 {
 	uint8_t deviceAddress = EEPROM_PAGE_ADDRESS | ((eeAddress >> 8) & 0x0F);
-	uint8_t data = 0xFF;
 
 	uint8_t addr_low_byte = eeAddress & 0xFF;
-	i2c_write_blocking(i2c0, deviceAddress, &addr_low_byte, 1, false);
+	if (i2c_write_blocking(i2c0, deviceAddress, &addr_low_byte, 1, true) != 1)
+		return false;
 
-	i2c_read_blocking(i2c0, deviceAddress, &data, 1, false);
-	return data;
+	return i2c_read_blocking(i2c0, deviceAddress, data, length, false) == (int)length;
 }
 
-// Read a 16-bit integer from EEPROM
-int ComputerCard::ReadIntFromEEPROM(unsigned int eeAddress)
+// Load calibration from flash cache, if it is valid and was made from EEPROM data with this CRC
+bool ComputerCard::ReadCalibrationCache(uint16_t eepromCRC)
 {
-	uint8_t highByte = ReadByteFromEEPROM(eeAddress);
-	uint8_t lowByte = ReadByteFromEEPROM(eeAddress + 1);
-	return (highByte << 8) | lowByte;
+#ifdef COMPUTERCARD_CAL_CACHE_OFFSET
+	const CalCache *cache = (const CalCache *)(XIP_BASE + COMPUTERCARD_CAL_CACHE_OFFSET);
+	if (cache->magic != CAL_CACHE_MAGIC || cache->eepromCRC != eepromCRC)
+		return false;
+
+	const uint8_t *body = (const uint8_t *)cache->numCalibrationPoints;
+	if (CRCencode(body, sizeof(CalCache) - offsetof(CalCache, numCalibrationPoints)) != cache->cacheCRC)
+		return false;
+
+	memcpy(numCalibrationPoints, cache->numCalibrationPoints, sizeof(numCalibrationPoints));
+	memcpy(calibrationTable, cache->calibrationTable, sizeof(calibrationTable));
+	memcpy(calCoeffs, cache->calCoeffs, sizeof(calCoeffs));
+	return true;
+#else
+	(void)eepromCRC;
+	return false;
+#endif
+}
+
+// Save validated calibration to flash cache.
+// Called from the constructor, so the other core must not yet be running code from flash.
+void ComputerCard::WriteCalibrationCache(uint16_t eepromCRC)
+{
+#ifdef COMPUTERCARD_CAL_CACHE_OFFSET
+	static_assert(sizeof(CalCache) <= FLASH_PAGE_SIZE, "Calibration cache must fit in one flash page");
+	static_assert(COMPUTERCARD_CAL_CACHE_OFFSET % FLASH_SECTOR_SIZE == 0, "Calibration cache must be sector-aligned");
+
+	union
+	{
+		CalCache cache;
+		uint8_t page[FLASH_PAGE_SIZE];
+	} buf;
+	memset(buf.page, 0xFF, sizeof(buf.page));
+
+	buf.cache.magic = CAL_CACHE_MAGIC;
+	buf.cache.eepromCRC = eepromCRC;
+	memcpy(buf.cache.numCalibrationPoints, numCalibrationPoints, sizeof(numCalibrationPoints));
+	memcpy(buf.cache.calibrationTable, calibrationTable, sizeof(calibrationTable));
+	memcpy(buf.cache.calCoeffs, calCoeffs, sizeof(calCoeffs));
+	const uint8_t *body = (const uint8_t *)buf.cache.numCalibrationPoints;
+	buf.cache.cacheCRC = CRCencode(body, sizeof(CalCache) - offsetof(CalCache, numCalibrationPoints));
+
+	uint32_t ints = save_and_disable_interrupts();
+	flash_range_erase(COMPUTERCARD_CAL_CACHE_OFFSET, FLASH_SECTOR_SIZE);
+	flash_range_program(COMPUTERCARD_CAL_CACHE_OFFSET, buf.page, FLASH_PAGE_SIZE);
+	restore_interrupts(ints);
+#else
+	(void)eepromCRC;
+#endif
 }
 
-uint16_t ComputerCard::CRCencode(const uint8_t *data, int length)
+// Byte-at-a-time lookup table for CRC-CCITT polynomial, built at compile time
+const ComputerCard::CRCTable_t ComputerCard::crcTable;
+
+uint16_t ComputerCard::CRCencode(const uint8_t *data, int length, uint16_t crc)
 {
-	uint16_t crc = 0xFFFF; // Initial CRC value
 	for (int i = 0; i < length; i++)
 	{
-		crc ^= ((uint16_t)data[i]) << 8; // Bring in the next byte
-		for (uint8_t bit = 0; bit < 8; bit++)
-		{
-			if (crc & 0x8000)
-			{
-				crc = (crc << 1) ^ 0x1021; // CRC-CCITT polynomial
-			}
-			else
-			{
-				crc = crc << 1;
-			}
-		}
+		crc = (crc << 8) ^ crcTable.t[(crc >> 8) ^ data[i]];
 	}
 	return crc;
 }
 
+bool ComputerCard::StartBackgroundCRC(const void *data, uint32_t length)
+{
+	if (crc_dma >= 0)
+	{
+		if (dma_channel_is_busy(crc_dma)) return false;
+		dma_channel_unclaim(crc_dma);
+	}
+
+	uintptr_t addr = (uintptr_t)data;
+
+	// Read flash through the non-allocating XIP alias, so as not to evict
+	// cached code or data used by the audio processing
+	if (addr >= XIP_BASE && addr < XIP_BASE + PICO_FLASH_SIZE_BYTES)
+	{
+		addr = addr - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE;
+	}
+
+	// Leading bytes up to a word boundary are done in software, now
+	uint16_t crc = 0xFFFF;
+	uint32_t head = (4 - (addr & 3)) & 3;
+	if (head > length) head = length;
+	crc = CRCencode((const uint8_t *)data, head, crc);
+	addr += head;
+	length -= head;
+
+	// Trailing bytes are done in software, after the DMA completes
+	uint32_t words = length >> 2;
+	crcTail = (const uint8_t *)data + head + (words << 2);
+	crcTailLength = length & 3;
+	crcHead = crc;
+
+	if (words == 0)
+	{
+		crc_dma = -1;
+		return true;
+	}
+
+	crc_dma = dma_claim_unused_channel(true);
+	dma_channel_config cfg = dma_channel_get_default_config(crc_dma);
+	channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+	channel_config_set_read_increment(&cfg, true);
+	channel_config_set_write_increment(&cfg, false);
+	channel_config_set_sniff_enable(&cfg, true);
+
+	// Sniffer computes CRC of each word MSB first, so byte-swap
+	// to process the bytes in memory order
+	dma_sniffer_set_data_accumulator(crc);
+	dma_sniffer_set_byte_swap_enabled(true);
+	dma_sniffer_set_output_reverse_enabled(false);
+	dma_sniffer_set_output_invert_enabled(false);
+	dma_sniffer_enable(crc_dma, 0x2, true); // 0x2 = CRC-16-CCITT
+
+	dma_channel_configure(crc_dma, &cfg, &crcDummy, (const void *)addr, words, true);
+	return true;
+}
+
+bool ComputerCard::BackgroundCRCBusy()
+{
+	return crc_dma >= 0 && dma_channel_is_busy(crc_dma);
+}
+
+uint16_t ComputerCard::BackgroundCRCResult()
+{
+	uint16_t crc = (crc_dma >= 0) ? (dma_sniffer_get_data_accumulator() & 0xFFFF) : crcHead;
+	return CRCencode(crcTail, crcTailLength, crc);
+}
+
 
 int ComputerCard::ReadEEPROM()
 {
@@ -1023,16 +1859,33 @@ int ComputerCard::ReadEEPROM()
 	calibrationTable[1][2].voltage = 20; // +2V
 	calibrationTable[1][2].dacSetting = 174400;
 
-	if (ReadIntFromEEPROM(EEPROM_ADDR_ID) != EEPROM_VAL_ID)
+	uint8_t buf[EEPROM_NUM_BYTES];
+
+#ifdef COMPUTERCARD_CAL_CACHE_OFFSET
+	// Read only the ID and CRC, and use the flash cache if it matches this CRC
+	if (ReadBlockFromEEPROM(EEPROM_ADDR_ID, buf, 2)
+		&& ((buf[0] << 8) | buf[1]) == EEPROM_VAL_ID
+		&& ReadBlockFromEEPROM(EEPROM_ADDR_CRC_H, &buf[EEPROM_ADDR_CRC_H], 2))
 	{
-		return 1;
+		uint16_t storedCRC = ((uint16_t)buf[EEPROM_ADDR_CRC_H] << 8) | buf[EEPROM_ADDR_CRC_L];
+		if (ReadCalibrationCache(storedCRC))
+		{
+			bootProfile.calibrationCached = true;
+			return 0;
+		}
 	}
-	uint8_t buf[EEPROM_NUM_BYTES];
-	for (int i = 0; i < EEPROM_NUM_BYTES; i++)
+#endif
+
+	// Read whole calibration block in one sequential read
+	if (!ReadBlockFromEEPROM(0, buf, EEPROM_NUM_BYTES))
 	{
-		buf[i] = ReadByteFromEEPROM(i);
+		return 1;
 	}
 
+	if (((buf[EEPROM_ADDR_ID] << 8) | buf[EEPROM_ADDR_ID + 1]) != EEPROM_VAL_ID)
+	{
+		return 1;
+	}
 
 	uint16_t calculatedCRC = CRCencode(buf, 86);
 	uint16_t foundCRC = ((uint16_t)buf[EEPROM_ADDR_CRC_H] << 8) | buf[EEPROM_ADDR_CRC_L];
@@ -1067,6 +1920,8 @@ int ComputerCard::ReadEEPROM()
 		CalcCalCoeffs(channel);
 	}
 
+	WriteCalibrationCache(foundCRC);
+
 	return 0;
 }
 
@@ -1112,6 +1967,17 @@ uint32_t ComputerCard::MIDIToDAC(int midiNote, int channel)
 	return dacValue;
 }
 
+/// As MIDIToDAC, with note in 1/256ths of a semitone, clamped to 0 to 127*256
+uint32_t ComputerCard::MIDIToDACPrecise(int32_t note, int channel)
+{
+	if (note < 0) note = 0;
+	if (note > (127 << 8)) note = 127 << 8;
+	int32_t dacValue = ((calCoeffs[channel].mi * (note - (60 << 8))) >> 12) + calCoeffs[channel].bi;
+	if (dacValue > 524287) dacValue = 524287;
+	if (dacValue < 0) dacValue = 0;
+	return dacValue;
+}
+
 /// Converts voltage in millivolts to corresponding 19-bit sigma-delta PWM DAC value
 /// Returns true if requested voltage is outside of full range of DAC values
 /// millivolts should be in range -6000 to 6000.
@@ -0,0 +1,298 @@
+/*
+FATReader - reads files from a FAT16 or FAT32 volume, such as a USB drive
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Finds the volume (the first FAT partition of an MBR partition table, or a
+volume filling the whole device), lists its root directory, and reads files,
+all through a block device that the card provides. File data is read in
+whole 512-byte sectors straight into the caller's buffer, with as many
+consecutive sectors as possible in each device read, so that a USB drive
+transfers long runs of data rather than one sector at a time. One sector
+of the FAT or directory is cached.
+
+FAT12 (only found on devices of 16MB or less), subdirectories and sector
+sizes other than 512 bytes are not supported.
+
+Allocation-free, and independent of the Pico SDK and TinyUSB.
+*/
+
+#ifndef FATREADER_H
+#define FATREADER_H
+
+#include <cstdint>
+#include <cstring>
+#include "FATVolume.h"
+
+/// A file open for reading from a FATReader
+struct FATFile
+{
+	uint32_t firstCluster = 0;
+	uint32_t size = 0; // bytes
+	uint32_t position = 0; // next byte to read: a sector boundary, or the end of the file
+	uint32_t cluster = 0; // cluster holding position
+
+	bool AtEnd() const {return position >= size;}
+};
+
+
+/** \brief Reads files from a FAT16 or FAT32 volume on a block device
+
+    BlockDevice must provide
+        bool ReadSectors(uint32_t sector, uint8_t *buffer, uint32_t count)
+    reading count 512-byte sectors from the device's sector number sector,
+    and returning false on failure. It may block until the data arrives.
+
+    Call Mount once the device is ready, then ReadEntry for each root
+    directory entry in turn, Open a file, and Read it. Reads that fail,
+    including those following a corrupt cluster chain, return zero bytes
+    with the file not yet AtEnd.
+*/
+template <typename BlockDevice>
+class FATReader
+{
+public:
+	static constexpr uint32_t sectorSize = 512;
+
+	explicit FATReader(BlockDevice &dev) : device(dev) {}
+
+	/// Find and check the volume. Returns false if no FAT16 or FAT32 volume is found.
+	bool Mount()
+	{
+		mounted = false;
+		cachedSector = noSector;
+		const uint8_t *b = Cached(0);
+		if (!b) return false;
+
+		uint32_t start = 0;
+		if (!IsBootSector(b))
+		{
+			// Partition table: four 16-byte entries from byte 446
+			if (b[510] != 0x55 || b[511] != 0xAA) return false;
+			for (int i = 0; i < 4 && !start; i++)
+			{
+				const uint8_t *p = b + 446 + 16 * i;
+				uint8_t type = p[4];
+				if (type == 0x04 || type == 0x06 || type == 0x0E || type == 0x0B || type == 0x0C)
+				{
+					start = Get32(p + 8);
+				}
+			}
+			if (!start) return false;
+			b = Cached(start);
+			if (!b || !IsBootSector(b)) return false;
+		}
+
+		// BIOS parameter block
+		sectorsPerCluster = b[13];
+		uint32_t reserved = Get16(b + 14);
+		uint32_t numFATs = b[16];
+		uint32_t rootEntries = Get16(b + 17);
+		uint32_t total = Get16(b + 19) ? Get16(b + 19) : Get32(b + 32);
+		uint32_t fatSize = Get16(b + 22) ? Get16(b + 22) : Get32(b + 36);
+
+		fatStart = start + reserved;
+		rootStart = fatStart + numFATs * fatSize;
+		rootSectors = (rootEntries * 32 + sectorSize - 1) / sectorSize;
+		dataStart = rootStart + rootSectors;
+		if (fatSize == 0 || total <= dataStart - start) return false;
+		clusters = (total - (dataStart - start)) / sectorsPerCluster;
+
+		// The FAT type is set by the number of clusters alone
+		if (clusters < 4085) return false; // FAT12
+		fat32 = clusters >= 65525;
+		if (fat32)
+		{
+			rootCluster = Get32(b + 44) & 0x0FFFFFFF;
+			if (rootEntries != 0 || !IsData(rootCluster)) return false;
+		}
+		else if (rootEntries == 0)
+		{
+			return false;
+		}
+		dirIndex = 0;
+		dirCluster = rootCluster;
+		mounted = true;
+		return true;
+	}
+
+	/// Forget the volume, for example when the device is removed
+	void Unmount() {mounted = false; cachedSector = noSector;}
+	bool Mounted() const {return mounted;}
+	bool IsFAT32() const {return fat32;}
+	uint32_t ClusterSize() const {return sectorsPerCluster * sectorSize;}
+
+	/// Root directory entry i. Returns false past the end of the directory,
+	/// or if it can't be read. Fastest with i increasing from 0.
+	bool ReadEntry(uint32_t i, FATDirEntry &entry)
+	{
+		if (!mounted) return false;
+		uint32_t sector = i / (sectorSize / 32);
+		uint32_t lba;
+		if (fat32)
+		{
+			// FAT32 root directory is a cluster chain: follow it from the
+			// cluster last used, or from the start
+			uint32_t n = sector / sectorsPerCluster;
+			if (n < dirIndex)
+			{
+				dirIndex = 0;
+				dirCluster = rootCluster;
+			}
+			while (dirIndex < n)
+			{
+				uint32_t next = Next(dirCluster);
+				if (!IsData(next)) return false;
+				dirCluster = next;
+				dirIndex++;
+			}
+			lba = ClusterStart(dirCluster) + sector % sectorsPerCluster;
+		}
+		else
+		{
+			if (sector >= rootSectors) return false;
+			lba = rootStart + sector;
+		}
+
+		const uint8_t *b = Cached(lba);
+		if (!b) return false;
+		memcpy(&entry, b + (i % (sectorSize / 32)) * 32, sizeof(entry));
+		return true;
+	}
+
+	/// Start reading the file in a directory entry, from its beginning
+	void Open(const FATDirEntry &entry, FATFile &file) const
+	{
+		file.firstCluster = entry.cluster | (fat32 ? uint32_t(entry.clusterHigh) << 16 : 0);
+		file.size = entry.size;
+		file.position = 0;
+		file.cluster = file.firstCluster;
+	}
+
+	/// Move the read position to the start of the sector holding position
+	/// (at most the size of the file). Follows the cluster chain from the current
+	/// cluster when moving forward, and otherwise from the start of the file.
+	bool Seek(FATFile &file, uint32_t position)
+	{
+		if (!mounted) return false;
+		if (position > file.size) position = file.size;
+		position -= position % sectorSize;
+
+		uint32_t clusterSize = ClusterSize();
+		uint32_t from = file.position / clusterSize;
+		if (position < file.position || !IsData(file.cluster))
+		{
+			from = 0;
+			file.cluster = file.firstCluster;
+		}
+		// Index in the chain of the cluster holding position: at the end of
+		// a file that fills its last cluster, that last cluster
+		uint32_t to = position / clusterSize;
+		if (position == file.size && position % clusterSize == 0 && to > 0) to--;
+		for (; from < to; from++)
+		{
+			uint32_t next = Next(file.cluster);
+			if (!IsData(next)) return false;
+			file.cluster = next;
+		}
+		file.position = position;
+		return true;
+	}
+
+	/// Read up to maxSectors sectors of the file from its current position,
+	/// in one device read of consecutive sectors. Returns the number of bytes
+	/// of the file read (less than the sectors read at the end of the file),
+	/// or zero at the end of the file or on failure.
+	uint32_t Read(FATFile &file, uint8_t *buffer, uint32_t maxSectors)
+	{
+		if (!mounted || file.AtEnd() || maxSectors == 0 || !IsData(file.cluster)) return 0;
+
+		uint32_t remaining = (file.size - file.position + sectorSize - 1) / sectorSize;
+		if (maxSectors > remaining) maxSectors = remaining;
+
+		// Sectors from the current one to the end of its cluster, then whole
+		// clusters while they follow on consecutively
+		uint32_t offset = (file.position / sectorSize) % sectorsPerCluster;
+		uint32_t first = ClusterStart(file.cluster) + offset;
+		uint32_t count = sectorsPerCluster - offset;
+		uint32_t last = file.cluster;
+		while (count < maxSectors)
+		{
+			uint32_t next = Next(last);
+			if (next != last + 1) break;
+			last = next;
+			count += sectorsPerCluster;
+		}
+		if (count > maxSectors) count = maxSectors;
+
+		if (!device.ReadSectors(first, buffer, count)) return 0;
+
+		uint32_t bytes = count * sectorSize;
+		if (bytes > file.size - file.position) bytes = file.size - file.position;
+		file.position += bytes;
+
+		// The cluster holding the new position: the next in the chain if
+		// this read finished at the end of a cluster
+		file.cluster = last;
+		if (!file.AtEnd() && (file.position / sectorSize) % sectorsPerCluster == 0)
+		{
+			file.cluster = Next(last);
+		}
+		return bytes;
+	}
+
+private:
+	static constexpr uint32_t noSector = 0xFFFFFFFF;
+
+	BlockDevice &device;
+	bool mounted = false, fat32 = false;
+	uint32_t sectorsPerCluster = 1, clusters = 0;
+	uint32_t fatStart = 0, rootStart = 0, rootSectors = 0, dataStart = 0, rootCluster = 0;
+
+	// Position in the FAT32 root directory chain: cluster number dirIndex of the directory
+	uint32_t dirIndex = 0, dirCluster = 0;
+
+	alignas(4) uint8_t cache[sectorSize];
+	uint32_t cachedSector = noSector;
+
+	static uint32_t Get16(const uint8_t *p) {return p[0] | (p[1] << 8);}
+	static uint32_t Get32(const uint8_t *p) {return Get16(p) | (Get16(p + 2) << 16);}
+
+	// A volume boot sector, with 512-byte sectors, rather than a partition table
+	static bool IsBootSector(const uint8_t *b)
+	{
+		uint32_t spc = b[13];
+		return (b[0] == 0xEB || b[0] == 0xE9) && Get16(b + 11) == sectorSize
+			&& spc != 0 && (spc & (spc - 1)) == 0
+			&& Get16(b + 14) != 0 && (b[16] == 1 || b[16] == 2);
+	}
+
+	// Sector, from the cache or read into it
+	const uint8_t *Cached(uint32_t sector)
+	{
+		if (sector != cachedSector)
+		{
+			cachedSector = noSector;
+			if (!device.ReadSectors(sector, cache, 1)) return nullptr;
+			cachedSector = sector;
+		}
+		return cache;
+	}
+
+	bool IsData(uint32_t cluster) const {return cluster >= 2 && cluster < clusters + 2;}
+	uint32_t ClusterStart(uint32_t cluster) const {return dataStart + (cluster - 2) * sectorsPerCluster;}
+
+	// FAT entry for a cluster: the next cluster of its chain, or a value for
+	// which IsData is false (end of chain, bad or free, or a read failure)
+	uint32_t Next(uint32_t cluster)
+	{
+		if (!IsData(cluster)) return 0;
+		uint32_t bytes = fat32 ? 4 : 2;
+		const uint8_t *b = Cached(fatStart + cluster * bytes / sectorSize);
+		if (!b) return 0;
+		const uint8_t *p = b + (cluster * bytes) % sectorSize;
+		return fat32 ? (Get32(p) & 0x0FFFFFFF) : Get16(p);
+	}
+};
+
+#endif
@@ -0,0 +1,272 @@
+/*
+FATVolume - virtual FAT16 volume, for USB mass storage devices
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Presents data stored in any form (for example, samples in flash) to a
+computer as a USB drive, without a filesystem in flash. FATVolume generates
+the FAT16 metadata: the boot sector, and RAM copies of the file allocation
+table (FAT) and root directory. The card adds files to these, and reads and
+writes the contents of files (data clusters) itself.
+
+The computer's writes to the FAT and root directory update the RAM copies,
+so once it has finished writing, the card can find new, changed and deleted
+files by reading the root directory and following cluster chains.
+
+Clusters are 4KB (eight 512-byte sectors), the RP2040 flash sector size.
+FAT16 requires at least 4085 clusters; any beyond those the card asks for
+are marked bad, so the computer never uses them.
+
+Allocation-free, and independent of the Pico SDK and TinyUSB.
+*/
+
+#ifndef FATVOLUME_H
+#define FATVOLUME_H
+
+#include <cstdint>
+#include <cstring>
+
+/// FAT directory entry, as stored in a directory sector
+struct FATDirEntry
+{
+	uint8_t name[11]; // 8.3 name, space-padded, without the dot
+	uint8_t attr;
+	uint8_t reserved;
+	uint8_t createTimeTenths;
+	uint16_t createTime, createDate, accessDate;
+	uint16_t clusterHigh; // always zero on FAT16
+	uint16_t writeTime, writeDate;
+	uint16_t cluster; // first cluster
+	uint32_t size; // bytes
+
+	// Attributes
+	static constexpr uint8_t ReadOnly = 0x01, Hidden = 0x02, System = 0x04;
+	static constexpr uint8_t VolumeLabel = 0x08, Directory = 0x10, Archive = 0x20;
+	static constexpr uint8_t LongName = 0x0F; // part of a long file name
+	// First byte of name for an entry that has been deleted
+	static constexpr uint8_t Deleted = 0xE5;
+
+	/// True for the first unused entry, after which all entries are unused
+	bool IsEnd() const {return name[0] == 0;}
+	/// True for a file (not deleted, and not a directory, volume label or long name)
+	bool IsFile() const {return !IsEnd() && name[0] != Deleted && !(attr & (VolumeLabel | Directory));}
+	/// True if the 8.3 extension is ext (three characters, upper case)
+	bool HasExtension(const char *ext) const {return memcmp(name + 8, ext, 3) == 0;}
+
+	/// 8.3 name from base and extension, upper case and space-padded
+	static void MakeName(uint8_t name[11], const char *base, const char *ext)
+	{
+		memset(name, ' ', 11);
+		for (int i = 0; i < 8 && base[i]; i++) name[i] = uint8_t(Upper(base[i]));
+		for (int i = 0; i < 3 && ext[i]; i++) name[8 + i] = uint8_t(Upper(ext[i]));
+	}
+
+private:
+	static char Upper(char c) {return (c >= 'a' && c <= 'z') ? char(c - 'a' + 'A') : c;}
+};
+static_assert(sizeof(FATDirEntry) == 32, "FAT directory entries are 32 bytes");
+
+
+/** \brief Virtual FAT16 volume, with the FAT and root directory in RAM
+
+    The volume is 512-byte sectors: a boot sector, two copies of the FAT
+    (only the first is kept; writes to the second are ignored), the root
+    directory, then the data clusters, numbered from 2. MaxClusters sets the
+    RAM used by the FAT (2 bytes per cluster), and RootEntries that of the
+    root directory (32 bytes per entry).
+
+    Call Format, then AddFile for each file. Pass USB mass storage reads and
+    writes to ReadSector and WriteSector, except where DataSector shows that
+    the sector is file data, which the card reads and writes itself.
+*/
+template <uint32_t MaxClusters, uint32_t RootEntries = 512>
+class FATVolume
+{
+public:
+	static constexpr uint32_t sectorSize = 512;
+	static constexpr uint32_t sectorsPerCluster = 8;
+	static constexpr uint32_t clusterSize = sectorSize * sectorsPerCluster;
+	static constexpr uint32_t rootEntries = RootEntries;
+	static constexpr uint32_t firstCluster = 2; // number of the first data cluster
+
+	// FAT entry values
+	static constexpr uint16_t Free = 0, Bad = 0xFFF7, EndOfChain = 0xFFFF;
+
+	static_assert(MaxClusters >= 4085 && MaxClusters <= 65524, "FAT16 has 4085 to 65524 clusters");
+	static_assert(RootEntries % (sectorSize / 32) == 0, "Root directory must be whole sectors");
+
+	/// Empty volume with the given number of data clusters, all free
+	void Format(uint32_t numClusters, const char *label, uint32_t serial)
+	{
+		usable = (numClusters < MaxClusters) ? numClusters : MaxClusters;
+		clusters = (usable < 4085) ? 4085 : usable;
+		fatSectors = ((clusters + firstCluster) * 2 + sectorSize - 1) / sectorSize;
+		rootStart = 1 + 2 * fatSectors;
+		dataStart = rootStart + RootEntries * 32 / sectorSize;
+		volumeSerial = serial;
+
+		fat[0] = 0xFFF8; // media type, as in the boot sector
+		fat[1] = EndOfChain;
+		for (uint32_t i = firstCluster; i < clusters + firstCluster; i++)
+		{
+			fat[i] = (i < usable + firstCluster) ? Free : Bad;
+		}
+
+		memset(root, 0, sizeof(root));
+		FATDirEntry::MakeName(volumeLabel, label, "");
+		memcpy(root[0].name, volumeLabel, 11);
+		root[0].attr = FATDirEntry::VolumeLabel;
+		root[0].writeDate = date;
+	}
+
+	/// Add a file to the root directory, occupying consecutive clusters from
+	/// first (a size of zero has no clusters). Returns false if the directory is full.
+	bool AddFile(const uint8_t name[11], uint32_t first, uint32_t size, uint8_t attr = FATDirEntry::ReadOnly)
+	{
+		uint32_t i = 0;
+		while (i < RootEntries && !root[i].IsEnd()) i++;
+		if (i == RootEntries) return false;
+
+		FATDirEntry &e = root[i];
+		memcpy(e.name, name, 11);
+		e.attr = attr;
+		e.createDate = e.accessDate = e.writeDate = date;
+		e.cluster = uint16_t(size ? first : 0);
+		e.size = size;
+
+		uint32_t n = ClustersFor(size);
+		for (uint32_t c = first; c < first + n; c++)
+		{
+			fat[c] = uint16_t((c + 1 < first + n) ? c + 1 : EndOfChain);
+		}
+		return true;
+	}
+
+	/// Number of data clusters (including any marked bad to make up the FAT16 minimum)
+	uint32_t Clusters() const {return clusters;}
+	/// Total number of sectors in the volume
+	uint32_t Sectors() const {return dataStart + clusters * sectorsPerCluster;}
+
+	/// FAT entry for a cluster: Free, Bad, EndOfChain (or above 0xFFF8), or the next cluster
+	uint16_t Next(uint32_t cluster) const {return (cluster < clusters + firstCluster) ? fat[cluster] : Bad;}
+	void SetNext(uint32_t cluster, uint16_t value) {if (cluster >= firstCluster && cluster < clusters + firstCluster) fat[cluster] = value;}
+
+	/// Root directory entries, in order
+	const FATDirEntry &Entry(uint32_t i) const {return root[i];}
+
+	/// Number of clusters that hold size bytes
+	static uint32_t ClustersFor(uint32_t size) {return (size + clusterSize - 1) / clusterSize;}
+
+	/// True if the size bytes from cluster first are in consecutive clusters,
+	/// with the chain ending after the last of them
+	bool Contiguous(uint32_t first, uint32_t size) const
+	{
+		uint32_t n = ClustersFor(size);
+		if (first < firstCluster || first + n > clusters + firstCluster) return false;
+		for (uint32_t c = first; c + 1 < first + n; c++)
+		{
+			if (fat[c] != c + 1) return false;
+		}
+		return n == 0 || fat[first + n - 1] >= 0xFFF8;
+	}
+
+	/// If sector is file data, gives its cluster, and byte offset within the cluster
+	bool DataSector(uint32_t sector, uint32_t &cluster, uint32_t &offset) const
+	{
+		if (sector < dataStart || sector >= Sectors()) return false;
+		cluster = firstCluster + (sector - dataStart) / sectorsPerCluster;
+		offset = ((sector - dataStart) % sectorsPerCluster) * sectorSize;
+		return true;
+	}
+
+	/// Read a metadata sector (anything except file data, for which this gives zeros)
+	void ReadSector(uint32_t sector, uint8_t *buffer) const
+	{
+		memset(buffer, 0, sectorSize);
+		if (sector == 0)
+		{
+			BootSector(buffer);
+		}
+		else if (sector < rootStart)
+		{
+			// Either copy of the FAT
+			uint32_t first = ((sector - 1) % fatSectors) * (sectorSize / 2);
+			for (uint32_t i = 0; i < sectorSize / 2 && first + i < clusters + firstCluster; i++)
+			{
+				Put16(buffer + 2 * i, fat[first + i]);
+			}
+		}
+		else if (sector < dataStart)
+		{
+			memcpy(buffer, reinterpret_cast<const uint8_t *>(root) + (sector - rootStart) * sectorSize, sectorSize);
+		}
+	}
+
+	/// Write a metadata sector. Returns true if the FAT or root directory changed.
+	/// Writes to the boot sector, the second FAT and file data are ignored.
+	bool WriteSector(uint32_t sector, const uint8_t *buffer)
+	{
+		bool changed = false;
+		if (sector > 0 && sector <= fatSectors)
+		{
+			uint32_t first = (sector - 1) * (sectorSize / 2);
+			for (uint32_t i = 0; i < sectorSize / 2 && first + i < clusters + firstCluster; i++)
+			{
+				uint16_t v = uint16_t(buffer[2 * i] | (buffer[2 * i + 1] << 8));
+				// Keep the reserved entries, and clusters beyond those usable
+				if (first + i < firstCluster || first + i >= usable + firstCluster) continue;
+				changed |= (fat[first + i] != v);
+				fat[first + i] = v;
+			}
+		}
+		else if (sector >= rootStart && sector < dataStart)
+		{
+			uint8_t *dest = reinterpret_cast<uint8_t *>(root) + (sector - rootStart) * sectorSize;
+			changed = memcmp(dest, buffer, sectorSize) != 0;
+			memcpy(dest, buffer, sectorSize);
+		}
+		return changed;
+	}
+
+private:
+	// Date of files and label: 1 January 2025
+	static constexpr uint16_t date = ((2025 - 1980) << 9) | (1 << 5) | 1;
+
+	uint16_t fat[MaxClusters + firstCluster];
+	FATDirEntry root[RootEntries];
+	uint8_t volumeLabel[11];
+	uint32_t clusters = 4085, usable = 0, fatSectors = 0, rootStart = 0, dataStart = 0;
+	uint32_t volumeSerial = 0;
+
+	static void Put16(uint8_t *p, uint32_t v) {p[0] = uint8_t(v); p[1] = uint8_t(v >> 8);}
+	static void Put32(uint8_t *p, uint32_t v) {Put16(p, v); Put16(p + 2, v >> 16);}
+
+	// Boot sector, with the BIOS parameter block describing the volume
+	void BootSector(uint8_t *b) const
+	{
+		uint32_t total = Sectors();
+		b[0] = 0xEB; b[1] = 0x3C; b[2] = 0x90; // jump instruction
+		memcpy(b + 3, "MSWIN4.1", 8); // OEM name, as recommended for compatibility
+		Put16(b + 11, sectorSize);
+		b[13] = sectorsPerCluster;
+		Put16(b + 14, 1); // reserved sectors (just this one)
+		b[16] = 2; // number of FATs
+		Put16(b + 17, RootEntries);
+		Put16(b + 19, (total < 0x10000) ? total : 0);
+		b[21] = 0xF8; // media type: fixed
+		Put16(b + 22, fatSectors);
+		Put16(b + 24, 32); // sectors per track and heads: unused, but conventional
+		Put16(b + 26, 64);
+		Put32(b + 28, 0); // hidden sectors: no partition table
+		Put32(b + 32, (total < 0x10000) ? 0 : total);
+		b[36] = 0x80; // drive number
+		b[38] = 0x29; // extended boot signature: serial, label and type follow
+		Put32(b + 39, volumeSerial);
+		memcpy(b + 43, volumeLabel, 11);
+		memcpy(b + 54, "FAT16   ", 8);
+		b[510] = 0x55;
+		b[511] = 0xAA;
+	}
+};
+
+#endif
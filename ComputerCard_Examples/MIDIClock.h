@@ -0,0 +1,254 @@
+/*
+MIDIClock - MIDI clock follower, for converting MIDI clock to analogue clocks
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Follows MIDI clock (24 pulses per quarter note), start, stop, continue and
+song position pointer messages. An internal phase-locked oscillator tracks the
+incoming clock, so that clock pulses arriving in bursts (as USB MIDI does,
+with up to ~1ms jitter) produce evenly-spaced output pulses, at the MIDI clock
+rate or any division or multiplication of it.
+
+Independent of the Pico SDK; call Event() and Process() from ProcessSample.
+*/
+
+#ifndef MIDICLOCK_H
+#define MIDICLOCK_H
+
+#include <cstdint>
+#include "MIDIParser.h"
+
+/** \brief MIDI clock and transport follower with jitter-filtering PLL
+
+    Call Event() for each received MIDIEvent (others than clock and transport are
+    ignored), ideally applied at a fixed latency with PopDueMIDIEvent, then Process()
+    once per sample. Pulse() and Gate() then give the clock outputs for that sample.
+
+    Rates are given in pulses per quarter note (PPQN): divisors of 24 (1, 2, 3, 4,
+    6, 8, 12, 24), or multiples of 24 up to 96. For example 4 gives sixteenth notes.
+
+    If the incoming clock stops without a Stop message, at most one further tick
+    is produced, and tempo lock is lost after four missing ticks. It is regained
+    at the second tick after the clock resumes.
+*/
+class MIDIClock
+{
+public:
+	static constexpr int ppqn = 24; // MIDI clock ticks per quarter note
+
+	/// Handle a clock or transport MIDI event
+	void Event(const MIDIEvent &e)
+	{
+		switch (e.type)
+		{
+		case MIDIEvent::Clock:
+			Clock();
+			break;
+		case MIDIEvent::Start:
+			songPosition = 0;
+			running = true;
+			waitingFirstClock = true;
+			break;
+		case MIDIEvent::Continue:
+			running = true;
+			waitingFirstClock = true;
+			break;
+		case MIDIEvent::Stop:
+			if (running && !waitingFirstClock) songPosition = tickCount + 1;
+			running = false;
+			waitingFirstClock = false;
+			break;
+		case MIDIEvent::SongPosition:
+			songPosition = uint32_t(e.Beats()) * 6; // MIDI beats are sixteenth notes
+			break;
+		default:
+			break;
+		}
+	}
+
+	/// Advance by one sample. Call once per sample, after any Event calls.
+	void Process()
+	{
+		previousFraction = fraction;
+		tickEdge = pendingEdge;
+		startEdge = pendingStart;
+		pendingEdge = false;
+		pendingStart = false;
+
+		if (samplesSinceClock < 0x7FFFFFFF) samplesSinceClock++;
+
+		if (increment)
+		{
+			if (samplesSinceClock > 4 * lastInterval + 48)
+			{
+				// Clock has stopped: lose lock, and don't measure tempo from the gap
+				increment = 0;
+				clocksSeen = 0;
+			}
+			else
+			{
+				// Advance, but not more than 1.5 ticks ahead of received clock
+				uint32_t next = phase + increment;
+				if (int32_t(next - rxPhase) > int32_t(maxLead)) next = rxPhase + maxLead;
+				phase = next;
+			}
+		}
+
+		// Has phase reached the next tick?
+		uint8_t tick = uint8_t(phase >> 24);
+		int8_t ticksAhead = int8_t(tick - lastTick);
+		if (ticksAhead > 0)
+		{
+			lastTick = tick;
+			if (skipTicks)
+			{
+				// Already output before the oscillator was snapped back
+				skipTicks--;
+			}
+			else if (running && !waitingFirstClock)
+			{
+				tickCount++;
+				tickEdge = true;
+			}
+		}
+
+		// Fraction of the way through the current tick. If phase correction has
+		// moved back before the last tick, hold at the start of that tick.
+		fraction = (ticksAhead < 0) ? 0 : (phase & (tickUnit - 1));
+		if (tickEdge) previousFraction = 0;
+	}
+
+	/// True for one sample at the start of each pulse at pulsesPerQuarter
+	bool Pulse(int pulsesPerQuarter) const
+	{
+		if (!running || waitingFirstClock) return false;
+		if (pulsesPerQuarter <= ppqn)
+		{
+			return tickEdge && (tickCount % uint32_t(ppqn / pulsesPerQuarter)) == 0;
+		}
+		// Multiplied clock: pulse at each tick, and as fraction passes each subdivision
+		uint32_t sub = uint32_t(pulsesPerQuarter / ppqn);
+		return tickEdge || ((fraction * sub) >> 24) > ((previousFraction * sub) >> 24);
+	}
+
+	/// True for the first half of each pulse period at pulsesPerQuarter (50% duty cycle clock)
+	bool Gate(int pulsesPerQuarter) const
+	{
+		if (!running || waitingFirstClock) return false;
+		if (pulsesPerQuarter <= ppqn)
+		{
+			// Position through pulse period, in ticks * 2^24
+			uint32_t ticksPerPulse = uint32_t(ppqn / pulsesPerQuarter);
+			uint64_t pos = (uint64_t(tickCount % ticksPerPulse) << 24) + fraction;
+			return pos < (uint64_t(ticksPerPulse) << 23);
+		}
+		uint32_t sub = uint32_t(pulsesPerQuarter / ppqn);
+		return ((fraction * sub) & (tickUnit - 1)) < tickUnit / 2;
+	}
+
+	/// True for one sample at the first tick after Start or Continue
+	bool StartPulse() const {return startEdge;}
+
+	/// True if transport is running (after Start/Continue, until Stop)
+	bool Running() const {return running;}
+
+	/// True if the tempo of the incoming clock is known
+	bool Locked() const {return increment != 0;}
+
+	/// Current tick, counted from the start of the song (24 per quarter note)
+	uint32_t SongPositionTicks() const {return tickCount;}
+
+	/// Tempo in beats per minute, or 0 if not locked
+	float BPM() const {return float(increment) * (48000.0f * 60.0f / float(ppqn) / float(tickUnit));}
+
+private:
+	static constexpr uint32_t tickUnit = 1u << 24; // phase units per tick
+	static constexpr uint32_t maxLead = tickUnit + tickUnit / 2;
+
+	// Internal oscillator: phase in ticks * 2^24 (wrapping), and increment per sample
+	uint32_t phase = 0, increment = 0;
+	uint32_t rxPhase = 0; // phase of last received clock
+	uint8_t lastTick = 0; // tick number (low 8 bits) of last tick output
+	uint32_t fraction = 0, previousFraction = 0;
+
+	int32_t samplesSinceClock = 0, lastInterval = 0;
+	uint32_t clocksSeen = 0;
+
+	// Transport
+	bool running = false, waitingFirstClock = false;
+	uint32_t tickCount = 0; // ticks output since start of song
+	uint32_t rxTickCount = 0; // ticks received since start of song
+	uint32_t songPosition = 0; // tick to continue from
+	uint32_t skipTicks = 0; // oscillator ticks already output, when it was ahead of received clock
+
+	// Output flags for this sample, and for the next sample from Event
+	bool tickEdge = false, startEdge = false;
+	bool pendingEdge = false, pendingStart = false;
+
+	void Clock()
+	{
+		int32_t interval = samplesSinceClock;
+		samplesSinceClock = 0;
+		rxPhase += tickUnit;
+		if (clocksSeen < 2) clocksSeen++;
+
+		bool counting = running && !waitingFirstClock;
+		if (waitingFirstClock)
+		{
+			// First clock after Start/Continue is the tick at the song position
+			waitingFirstClock = false;
+			rxTickCount = songPosition;
+			tickCount = songPosition;
+			skipTicks = 0;
+			pendingEdge = true;
+			pendingStart = true;
+			Snap();
+		}
+		else if (counting)
+		{
+			rxTickCount++;
+		}
+
+		int32_t err = int32_t(rxPhase - phase); // positive if oscillator is behind
+		if (increment == 0 || err > int32_t(2 * tickUnit) || err < -int32_t(2 * tickUnit))
+		{
+			// Not locked, or tempo has changed suddenly: follow received clock
+			// directly, and (re)start oscillator from interval between clocks
+			if (clocksSeen >= 2 && interval > 0) increment = tickUnit / uint32_t(interval);
+			// If the oscillator was ahead, its ticks since this one have already
+			// been output, so skip them; if behind, catch up to this tick
+			if (counting)
+			{
+				int32_t ahead = int32_t(tickCount - rxTickCount);
+				if (ahead >= 0)
+				{
+					skipTicks = uint32_t(ahead);
+				}
+				else
+				{
+					tickCount = rxTickCount;
+					pendingEdge = true;
+				}
+			}
+			Snap();
+		}
+		else
+		{
+			// PI loop filter: correct phase by 1/8 of the error, and
+			// tempo by 1/16 of the error (in ticks) per tick
+			phase += uint32_t(err >> 3);
+			int64_t newIncrement = int64_t(increment) + ((int64_t(err) * increment) >> 28);
+			increment = (newIncrement < 1) ? 1 : uint32_t(newIncrement);
+		}
+		if (interval > 0) lastInterval = interval;
+	}
+
+	// Set oscillator phase to that of received clock
+	void Snap()
+	{
+		phase = rxPhase;
+		lastTick = uint8_t(phase >> 24);
+	}
+};
+
+#endif
@@ -0,0 +1,341 @@
+/*
+MIDIControllers - high-resolution MIDI controller decoding
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Decodes 14-bit controller pairs (CC 0-31 with LSB on CC 32-63), NRPN and RPN
+parameters, pitch bend, pressure, and MPE (MIDI Polyphonic Expression) zones,
+into 14-bit values that can be sent to the 19-bit CVOutPrecise outputs.
+ControlRamp interpolates between successive values at the sample rate, to
+remove the steps between MIDI updates.
+
+Allocation-free, and independent of the Pico SDK.
+*/
+
+#ifndef MIDICONTROLLERS_H
+#define MIDICONTROLLERS_H
+
+#include <cstdint>
+#include "MIDIParser.h"
+
+/// One controller value update, from MIDIControllers::Decode
+struct MIDIControllerChange
+{
+	enum Type : uint8_t
+	{
+		None,
+		Controller,      // 7-bit controller (CC 64-127, other than NRPN/RPN)
+		Controller14,    // 14-bit controller pair, number 0-31 (MSB controller)
+		NRPN, RPN,       // number is parameter number 0-16383
+		PitchBend,       // 8192 is centre
+		ChannelPressure,
+		PolyPressure     // number is note
+	};
+
+	Type type;
+	uint8_t channel;
+	uint16_t number;
+	uint16_t value; // 0-16383; 7-bit values are scaled to the full range
+
+	/// Value as 19-bit CV for CVOutPrecise, 0 to 262143
+	int32_t Unipolar() const {return (int32_t(value) << 4) | (value >> 10);}
+	/// Value as 19-bit CV for CVOutPrecise, -262144 to 262143, with 8192 at 0 (e.g. for pitch bend)
+	int32_t Bipolar() const {return (int32_t(value) - 8192) << 5;}
+};
+
+
+/** \brief Per-channel state of MIDI controllers, pitch bend, pressure and MPE zones
+
+    Call Decode for each received MIDIEvent. It returns true, and sets change,
+    when an event updates a controller value.
+
+    - CC 0-31 followed by CC 32-63 gives a 14-bit Controller14 value. As in the
+      MIDI specification, an MSB alone resets the LSB to 0.
+    - CC 99/98 (NRPN) or 101/100 (RPN) select a parameter, and data entry
+      (CC 6/38, increment 96, decrement 97) sets its value.
+    - RPN 0 sets the pitch bend range of the channel, and RPN 6 on channel 1
+      or 16 sets an MPE lower or upper zone. Member channels of an MPE zone
+      then have a pitch bend range of 48 semitones, and the zone's master channel 2.
+    - Bend, Pressure and Timbre (CC 74) give the latest values per channel,
+      for MPE per-note expression, where each note is on its own channel.
+    - CC 120-127 are channel mode messages (such as All Notes Off), not
+      controllers, so Decode returns false for them.
+*/
+class MIDIControllers
+{
+public:
+	MIDIControllers() {Reset();}
+
+	/// Reset all controllers and parameters to default, and MPE off
+	void Reset()
+	{
+		for (int ch = 0; ch < 16; ch++)
+		{
+			ChannelState &c = channels[ch];
+			for (int i = 0; i < 32; i++) c.value14[i] = 0;
+			c.param = 0;
+			c.paramType = MIDIControllerChange::None;
+			c.data = 0;
+			c.bend = 8192;
+			c.pressure = 0;
+			c.timbre = 8192;
+			c.bendRangeCents = 200;
+		}
+		lowerZoneMembers = 0;
+		upperZoneMembers = 0;
+	}
+
+	/// Decode a MIDI event. Returns true if it changed a controller value, described by change.
+	bool Decode(const MIDIEvent &e, MIDIControllerChange &change)
+	{
+		if (!e.IsChannelMessage()) return false;
+		ChannelState &c = channels[e.channel];
+		change.channel = e.channel;
+
+		switch (e.type)
+		{
+		case MIDIEvent::PitchBend:
+			c.bend = uint16_t(e.data1 | (e.data2 << 7));
+			return Set(change, MIDIControllerChange::PitchBend, 0, c.bend);
+
+		case MIDIEvent::ChannelPressure:
+			c.pressure = Scale7(e.data1);
+			return Set(change, MIDIControllerChange::ChannelPressure, 0, c.pressure);
+
+		case MIDIEvent::PolyPressure:
+			return Set(change, MIDIControllerChange::PolyPressure, e.Note(), Scale7(e.data2));
+
+		case MIDIEvent::ControlChange:
+			return ControlChange(c, e.Controller(), e.Value(), change);
+
+		default:
+			return false;
+		}
+	}
+
+	/// Current value of 14-bit controller pair (number 0-31), 0-16383
+	uint16_t Controller14(uint8_t channel, uint8_t number) const {return channels[channel & 15].value14[number & 31];}
+	/// Current pitch bend, -8192 to 8191
+	int32_t Bend(uint8_t channel) const {return int32_t(channels[channel & 15].bend) - 8192;}
+	/// Current channel pressure, 0-16383
+	uint16_t Pressure(uint8_t channel) const {return channels[channel & 15].pressure;}
+	/// Current timbre (CC 74, the MPE third dimension), 0-16383
+	uint16_t Timbre(uint8_t channel) const {return channels[channel & 15].timbre;}
+	/// Pitch bend range, in cents
+	uint16_t BendRangeCents(uint8_t channel) const {return channels[channel & 15].bendRangeCents;}
+
+	/// Master channel of the MPE zone that channel is a member of, or -1 if none
+	int MPEMaster(uint8_t channel) const
+	{
+		channel &= 15;
+		if (channel >= 1 && channel <= lowerZoneMembers) return 0;
+		if (channel <= 14 && channel >= 15 - upperZoneMembers) return 15;
+		return -1;
+	}
+
+	/// Pitch of note played on channel, in 1/256ths of a semitone (as for CVOutMIDINotePrecise),
+	/// including the pitch bend of channel and, for MPE member channels, of the zone master channel
+	int32_t NotePitch(uint8_t note, uint8_t channel) const
+	{
+		int32_t pitch = (int32_t(note) << 8) + BendPitch(channel);
+		int master = MPEMaster(channel);
+		if (master >= 0) pitch += BendPitch(uint8_t(master));
+		return pitch;
+	}
+
+private:
+	struct ChannelState
+	{
+		uint16_t value14[32]; // 14-bit controller pairs
+		uint16_t param; // selected NRPN/RPN parameter
+		MIDIControllerChange::Type paramType; // NRPN, RPN, or None
+		uint16_t data; // data entry value
+		uint16_t bend, pressure, timbre;
+		uint16_t bendRangeCents;
+	};
+
+	ChannelState channels[16];
+	uint8_t lowerZoneMembers, upperZoneMembers;
+
+	static uint16_t Scale7(uint8_t v) {return uint16_t((v << 7) | v);}
+
+	static bool Set(MIDIControllerChange &change, MIDIControllerChange::Type type, uint16_t number, uint16_t value)
+	{
+		change.type = type;
+		change.number = number;
+		change.value = value;
+		return true;
+	}
+
+	// Pitch bend of channel, in 1/256ths of a semitone
+	int32_t BendPitch(uint8_t channel) const
+	{
+		const ChannelState &c = channels[channel & 15];
+		// bend / 8192 * cents / 100 * 256
+		return (int32_t(c.bend) - 8192) * c.bendRangeCents / 3200;
+	}
+
+	bool ControlChange(ChannelState &c, uint8_t number, uint8_t value, MIDIControllerChange &change)
+	{
+		switch (number)
+		{
+		case 6: // data entry MSB
+			c.data = uint16_t(value << 7);
+			return DataEntry(c, change);
+		case 38: // data entry LSB
+			c.data = uint16_t((c.data & 0x3F80) | value);
+			return DataEntry(c, change);
+		case 96: // data increment
+			if (c.data < 16383) c.data++;
+			return DataEntry(c, change);
+		case 97: // data decrement
+			if (c.data > 0) c.data--;
+			return DataEntry(c, change);
+		case 98: // NRPN LSB
+		case 100: // RPN LSB
+			SelectParam(c, number == 98 ? MIDIControllerChange::NRPN : MIDIControllerChange::RPN, 0x3F80, value);
+			return false;
+		case 99: // NRPN MSB
+		case 101: // RPN MSB
+			SelectParam(c, number == 99 ? MIDIControllerChange::NRPN : MIDIControllerChange::RPN, 0x7F, uint16_t(value << 7));
+			return false;
+		default:
+			if (number >= 120) return false; // channel mode message
+			break;
+		}
+
+		if (number < 32)
+		{
+			c.value14[number] = uint16_t(value << 7);
+			return Set(change, MIDIControllerChange::Controller14, number, c.value14[number]);
+		}
+		if (number < 64)
+		{
+			uint8_t msb = number - 32;
+			c.value14[msb] = uint16_t((c.value14[msb] & 0x3F80) | value);
+			return Set(change, MIDIControllerChange::Controller14, msb, c.value14[msb]);
+		}
+		if (number == 74) c.timbre = Scale7(value);
+		return Set(change, MIDIControllerChange::Controller, number, Scale7(value));
+	}
+
+	// Set one half of the parameter number; keep is the mask of the other half,
+	// which is only kept if the same type of parameter (NRPN or RPN) was selected
+	void SelectParam(ChannelState &c, MIDIControllerChange::Type type, uint16_t keep, uint16_t bits)
+	{
+		uint16_t param = (type == c.paramType || c.paramType == MIDIControllerChange::None) ? uint16_t(c.param & keep) : 0;
+		c.param = param | bits;
+		c.paramType = type;
+		c.data = 0;
+		if (type == MIDIControllerChange::RPN && c.param == 0x3FFF) c.paramType = MIDIControllerChange::None; // RPN null
+	}
+
+	bool DataEntry(ChannelState &c, MIDIControllerChange &change)
+	{
+		if (c.paramType == MIDIControllerChange::None) return false;
+		if (c.paramType == MIDIControllerChange::RPN)
+		{
+			if (c.param == 0)
+			{
+				// Pitch bend range: MSB semitones, LSB cents
+				c.bendRangeCents = uint16_t((c.data >> 7) * 100 + (c.data & 0x7F));
+			}
+			else if (c.param == 6)
+			{
+				MPEConfiguration(uint8_t(&c - channels), uint8_t(c.data >> 7));
+			}
+		}
+		return Set(change, c.paramType, c.param, c.data);
+	}
+
+	// MPE Configuration Message (RPN 6) on channel: set zone with members member channels
+	void MPEConfiguration(uint8_t channel, uint8_t members)
+	{
+		if (members > 15) members = 15;
+		if (channel == 0)
+		{
+			lowerZoneMembers = members;
+			if (upperZoneMembers + members > 14) upperZoneMembers = uint8_t(members >= 14 ? 0 : 14 - members);
+		}
+		else if (channel == 15)
+		{
+			upperZoneMembers = members;
+			if (lowerZoneMembers + members > 14) lowerZoneMembers = uint8_t(members >= 14 ? 0 : 14 - members);
+		}
+		else
+		{
+			return;
+		}
+
+		// Default pitch bend ranges: 48 semitones for members, 2 for master
+		channels[channel].bendRangeCents = 200;
+		for (int ch = 0; ch < 16; ch++)
+		{
+			if (MPEMaster(uint8_t(ch)) == channel) channels[ch].bendRangeCents = 4800;
+		}
+	}
+};
+
+
+/** \brief Linear interpolation, at the sample rate, of a value updated at irregular intervals
+
+    Call Set with each new value (for example, on each MIDI controller update),
+    and Process once per sample. Each new value is approached in a straight line
+    over the time since the previous update, so that a steady stream of updates
+    gives a smooth output, one update interval behind. Ramps are at most
+    maxRampSamples long (default 480, 10ms), and 0 turns interpolation off.
+
+    Values must be within +/-2^22, such as 19-bit CV values.
+*/
+class ControlRamp
+{
+public:
+	/// Set new target value
+	void Set(int32_t target)
+	{
+		uint32_t n = (samplesSinceSet < maxRampSamples) ? samplesSinceSet : maxRampSamples;
+		samplesSinceSet = 0;
+		targetValue = target;
+		if (n <= 1)
+		{
+			value = target << 8;
+			remaining = 0;
+			return;
+		}
+		step = ((target << 8) - value) / int32_t(n);
+		remaining = n;
+	}
+
+	/// Set value immediately, without a ramp
+	void Jump(int32_t v)
+	{
+		value = v << 8;
+		targetValue = v;
+		remaining = 0;
+	}
+
+	/// Advance by one sample, and return current value
+	int32_t Process()
+	{
+		if (samplesSinceSet < 0xFFFFFFFF) samplesSinceSet++;
+		if (remaining)
+		{
+			value += step;
+			if (--remaining == 0) value = targetValue << 8;
+		}
+		return value >> 8;
+	}
+
+	int32_t Value() const {return value >> 8;}
+
+	/// Maximum ramp length, in samples. 0 for no interpolation.
+	void SetMaxRampSamples(uint32_t n) {maxRampSamples = n;}
+
+private:
+	int32_t value = 0, step = 0; // in 1/256ths
+	int32_t targetValue = 0;
+	uint32_t remaining = 0, samplesSinceSet = 0;
+	uint32_t maxRampSamples = 480;
+};
+
+#endif
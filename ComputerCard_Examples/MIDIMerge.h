@@ -0,0 +1,74 @@
+/*
+MIDIMerge - merge timestamped MIDI events from several sources
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Each MIDI source (for example, each device connected to a USB hub) has its own
+queue, so that a device sending a flood of messages cannot fill the queue
+used by the others. ProcessSample takes events from all queues in timestamp
+order, each a fixed latency after it was received, as with PopDueMIDIEvent.
+*/
+
+#ifndef MIDIMERGE_H
+#define MIDIMERGE_H
+
+#include "MIDIParser.h"
+#include "SPSCQueue.h"
+
+/** \brief Per-source MIDI event queues, merged in timestamp order
+
+    The producer (e.g. USB code on core 1) pushes events from source s into
+    Queue(s). The consumer (ProcessSample) calls PopDue until it returns false.
+    Events with equal timestamps are returned lowest source first.
+*/
+template <int Sources, uint32_t QueueSize = 64>
+class MIDIMerge
+{
+	static_assert(Sources >= 1, "MIDIMerge needs at least one source");
+
+public:
+	/// Queue for events from source s. Producer pushes to this, for example with MIDIParser::Parse.
+	SPSCQueue<MIDIEvent, QueueSize> &Queue(int s) {return queues[s];}
+
+	/// Remove the earliest event from any queue, if it is due (now at least latency samples
+	/// after its timestamp). Sets source to the index of its queue. Consumer only.
+	bool __not_in_flash_func(PopDue)(uint32_t now, uint32_t latency, MIDIEvent &event, int &source)
+	{
+		int best = -1;
+		int32_t bestAge = 0;
+		MIDIEvent e;
+		for (int s = 0; s < Sources; s++)
+		{
+			if (queues[s].Empty() || !queues[s].Peek(e)) continue;
+			int32_t age = int32_t(now - e.timestamp);
+			if (best < 0 || age > bestAge)
+			{
+				best = s;
+				bestAge = age;
+			}
+		}
+		if (best < 0 || bestAge < int32_t(latency)) return false;
+		queues[best].Pop(event);
+		source = best;
+		return true;
+	}
+
+	/// Discard events from source s. Consumer only.
+	void Clear(int s) {queues[s].Clear();}
+
+	/// Total number of events lost because a queue was full
+	uint32_t Overflows() const
+	{
+		uint32_t n = 0;
+		for (int s = 0; s < Sources; s++)
+		{
+			n += queues[s].Overflows();
+		}
+		return n;
+	}
+
+private:
+	SPSCQueue<MIDIEvent, QueueSize> queues[Sources];
+};
+
+#endif
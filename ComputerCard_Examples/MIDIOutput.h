@@ -0,0 +1,296 @@
+/*
+MIDIOutput - batched, rate-limited MIDI output
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Sending each MIDI message as soon as it is generated (for example, each time
+a knob reading changes) uses one USB transfer per message, and a noisy knob
+can send hundreds of messages per second. MIDIOutput instead keeps only the
+latest value of each controller, sends each controller at most once per
+configurable interval, and packs all messages due into a single write of up
+to 16 messages, which fills one 64-byte USB packet.
+
+Allocation-free, and independent of the Pico SDK, so can be used with both
+USB device (tud_midi_stream_write) and USB host (tuh_midi_stream_write) code.
+*/
+
+#ifndef MIDIOUTPUT_H
+#define MIDIOUTPUT_H
+
+#include <cstdint>
+
+/** \brief Quantise a noisy reading, such as a knob, with hysteresis
+
+    The output is input >> shift, but only changes once the input has moved
+    more than margin beyond the range of the current output value, so that
+    noise on a reading close to a step boundary does not toggle the output.
+    The default converts a 12-bit knob reading to a 7-bit MIDI value.
+*/
+class Hysteresis
+{
+public:
+	Hysteresis(int shift = 5, int32_t margin = 8) : shift(shift), margin(margin) {}
+
+	/// Update with new reading. Returns true if the output value has changed.
+	bool Update(int32_t input)
+	{
+		if (value >= 0)
+		{
+			int32_t low = value << shift;
+			int32_t high = (value + 1) << shift;
+			if (input >= low - margin && input < high + margin) return false;
+		}
+		int32_t v = input >> shift;
+		if (v < 0) v = 0;
+		if (v == value) return false;
+		value = v;
+		return true;
+	}
+
+	/// Current output value, or -1 before the first Update
+	int32_t Value() const {return value;}
+
+private:
+	int shift;
+	int32_t margin;
+	int32_t value = -1;
+};
+
+
+/** \brief Outgoing MIDI scheduler, with per-controller coalescing and rate limits
+
+    Messages are added with the functions below, and sent by calling Flush
+    regularly (e.g. every pass of the USB loop), which passes all messages due
+    to a write function in one call, for example:
+
+        midiOut.Flush(SampleCounter(), [](const uint8_t *bytes, uint32_t length) {
+            tud_midi_stream_write(0, bytes, length);
+        });
+
+    - Send, NoteOn and NoteOff queue messages, which are all sent, in order.
+    - ControlChange, ControlChange14, PitchBend and ChannelPressure set the
+      value of a controller. Only the latest value of each is sent, and only if
+      it differs from the value last sent. Each controller is sent at most once
+      per controller interval. For ControlChange14, the MSB is only sent when
+      it has changed.
+    - Flush writes at most once per flush interval, and at most 16 messages per
+      write (one 64-byte USB packet). Queued messages go first, then controllers
+      in turn, so a busy controller cannot starve the others.
+
+    Times are in any units, as long as they are consistent, for example
+    samples from ComputerCard::SampleCounter(). Controllers sets the number of
+    controllers tracked at once; if more are used, the value is queued as with Send.
+*/
+template <int Controllers = 16, uint32_t QueueSize = 32>
+class MIDIOutput
+{
+	static_assert(Controllers >= 1, "MIDIOutput needs at least one controller slot");
+	static_assert(QueueSize >= 1, "MIDIOutput needs a queue of at least one message");
+
+public:
+	/// Messages in one full-speed USB packet: 64 bytes, 4 bytes per USB-MIDI event
+	static constexpr uint32_t maxMessagesPerWrite = 16;
+
+	/// Queue a channel or system common message (not SysEx). Returns false if the queue is full.
+	bool Send(uint8_t status, uint8_t data1 = 0, uint8_t data2 = 0)
+	{
+		if (queueCount == QueueSize)
+		{
+			overflows++;
+			return false;
+		}
+		Message &m = queue[(queueHead + queueCount) % QueueSize];
+		m.status = status;
+		m.data1 = data1 & 0x7F;
+		m.data2 = data2 & 0x7F;
+		queueCount++;
+		return true;
+	}
+
+	bool NoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {return Send(0x90 | (channel & 15), note, velocity);}
+	bool NoteOff(uint8_t channel, uint8_t note, uint8_t velocity = 0) {return Send(0x80 | (channel & 15), note, velocity);}
+
+	/// Set 7-bit controller value (0-127)
+	bool ControlChange(uint8_t channel, uint8_t controller, uint8_t value)
+	{
+		return Update(0xB0 | (channel & 15), controller & 0x7F, value & 0x7F, false);
+	}
+	/// Set 14-bit controller value (0-16383), sent as controller (0-31) and controller + 32
+	bool ControlChange14(uint8_t channel, uint8_t controller, uint16_t value)
+	{
+		return Update(0xB0 | (channel & 15), controller & 31, value & 0x3FFF, true);
+	}
+	/// Set pitch bend, -8192 to 8191
+	bool PitchBend(uint8_t channel, int32_t bend)
+	{
+		if (bend < -8192) bend = -8192;
+		if (bend > 8191) bend = 8191;
+		return Update(0xE0 | (channel & 15), 0, uint16_t(bend + 8192), true);
+	}
+	/// Set channel pressure (0-127)
+	bool ChannelPressure(uint8_t channel, uint8_t value)
+	{
+		return Update(0xD0 | (channel & 15), 0, value & 0x7F, false);
+	}
+
+	/// Pass all messages due to write(const uint8_t *bytes, uint32_t length), in a
+	/// single call, if any. Returns number of messages written.
+	template <typename Write>
+	uint32_t Flush(uint32_t now, Write &&write)
+	{
+		if (transfers > 0 && int32_t(now - lastWrite) < int32_t(flushInterval)) return 0;
+
+		uint8_t buffer[maxMessagesPerWrite * 3];
+		uint32_t length = 0, messages = 0;
+
+		while (queueCount > 0 && messages < maxMessagesPerWrite)
+		{
+			const Message &m = queue[queueHead];
+			length += Append(buffer + length, m.status, m.data1, m.data2);
+			messages++;
+			queueHead = (queueHead + 1) % QueueSize;
+			queueCount--;
+		}
+
+		for (int i = 0; i < Controllers && messages < maxMessagesPerWrite; i++)
+		{
+			int n = (nextSlot + i) % Controllers;
+			Slot &s = slots[n];
+			if (!s.pending) continue;
+			if (s.sent && int32_t(now - s.lastSent) < int32_t(controllerInterval)) continue;
+
+			bool isCC14 = s.wide && (s.status & 0xF0) == 0xB0;
+			bool sendMSB = !isCC14 || !s.sent || (s.value >> 7) != (s.sentValue >> 7);
+			uint32_t needed = (isCC14 && sendMSB) ? 2 : 1;
+			if (messages + needed > maxMessagesPerWrite) break;
+
+			if (isCC14)
+			{
+				if (sendMSB) length += Append(buffer + length, s.status, s.number, uint8_t(s.value >> 7));
+				length += Append(buffer + length, s.status, s.number + 32, s.value & 0x7F);
+			}
+			else if (s.wide)
+			{
+				length += Append(buffer + length, s.status, s.value & 0x7F, uint8_t(s.value >> 7));
+			}
+			else
+			{
+				length += Append(buffer + length, s.status, s.number, uint8_t(s.value));
+			}
+			messages += needed;
+
+			s.pending = false;
+			s.sent = true;
+			s.sentValue = s.value;
+			s.lastSent = now;
+			nextSlot = (n + 1) % Controllers;
+		}
+
+		if (length == 0) return 0;
+		write(buffer, length);
+		lastWrite = now;
+		transfers++;
+		messagesSent += messages;
+		return messages;
+	}
+
+	/// Minimum time between writes, default 48 (1ms at 48kHz, one USB frame)
+	void SetFlushInterval(uint32_t t) {flushInterval = t;}
+	/// Minimum time between messages for the same controller, default 48
+	void SetControllerInterval(uint32_t t) {controllerInterval = t;}
+
+	/// True if any messages are waiting to be sent
+	bool Pending() const
+	{
+		if (queueCount > 0) return true;
+		for (int i = 0; i < Controllers; i++)
+		{
+			if (slots[i].pending) return true;
+		}
+		return false;
+	}
+
+	/// Total messages written
+	uint32_t Messages() const {return messagesSent;}
+	/// Total calls to the write function, each one USB transfer
+	uint32_t Transfers() const {return transfers;}
+	/// Controller values replaced by a newer value before being sent
+	uint32_t Coalesced() const {return coalesced;}
+	/// Messages lost because the queue was full
+	uint32_t Overflows() const {return overflows;}
+
+private:
+	struct Message
+	{
+		uint8_t status, data1, data2;
+	};
+
+	struct Slot
+	{
+		uint8_t status = 0, number = 0; // status 0 if slot unused
+		bool wide = false; // 14-bit value
+		bool pending = false, sent = false;
+		uint16_t value = 0, sentValue = 0;
+		uint32_t lastSent = 0;
+	};
+
+	Message queue[QueueSize];
+	uint32_t queueHead = 0, queueCount = 0;
+
+	Slot slots[Controllers];
+	int nextSlot = 0;
+
+	uint32_t flushInterval = 48, controllerInterval = 48;
+	uint32_t lastWrite = 0;
+	uint32_t messagesSent = 0, transfers = 0, coalesced = 0, overflows = 0;
+
+	static uint32_t Append(uint8_t *p, uint8_t status, uint8_t data1, uint8_t data2)
+	{
+		p[0] = status;
+		p[1] = data1;
+		if ((status & 0xE0) == 0xC0) return 2; // program change and channel pressure have one data byte
+		p[2] = data2;
+		return 3;
+	}
+
+	bool Update(uint8_t status, uint8_t number, uint16_t value, bool wide)
+	{
+		Slot *s = nullptr, *unused = nullptr, *idle = nullptr;
+		for (int i = 0; i < Controllers; i++)
+		{
+			Slot &t = slots[i];
+			if (t.status == status && t.number == number && t.wide == wide)
+			{
+				s = &t;
+				break;
+			}
+			if (t.status == 0 && !unused) unused = &t;
+			else if (!t.pending && !idle) idle = &t;
+		}
+
+		if (!s)
+		{
+			// Use an unused slot, or failing that, one with nothing to send
+			Slot *free = unused ? unused : idle;
+			if (!free)
+			{
+				// All slots busy: send without coalescing
+				if (!wide) return Send(status, number, uint8_t(value));
+				if ((status & 0xF0) == 0xE0) return Send(status, value & 0x7F, uint8_t(value >> 7));
+				return Send(status, number, uint8_t(value >> 7)) && Send(status, number + 32, value & 0x7F);
+			}
+			s = free;
+			*s = Slot();
+			s->status = status;
+			s->number = number;
+			s->wide = wide;
+		}
+
+		if (s->pending) coalesced++;
+		s->value = value;
+		s->pending = !s->sent || value != s->sentValue;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+MIDIParser - incremental MIDI byte stream parser
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Converts a stream of MIDI bytes, as read from USB MIDI (tud_midi_stream_read,
+tuh_midi_stream_read) or a serial MIDI input, into typed MIDIEvents.
+Handles running status, system common messages, SysEx, and system real-time
+bytes (such as 0xF8 clock) arriving in the middle of other messages.
+
+Allocation-free, and independent of the Pico SDK, so can also be used in host code.
+*/
+
+#ifndef MIDIPARSER_H
+#define MIDIPARSER_H
+
+#include <cstdint>
+
+/// One complete MIDI message
+struct MIDIEvent
+{
+	/// Message type; values are the status byte (with channel bits zero for channel messages)
+	enum Type : uint8_t
+	{
+		None = 0x00,
+		NoteOff = 0x80, NoteOn = 0x90, PolyPressure = 0xA0, ControlChange = 0xB0,
+		ProgramChange = 0xC0, ChannelPressure = 0xD0, PitchBend = 0xE0,
+		SysEx = 0xF0, TimeCode = 0xF1, SongPosition = 0xF2, SongSelect = 0xF3, TuneRequest = 0xF6,
+		Clock = 0xF8, Start = 0xFA, Continue = 0xFB, Stop = 0xFC, ActiveSensing = 0xFE, Reset = 0xFF
+	};
+
+	Type type;
+	uint8_t channel; // 0-15, for channel messages
+	uint8_t data1, data2;
+	uint16_t sysExLength; // for SysEx: number of data bytes, see MIDIParser::SysExData
+	uint8_t port; // source of message, as set by MIDIParser::SetPort, e.g. USB MIDI cable number
+	uint32_t timestamp; // time received, as set by MIDIParser::SetTimestamp, e.g. ComputerCard::SampleCounter()
+
+	uint8_t Note() const {return data1;}
+	uint8_t Velocity() const {return data2;}
+	uint8_t Controller() const {return data1;}
+	uint8_t Value() const {return data2;}
+	uint8_t Program() const {return data1;}
+	uint8_t Pressure() const {return type == ChannelPressure ? data1 : data2;}
+	/// Pitch bend, -8192 to 8191
+	int16_t Bend() const {return int16_t((data1 | (data2 << 7)) - 8192);}
+	/// Song position, in MIDI beats (sixteenth notes) since start of song
+	uint16_t Beats() const {return uint16_t(data1 | (data2 << 7));}
+
+	bool IsChannelMessage() const {return type >= NoteOff && type < SysEx;}
+	bool IsRealTime() const {return type >= Clock;}
+};
+
+
+/** \brief Incremental MIDI parser state machine
+
+    Feed bytes one at a time with Parse(byte, event), which returns true each
+    time a message is complete, or a buffer at a time with Parse(data, length, queue),
+    which pushes each event into any queue with a Push(const MIDIEvent &) method,
+    such as SPSCQueue<MIDIEvent, N>.
+
+    - Running status is supported for channel messages, and cancelled by
+      system common and SysEx messages.
+    - Note on with velocity zero is returned as NoteOff.
+    - Real-time bytes are returned immediately, without interrupting the message
+      (or SysEx) in progress.
+    - SysEx data bytes are stored in an internal buffer of SysExSize bytes. A SysEx
+      event is returned when 0xF7 (or any other non-real-time status byte) is received.
+      SysExData() and sysExLength give the data, which is valid until the next SysEx
+      starts. SysExOverflow() is true if the message was longer than SysExSize.
+    - Data bytes with no preceding status byte are ignored.
+*/
+template <int SysExSize = 64>
+class MIDIParser
+{
+	static_assert(SysExSize >= 1, "SysEx buffer must have at least one byte");
+
+public:
+	/// Parse one byte. Returns true, and sets event, if the byte completes a message.
+	bool Parse(uint8_t byte, MIDIEvent &event)
+	{
+		if (byte >= 0xF8)
+		{
+			// System real-time: return immediately, leaving any message in progress
+			if (byte == 0xF9 || byte == 0xFD) return false; // undefined
+			SetEvent(event, MIDIEvent::Type(byte), 0, 0, 0);
+			return true;
+		}
+
+		if (byte & 0x80)
+		{
+			// Any status byte ends a SysEx message
+			bool endSysEx = inSysEx;
+			inSysEx = false;
+
+			if (byte < 0xF0)
+			{
+				// Channel message
+				status = byte;
+				dataCount = 0;
+				dataNeeded = ((byte & 0xE0) == 0xC0) ? 1 : 2; // program change and channel pressure have one data byte
+			}
+			else
+			{
+				// System common or SysEx: cancel running status
+				status = 0;
+				dataCount = 0;
+				switch (byte)
+				{
+				case 0xF0:
+					inSysEx = true;
+					sysExLength = 0;
+					sysExOverflow = false;
+					break;
+				case 0xF1:
+				case 0xF3:
+					status = byte;
+					dataNeeded = 1;
+					break;
+				case 0xF2:
+					status = byte;
+					dataNeeded = 2;
+					break;
+				case 0xF6:
+					if (endSysEx) break; // SysEx event takes priority over this obsolete message
+					SetEvent(event, MIDIEvent::TuneRequest, 0, 0, 0);
+					return true;
+				default: // 0xF7 end of SysEx, or undefined 0xF4/0xF5
+					break;
+				}
+			}
+
+			if (endSysEx)
+			{
+				SetEvent(event, MIDIEvent::SysEx, 0, 0, 0);
+				event.sysExLength = sysExLength;
+				return true;
+			}
+			return false;
+		}
+
+		// Data byte
+		if (inSysEx)
+		{
+			if (sysExLength < SysExSize)
+				sysExBuffer[sysExLength++] = byte;
+			else
+				sysExOverflow = true;
+			return false;
+		}
+
+		if (status == 0) return false; // no status byte yet: ignore
+
+		data[dataCount++] = byte;
+		if (dataCount < dataNeeded) return false;
+
+		// Message complete. Keep status for running status (channel messages only)
+		dataCount = 0;
+		if (status < 0xF0)
+		{
+			MIDIEvent::Type type = MIDIEvent::Type(status & 0xF0);
+			if (type == MIDIEvent::NoteOn && data[1] == 0) type = MIDIEvent::NoteOff;
+			SetEvent(event, type, status & 0x0F, data[0], dataNeeded > 1 ? data[1] : 0);
+		}
+		else
+		{
+			SetEvent(event, MIDIEvent::Type(status), 0, data[0], dataNeeded > 1 ? data[1] : 0);
+			status = 0;
+		}
+		return true;
+	}
+
+	/// Parse length bytes, pushing each complete event into queue, with the given timestamp.
+	/// Returns number of events.
+	template <typename Queue>
+	uint32_t Parse(const uint8_t *bytes, uint32_t length, Queue &queue, uint32_t timestamp = 0)
+	{
+		SetTimestamp(timestamp);
+		uint32_t n = 0;
+		MIDIEvent event;
+		for (uint32_t i = 0; i < length; i++)
+		{
+			if (Parse(bytes[i], event))
+			{
+				queue.Push(event);
+				n++;
+			}
+		}
+		return n;
+	}
+
+	/// Parse one 4-byte USB-MIDI event packet (as from tuh_midi_packets_peek), pushing any
+	/// complete events into queue, with the given timestamp. Returns number of events.
+	/// The cable number (packet[0] >> 4) is ignored: use one parser per cable.
+	/// As in tuh_midi_stream_read, the CIN field is not used, as many devices
+	/// set it incorrectly; the message length is found from the status byte.
+	template <typename Queue>
+	uint32_t ParseUSBPacket(const uint8_t *packet, Queue &queue, uint32_t timestamp = 0)
+	{
+		SetTimestamp(timestamp);
+		MIDIEvent event;
+		uint8_t byte = packet[1];
+
+		if (byte >= 0x80 && byte < 0xF0)
+		{
+			uint8_t needed = ((byte & 0xE0) == 0xC0) ? 1 : 2;
+			if (!inSysEx && packet[2] < 0x80 && (needed == 1 || packet[3] < 0x80))
+			{
+				// Complete channel message: decode directly, rather than byte by byte
+				status = byte;
+				dataCount = 0;
+				dataNeeded = needed;
+				MIDIEvent::Type type = MIDIEvent::Type(byte & 0xF0);
+				if (type == MIDIEvent::NoteOn && packet[3] == 0) type = MIDIEvent::NoteOff;
+				SetEvent(event, type, byte & 0x0F, packet[2], needed > 1 ? packet[3] : 0);
+				queue.Push(event);
+				return 1;
+			}
+			return ParseBytes(packet + 1, 1 + needed, queue);
+		}
+
+		// Real-time and system common messages have 1-3 bytes. SysEx start,
+		// continuation and end packets have up to 3 bytes, ending at any 0xF7
+		uint32_t length = (byte == 0xF1 || byte == 0xF3) ? 2 : (byte == 0xF2 || byte <= 0xF0) ? 3 : 1;
+		return ParseBytes(packet + 1, length, queue);
+	}
+
+	/// Data bytes of last SysEx message (without the 0xF0 and 0xF7)
+	const uint8_t *SysExData() const {return sysExBuffer;}
+	/// True if last SysEx message was longer than the buffer, and was truncated
+	bool SysExOverflow() const {return sysExOverflow;}
+
+	/// Set timestamp given to events returned by subsequent calls to Parse(byte, event)
+	void SetTimestamp(uint32_t t) {timestamp = t;}
+
+	/// Set port given to all events from this parser, to identify the source
+	/// when events from several parsers share a queue
+	void SetPort(uint8_t p) {port = p;}
+
+	/// Forget any message in progress, and running status
+	void Reset()
+	{
+		status = 0;
+		dataCount = 0;
+		inSysEx = false;
+	}
+
+private:
+	uint8_t status = 0; // running status, or system common status in progress; 0 if none
+	uint8_t data[2];
+	uint8_t dataCount = 0, dataNeeded = 0;
+
+	bool inSysEx = false;
+	bool sysExOverflow = false;
+	uint16_t sysExLength = 0;
+	uint8_t sysExBuffer[SysExSize];
+	uint32_t timestamp = 0;
+	uint8_t port = 0;
+
+	// Parse up to length bytes, stopping after any 0xF7 (end of SysEx)
+	template <typename Queue>
+	uint32_t ParseBytes(const uint8_t *bytes, uint32_t length, Queue &queue)
+	{
+		uint32_t n = 0;
+		MIDIEvent event;
+		for (uint32_t i = 0; i < length; i++)
+		{
+			if (Parse(bytes[i], event))
+			{
+				queue.Push(event);
+				n++;
+			}
+			if (bytes[i] == 0xF7) break;
+		}
+		return n;
+	}
+
+	void SetEvent(MIDIEvent &event, MIDIEvent::Type type, uint8_t channel, uint8_t data1, uint8_t data2)
+	{
+		event.type = type;
+		event.channel = channel;
+		event.data1 = data1;
+		event.data2 = data2;
+		event.sysExLength = 0;
+		event.timestamp = timestamp;
+		event.port = port;
+	}
+};
+
+
+/** \brief Remove the next event from queue, if it is due to be applied
+
+    For sample-accurate MIDI timing: events are timestamped with the sample count
+    when received (on the USB core), and applied in ProcessSample a fixed latency
+    (in samples) later, so that the delay from receipt to output does not depend
+    on when the USB code ran. Call repeatedly in ProcessSample with
+    now = SampleCounter(), until it returns false.
+*/
+template <typename Queue>
+bool PopDueMIDIEvent(Queue &queue, uint32_t now, uint32_t latency, MIDIEvent &event)
+{
+	if (!queue.Peek(event)) return false;
+	if (int32_t(now - (event.timestamp + latency)) < 0) return false;
+	queue.Pop(event);
+	return true;
+}
+
+#endif
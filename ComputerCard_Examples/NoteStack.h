@@ -0,0 +1,359 @@
+/*
+NoteStack - held MIDI note tracking, note priority and voice allocation
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+NoteStack keeps the set of held notes, in the order they were pressed, so that
+releasing one note of several returns to another held note rather than
+closing the gate. VoiceAllocator uses this to assign notes to a small fixed
+number of voices, such as the two CV/pulse output pairs.
+
+Allocation-free, and independent of the Pico SDK, so can be used with
+MIDIParser in both USB device and host code.
+*/
+
+#ifndef NOTESTACK_H
+#define NOTESTACK_H
+
+#include <cstdint>
+
+/** \brief Set of held MIDI notes, with last, lowest and highest note lookup
+
+    Holds all 128 MIDI notes, as a doubly linked list in pressed order,
+    plus a bitmap for lowest/highest lookup. All operations are O(1).
+*/
+class NoteStack
+{
+public:
+	NoteStack() {Clear();}
+
+	/// Add note to top of stack. If already held, moves it to the top.
+	void NoteOn(uint8_t note, uint8_t velocity = 127)
+	{
+		note &= 0x7F;
+		if (Held(note)) Unlink(note);
+
+		older[note] = top;
+		newer[note] = none;
+		if (top != none) newer[top] = note;
+		top = note;
+
+		velocities[note] = velocity;
+		held[note >> 5] |= 1u << (note & 31);
+		count++;
+	}
+
+	/// Remove note from stack. Returns false if note was not held.
+	bool NoteOff(uint8_t note)
+	{
+		note &= 0x7F;
+		if (!Held(note)) return false;
+		Unlink(note);
+		return true;
+	}
+
+	/// Remove all notes
+	void Clear()
+	{
+		for (int i = 0; i < 4; i++) held[i] = 0;
+		top = none;
+		count = 0;
+	}
+
+	bool Held(uint8_t note) const {return held[(note & 0x7F) >> 5] & (1u << (note & 31));}
+	int Count() const {return count;}
+	uint8_t Velocity(uint8_t note) const {return velocities[note & 0x7F];}
+
+	/// Most recently pressed held note, or -1 if none
+	int Last() const {return top == none ? -1 : top;}
+	/// Held note pressed before note, or -1 if none. With Last, walks notes from newest to oldest.
+	int Previous(uint8_t note) const {return older[note & 0x7F] == none ? -1 : older[note & 0x7F];}
+
+	/// Lowest held note, or -1 if none
+	int Lowest() const {return LowestFrom(0);}
+	/// Highest held note, or -1 if none
+	int Highest() const {return HighestFrom(127);}
+	/// Lowest held note above note, or -1 if none
+	int LowestAbove(uint8_t note) const {return (note >= 127) ? -1 : LowestFrom(note + 1);}
+	/// Highest held note below note, or -1 if none
+	int HighestBelow(uint8_t note) const {return (note == 0) ? -1 : HighestFrom(note - 1);}
+
+private:
+	static constexpr uint8_t none = 0xFF;
+
+	uint32_t held[4]; // bitmap of held notes
+	uint8_t older[128], newer[128]; // links in pressed order, valid for held notes only
+	uint8_t velocities[128];
+	uint8_t top; // most recently pressed note
+	int count;
+
+	void Unlink(uint8_t note)
+	{
+		if (older[note] != none) newer[older[note]] = newer[note];
+		if (newer[note] != none) older[newer[note]] = older[note];
+		else top = older[note];
+
+		held[note >> 5] &= ~(1u << (note & 31));
+		count--;
+	}
+
+	// Lowest held note >= note
+	int LowestFrom(int note) const
+	{
+		int word = note >> 5;
+		uint32_t bits = held[word] & (0xFFFFFFFFu << (note & 31));
+		while (true)
+		{
+			if (bits) return (word << 5) + __builtin_ctz(bits);
+			if (++word == 4) return -1;
+			bits = held[word];
+		}
+	}
+
+	// Highest held note <= note
+	int HighestFrom(int note) const
+	{
+		int word = note >> 5;
+		uint32_t bits = held[word] & (0xFFFFFFFFu >> (31 - (note & 31)));
+		while (true)
+		{
+			if (bits) return (word << 5) + 31 - __builtin_clz(bits);
+			if (--word < 0) return -1;
+			bits = held[word];
+		}
+	}
+};
+
+
+/** \brief Assigns held notes to a fixed number of voices
+
+    Modes:
+    - LastPriority, LowPriority, HighPriority: voices play the Voices most
+      recent / lowest / highest held notes. Releasing a note returns to the
+      next note in priority order. With one voice, this is a monophonic synth.
+    - RoundRobin: each new note goes to the next free voice in turn, or
+      steals the next voice in turn if none is free.
+    - StealOldest: each new note goes to the free voice that was released
+      longest ago, or steals the voice whose note started longest ago.
+
+    In the RoundRobin and StealOldest modes, a voice released while other notes
+    are still held (for example, notes that were stolen) plays the most recent of those.
+
+    When a voice's gate closes, it keeps its note, for the release of an envelope.
+    Operations are O(Voices), and use no dynamic memory.
+*/
+template <int Voices = 2>
+class VoiceAllocator
+{
+	static_assert(Voices >= 1 && Voices <= 16, "VoiceAllocator supports 1 to 16 voices");
+
+public:
+	enum Mode {LastPriority, LowPriority, HighPriority, RoundRobin, StealOldest};
+
+	VoiceAllocator()
+	{
+		for (int i = 0; i < Voices; i++)
+		{
+			voice[i] = Voice();
+		}
+	}
+
+	void SetMode(Mode m)
+	{
+		if (m == mode) return;
+		mode = m;
+		if (IsPriorityMode()) AssignByPriority(-1);
+	}
+	Mode GetMode() const {return mode;}
+
+	void NoteOn(uint8_t note, uint8_t velocity = 127)
+	{
+		note &= 0x7F;
+		notes.NoteOn(note, velocity);
+		if (IsPriorityMode())
+		{
+			AssignByPriority(note);
+			return;
+		}
+
+		// Note already playing: retrigger the same voice
+		int v = VoicePlaying(note);
+		if (v < 0)
+		{
+			v = (mode == RoundRobin) ? RoundRobinVoice() : OldestVoice();
+		}
+		Start(v, note, true);
+	}
+
+	void NoteOff(uint8_t note)
+	{
+		note &= 0x7F;
+		if (!notes.NoteOff(note)) return;
+		if (IsPriorityMode())
+		{
+			AssignByPriority(-1);
+			return;
+		}
+
+		int v = VoicePlaying(note);
+		if (v < 0) return; // note had been stolen
+
+		// Play the most recent held note not already playing, if any.
+		// At most Voices held notes are playing, so this loop is short.
+		for (int n = notes.Last(); n >= 0; n = notes.Previous(uint8_t(n)))
+		{
+			if (VoicePlaying(uint8_t(n)) < 0)
+			{
+				Start(v, uint8_t(n), false);
+				return;
+			}
+		}
+		voice[v].gate = false;
+		voice[v].age = ++clock;
+	}
+
+	/// Release all notes, for example on MIDI CC 123 (All Notes Off)
+	void AllNotesOff()
+	{
+		notes.Clear();
+		for (int i = 0; i < Voices; i++)
+		{
+			voice[i].gate = false;
+		}
+	}
+
+	bool Gate(int v) const {return voice[v].gate;}
+	uint8_t Note(int v) const {return voice[v].note;}
+	uint8_t Velocity(int v) const {return voice[v].velocity;}
+
+	/// True once after voice v starts a newly pressed note, including
+	/// when the gate was already open, so that an envelope can be retriggered.
+	bool Retrigger(int v)
+	{
+		bool r = voice[v].retrigger;
+		voice[v].retrigger = false;
+		return r;
+	}
+
+	/// Held notes
+	const NoteStack &Notes() const {return notes;}
+
+private:
+	struct Voice
+	{
+		uint8_t note = 0, velocity = 0;
+		bool gate = false, retrigger = false;
+		uint32_t age = 0; // clock value at note start or release
+	};
+
+	NoteStack notes;
+	Voice voice[Voices];
+	Mode mode = LastPriority;
+	int nextVoice = 0; // for RoundRobin
+	uint32_t clock = 0;
+
+	bool IsPriorityMode() const {return mode <= HighPriority;}
+
+	void Start(int v, uint8_t note, bool pressed)
+	{
+		voice[v].note = note;
+		voice[v].velocity = notes.Velocity(note);
+		voice[v].gate = true;
+		voice[v].retrigger = voice[v].retrigger || pressed;
+		voice[v].age = ++clock;
+	}
+
+	// Voice with gate open playing note, or -1
+	int VoicePlaying(uint8_t note) const
+	{
+		for (int i = 0; i < Voices; i++)
+		{
+			if (voice[i].gate && voice[i].note == note) return i;
+		}
+		return -1;
+	}
+
+	// Next free voice in turn, or next voice if none free
+	int RoundRobinVoice()
+	{
+		int v = nextVoice;
+		for (int i = 0; i < Voices; i++)
+		{
+			int j = (nextVoice + i) % Voices;
+			if (!voice[j].gate)
+			{
+				v = j;
+				break;
+			}
+		}
+		nextVoice = (v + 1) % Voices;
+		return v;
+	}
+
+	// Free voice released longest ago, or if none free, voice started longest ago
+	int OldestVoice() const
+	{
+		int best = 0;
+		for (int i = 1; i < Voices; i++)
+		{
+			if (voice[i].gate != voice[best].gate)
+			{
+				if (!voice[i].gate) best = i;
+			}
+			else if (int32_t(voice[i].age - voice[best].age) < 0)
+			{
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	// Assign the Voices highest-priority held notes to voices. Voices already
+	// playing one of these notes keep it. pressed is the note just pressed, or -1.
+	void AssignByPriority(int pressed)
+	{
+		int wanted[Voices] = {};
+		int numWanted = 0;
+		int n = (mode == LastPriority) ? notes.Last() : (mode == LowPriority) ? notes.Lowest() : notes.Highest();
+		while (n >= 0 && numWanted < Voices)
+		{
+			wanted[numWanted++] = n;
+			uint8_t u = uint8_t(n);
+			n = (mode == LastPriority) ? notes.Previous(u) : (mode == LowPriority) ? notes.LowestAbove(u) : notes.HighestBelow(u);
+		}
+
+		// Keep voices already playing a wanted note
+		bool keep[Voices] = {};
+		for (int i = 0; i < numWanted; i++)
+		{
+			int v = VoicePlaying(uint8_t(wanted[i]));
+			if (v >= 0)
+			{
+				keep[v] = true;
+				if (wanted[i] == pressed) Start(v, uint8_t(pressed), true);
+				wanted[i] = -1;
+			}
+		}
+
+		// Give remaining wanted notes to other voices, in voice order
+		int v = 0;
+		for (int i = 0; i < numWanted; i++)
+		{
+			if (wanted[i] < 0) continue;
+			while (keep[v]) v++;
+			keep[v] = true;
+			Start(v, uint8_t(wanted[i]), wanted[i] == pressed);
+		}
+
+		for (int i = 0; i < Voices; i++)
+		{
+			if (!keep[i] && voice[i].gate)
+			{
+				voice[i].gate = false;
+				voice[i].age = ++clock;
+			}
+		}
+	}
+};
+
+#endif
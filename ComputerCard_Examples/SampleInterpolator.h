@@ -0,0 +1,233 @@
+/*
+SampleInterpolator - fixed-point interpolation, for playing samples at any speed
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Reads 16-bit samples at fractional positions, with a choice of three
+interpolators, in increasing order of quality and cost:
+
+- Linear: 2 samples. Cheapest, but dulls high frequencies, and only weakly
+  suppresses the images and aliases that resampling creates.
+- Hermite: 4-point, third-order (Catmull-Rom) cubic. A flatter passband
+  and better image rejection, for a few multiplies more.
+- Sinc: 16-point polyphase windowed sinc (Kaiser window). Band-limited:
+  the filter bank is chosen by the playback increment, with a lower cutoff
+  when a sample is pitched up (in half-octave steps, up to 8x), so that
+  frequencies that would fold back below the output Nyquist frequency are
+  attenuated rather than aliased. Sixteen taps can only make a filter so
+  sharp: up to 2x, content that would alias is at least 55dB down from 1.5
+  times the output Nyquist frequency, and from 3 times it at 8x, with the
+  transition band in between. Increments above maxIncrement use the last
+  bank, which no longer removes all that aliases, so clamp the increment
+  to maxIncrement where that matters.
+
+Positions (SamplePhase) are whole samples and a 16-bit fraction, advanced
+by a 16.16 increment each output sample. Compute the increment with
+PhaseIncrement when the playback speed changes, not every sample, and the
+ratio of sample rates it uses once, when the sample is loaded.
+
+All arithmetic in Interpolate is 32-bit integer. Only Init, which builds
+the sinc tables, uses floating point.
+
+Allocation-free, and independent of the Pico SDK.
+*/
+
+#ifndef SAMPLEINTERPOLATOR_H
+#define SAMPLEINTERPOLATOR_H
+
+#include <cmath>
+#include <cstdint>
+
+/// Playback position in a sample: whole samples, and a 16-bit fraction
+struct SamplePhase
+{
+	uint32_t index = 0;
+	uint32_t fraction = 0; // 0 to 65535
+
+	/// Move on by a 16.16 increment
+	void Advance(uint32_t increment)
+	{
+		fraction += increment;
+		index += fraction >> 16;
+		fraction &= 0xFFFF;
+	}
+};
+
+
+/** \brief Linear, Hermite and band-limited windowed-sinc sample interpolation
+
+    Call Init once, before use (the sinc tables are computed in floating
+    point, so not in ProcessSample). The tables are 56KB, so make the
+    interpolator a static or global object rather than a local variable.
+
+    Interpolate reads samples s[-Before(q)] to s[After(q)] around the
+    position s[0] + fraction. InterpolateLoop does the same in a looping
+    sample, wrapping reads around its ends.
+*/
+class SampleInterpolator
+{
+public:
+	enum Quality {Linear, Hermite, Sinc};
+	static constexpr int numQualities = 3;
+
+	static constexpr int sincTaps = 16; // samples read by the sinc interpolator
+	static constexpr int sincPhases = 256; // fractional positions tabulated
+	static constexpr int sincBanks = 7; // cutoffs, for increments up to 1, sqrt(2), 2, ... 8
+	static constexpr uint32_t unity = 1 << 16; // increment at the original speed and rate
+	static constexpr uint32_t maxIncrement = 8 * unity; // highest increment the sinc banks cover
+
+	/// Samples read before and after the position, by each quality
+	static constexpr int Before(Quality q) {return (q == Sinc) ? sincTaps / 2 - 1 : (q == Hermite) ? 1 : 0;}
+	static constexpr int After(Quality q) {return (q == Sinc) ? sincTaps / 2 : (q == Hermite) ? 2 : 1;}
+	static constexpr int maxBefore = sincTaps / 2 - 1, maxAfter = sincTaps / 2;
+
+	/// Ratio of a sample's rate to the output rate, as 16.16
+	static uint32_t RateRatio(uint32_t sampleRate, uint32_t outputRate = 48000)
+	{
+		return uint32_t((uint64_t(sampleRate) << 16) / outputRate);
+	}
+
+	/// 16.16 increment to play a sample with the given RateRatio at speed
+	/// (in units of 2^-speedShift, so 1024 is the original speed by default)
+	static uint32_t PhaseIncrement(uint32_t rateRatio, uint32_t speed, int speedShift = 10)
+	{
+		return uint32_t((uint64_t(rateRatio) * speed) >> speedShift);
+	}
+
+	/// Sinc filter bank for a 16.16 increment: the cutoff is lowered by the
+	/// increment (in steps of half an octave) above the original speed,
+	/// up to maxIncrement
+	static int Bank(uint32_t increment)
+	{
+		// Highest increment of each bank: unity * 2^(b/2)
+		static constexpr uint32_t limits[sincBanks - 1] = {65536, 92682, 131072, 185364, 262144, 370728};
+		int b = 0;
+		while (b < sincBanks - 1 && increment > limits[b]) b++;
+		return b;
+	}
+
+	/// Build the sinc tables. cutoff is that of bank 0 relative to the
+	/// Nyquist frequency, and beta the Kaiser window parameter, trading
+	/// stopband rejection (higher) against the width of the transition band.
+	void Init(float cutoff = 0.9f, float beta = 6.0f)
+	{
+		const float i0Beta = BesselI0(beta);
+		for (int p = 0; p < sincPhases; p++)
+		{
+			float fraction = p / float(sincPhases);
+			float x[sincTaps], window[sincTaps];
+			for (int k = 0; k < sincTaps; k++)
+			{
+				// Distance of tap k from the position, and the window there
+				x[k] = float(k - maxBefore) - fraction;
+				float t = x[k] / (sincTaps / 2);
+				float r = 1.0f - t * t;
+				window[k] = BesselI0(beta * sqrtf(r > 0.0f ? r : 0.0f)) / i0Beta;
+			}
+
+			float c = cutoff;
+			for (int b = 0; b < sincBanks; b++, c *= 0.70710678f)
+			{
+				float h[sincTaps];
+				float sum = 0.0f;
+				for (int k = 0; k < sincTaps; k++)
+				{
+					float a = 3.14159265f * c * x[k];
+					h[k] = window[k] * ((a == 0.0f) ? 1.0f : sinf(a) / a);
+					sum += h[k];
+				}
+
+				// Q15, normalised to unity gain at DC, with the rounding error
+				// added to the tap nearest the position
+				int16_t *coeffs = sinc[b][p];
+				int32_t total = 0;
+				for (int k = 0; k < sincTaps; k++)
+				{
+					coeffs[k] = int16_t(floorf(h[k] / sum * 32768.0f + 0.5f));
+					total += coeffs[k];
+				}
+				coeffs[maxBefore + (fraction >= 0.5f)] += int16_t(32768 - total);
+			}
+		}
+	}
+
+	/// Sample at position s[0] + fraction/65536, reading s[-Before(q)] to s[After(q)].
+	/// bank is only used by Sinc: Bank(increment) for the current increment.
+	int16_t Interpolate(const int16_t *s, uint32_t fraction, Quality q, int bank = 0) const
+	{
+		int32_t v;
+		if (q == Sinc)
+		{
+			const int16_t *coeffs = sinc[bank][fraction >> 8];
+			const int16_t *p = s - maxBefore;
+			v = 0;
+			for (int k = 0; k < sincTaps; k++)
+			{
+				v += p[k] * coeffs[k];
+			}
+			v = (v + (1 << 14)) >> 15;
+		}
+		else if (q == Hermite)
+		{
+			// Catmull-Rom weights, Q15, from powers of the fraction
+			int32_t t = int32_t(fraction >> 1);
+			int32_t t2 = (t * t) >> 15;
+			int32_t t3 = (t2 * t) >> 15;
+			int32_t w0 = (2 * t2 - t3 - t) >> 1;
+			int32_t w2 = (4 * t2 - 3 * t3 + t) >> 1;
+			int32_t w3 = (t3 - t2) >> 1;
+			int32_t w1 = 32768 - w0 - w2 - w3; // (3 t^3 - 5 t^2 + 2) / 2, so the weights sum to exactly one
+			v = (w0 * s[-1] + w1 * s[0] + w2 * s[1] + w3 * s[2] + (1 << 14)) >> 15;
+		}
+		else
+		{
+			v = s[0] + (((s[1] - s[0]) * int32_t(fraction >> 2)) >> 14);
+		}
+		if (v > 32767) v = 32767;
+		if (v < -32768) v = -32768;
+		return int16_t(v);
+	}
+
+	/// Sample at phase (phase.index < numSamples) in a looping sample,
+	/// wrapping reads that fall before its start or after its end
+	int16_t InterpolateLoop(const int16_t *data, uint32_t numSamples, SamplePhase phase, Quality q, int bank = 0) const
+	{
+		uint32_t before = Before(q), after = After(q);
+		if (phase.index >= before && phase.index + after < numSamples)
+		{
+			return Interpolate(data + phase.index, phase.fraction, q, bank);
+		}
+
+		// Near either end: copy the samples read, in order
+		int16_t window[sincTaps];
+		uint32_t i = phase.index;
+		for (uint32_t k = 0; k < before; k++)
+		{
+			i = (i > 0) ? i - 1 : numSamples - 1;
+		}
+		for (uint32_t k = 0; k <= before + after; k++)
+		{
+			window[k] = data[i];
+			if (++i >= numSamples) i = 0;
+		}
+		return Interpolate(window + before, phase.fraction, q, bank);
+	}
+
+private:
+	int16_t sinc[sincBanks][sincPhases][sincTaps];
+
+	// Modified Bessel function of the first kind, order zero, for the Kaiser window
+	static float BesselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 32 && term > 1e-7f * sum; k++)
+		{
+			float a = x / (2.0f * k);
+			term *= a * a;
+			sum += term;
+		}
+		return sum;
+	}
+};
+
+#endif
@@ -0,0 +1,321 @@
+/*
+SampleStream - samples read from flash ahead of playback, by DMA, into RAM
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Samples read straight from flash stall ProcessSample whenever they miss
+the 16KB XIP cache, while the flash is read over QSPI, and several voices
+(or the program's own code and data) evict each other's cache lines, so
+the time taken varies from sample to sample. Instead, each voice has a
+small ring of blocks in RAM, which one DMA channel fills with the blocks
+just ahead of the voice's playback position, and ProcessSample reads
+samples only from RAM.
+
+Blocks are read from flash through the XIP streaming FIFO, which fetches
+from flash in the background without holding up the bus, or otherwise
+through the non-allocating XIP alias (as with the background CRC); neither
+allocates in the XIP cache. A sample not yet in RAM, such as just after a
+voice starts a new sample, is read from flash as before, and counted.
+
+XIPCacheCounters reads the XIP cache's own hit and access counters, to
+check how often flash reads still go through the cache.
+*/
+
+#ifndef SAMPLESTREAM_H
+#define SAMPLESTREAM_H
+
+#include "SampleInterpolator.h"
+#include "pico.h"
+#include "hardware/dma.h"
+#include "hardware/structs/xip_ctrl.h"
+
+/// Hit and access counts of the XIP cache. The hardware counts all
+/// cacheable flash reads (from either core, or DMA), saturating at 2^32-1.
+struct XIPCacheCounters
+{
+	uint32_t hits, accesses;
+
+	uint32_t Misses() const {return accesses - hits;}
+
+	/// Read the counters, then optionally clear them
+	static XIPCacheCounters Read(bool clear = false)
+	{
+		XIPCacheCounters c = {xip_ctrl_hw->ctr_hit, xip_ctrl_hw->ctr_acc};
+		if (clear)
+		{
+			xip_ctrl_hw->ctr_hit = 0; // any write clears
+			xip_ctrl_hw->ctr_acc = 0;
+		}
+		return c;
+	}
+};
+
+
+/** \brief Per-voice RAM rings of sample blocks, filled ahead of playback by DMA
+
+    Each of Voices voices has a ring of BlocksPerVoice blocks of
+    blockSamples samples (256 bytes each, so 2KB per voice by default),
+    holding consecutive blocks in playback order, from the one holding the
+    first sample the interpolator reads, and looping round at the end of
+    the sample. Blocks are aligned in flash, so each is one DMA transfer of
+    whole words, wherever the samples start.
+
+    Call Init once, then from ProcessSample only: Start when a voice plays
+    a new sample, Interpolate to read it, and Prefetch once per sample,
+    which starts one block transfer at a time, for each voice in turn.
+    Prefetch does a bounded amount of work, so ProcessSample takes about
+    the same time each sample.
+
+    Flash can't be read while it is erased or programmed: stop calling
+    Prefetch, then wait (on another core) until Busy() is false, before
+    writing flash.
+*/
+template <int Voices, uint32_t BlocksPerVoice = 8>
+class SampleStream
+{
+	static_assert(Voices >= 1, "SampleStream needs at least one voice");
+	static_assert(BlocksPerVoice >= 2 && (BlocksPerVoice & (BlocksPerVoice - 1)) == 0,
+				  "SampleStream blocks per voice must be a power of two, at least 2");
+	static constexpr uint32_t mask = BlocksPerVoice - 1;
+
+public:
+	static constexpr uint32_t blockBytes = 256;
+	static constexpr uint32_t blockSamples = blockBytes / 2;
+
+	/// Claim a DMA channel. useStreamFIFO reads flash through the XIP
+	/// streaming FIFO, rather than the non-allocating XIP alias.
+	void Init(bool useStreamFIFO = true)
+	{
+		streamFIFO = useStreamFIFO;
+		channel = dma_claim_unused_channel(true);
+
+		copyConfig = dma_channel_get_default_config(channel);
+		channel_config_set_transfer_data_size(&copyConfig, DMA_SIZE_32);
+		channel_config_set_read_increment(&copyConfig, true);
+		channel_config_set_write_increment(&copyConfig, true);
+
+		fifoConfig = copyConfig;
+		channel_config_set_read_increment(&fifoConfig, false);
+		channel_config_set_dreq(&fifoConfig, DREQ_XIP_STREAM);
+
+		for (int v = 0; v < Voices; v++)
+		{
+			Start(v, nullptr, 0);
+		}
+	}
+
+	/// Play numSamples samples from data (in flash) on voice v, from nothing
+	/// held in RAM. Call when the voice changes sample, or the flash it
+	/// played from has been rewritten.
+	void __not_in_flash_func(Start)(int v, const int16_t *data, uint32_t numSamples)
+	{
+		Voice &voice = voices[v];
+		voice.data = numSamples ? data : nullptr;
+		voice.numSamples = voice.data ? numSamples : 0;
+		voice.position = 0;
+		voice.count = 0;
+		for (uint32_t s = 0; s < BlocksPerVoice; s++)
+		{
+			voice.key[s] = noBlock;
+		}
+
+		// Discard a block still being read for the previous sample,
+		// and fetch this voice's first block next
+		if (pendingVoice == v) pendingVoice = -1;
+		nextVoice = v;
+	}
+
+	/// Sample of voice v at a fractional position (phase.index < numSamples),
+	/// as SampleInterpolator::InterpolateLoop, from RAM where prefetched.
+	/// Also sets the position from which Prefetch reads ahead.
+	int16_t __not_in_flash_func(Interpolate)(int v, const SampleInterpolator &interpolator, SamplePhase phase,
+											 SampleInterpolator::Quality q, int bank = 0)
+	{
+		Voice &voice = voices[v];
+		if (phase.index >= voice.numSamples)
+		{
+			return 0;
+		}
+		voice.position = phase.index;
+
+		// Usually, all the samples read are in one block
+		uint32_t before = SampleInterpolator::Before(q), after = SampleInterpolator::After(q);
+		if (phase.index >= before && phase.index + after < voice.numSamples)
+		{
+			uintptr_t first = uintptr_t(voice.data + phase.index - before);
+			uintptr_t last = uintptr_t(voice.data + phase.index + after);
+			const int16_t *s = (first / blockBytes == last / blockBytes) ? Find(voice, first) : nullptr;
+			if (s)
+			{
+				return interpolator.Interpolate(s + before, phase.fraction, q, bank);
+			}
+		}
+
+		// Otherwise, copy the samples read, in order, wrapping at the ends
+		int16_t window[SampleInterpolator::sincTaps];
+		uint32_t i = phase.index;
+		for (uint32_t k = 0; k < before; k++)
+		{
+			i = (i > 0) ? i - 1 : voice.numSamples - 1;
+		}
+		for (uint32_t k = 0; k <= before + after; k++)
+		{
+			const int16_t *s = Find(voice, uintptr_t(voice.data + i));
+			if (!s)
+			{
+				s = voice.data + i;
+				misses++;
+			}
+			window[k] = *s;
+			if (++i >= voice.numSamples) i = 0;
+		}
+		return interpolator.Interpolate(window + before, phase.fraction, q, bank);
+	}
+
+	/// Finish the block transfer that has completed, if any, and start the
+	/// next block needed by the next voice in turn. Once per sample.
+	void __not_in_flash_func(Prefetch)()
+	{
+		if (channel < 0) return;
+		if (pending)
+		{
+			if (dma_channel_is_busy(channel)) return;
+			pending = false;
+			if (pendingVoice >= 0)
+			{
+				Voice &voice = voices[pendingVoice];
+				voice.key[(voice.oldest + voice.count) & mask] = pendingKey;
+				voice.count++;
+				blocks++;
+			}
+		}
+
+		int v = nextVoice;
+		nextVoice = (v + 1 < Voices) ? v + 1 : 0;
+		Voice &voice = voices[v];
+		if (!voice.data) return;
+
+		// Drop the blocks before the one holding the first sample read, or
+		// all of them if that isn't in the ring (the position has jumped)
+		uint32_t back = SampleInterpolator::maxBefore % voice.numSamples;
+		uint32_t i = (voice.position >= back) ? voice.position - back : voice.position + voice.numSamples - back;
+		uint32_t key = KeyOf(voice.data + i);
+		uint32_t j = 0;
+		while (j < voice.count && voice.key[(voice.oldest + j) & mask] != key) j++;
+		if (j < voice.count)
+		{
+			voice.oldest = (voice.oldest + j) & mask;
+			voice.count -= j;
+		}
+		else
+		{
+			voice.count = 0;
+		}
+		if (voice.count == BlocksPerVoice) return;
+
+		// The block after the newest, looping round at the end of the sample,
+		// unless the ring already holds the whole loop
+		if (voice.count > 0)
+		{
+			uint32_t newest = voice.key[(voice.oldest + voice.count - 1) & mask];
+			key = (newest == KeyOf(voice.data + voice.numSamples - 1)) ? KeyOf(voice.data) : newest + 1;
+			if (key == voice.key[voice.oldest]) return;
+		}
+
+		// A slot dropped from the ring may still hold the block (when looping)
+		uint32_t slot = (voice.oldest + voice.count) & mask;
+		if (voice.key[slot] == key)
+		{
+			voice.count++;
+			return;
+		}
+
+		// The slot can't be read while it is replaced
+		voice.key[slot] = noBlock;
+		int16_t *dest = voice.ring[slot];
+		uintptr_t source = key * blockBytes;
+		if (source >= XIP_BASE && source < XIP_BASE + PICO_FLASH_SIZE_BYTES)
+		{
+			if (streamFIFO)
+			{
+				while (!(xip_ctrl_hw->stat & XIP_STAT_FIFO_EMPTY_BITS)) (void)xip_ctrl_hw->stream_fifo;
+				xip_ctrl_hw->stream_addr = source;
+				xip_ctrl_hw->stream_ctr = blockBytes / 4;
+				dma_channel_configure(channel, &fifoConfig, dest, (const void *)XIP_AUX_BASE, blockBytes / 4, true);
+			}
+			else
+			{
+				source = source - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE;
+				dma_channel_configure(channel, &copyConfig, dest, (const void *)source, blockBytes / 4, true);
+			}
+		}
+		else
+		{
+			dma_channel_configure(channel, &copyConfig, dest, (const void *)source, blockBytes / 4, true);
+		}
+		pending = true;
+		pendingVoice = v;
+		pendingKey = key;
+	}
+
+	/// True while a block is being read. Any core.
+	bool Busy() const {return channel >= 0 && dma_channel_is_busy(channel);}
+
+	/// Blocks read into RAM, and samples that had to be read from flash instead
+	uint32_t Blocks() const {return blocks;}
+	uint32_t Misses() const {return misses;}
+
+private:
+	static constexpr uint32_t noBlock = 0xFFFFFFFF;
+
+	struct Voice
+	{
+		const int16_t *data = nullptr;
+		uint32_t numSamples = 0;
+		uint32_t position = 0; // last position read
+
+		// Ring: count blocks from slot oldest, in playback order. A slot's key
+		// is the address / blockBytes of the block it holds (in the ring or
+		// not), or noBlock while empty or being read into.
+		uint32_t key[BlocksPerVoice];
+		uint32_t oldest = 0, count = 0;
+		uint32_t hint = 0; // slot last read from
+		alignas(4) int16_t ring[BlocksPerVoice][blockSamples];
+	};
+
+	Voice voices[Voices];
+	int channel = -1;
+	bool streamFIFO = true;
+	dma_channel_config copyConfig, fifoConfig;
+
+	// Block being read, into the slot after the ring of voice pendingVoice (-1 if discarded)
+	bool pending = false;
+	int pendingVoice = -1;
+	uint32_t pendingKey = noBlock;
+	int nextVoice = 0;
+
+	volatile uint32_t blocks = 0, misses = 0;
+
+	static uint32_t KeyOf(const int16_t *p) {return uintptr_t(p) / blockBytes;}
+
+	// Sample at a flash address, in RAM, or nullptr if not there. Looks first
+	// in the slot last read from, then the next, as playback moves through the ring.
+	static const int16_t *__not_in_flash_func(Find)(Voice &voice, uintptr_t address)
+	{
+		uint32_t key = address / blockBytes;
+		uint32_t s = voice.hint;
+		if (voice.key[s] != key)
+		{
+			s = (s + 1) & mask;
+			if (voice.key[s] != key)
+			{
+				for (s = 0; s < BlocksPerVoice && voice.key[s] != key; s++) {}
+				if (s == BlocksPerVoice) return nullptr;
+			}
+			voice.hint = s;
+		}
+		return &voice.ring[s][(address % blockBytes) / 2];
+	}
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+TraceStream - real-time binary trace of signals from ProcessSample
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+ProcessSample sets values of a fixed number of channels each sample, and
+Commit()s them as one frame into a lock-free queue. Another core drains the
+queue into packets, which can be written to USB serial at full 48kHz rate
+and decoded on the host with examples/usb_trace/trace_decode.py
+
+Packet format (all values little-endian):
+  2 bytes   sync, 'T' 'C'
+  1 byte    number of channels
+  1 byte    number of frames in packet
+  4 bytes   sequence number of first frame (frames since start)
+  frames * channels * int16 values, frame by frame
+  2 bytes   16-bit sum of all preceding bytes of the packet
+Frames within a packet are always consecutive. Frames lost because the queue
+was full show up as a gap in sequence numbers between packets.
+*/
+
+#ifndef TRACESTREAM_H
+#define TRACESTREAM_H
+
+#include "ComputerCard.h"
+
+/** \brief Lock-free trace of Channels 16-bit signals, sent as compact binary packets
+
+    Set/Commit are called from ProcessSample only, and Drain from one other
+    core or thread only.
+*/
+template <int Channels, uint32_t QueueFrames = 1024>
+class TraceStream
+{
+	static_assert(Channels >= 1 && Channels <= 16, "TraceStream supports 1 to 16 channels");
+
+public:
+	static constexpr int maxFramesPerPacket = 32;
+	static constexpr int headerSize = 8;
+	static constexpr int maxPacketSize = headerSize + maxFramesPerPacket * Channels * 2 + 2;
+
+	/// Set value of a channel in the current frame. Audio side.
+	void __not_in_flash_func(Set)(int channel, int16_t value)
+	{
+		current.value[channel] = value;
+	}
+
+	/// Queue the current frame, and start the next. Audio side, once per sample.
+	/// Channel values are kept until Set again.
+	void __not_in_flash_func(Commit)()
+	{
+		current.sequence = sequence++;
+		frames.Push(current);
+	}
+
+	/// Send all queued frames as packets, calling write(const uint8_t *data, uint32_t length)
+	/// for each packet. Returns the number of frames sent.
+	template <typename WriteFn>
+	uint32_t Drain(WriteFn write)
+	{
+		uint32_t sent = 0;
+		Frame f;
+		while (frames.Pop(f))
+		{
+			// Start a new packet if full, or frames have been lost
+			if (packetFrames == maxFramesPerPacket || (packetFrames > 0 && f.sequence != packetSequence + packetFrames))
+			{
+				Flush(write);
+			}
+			if (packetFrames == 0) packetSequence = f.sequence;
+
+			uint8_t *p = packet + headerSize + packetFrames * Channels * 2;
+			for (int i = 0; i < Channels; i++)
+			{
+				p[2 * i] = uint8_t(f.value[i]);
+				p[2 * i + 1] = uint8_t(uint16_t(f.value[i]) >> 8);
+			}
+			packetFrames++;
+			sent++;
+		}
+		Flush(write);
+		return sent;
+	}
+
+	/// Number of frames lost because the queue was full
+	uint32_t Dropped() const {return frames.Overflows();}
+
+private:
+	struct Frame
+	{
+		uint32_t sequence;
+		int16_t value[Channels];
+	};
+
+	// Audio side
+	Frame current = {};
+	uint32_t sequence = 0;
+
+	SPSCQueue<Frame, QueueFrames> frames;
+
+	// Drain side
+	uint8_t packet[maxPacketSize];
+	int packetFrames = 0;
+	uint32_t packetSequence = 0;
+
+	template <typename WriteFn>
+	void Flush(WriteFn write)
+	{
+		if (packetFrames == 0) return;
+
+		packet[0] = 'T';
+		packet[1] = 'C';
+		packet[2] = Channels;
+		packet[3] = uint8_t(packetFrames);
+		for (int i = 0; i < 4; i++)
+		{
+			packet[4 + i] = uint8_t(packetSequence >> (8 * i));
+		}
+
+		int length = headerSize + packetFrames * Channels * 2;
+		uint16_t sum = 0;
+		for (int i = 0; i < length; i++)
+		{
+			sum += packet[i];
+		}
+		packet[length] = uint8_t(sum);
+		packet[length + 1] = uint8_t(sum >> 8);
+
+		write(packet, uint32_t(length + 2));
+		packetFrames = 0;
+	}
+};
+
+#endif
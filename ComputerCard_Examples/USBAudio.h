@@ -0,0 +1,223 @@
+/*
+USBAudio - clock drift correction for USB audio streaming
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+The Computer's 48kHz sample rate is paced by its ADC, from the RP2040 crystal,
+while a USB audio host sends and receives audio at 48kHz as measured by its
+own clock. These differ by up to a few hundred parts per million, so without
+correction a buffer between USB and ProcessSample slowly empties or overflows.
+
+- USBAudioFeedback measures the Computer's sample rate against the USB
+  start-of-frame (SOF) clock, for the asynchronous feedback endpoint, which
+  tells the host how many samples to send each 1ms frame.
+- AsyncResampler is a fixed-point asynchronous sample-rate converter, which
+  plays the received audio at a rate adjusted to keep the buffer at a set
+  level. This absorbs the remaining drift, including with hosts that
+  ignore the feedback endpoint.
+
+Allocation-free, and independent of the Pico SDK.
+*/
+
+#ifndef USBAUDIO_H
+#define USBAUDIO_H
+
+#include <cstdint>
+
+/// One stereo sample, as 16-bit PCM
+struct AudioFrame
+{
+	int16_t left, right;
+};
+
+
+/** \brief Measures samples per USB frame, for the UAC2 asynchronous feedback endpoint
+
+    Call Frame(SampleCounter()) at each USB start-of-frame (every 1ms). Every
+    2^FrameShift frames, the number of samples processed in that time gives a
+    new measurement, which is smoothed, and Frame returns true. Value() is then
+    the feedback value in 16.16 format (samples per frame), as for tud_audio_fb_set.
+*/
+template <int FrameShift = 8>
+class USBAudioFeedback
+{
+	static_assert(FrameShift >= 4 && FrameShift <= 12, "USBAudioFeedback measurement period must be 16 to 4096 frames");
+
+public:
+	/// sampleRate is the nominal sample rate, used until the first measurement
+	explicit USBAudioFeedback(uint32_t sampleRate = 48000) : value((sampleRate << 16) / 1000) {}
+
+	/// Call at each USB start of frame. Returns true when Value has been updated.
+	bool Frame(uint32_t sampleCounter)
+	{
+		if (frames++ == 0)
+		{
+			lastCount = sampleCounter;
+			return false;
+		}
+		if (frames <= (1u << FrameShift)) return false;
+
+		// Samples in 2^FrameShift frames, as 16.16 samples per frame
+		uint32_t measured = (sampleCounter - lastCount) << (16 - FrameShift);
+		lastCount = sampleCounter;
+		frames = 1;
+
+		if (!measuredOnce)
+		{
+			value = measured;
+			measuredOnce = true;
+		}
+		else
+		{
+			value += (int32_t(measured - value)) >> 2;
+		}
+		return true;
+	}
+
+	/// Forget measurements, e.g. when streaming stops
+	void Reset()
+	{
+		frames = 0;
+		measuredOnce = false;
+	}
+
+	/// Samples per frame, in 16.16 format
+	uint32_t Value() const {return value;}
+
+private:
+	uint32_t value;
+	uint32_t frames = 0, lastCount = 0;
+	bool measuredOnce = false;
+};
+
+
+/** \brief Fixed-point asynchronous sample-rate converter, locked to a buffer level
+
+    Call Process once per sample in ProcessSample, with the queue of received
+    frames (any queue with Pop and Count, such as SPSCQueue<AudioFrame, N>).
+    Frames are read at a rate close to 1 per call, interpolated with a 4-point
+    cubic Lagrange interpolator. The rate is adjusted by a PI controller so that
+    the average queue level, measured over each 1ms, is the target level; this
+    sets the latency. The adjustment is limited to +/-1000ppm.
+
+    Until the queue first reaches the target level (and after an underrun),
+    Process outputs silence and returns false.
+*/
+class AsyncResampler
+{
+public:
+	AsyncResampler() {Reset();}
+
+	/// Target queue level, in frames. Default 96 (2ms).
+	void SetTargetLevel(uint32_t frames)
+	{
+		target = frames;
+		Reset();
+	}
+
+	/// Start again, waiting for the queue to fill to the target level
+	void Reset()
+	{
+		running = false;
+		frac = 0;
+		integral = 0;
+		increment = unity;
+		levelSum = 0;
+		levelCount = 0;
+		for (int i = 0; i < 4; i++) history[i] = AudioFrame{0, 0};
+	}
+
+	template <typename Queue>
+	bool Process(Queue &queue, AudioFrame &out)
+	{
+		uint32_t level = queue.Count();
+		if (!running)
+		{
+			out = AudioFrame{0, 0};
+			if (level < target) return false;
+			running = true;
+		}
+
+		// Advance by increment (close to one frame), reading new frames as needed
+		frac += uint32_t(increment);
+		while (frac >= unity)
+		{
+			frac -= unity;
+			history[0] = history[1];
+			history[1] = history[2];
+			history[2] = history[3];
+			if (!queue.Pop(history[3]))
+			{
+				underruns++;
+				Reset();
+				out = AudioFrame{0, 0};
+				return false;
+			}
+		}
+
+		// Interpolate between history[1] and history[2]
+		int32_t t = int32_t(frac >> 15); // Q15
+		out.left = Interpolate(history[0].left, history[1].left, history[2].left, history[3].left, t);
+		out.right = Interpolate(history[0].right, history[1].right, history[2].right, history[3].right, t);
+
+		// Once per 1ms, adjust rate from average queue level
+		levelSum += level;
+		if (++levelCount == 48)
+		{
+			// Error, in 1/256ths of a frame
+			int32_t error = int32_t((levelSum << 8) / 48) - int32_t(target << 8);
+			levelSum = 0;
+			levelCount = 0;
+
+			integral += error;
+			if (integral > integralLimit) integral = integralLimit;
+			if (integral < -integralLimit) integral = -integralLimit;
+
+			// Proportional: 10ppm per frame of error. Integral: 2.7ppm per frame-second.
+			int32_t correction = error * 42 + ((integral * 11) >> 10);
+			if (correction > maxCorrection) correction = maxCorrection;
+			if (correction < -maxCorrection) correction = -maxCorrection;
+			increment = unity + correction;
+		}
+		return true;
+	}
+
+	/// Current rate correction, in parts per million (positive when reading faster)
+	int32_t RatioPPM() const {return int32_t((int64_t(increment - unity) * 1000000) >> 30);}
+	/// Number of times the queue has run empty
+	uint32_t Underruns() const {return underruns;}
+	/// True once the queue has filled to the target level, until an underrun
+	bool Running() const {return running;}
+
+private:
+	static constexpr int32_t unity = 1 << 30; // increment of one frame, Q30
+	static constexpr int32_t maxCorrection = 1073742; // 1000ppm
+	static constexpr int32_t integralLimit = maxCorrection / 11 * 1024;
+
+	AudioFrame history[4];
+	uint32_t frac; // position between history[1] and history[2], Q30
+	int32_t increment;
+	int32_t integral;
+	uint32_t levelSum, levelCount;
+	uint32_t target = 96;
+	bool running = false;
+	uint32_t underruns = 0;
+
+	// 4-point cubic Lagrange interpolation at t (Q15) between y1 and y2
+	static int16_t Interpolate(int32_t y0, int32_t y1, int32_t y2, int32_t y3, int32_t t)
+	{
+		// Polynomial coefficients, multiplied by 6
+		int32_t c1 = 6 * y2 - 2 * y0 - 3 * y1 - y3;
+		int32_t c2 = 3 * (y0 + y2) - 6 * y1;
+		int32_t c3 = y3 - y0 + 3 * (y1 - y2);
+		int32_t v = int32_t((int64_t(c3) * t) >> 15) + c2;
+		v = int32_t((int64_t(v) * t) >> 15) + c1;
+		v = int32_t((int64_t(v) * t) >> 15);
+		v = y1 + int32_t((int64_t(v) * 10923) >> 16); // divide by 6; v is up to about 400000
+		if (v > 32767) v = 32767;
+		if (v < -32768) v = -32768;
+		return int16_t(v);
+	}
+};
+
+#endif
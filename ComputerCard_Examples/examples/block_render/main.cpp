@@ -0,0 +1,105 @@
+#include "ComputerCard.h"
+#include "pico/multicore.h"
+#include <cmath>
+
+/*
+
+Block rendering example: a floating-point phase modulation (FM) voice,
+rendered on the second core in blocks of 32 samples.
+
+Two sinf calls per sample, plus the per-block parameter calculation, is too
+much for ProcessSample at 48kHz. With EnableBlockRendering, the audio ISR on
+core 0 only passes input frames to core 1 and copies rendered output frames
+to the jacks, and ProcessBlock on core 1 has a whole block of time to fill
+each block. Rendered outputs appear two blocks (1.3ms) after their inputs.
+
+Knob and switch values are only updated slowly, so they are read once per
+block, directly with KnobVal. LEDs, though, are set from the audio ISR on
+core 0, so ProcessBlock passes the peak level of each block to ProcessSample
+through a DoubleBuffer, and ProcessSample drives the level meter.
+
+
+User interface:
+---------------
+
+Main knob + CV in 1:    Pitch
+Knob X:                 Modulator ratio
+Knob Y + CV in 2:       Modulation index
+Audio in 1:             Added to modulation
+Audio out 1/2:          FM voice
+Left LEDs:              Output level meter
+Bottom right LED:       Lit if core 1 has failed to render a block in time
+
+ */
+
+constexpr float twopi = (float)M_TWOPI;
+
+class BlockRender : public ComputerCard
+{
+	float carrierPhase, modPhase;
+
+	// Peak output level of the latest block, from core 1 to ProcessSample
+	DoubleBuffer<int16_t> blockPeak;
+
+public:
+	BlockRender()
+	{
+		carrierPhase = 0.0f;
+		modPhase = 0.0f;
+		EnableBlockRendering(32, 2);
+
+		// Start the second core, which runs ProcessBlock
+		multicore_launch_core1(ComputerCard::RunCore1);
+	}
+
+	// Called on core 1, once for every 32 samples
+	virtual void ProcessBlock(const InputFrame *in, OutputFrame *out, int numFrames)
+	{
+		// Parameters are calculated once per block
+		float pitch = (KnobVal(Knob::Main) + in[0].cv[0]) * (1.0f / 409.6f); // ~10 octaves
+		float freq = 27.5f * exp2f(pitch);
+		float ratio = 0.5f + (KnobVal(Knob::X) >> 9) * 0.5f; // 0.5 to 4, in steps of 0.5
+		float index = (KnobVal(Knob::Y) + in[0].cv[1]) * (4.0f / 4096.0f);
+		if (index < 0.0f) index = 0.0f;
+
+		float dCarrier = twopi * freq / 48000.0f;
+		float dMod = dCarrier * ratio;
+
+		int16_t peak = 0;
+		for (int i = 0; i < numFrames; i++)
+		{
+			float mod = index * sinf(modPhase) + in[i].audio[0] * (1.0f / 2048.0f);
+			int16_t v = int16_t(1800.0f * sinf(carrierPhase + mod));
+
+			out[i].audio[0] = v;
+			out[i].audio[1] = v;
+			out[i].cv[0] = 0;
+			out[i].cv[1] = 0;
+			out[i].pulse[0] = false;
+			out[i].pulse[1] = false;
+			if (v > peak) peak = v;
+
+			carrierPhase += dCarrier;
+			if (carrierPhase > twopi) carrierPhase -= twopi;
+			modPhase += dMod;
+			if (modPhase > twopi) modPhase -= twopi;
+		}
+
+		blockPeak.Write() = peak;
+		blockPeak.Publish();
+	}
+
+	// 48kHz audio processing function, called after the rendered outputs are applied
+	virtual void ProcessSample()
+	{
+		LedMeter(0, blockPeak.Read());
+		LedOn(5, BlockUnderruns() > 0);
+	}
+};
+
+
+int main()
+{
+	BlockRender br;
+	br.Run();
+}
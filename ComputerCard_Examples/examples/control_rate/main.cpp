@@ -0,0 +1,107 @@
+#include "ComputerCard.h"
+#include <cmath>
+
+/*
+
+Control-rate processing example: a resonant state-variable filter, whose
+coefficients are calculated from the knobs and CV 1000 times a second.
+
+Calculating the filter coefficients needs floating-point sinf and expf,
+which would take much of the ~20us available in every call of
+ProcessSample. Instead, ProcessControl is called at 1kHz (EnableControlRate),
+from the main loop on core 0, where it is interrupted by audio processing
+as required. It publishes the new coefficients through a DoubleBuffer, and
+ProcessSample only has to run the integer filter.
+
+
+User interface:
+---------------
+
+Audio in 1:             Filter input
+Main knob + CV in 1:    Cutoff frequency
+Knob X:                 Resonance
+Audio out 1:            Lowpass output
+Audio out 2:            Bandpass output
+Switch:                 Up = filter, Middle/Down = bypass
+LEDs (left column):     Cutoff frequency
+
+ */
+
+class ControlRate : public ComputerCard
+{
+	// Filter coefficients, as 16.16 fixed point
+	struct FilterParams
+	{
+		int32_t f; // frequency coefficient, 2 sin(pi fc / fs)
+		int32_t q; // damping, 1/Q
+		bool bypass;
+	};
+	DoubleBuffer<FilterParams> params;
+
+	// Filter state, used only by ProcessSample
+	int32_t low, band;
+
+public:
+	ControlRate()
+	{
+		low = 0;
+		band = 0;
+		EnableControlRate(1000);
+	}
+
+	// Called 1000 times a second, outside the audio interrupt
+	virtual void ProcessControl()
+	{
+		// Cutoff from 20Hz to ~8kHz, exponential in knob + CV
+		int32_t c = KnobVal(Knob::Main) + CVIn1();
+		if (c < 0) c = 0;
+		if (c > 4095) c = 4095;
+		float fc = 20.0f * expf(c * (6.0f / 4096.0f));
+
+		// Resonance from Q=0.5 to Q=20
+		float q = 2.0f - KnobVal(Knob::X) * (1.95f / 4096.0f);
+
+		FilterParams &p = params.Write();
+		p.f = int32_t(65536.0f * 2.0f * sinf(3.14159265f * fc / 48000.0f));
+		p.q = int32_t(65536.0f * q);
+		p.bypass = (SwitchVal() != Switch::Up);
+		params.Publish();
+
+		LedMeter(0, c >> 1);
+	}
+
+	// Called every sample, 48kHz
+	virtual void ProcessSample()
+	{
+		const FilterParams &p = params.Read();
+
+		int32_t in = AudioIn1();
+		if (p.bypass)
+		{
+			AudioOut1(in);
+			AudioOut2(in);
+			return;
+		}
+
+		// Chamberlin state-variable filter
+		int32_t high = in - low - ((p.q * band) >> 16);
+		band += (p.f * high) >> 16;
+		low += (p.f * band) >> 16;
+
+		// Limit state, to keep high resonance stable
+		if (band > 2047) band = 2047;
+		if (band < -2048) band = -2048;
+		if (low > 2047) low = 2047;
+		if (low < -2048) low = -2048;
+
+		AudioOut1(int16_t(low));
+		AudioOut2(int16_t(band));
+	}
+};
+
+
+int main()
+{
+	ControlRate cr;
+	cr.Run();
+}
@@ -0,0 +1,170 @@
+#include "ComputerCard.h"
+#include "pico/multicore.h"
+#include "tusb.h"
+#include "MIDIParser.h"
+#include "MIDIClock.h"
+
+
+
+/*
+
+   ComputerCard USB MIDI clock example
+
+   Converts MIDI clock and transport messages, received with the
+   Workshop System Computer acting as a USB MIDI Device, into analogue
+   clock, reset and run signals.
+
+   USB MIDI delivers clock messages in bursts, with up to ~1ms of jitter.
+   MIDIClock (in MIDIClock.h) smooths this with a phase-locked oscillator,
+   so the output clocks are evenly spaced, and can be multiplied as well as divided.
+
+
+   Outputs:
+   - Pulse out 1: clock, at a rate set by knob X
+   - Pulse out 2: reset trigger, at Start (or Continue)
+   - CV out 1:    clock, at a rate set by knob Y
+   - CV out 2:    run gate, high while transport is running
+
+   Clock rates, in pulses per quarter note, from knob fully anticlockwise:
+   1 (quarter notes), 2, 4 (sixteenth notes), 6, 8, 12, 24 (MIDI clock), 48, 96
+
+   LEDs show the four outputs, and the bottom right LED is lit while
+   the card is locked to the incoming clock tempo. The LEDs are refreshed
+   at 100Hz, so each reset and clock pulse lights its LED for at least
+   20ms, to be sure it is seen.
+
+
+   As in the midi_device example, MIDI messages are timestamped on the
+   MIDI core and applied at a fixed latency in ProcessSample.
+
+ */
+
+
+class MIDIClockBridge : public ComputerCard
+{
+public:
+	MIDIClockBridge()
+	{
+		resetTimer = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			ledTimer[i] = 0;
+			lastGate[i] = false;
+		}
+
+		// Start the second core
+		multicore_launch_core1(core1);
+	}
+
+	// Boilerplate static function to call member function as second core
+	static void core1()
+	{
+		((MIDIClockBridge *)ThisPtr())->USBCore();
+	}
+
+	// Code for second RP2040 core. Blocking.
+	void USBCore()
+	{
+		uint8_t buffer[64];
+
+		// Initialise TinyUSB
+		tusb_init();
+
+		while (1)
+		{
+			tud_task();
+
+			while (tud_midi_available())
+			{
+				uint32_t bytesRead = tud_midi_stream_read(buffer, sizeof(buffer));
+				parser.Parse(buffer, bytesRead, midiEvents, SampleCounter());
+			}
+		}
+	}
+
+	// Map knob to one of the clock rates
+	static int KnobRate(int32_t knob)
+	{
+		static const int rates[] = {1, 2, 4, 6, 8, 12, 24, 48, 96};
+		static constexpr int numRates = sizeof(rates) / sizeof(rates[0]);
+		return rates[(knob * numRates) >> 12];
+	}
+
+	// 48kHz audio processing function; runs on audio core
+	virtual void ProcessSample()
+	{
+		// Apply clock and transport messages at a fixed latency after they were received
+		MIDIEvent m;
+		while (PopDueMIDIEvent(midiEvents, SampleCounter(), midiLatency, m))
+		{
+			clock.Event(m);
+		}
+		clock.Process();
+
+		// Clock outputs, 50% duty cycle
+		bool clock1 = clock.Gate(KnobRate(KnobVal(Knob::X)));
+		bool clock2 = clock.Gate(KnobRate(KnobVal(Knob::Y)));
+		PulseOut1(clock1);
+		CVOut1(clock2 ? 2047 : 0);
+
+		// Reset trigger, 5ms long
+		if (clock.StartPulse())
+		{
+			resetTimer = 240;
+		}
+		if (resetTimer > 0)
+		{
+			resetTimer--;
+		}
+		PulseOut2(resetTimer > 0);
+
+		// Run gate
+		CVOut2(clock.Running() ? 2047 : 0);
+
+		LedOn(0, StretchedLed(0, clock1));
+		LedOn(1, StretchedLed(1, resetTimer > 0));
+		LedOn(2, StretchedLed(2, clock2));
+		LedOn(3, clock.Running());
+		LedOn(5, clock.Locked());
+	}
+
+private:
+	// Shortest time an LED is lit for a pulse: two LED refresh periods
+	static constexpr int32_t ledPulseSamples = 960; // 20ms
+
+	// LED for gate i (clock 1, reset, clock 2): lit while the gate is high,
+	// and for at least ledPulseSamples after it rises
+	bool StretchedLed(int i, bool gate)
+	{
+		if (gate && !lastGate[i])
+		{
+			ledTimer[i] = ledPulseSamples;
+		}
+		lastGate[i] = gate;
+		if (ledTimer[i] > 0)
+		{
+			ledTimer[i]--;
+		}
+		return gate || ledTimer[i] > 0;
+	}
+
+	// Audio core
+	MIDIClock clock;
+	int32_t resetTimer;
+	int32_t ledTimer[3];
+	bool lastGate[3];
+
+	// MIDI input parser, used on the MIDI core
+	MIDIParser<16> parser;
+
+	// Timestamped messages from MIDI core to audio core
+	SPSCQueue<MIDIEvent, 64> midiEvents;
+	static constexpr uint32_t midiLatency = 48; // samples
+};
+
+
+int main()
+{
+	MIDIClockBridge mc;
+	mc.Run();
+}
@@ -1,6 +1,10 @@
 #include "ComputerCard.h"
 #include "pico/multicore.h"
 #include "tusb.h"
+#include "MIDIParser.h"
+#include "NoteStack.h"
+#include "MIDIOutput.h"
+#include "MIDIControllers.h"
 
 
 
@@ -19,89 +23,44 @@
 
 
    MIDI messages received:
-   - Note on/off messages turn on and off Pulse Out 1 and the top right LED.
-   - Note on pitch is sent to CV out 1 (1V per octave)
-   - MIDI CC 1 (Mod wheel) is sent to CV out 2, and to the middle right LED
+   - Notes are played by two voices: CV out 1 / Pulse out 1 and CV out 2 / Pulse out 2
+     (1V per octave pitch and gate), with the gates also shown on the top and middle right LEDs.
+   - Knob X selects how notes are allocated to the two voices, using VoiceAllocator
+     (in NoteStack.h). From fully anticlockwise: last note priority, low note priority,
+     high note priority, round robin, steal oldest note. The five zones overlap
+     slightly (with Hysteresis), so that the mode doesn't flicker between two
+     when the knob is left near a boundary.
+   - MIDI CC 1 (Mod wheel) is sent to Audio out 1, and to the bottom left LED,
+     at 14-bit resolution if the controller also sends CC 33 (MIDIControllers,
+     in MIDIControllers.h)
+   - MIDI CC 123 (All notes off) releases all notes
    
+   Incoming bytes are parsed by MIDIParser (in MIDIParser.h), which handles
+   running status, SysEx and real-time messages such as MIDI clock.
+
    MIDI messages sent:
    - Turning the main knob sends MIDI CC 1 (Mod Wheel) messages, on channel 1.
+     The knob reading is converted to a 7-bit value with Hysteresis, so that
+     noise does not send a stream of messages when the knob is still, and sent
+     with MIDIOutput (both in MIDIOutput.h), which sends at most one value per
+     1ms USB frame, packing any other messages into the same USB packet.
 
 
-   In this example, most of the jack/LED outputs from MIDI are controlled directly
-   from the MIDI core. More typically MIDI data would be used by the audio core.
-
-   As an example of inter-core communication, the volatile 'receivedCC1' member
-   variable stores the MIDI CC 1 value received in the MIDI core,
-   and the LED and CV out are set from this variable on the audio core.
+   Each MIDI message received on the MIDI core is timestamped with the current
+   sample count, and passed to the audio core through a queue. ProcessSample
+   applies each message a fixed latency (1ms) after it was received, so that the
+   time from MIDI input to gate/CV output does not depend on when the USB code
+   happened to run, and the jack outputs are only ever set by the audio core.
 
  */
 
 
-// Minimal MIDI message reading struct
-struct MIDIMessage
-{
-	// Parse a MIDI message from the raw packet data
-	MIDIMessage(uint8_t* packet)
-	{
-		channel = packet[0]&0x0F;
-		command = static_cast<Command>(packet[0] & 0xF0);
-		switch (packet[0]&0xF0)
-		{
-		case Command::NoteOn: // two separate data bytes
-		case Command::NoteOff:
-		case Command::Aftertouch:
-		case Command::CC:
-			note = packet[1];
-			velocity = packet[2];
-			break;
-			
-		case Command::PatchChange: // single data bytes
-			instrument = packet[1];
-			break;
-			
-		case Command::PitchBend: // pitch bend combines msb/lsb
-			pitchbend = packet[1] + (packet[2]<<7) - 8192;
-			break;
-			
-		default:
-			command = Command::Unknown;
-			break;
-		}
-	}
-	
-	enum Command {Unknown = 0x00, NoteOn = 0x90, NoteOff = 0x80,
-		PitchBend = 0xE0, Aftertouch = 0xA0, CC = 0xB0,	PatchChange = 0xC0};
-	Command command;
-	uint8_t channel;
-	union // Store MIDI data bytes in two-byte union
-	{
-		struct
-		{
-			union // data byte 1
-			{
-				uint8_t note; // note on/off/aftertouch
-				uint8_t cc; // CC
-				uint8_t instrument; // patch change
-			};
-			union // data byte 2
-			{
-				uint8_t velocity; // note on/off
-				uint8_t touch; // aftertouch
-				uint8_t value; // CC 
-			};
-		};
-		int16_t pitchbend;
-	};
-};
-
-
-
 class MIDIDevice : public ComputerCard
 {
 public:
 	MIDIDevice()
 	{
-		receivedCC1 = 0;
+		modWheel = 0;
 		
 		// Start the second core
 		multicore_launch_core1(core1);
@@ -113,37 +72,35 @@ public:
 		((MIDIDevice *)ThisPtr())->USBCore();
 	}
 
-	void HandleMIDIMessage(const MIDIMessage &m)
+	// Apply MIDI message to jacks and LEDs; called by ProcessSample
+	void HandleMIDIMessage(const MIDIEvent &m)
 	{
-		// Handle MIDI note on/off and mod wheel
-		// Real MIDI note on/off handling should be more sophisticated, at least counting
-		// the number of notes down, or possibly tracking the entire set of notes held down.
-		switch (m.command)
+		// Mod wheel -> Audio out 1
+		MIDIControllerChange c;
+		if (controllers.Decode(m, c))
 		{
-		case MIDIMessage::NoteOn:
-			if (m.velocity > 0) // real note on (velocity > 0)
+			if (c.type == MIDIControllerChange::Controller14 && c.number == 1)
 			{
-				CVOut1MIDINote(m.note);
-				LedOn(1);
-				PulseOut1(true);
-			}
-			else // note on with velocity 0 = note off
-			{
-				LedOff(1);
-				PulseOut1(false);
+				modWheel = c.value;
 			}
+			return;
+		}
+
+		// Handle MIDI note on/off and all notes off
+		switch (m.type)
+		{
+		case MIDIEvent::NoteOn: // (note on with velocity 0 is converted to note off by the parser)
+			voices.NoteOn(m.Note(), m.Velocity());
 			break;
 					
-		case MIDIMessage::NoteOff:
-			LedOff(1);
-			PulseOut1(false);
+		case MIDIEvent::NoteOff:
+			voices.NoteOff(m.Note());
 			break;
 					
-		case MIDIMessage::CC:
-			// Mod wheel -> CV out 2
-			if (m.cc == 1)
+		case MIDIEvent::ControlChange:
+			if (m.Controller() == 123)
 			{
-				receivedCC1 = m.value;
+				voices.AllNotesOff();
 			}
 			break;
 					
@@ -155,7 +112,6 @@ public:
 	// Code for second RP2040 core. Blocking.
 	void USBCore()
 	{
-		uint8_t lastCCOut = 0;
 		uint8_t buffer[64];
 
 		// Initialise TinyUSB
@@ -171,39 +127,29 @@ public:
 			// Receiving MIDI
 			while (tud_midi_available())
 			{
-				// Read MIDI input - this will be some number of MIDI messages (zero, one, or multiple)
-				uint32_t bytesToProcess = tud_midi_stream_read(buffer, sizeof(buffer));
-				uint8_t *bufPtr = buffer;
-
-				while (bytesToProcess > 0)
-				{
-					// Read and process MIDI message
-					MIDIMessage m(bufPtr);
-					HandleMIDIMessage(m);
-					
-					// Move pointer to next midi message in buffer, if there is one
-					// by scanning until we see a MIDI command byte (most significant bit set)
-					do 
-					{
-						bufPtr++;
-						bytesToProcess--;
-					} while (bytesToProcess > 0 && (!(*bufPtr & 0x80)));			
-				}
+				// Read MIDI input - this will be some number of bytes, which may contain
+				// any number of MIDI messages, or parts of messages
+				uint32_t bytesRead = tud_midi_stream_read(buffer, sizeof(buffer));
+
+				// Parse bytes, and queue each complete MIDI message for the audio core,
+				// timestamped with the sample count now
+				parser.Parse(buffer, bytesRead, midiEvents, SampleCounter());
 			}
 
 			////////////////////////////////////////
 			// Sending MIDI
 			
-			// Read main knob, and if value has changed, send 
-			// MIDI CC 1 (Mod wheel) on channel 1 with knob position
-			// (In a real application, would want to add some hysteresis to eliminate jitter)
-			uint8_t ccOut = KnobVal(Knob::Main) >> 5;
-			if (ccOut != lastCCOut) // if value that would be sent has changed since last time,
+			// Read main knob, and if value has changed, set
+			// MIDI CC 1 (Mod wheel) on channel 1 to knob position
+			if (knobCC.Update(KnobVal(Knob::Main)))
 			{
-				uint8_t ccmesg[3] = {0xB0, 0x01, ccOut}; // construct...
-				tud_midi_stream_write(0, ccmesg, 3); // ...and send MIDI message
-				lastCCOut = ccOut;
+				midiOut.ControlChange(0, 1, uint8_t(knobCC.Value()));
 			}
+
+			// Send any messages due, in a single USB packet
+			midiOut.Flush(SampleCounter(), [](const uint8_t *bytes, uint32_t length) {
+				tud_midi_stream_write(0, bytes, length);
+			});
 		}
 	}
 
@@ -211,21 +157,59 @@ public:
 	// 48kHz audio processing function; runs on audio core
 	virtual void ProcessSample()
 	{
-		// No audio I/O, so just flash an LED
+		// Flash an LED
 		// to indicate that the card is running
 		static int32_t frame=0;
 		LedOn(5,(frame>>13)&1);
 		frame++;
 
 
-		// Set CV out 2 and LED 3 according to value received from MIDI
-		CVOut2(receivedCC1 << 4);
-		LedBrightness(3, receivedCC1 << 4);
+		// Apply MIDI messages received on the MIDI core, at a fixed latency after they were received
+		MIDIEvent m;
+		while (PopDueMIDIEvent(midiEvents, SampleCounter(), midiLatency, m))
+		{
+			HandleMIDIMessage(m);
+		}
+
+		// Knob X selects voice allocation mode: five zones of 4096, with a
+		// margin of about 1.5% of the knob's travel either side
+		if (modeSelect.Update(KnobVal(Knob::X) * 5))
+		{
+			voices.SetMode(VoiceAllocator<2>::Mode(modeSelect.Value()));
+		}
+
+		// Voice pitch and gate outputs
+		CVOut1MIDINote(voices.Note(0));
+		CVOut2MIDINote(voices.Note(1));
+		PulseOut1(voices.Gate(0));
+		PulseOut2(voices.Gate(1));
+		LedOn(1, voices.Gate(0));
+		LedOn(3, voices.Gate(1));
+
+		// Set Audio out 1 and LED 4 according to 14-bit value received from MIDI
+		AudioOut1(int16_t(modWheel >> 3));
+		LedBrightness(4, uint16_t(modWheel >> 2));
 	}
 
 private:
-	// Variable to communicate between the MIDI and audio cores
-	volatile uint32_t receivedCC1;
+	// Last MIDI CC 1 value (0-16383), and controller state, used on the audio core
+	uint32_t modWheel;
+	MIDIControllers controllers;
+
+	// Notes held down, and their allocation to the two CV/pulse outputs, used on the audio core
+	VoiceAllocator<2> voices;
+	Hysteresis modeSelect{12, 320};
+
+	// MIDI input parser, used on the MIDI core
+	MIDIParser<> parser;
+
+	// Outgoing MIDI, used on the MIDI core
+	MIDIOutput<> midiOut;
+	Hysteresis knobCC;
+
+	// Timestamped messages from MIDI core to audio core
+	SPSCQueue<MIDIEvent, 64> midiEvents;
+	static constexpr uint32_t midiLatency = 48; // samples
 };
 
 
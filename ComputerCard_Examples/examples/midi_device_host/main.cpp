@@ -35,8 +35,11 @@ public:
 		midi_dev_addr = 0;
 		device_connected = 0;
 		
-		counter = 0;
+		sampleCount = 0;
 		powerState = Unsupported;
+
+		// Notes are sent by deferred work on the USB core
+		SetDeferredWorker(UserLoop);
 		
 		// Start the second core
 		multicore_launch_core1(core1);
@@ -49,6 +52,12 @@ public:
 	}
 
 
+	// Deferred function, called on the USB core after Defer in ProcessSample
+	static void SendNextNoteDeferred(void *context, uint32_t)
+	{
+		((MIDIDeviceHost *)context)->SendNextNote();
+	}
+
 	// Send alternate note-on and note-off messages
 	void SendNextNote()
 	{
@@ -127,14 +136,11 @@ public:
 					// Read and discard MIDI input
 					tud_midi_stream_read(packet, sizeof(packet));
 
-					// Use code from midi_device example here to process MIDI input
+					// Use MIDIParser (see midi_device example) here to process MIDI input
 				}
 				
-				if (counter >= 20000)
-				{
-					SendNextNote();
-					counter -= 20000;
-				}
+				// Send any notes requested by ProcessSample
+				ServiceDeferred();
 			}
 			else  // Computer is USB host
 			{
@@ -146,15 +152,13 @@ public:
 				if (connected && tuh_midih_get_num_tx_cables(midi_dev_addr) >= 1)
 				{
 
-					if (counter >= 20000)
+					// Send any notes requested by ProcessSample, then a USB packet
+					// with all of them. Only flush when there is something to send,
+					// rather than on every pass of this loop.
+					if (ServiceDeferred())
 					{
-						SendNextNote();
-						counter -= 20000;
+						tuh_midi_stream_flush(midi_dev_addr);
 					}
-
-					// Send a USB packet immediately (even though in this case,
-					// we are not close to the 64-byte maximum payload)
-					tuh_midi_stream_flush(midi_dev_addr);
 				}
 			}
 		}
@@ -185,10 +189,11 @@ public:
 		LedOn(2, USBPowerState()==DFP);
 		LedOn(3, USBPowerState()==UFP);
 		
-		// Counter increment here, but reset by other core
-		if (counter <= 30000)
+		// Every 20000 samples, ask the USB core to send the next note
+		if (++sampleCount >= 20000)
 		{
-			counter++;
+			sampleCount = 0;
+			Defer(SendNextNoteDeferred, this);
 		}
 	}
 
@@ -199,7 +204,7 @@ public:
 private:
 	volatile bool noteOnNext;
 	
-	volatile uint32_t counter;
+	uint32_t sampleCount;
 
 	// powerState and isUSBMIDIHost have similar roles here
 	// We keep powerState as a class member only so that we can indicate
@@ -248,18 +253,13 @@ void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
 	if (num_packets == 0)
 		return;
 	
-	uint8_t cable_num;
-	uint8_t buffer[48];
-	while (1)
+	// Discard MIDI packets received as USB MIDI host
+	// See midi_host example for how to parse these with MIDIParser
+	const uint8_t *packets;
+	uint32_t n;
+	while ((n = tuh_midi_packets_peek(dev_addr, &packets)) > 0)
 	{
-		// Read and discard MIDI data received as USB MIDI host
-		// See midi_host example for how to process this
-		int32_t bytesToProcess = tuh_midi_stream_read(dev_addr, &cable_num, buffer, sizeof(buffer));
-
-		if (bytesToProcess == 0)
-		{
-			break;
-		}
+		tuh_midi_packets_consume(dev_addr, n);
 	}
 
 }
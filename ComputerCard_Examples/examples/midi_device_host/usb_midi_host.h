@@ -36,11 +36,15 @@
 //--------------------------------------------------------------------+
 // Class Driver Configuration
 //--------------------------------------------------------------------+
-// Use this function in Arduino or other environments where modifying
-// the tusb_config.h file is not practical.
-// Call this before midih_init() gets called by the TinyUSB stack,
+// Buffers for CFG_TUH_DEVICE_MAX devices are allocated statically (no heap),
+// with sizes set at compile time in tusb_config.h:
+//   CFG_TUH_MIDI_RX_BUFSIZE  RX FIFO bytes per device (multiple of 4, default 64)
+//   CFG_TUH_MIDI_TX_BUFSIZE  TX FIFO bytes per device (multiple of 4, default 64)
+//   CFG_TUH_MAX_CABLES       virtual cables per device for stream write (default 16)
+//
+// tuh_midih_define_limits() can reduce, but not increase, these limits.
+// Call it before midih_init() gets called by the TinyUSB stack,
 // which is before the application calls tusb_init() or tuh_init().
-// Calling this function after midih_init() will cause problems.
 //
 // Note: To figure out how long a USB MIDI 1.0 stream needs to be
 // in bytes, multiply the number of bytes in the stream by 4/3 and
@@ -132,6 +136,26 @@ uint32_t tuh_midi_stream_read (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *
 // Return true if a packet was returned
 bool tuh_midi_packet_read (uint8_t dev_addr, uint8_t packet[4]);
 
+// Zero-copy access to received 4-byte USB-MIDI event packets.
+// Sets *p_packets to point to packets in the RX FIFO, and returns the
+// number of packets there, which may be fewer than the number received
+// if the FIFO wraps around. After processing them (for example with
+// MIDIParser::ParseUSBPacket), remove them with tuh_midi_packets_consume(),
+// then call again until it returns 0:
+//
+//   uint8_t const *packets;
+//   uint32_t n;
+//   while ((n = tuh_midi_packets_peek(dev_addr, &packets)) > 0)
+//   {
+//     for (uint32_t i = 0; i < n; i++) handle(packets + 4 * i);
+//     tuh_midi_packets_consume(dev_addr, n);
+//   }
+//
+// Packets are as sent by the device; the cable number is packet[0] >> 4.
+// Do not mix with tuh_midi_stream_read() or tuh_midi_packet_read().
+uint32_t tuh_midi_packets_peek (uint8_t dev_addr, uint8_t const **p_packets);
+void tuh_midi_packets_consume (uint8_t dev_addr, uint32_t num_packets);
+
 uint8_t tuh_midi_get_num_rx_cables(uint8_t dev_addr);
 uint8_t tuh_midi_get_num_tx_cables(uint8_t dev_addr);
 #if CFG_MIDI_HOST_DEVSTRINGS
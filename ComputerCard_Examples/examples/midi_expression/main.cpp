@@ -0,0 +1,238 @@
+#include "ComputerCard.h"
+#include "pico/multicore.h"
+#include "tusb.h"
+#include "MIDIParser.h"
+#include "MIDIControllers.h"
+#include "NoteStack.h"
+
+
+
+/*
+
+   ComputerCard USB MIDI expression example
+
+   Converts high-resolution MIDI controllers to CV, with the Workshop
+   System Computer acting as a USB MIDI Device.
+
+   7-bit MIDI controllers give only 128 steps, which are audible as
+   'zipper noise' on a filter cutoff or pitch. This example decodes the
+   higher-resolution messages, and outputs them with the 19-bit CVOutPrecise
+   functions, interpolated at the sample rate between MIDI updates:
+   - 14-bit controllers (CC 1 with CC 33 as its least significant byte)
+   - pitch bend, with the range set by RPN 0
+   - MPE (MIDI Polyphonic Expression), where each note has its own channel,
+     with per-note pitch bend, pressure and timbre (CC 74)
+
+
+   Outputs:
+   - CV out 1:    pitch (1V per octave) of the most recent held note,
+                  including pitch bend, calibrated
+   - Pulse out 1: gate, high while any note is held
+   - CV out 2:    expression, 0 to +6V, chosen by the switch:
+                  - up:     pressure of the note (channel or polyphonic aftertouch)
+                  - middle: mod wheel (CC 1 / CC 33, 14-bit)
+                  - down:   timbre of the note (CC 74)
+
+   The main knob sets the longest time (up to 20ms) over which CV outputs
+   are interpolated between MIDI updates; fully anticlockwise turns interpolation off.
+
+   LEDs show the gate (top right) and the expression CV (middle right).
+
+
+   As in the midi_device example, MIDI messages are timestamped on the
+   MIDI core and applied at a fixed latency in ProcessSample.
+
+ */
+
+
+class MIDIExpression : public ComputerCard
+{
+public:
+	MIDIExpression()
+	{
+		noteChannel = 0;
+		pressure = 0;
+		modWheel = 0;
+		lastPitch = -1;
+		lastExpression = -1;
+
+		// Start the second core
+		multicore_launch_core1(core1);
+	}
+
+	// Boilerplate static function to call member function as second core
+	static void core1()
+	{
+		((MIDIExpression *)ThisPtr())->USBCore();
+	}
+
+	// Code for second RP2040 core. Blocking.
+	void USBCore()
+	{
+		uint8_t buffer[64];
+
+		// Initialise TinyUSB
+		tusb_init();
+
+		while (1)
+		{
+			tud_task();
+
+			while (tud_midi_available())
+			{
+				uint32_t bytesRead = tud_midi_stream_read(buffer, sizeof(buffer));
+				parser.Parse(buffer, bytesRead, midiEvents, SampleCounter());
+			}
+		}
+	}
+
+	// Apply MIDI message; called by ProcessSample
+	void HandleMIDIMessage(const MIDIEvent &m)
+	{
+		MIDIControllerChange c;
+		if (controllers.Decode(m, c))
+		{
+			int note = notes.Last();
+			if (c.type == MIDIControllerChange::Controller14 && c.number == 1)
+			{
+				modWheel = c.value;
+			}
+			else if (c.type == MIDIControllerChange::ChannelPressure && c.channel == noteChannel)
+			{
+				pressure = c.value;
+			}
+			else if (c.type == MIDIControllerChange::PolyPressure && c.number == note)
+			{
+				pressure = c.value;
+			}
+			return;
+		}
+
+		switch (m.type)
+		{
+		case MIDIEvent::NoteOn:
+			// With MPE, each note is on its own channel, which carries its expression
+			notes.NoteOn(m.Note(), m.Velocity());
+			channels[m.Note()] = m.channel;
+			noteChannel = m.channel;
+			pressure = controllers.Pressure(m.channel);
+			break;
+
+		case MIDIEvent::NoteOff:
+			notes.NoteOff(m.Note());
+			if (notes.Count() > 0)
+			{
+				noteChannel = channels[notes.Last()];
+			}
+			break;
+
+		case MIDIEvent::ControlChange:
+			// Channel mode messages, which Decode leaves to us
+			if (m.Controller() == 120 || m.Controller() == 123) // All sound off, all notes off
+			{
+				notes.Clear();
+			}
+			break;
+
+		case MIDIEvent::Reset:
+			notes.Clear();
+			controllers.Reset();
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	// 48kHz audio processing function; runs on audio core
+	virtual void ProcessSample()
+	{
+		MIDIEvent m;
+		while (PopDueMIDIEvent(midiEvents, SampleCounter(), midiLatency, m))
+		{
+			HandleMIDIMessage(m);
+		}
+
+		// Main knob: maximum interpolation time, 0 to 960 samples (20ms)
+		uint32_t rampSamples = (KnobVal(Knob::Main) * 960) >> 12;
+		pitchRamp.SetMaxRampSamples(rampSamples);
+		expressionRamp.SetMaxRampSamples(rampSamples);
+
+		// Pitch, in 1/256ths of a semitone. Jump to each new note, and
+		// interpolate pitch bend.
+		bool gate = notes.Count() > 0;
+		if (gate)
+		{
+			uint8_t note = uint8_t(notes.Last());
+			int32_t pitch = controllers.NotePitch(note, noteChannel);
+			if (note != lastNote)
+			{
+				pitchRamp.Jump(pitch);
+				lastNote = note;
+			}
+			else if (pitch != lastPitch)
+			{
+				pitchRamp.Set(pitch);
+			}
+			lastPitch = pitch;
+		}
+		CVOut1MIDINotePrecise(pitchRamp.Process());
+		PulseOut1(gate);
+
+		// Expression, as 19-bit CV, 0 to 262143
+		uint16_t value;
+		switch (SwitchVal())
+		{
+		case Switch::Up:
+			value = pressure;
+			break;
+		case Switch::Middle:
+			value = modWheel;
+			break;
+		default:
+			value = controllers.Timbre(noteChannel);
+			break;
+		}
+		int32_t expression = (int32_t(value) << 4) | (value >> 10);
+		if (expression != lastExpression)
+		{
+			expressionRamp.Set(expression);
+			lastExpression = expression;
+		}
+		int32_t cv = expressionRamp.Process();
+		CVOut2Precise(cv);
+
+		LedOn(1, gate);
+		LedBrightness(3, uint16_t(cv >> 6));
+
+		// Flash an LED to indicate that the card is running
+		static int32_t frame = 0;
+		LedOn(5, (frame >> 13) & 1);
+		frame++;
+	}
+
+private:
+	// Audio core
+	MIDIControllers controllers;
+	NoteStack notes;
+	uint8_t channels[128]; // channel of each held note
+	uint8_t noteChannel; // channel of most recent held note
+	uint8_t lastNote = 0xFF;
+	uint16_t pressure, modWheel;
+	int32_t lastPitch, lastExpression;
+	ControlRamp pitchRamp, expressionRamp;
+
+	// MIDI input parser, used on the MIDI core
+	MIDIParser<16> parser;
+
+	// Timestamped messages from MIDI core to audio core
+	SPSCQueue<MIDIEvent, 64> midiEvents;
+	static constexpr uint32_t midiLatency = 48; // samples
+};
+
+
+int main()
+{
+	MIDIExpression me;
+	me.Run();
+}
@@ -8,7 +8,24 @@
 // see the usb_device example.
 
 
-// This is a very slightly modified 
+// Up to four USB MIDI devices can be connected at once, through a USB hub.
+// Each device is given a slot (0, 1, ...) in the order it is connected.
+// A routing table (routes, below) selects which device, cable and channel
+// plays each of two voices:
+//   - CV out 1 (1V per octave), pulse out 1 and the top right LED
+//   - CV out 2 (1V per octave), pulse out 2 and the middle right LED
+// By default, the first device connected plays voice 1, and the second voice 2.
+// Held notes are tracked with a NoteStack (in NoteStack.h) for each voice, so that
+// the voice plays the most recent held note, and the gate only closes when all
+// notes are released.
+//
+// Received USB-MIDI packets are parsed by MIDIParser (in MIDIParser.h) on the USB core,
+// directly from the USB driver's buffer. Each device's events go into its own queue,
+// timestamped, and ProcessSample takes events from all queues in timestamp order
+// (with MIDIMerge, in MIDIMerge.h), each applied a fixed 1ms after it was received.
+//
+// Notes sent to the devices are queued in a MIDIOutput (in MIDIOutput.h), and
+// written to each device, and flushed, only when there is something to send.
 
 #include "ComputerCard.h"
 
@@ -16,8 +33,28 @@
 #include "bsp/board.h"
 #include "tusb.h"
 #include "usb_midi_host.h"
+#include "MIDIParser.h"
+#include "MIDIMerge.h"
+#include "NoteStack.h"
+#include "MIDIOutput.h"
 
 
+// Maximum number of MIDI devices connected at once
+static constexpr int maxDevices = CFG_TUH_DEVICE_MAX;
+
+// Which MIDI input drives each voice
+struct Route
+{
+	int8_t device;  // device slot, in order connected (0 = first), or -1 for any
+	int8_t cable;   // USB MIDI cable (0-15), or -1 for any
+	int8_t channel; // MIDI channel (0-15, i.e. channel 1 is 0), or -1 for any
+};
+
+static constexpr int numVoices = 2;
+static constexpr Route routes[numVoices] = {
+	{0, -1, -1}, // voice 1: first device connected, any cable and channel
+	{1, -1, -1}, // voice 2: second device connected, any cable and channel
+};
 
 
 class MIDIHost : public ComputerCard
@@ -25,11 +62,14 @@ class MIDIHost : public ComputerCard
 public:
 	MIDIHost()
 	{
-		midi_dev_addr = 0;
-		device_connected = 0;
-		
+		for (int i = 0; i < maxDevices; i++)
+		{
+			dev_addr[i] = 0;
+		}
+		devices_connected = 0;
+
 		counter = 0;
-		
+
 		// Start the second core
 		multicore_launch_core1(core1);
 	}
@@ -40,89 +80,162 @@ public:
 		((MIDIHost *)ThisPtr())->USBCore();
 	}
 
-	// Send alternate note-on and note-off messages
-	void SendNextNote()
+	// Write MIDI bytes to all connected devices, and start the USB transfers
+	static void WriteToDevices(const uint8_t *bytes, uint32_t length)
 	{
-		static uint8_t noteOn[3] = {0x90, 0x5f, 0x7f};
-		static uint8_t noteOff[3] = {0x80, 0x5f, 0x00};
-		static bool noteOnNext = true;
-
-		// Transmit the note message on the highest cable number
-		uint8_t cable = tuh_midih_get_num_tx_cables(midi_dev_addr) - 1;
+		for (int i = 0; i < maxDevices; i++)
+		{
+			uint8_t addr = dev_addr[i];
+			bool connected = addr != 0 && tuh_midi_configured(addr);
 
+			// device must be attached and have at least one endpoint ready to receive a message
+			if (connected && tuh_midih_get_num_tx_cables(addr) >= 1)
+			{
+				// Transmit on the highest cable number
+				uint8_t cable = tuh_midih_get_num_tx_cables(addr) - 1;
+				tuh_midi_stream_write(addr, cable, bytes, length);
 
-		// Toggle between sending note-on and note-off messages
-		if (noteOnNext)
-		{
-			tuh_midi_stream_write(midi_dev_addr, cable, noteOn, sizeof(noteOn));
-			noteOnNext = false;
-		}
-		else
-		{
-			tuh_midi_stream_write(midi_dev_addr, cable, noteOff, sizeof(noteOff));
-			noteOnNext = true;
+				// Send a USB packet now. If the endpoint is still busy, the driver
+				// sends the remaining bytes when the previous transfer completes.
+				tuh_midi_stream_flush(addr);
+			}
 		}
 	}
 
-	
+
 	// Code for second RP2040 core, blocking
 	// Handles MIDI in/out messages
 	void USBCore()
 	{
+		bool noteOnNext = true;
+
 		// Initialise TinyUSB
 		board_init();
 		tusb_init();
-		
+
 		while (1)
 		{
 			tuh_task();
-		
-			bool connected = midi_dev_addr != 0 && tuh_midi_configured(midi_dev_addr);
 
-			// device must be attached and have at least one endpoint ready to receive a message
-			if (connected && tuh_midih_get_num_tx_cables(midi_dev_addr) >= 1)
+			// Alternate note-on and note-off messages
+			if (counter >= 20000)
 			{
-
-				if (counter >= 20000)
+				counter -= 20000;
+				if (noteOnNext)
 				{
-					SendNextNote();
-					counter -= 20000;
+					midiOut.NoteOn(0, 0x5f, 0x7f);
 				}
-
-				// Send a USB packet immediately (even though in this case,
-				// we are not close to the 64-byte maximum payload)
- 				tuh_midi_stream_flush(midi_dev_addr);
+				else
+				{
+					midiOut.NoteOff(0, 0x5f);
+				}
+				noteOnNext = !noteOnNext;
 			}
+
+			// Write any messages due, as one USB packet per device
+			midiOut.Flush(SampleCounter(), WriteToDevices);
 		}
 
 	}
 
-	
+	// True if event from device slot is routed to voice
+	static bool Routed(const Route &r, int device, const MIDIEvent &m)
+	{
+		return (r.device < 0 || r.device == device)
+			&& (r.cable < 0 || r.cable == m.port)
+			&& (r.channel < 0 || !m.IsChannelMessage() || r.channel == m.channel);
+	}
+
 	// 48kHz audio processing function
 	virtual void ProcessSample()
 	{
+		// Apply MIDI events received on the USB core from all devices, in the
+		// order they were received, 48 samples (1ms) after they arrived
+		MIDIEvent m;
+		int device;
+		while (midiIn.PopDue(SampleCounter(), 48, m, device))
+		{
+			for (int v = 0; v < numVoices; v++)
+			{
+				if (!Routed(routes[v], device, m)) continue;
+
+				if (m.type == MIDIEvent::NoteOn)
+				{
+					heldNotes[v].NoteOn(m.Note(), m.Velocity());
+				}
+				else if (m.type == MIDIEvent::NoteOff)
+				{
+					heldNotes[v].NoteOff(m.Note());
+				}
+				else if (m.type == MIDIEvent::Reset)
+				{
+					// Sent by a device, or queued when a device is disconnected
+					heldNotes[v].Clear();
+				}
+			}
+		}
+
+		// Last note priority: each voice plays most recent held note
+		for (int v = 0; v < numVoices; v++)
+		{
+			bool gate = heldNotes[v].Count() > 0;
+			if (gate)
+			{
+				uint8_t note = uint8_t(heldNotes[v].Last());
+				if (v == 0) CVOut1MIDINote(note);
+				else CVOut2MIDINote(note);
+			}
+			if (v == 0) PulseOut1(gate);
+			else PulseOut2(gate);
+			LedOn(1 + 2 * v, gate);
+		}
+
 		// No audio I/O, so just flash an LED
 		// to indicate that the card is running
 		LedOn(5, counter < 10000);
 
-		// LED 4 indicates whether MIDI device is connected
-		LedOn(4, device_connected);
-		
+		// LED 4 brightness indicates number of MIDI devices connected
+		LedBrightness(4, uint16_t(devices_connected * 4095 / maxDevices));
+
 		// Counter is reset by other core
 		if (counter <= 30000)
 			counter++;
 	}
-	
-	static uint8_t device_connected;
-	static uint8_t midi_dev_addr;
-	
+
+	// Find slot of connected device, or -1
+	static int Slot(uint8_t addr)
+	{
+		for (int i = 0; i < maxDevices; i++)
+		{
+			if (dev_addr[i] == addr) return i;
+		}
+		return -1;
+	}
+
+	// Device address in each slot, or 0 if none. Written by USB core.
+	static volatile uint8_t dev_addr[maxDevices];
+	static volatile uint8_t devices_connected;
+
+	// One parser per device and USB MIDI cable, and a queue of events for each
+	// device from USB core to ProcessSample
+	static MIDIParser<16> parsers[maxDevices][16];
+	static MIDIMerge<maxDevices> midiIn;
+
 private:
+	// Outgoing MIDI, used on the USB core
+	MIDIOutput<> midiOut;
+
 	volatile uint32_t counter;
+
+	// Notes held down for each voice, used in ProcessSample
+	NoteStack heldNotes[numVoices];
 };
 
 
-uint8_t MIDIHost::device_connected;
-uint8_t MIDIHost::midi_dev_addr;
+volatile uint8_t MIDIHost::dev_addr[maxDevices];
+volatile uint8_t MIDIHost::devices_connected;
+MIDIParser<16> MIDIHost::parsers[maxDevices][16];
+MIDIMerge<maxDevices> MIDIHost::midiIn;
 
 
 // Four callback functions that rppicomidi/usb_midi_host uses
@@ -131,48 +244,61 @@ void tuh_midi_mount_cb(uint8_t dev_addr, uint8_t in_ep, uint8_t out_ep, uint8_t
 {
 	(void)in_ep; (void)out_ep; (void)num_cables_rx; (void)num_cables_tx; // avoid unused variable warnings
 
-	
-	if (MIDIHost::midi_dev_addr == 0)
+	// Use first free slot
+	int slot = MIDIHost::Slot(0);
+	if (slot < 0)
+		return;
+
+	for (int cable = 0; cable < 16; cable++)
 	{
-		MIDIHost::midi_dev_addr = dev_addr;
-		MIDIHost::device_connected = 1;
+		MIDIHost::parsers[slot][cable].Reset();
+		MIDIHost::parsers[slot][cable].SetPort(uint8_t(cable));
 	}
+	MIDIHost::dev_addr[slot] = dev_addr;
+	MIDIHost::devices_connected++;
 }
 
 void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance)
 {
 	(void)instance;
-	
-	if (dev_addr == MIDIHost::midi_dev_addr)
-	{
-		MIDIHost::midi_dev_addr = 0;
-		MIDIHost::device_connected = 0;
-	}
+
+	int slot = MIDIHost::Slot(dev_addr);
+	if (slot < 0)
+		return;
+
+	// Release any notes held from this device
+	MIDIEvent reset = {};
+	reset.type = MIDIEvent::Reset;
+	reset.timestamp = ComputerCard::ThisPtr()->SampleCounter();
+	MIDIHost::midiIn.Queue(slot).Push(reset);
+
+	MIDIHost::dev_addr[slot] = 0;
+	MIDIHost::devices_connected--;
 }
 
 void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
 {
-	if (MIDIHost::midi_dev_addr != dev_addr)
+	int slot = MIDIHost::Slot(dev_addr);
+	if (slot < 0)
 		return;
 
 	if (num_packets == 0)
 		return;
-	
-	uint8_t cable_num;
-	uint8_t buffer[48];
-	while (1)
-	{
-		uint32_t bytes_read = tuh_midi_stream_read(dev_addr, &cable_num, buffer, sizeof(buffer));
 
-		if (bytes_read == 0)
-			return;
-		
-		for (uint32_t idx = 0; idx < bytes_read; idx++)
+	// Parse received USB-MIDI packets in place in the driver's FIFO, and queue
+	// any complete messages for ProcessSample
+	uint32_t now = ComputerCard::ThisPtr()->SampleCounter();
+	const uint8_t *packets;
+	uint32_t n;
+	while ((n = tuh_midi_packets_peek(dev_addr, &packets)) > 0)
+	{
+		for (uint32_t i = 0; i < n; i++)
 		{
-			//buffer[idx]
+			const uint8_t *packet = packets + 4 * i;
+			MIDIHost::parsers[slot][packet[0] >> 4].ParseUSBPacket(packet, MIDIHost::midiIn.Queue(slot), now);
 		}
+		tuh_midi_packets_consume(dev_addr, n);
 	}
-
 }
 
 void tuh_midi_tx_cb(uint8_t dev_addr)
@@ -187,5 +313,3 @@ int main()
 	MIDIHost mh;
 	mh.Run();
 }
-
-  
@@ -31,7 +31,6 @@
 #include "host/usbh_pvt.h"
 
 #include "usb_midi_host.h"
-#include <stdlib.h>
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF
 //--------------------------------------------------------------------+
@@ -48,6 +47,11 @@
   #define CFG_TUH_MIDI_EP_BUFSIZE USBH_EPSIZE_BULK_MAX
 #endif
 
+// FIFOs hold whole 4-byte USB-MIDI packets, so that tuh_midi_packets_peek()
+// can return pointers to packets in the RX FIFO
+TU_VERIFY_STATIC(CFG_TUH_MIDI_RX_BUFSIZE % 4 == 0, "CFG_TUH_MIDI_RX_BUFSIZE must be a multiple of 4");
+TU_VERIFY_STATIC(CFG_TUH_MIDI_TX_BUFSIZE % 4 == 0, "CFG_TUH_MIDI_TX_BUFSIZE must be a multiple of 4");
+
 #define MIDI_MAX_DATA_VAL 0x7f
 static struct midih_limits_s {
     size_t midi_rx_buf;
@@ -88,7 +92,7 @@ typedef struct
   // For Stream read()/write() API
   // Messages are always 4 bytes long, queue them for reading and writing so the
   // callers can use the Stream interface with single-byte read/write calls.
-  midi_stream_t *stream_write;
+  midi_stream_t stream_write[CFG_TUH_MAX_CABLES];
   midi_stream_t stream_read;
 
   /*------------- From this point, data is not cleared by bus reset -------------*/
@@ -96,9 +100,10 @@ typedef struct
   tu_fifo_t rx_ff;
   tu_fifo_t tx_ff;
  
-
-  uint8_t *rx_ff_buf;
-  uint8_t *tx_ff_buf;
+  // FIFO storage is allocated statically, for CFG_TUH_DEVICE_MAX devices,
+  // sized by CFG_TUH_MIDI_RX_BUFSIZE and CFG_TUH_MIDI_TX_BUFSIZE
+  uint8_t rx_ff_buf[CFG_TUH_MIDI_RX_BUFSIZE];
+  uint8_t tx_ff_buf[CFG_TUH_MIDI_TX_BUFSIZE];
 
   #if CFG_FIFO_MUTEX
   osal_mutex_def_t rx_ff_mutex;
@@ -151,40 +156,16 @@ static midih_interface_t *get_midi_host(uint8_t dev_addr)
 //------------- Internal prototypes -------------//
 static uint32_t write_flush(uint8_t dev_addr, midih_interface_t* midi);
 
-static void midih_freeall(void)
-{
-  // free memory allocated by midih_init()
-  for (int inst = 0; inst < CFG_TUH_DEVICE_MAX; inst++)
-  {
-    midih_interface_t *p_midi_host = &_midi_host[inst];
-    if (p_midi_host->rx_ff_buf != NULL)
-    {
-      free (p_midi_host->rx_ff_buf);
-      p_midi_host->rx_ff_buf = NULL;
-    }
-    if (p_midi_host->tx_ff_buf != NULL)
-    {
-      free (p_midi_host->tx_ff_buf);
-      p_midi_host->tx_ff_buf = NULL;
-    }
-    if (p_midi_host->stream_write != NULL)
-    {
-      free(p_midi_host->stream_write);
-      p_midi_host->stream_write = NULL;
-    }
-  }
-}
-
 //--------------------------------------------------------------------+
 // USBH API
 //--------------------------------------------------------------------+
 void tuh_midih_define_limits(size_t midi_rx_buffer_bytes, size_t midi_tx_buffer_bytes, uint8_t max_cables)
 {
-  // prevent memory leak in case midih_init() was called before this function
-  midih_freeall();
-  midih_limits.midi_rx_buf = midi_rx_buffer_bytes;
-  midih_limits.midi_tx_buf = midi_tx_buffer_bytes;
-  midih_limits.max_cables = max_cables;
+  // Buffers are allocated statically, so limits can only be reduced from the
+  // compile-time sizes. Round FIFO sizes down to whole packets.
+  midih_limits.midi_rx_buf = tu_min32(midi_rx_buffer_bytes, CFG_TUH_MIDI_RX_BUFSIZE) & ~3u;
+  midih_limits.midi_tx_buf = tu_min32(midi_tx_buffer_bytes, CFG_TUH_MIDI_TX_BUFSIZE) & ~3u;
+  midih_limits.max_cables = tu_min8(max_cables, CFG_TUH_MAX_CABLES);
 }
 
 bool midih_init(void)
@@ -194,11 +175,6 @@ bool midih_init(void)
   for (int inst = 0; inst < CFG_TUH_DEVICE_MAX; inst++)
   {
     midih_interface_t *p_midi_host = &_midi_host[inst];
-    p_midi_host->rx_ff_buf = malloc(midih_limits.midi_rx_buf);
-    p_midi_host->tx_ff_buf = malloc(midih_limits.midi_tx_buf);
-    p_midi_host->stream_write = malloc(midih_limits.max_cables * sizeof(midi_stream_t));
-    TU_ASSERT((p_midi_host->rx_ff_buf != NULL && p_midi_host->tx_ff_buf != NULL && p_midi_host->stream_write != NULL), 0);
-    tu_memclr(p_midi_host->stream_write, sizeof(*(p_midi_host->stream_write))*midih_limits.max_cables);
     tu_fifo_config(&p_midi_host->rx_ff, p_midi_host->rx_ff_buf, midih_limits.midi_rx_buf, 1, false); // true, true
     tu_fifo_config(&p_midi_host->tx_ff, p_midi_host->tx_ff_buf, midih_limits.midi_tx_buf, 1, false); // OBVS.
 
@@ -212,7 +188,6 @@ bool midih_init(void)
 
 bool midih_deinit()
 {
-  midih_freeall();
   return true;
 }
 bool midih_xfer_cb(uint8_t dev_addr, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
@@ -300,7 +275,7 @@ void midih_close(uint8_t dev_addr)
   p_midi_host->dev_addr = 255; // invalid
   p_midi_host->configured = false;
   tu_memclr(&p_midi_host->stream_read, sizeof(p_midi_host->stream_read));
-  tu_memclr(p_midi_host->stream_write, sizeof(p_midi_host->stream_write)*midih_limits.max_cables);
+  tu_memclr(p_midi_host->stream_write, sizeof(p_midi_host->stream_write));
 }
 
 //--------------------------------------------------------------------+
@@ -814,6 +789,28 @@ bool tuh_midi_packet_read (uint8_t dev_addr, uint8_t packet[4])
   return tu_fifo_read_n(&p_midi_host->rx_ff, packet, 4) == 4;
 }
 
+uint32_t tuh_midi_packets_peek (uint8_t dev_addr, uint8_t const **p_packets)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  TU_VERIFY(p_midi_host != NULL);
+  TU_ASSERT(p_packets);
+
+  // Packets are always written and read whole, and the FIFO size is a
+  // multiple of 4, so no packet is split by the FIFO wrapping
+  tu_fifo_buffer_info_t info;
+  tu_fifo_get_read_info(&p_midi_host->rx_ff, &info);
+  *p_packets = (uint8_t const *) info.ptr_lin;
+  return info.len_lin / 4;
+}
+
+void tuh_midi_packets_consume (uint8_t dev_addr, uint32_t num_packets)
+{
+  midih_interface_t *p_midi_host = get_midi_host(dev_addr);
+  if (p_midi_host == NULL)
+    return;
+  tu_fifo_advance_read_pointer(&p_midi_host->rx_ff, (uint16_t) (num_packets * 4));
+}
+
 uint32_t tuh_midi_stream_read (uint8_t dev_addr, uint8_t *p_cable_num, uint8_t *p_buffer, uint16_t bufsize)
 {
   midih_interface_t *p_midi_host = get_midi_host(dev_addr);
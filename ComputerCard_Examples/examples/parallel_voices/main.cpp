@@ -0,0 +1,98 @@
+#include "ComputerCard.h"
+#include "pico/multicore.h"
+#include <cmath>
+
+/*
+
+Parallel processing example: a four-voice floating-point sine chord, split
+between the two RP2040 cores.
+
+Only about two sinf evaluations fit into one 48kHz sample on one core
+(see the sine_wave_float example). With EnableParallelProcessing, the audio
+interrupt starts ProcessSampleCore1 on core 1 at the same time as it calls
+ProcessSample on core 0, and waits for both to finish before sending the
+audio outputs to the DAC. Each core computes two voices and writes one
+audio output, so there is no extra latency.
+
+
+User interface:
+---------------
+
+Main knob + CV in 1:    Root pitch
+Knob X:                 Chord (major / minor / sus4 / ...)
+Audio out 1:            Root and fifth (computed on core 0)
+Audio out 2:            Third and octave (computed on core 1)
+
+ */
+
+constexpr float twopi = (float)M_TWOPI;
+
+class ParallelVoices : public ComputerCard
+{
+	// Voices 0 and 1 are only used by core 0, 2 and 3 only by core 1
+	float phase[4];
+	volatile float increment[4]; // phase increment per sample
+	uint32_t sampleCount;
+
+public:
+	ParallelVoices()
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			phase[i] = 0.0f;
+			increment[i] = 0.0f;
+		}
+		sampleCount = 0;
+		EnableParallelProcessing();
+
+		// Start the second core, which runs ProcessSampleCore1
+		multicore_launch_core1(ComputerCard::RunCore1);
+	}
+
+	// Calculate sine voices a and b, and return their sum
+	int32_t __not_in_flash_func(TwoVoices)(int a, int b)
+	{
+		float out = sinf(phase[a]) + sinf(phase[b]);
+
+		phase[a] += increment[a];
+		if (phase[a] > twopi) phase[a] -= twopi;
+		phase[b] += increment[b];
+		if (phase[b] > twopi) phase[b] -= twopi;
+
+		return int32_t(out * 900.0f);
+	}
+
+	// Core 1: third and octave
+	virtual void ProcessSampleCore1()
+	{
+		AudioOut2(TwoVoices(2, 3));
+	}
+
+	// Core 0: root and fifth, and chord calculation
+	virtual void ProcessSample()
+	{
+		// Update pitches every 64 samples, to save time for the voices
+		if ((++sampleCount & 63) == 0)
+		{
+			// Semitones above root for third, fifth and octave
+			static const int8_t chords[4][3] = {{4, 7, 12}, {3, 7, 12}, {5, 7, 12}, {4, 8, 11}};
+			int chord = KnobVal(Knob::X) >> 10;
+
+			// 5 octaves of root pitch
+			float root = twopi * 55.0f / 48000.0f * exp2f((KnobVal(Knob::Main) + CVIn1()) * (1.0f / 819.2f));
+			increment[0] = root;
+			increment[1] = root * exp2f(chords[chord][1] * (1.0f / 12.0f));
+			increment[2] = root * exp2f(chords[chord][0] * (1.0f / 12.0f));
+			increment[3] = root * exp2f(chords[chord][2] * (1.0f / 12.0f));
+		}
+
+		AudioOut1(TwoVoices(0, 1));
+	}
+};
+
+
+int main()
+{
+	ParallelVoices pv;
+	pv.Run();
+}
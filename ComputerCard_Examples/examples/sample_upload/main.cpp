@@ -1,15 +1,55 @@
 #include "ComputerCard.h"
+#include "pico/multicore.h"
+#include "tusb.h"
+#include "FATVolume.h"
+#include "SampleInterpolator.h"
+#include "SampleStream.h"
+#include <array>
+#include <cstdio>
 #include <vector>
 
 #include <pico/bootrom.h>
 
+/*
+
+   ComputerCard sample upload example
+
+   Plays WAV files stored in flash. Samples are uploaded
+   while the card is running, either by copying WAV files to the USB drive
+   that the card appears as, or over USB serial (using
+   generate_sample_uf2.html in Chrome or Edge); or as a UF2 file through
+   the RP2040 bootloader.
+
+   The USB drive has no filesystem stored in flash. Its FAT16 filesystem is
+   generated from the samples in flash (FATVolume), each WAV file being
+   read directly from where it is stored. Files the computer writes to the
+   drive go straight to flash, and once it has finished writing, the
+   samples played are updated from the drive's root directory.
+
+   This example is built with the copy_to_ram binary type (see
+   CMakeLists.txt), so that all code and constant data, including the
+   audio interrupt and ProcessSample, run from RAM. Flash can then be
+   erased and programmed from core 1 while audio keeps running on core 0.
+   The only flash reads left are the samples themselves, which DMA reads
+   ahead of the playback position into RAM (SampleStream), so that
+   ProcessSample does not wait for flash; for the duration of each flash
+   operation, ProcessSample plays from a larger RAM copy of the samples
+   just ahead of the playback position.
+
+ */
+
 
 ////////////////////////////////////////
-// A very simple WAV file parsing class.
+// A simple WAV file parsing class.
 //
 // Takes a WAV file mapped into memory (e.g. in flash)
-// and gives an interface to the samples and basic format info
-// Currently hard-coded to 16-bit mono PCM files
+// and gives an interface to the samples and basic format info.
+//
+// Files are played in the native format, 16-bit mono PCM, read directly
+// from where they are stored. Files in other formats (any number of
+// channels; 8, 16, 24 or 32-bit integer, or 32-bit floating point) are
+// loaded so that they can be converted, once, to the native format, using
+// Converted() and WriteHeader().
 
 class WAVFile
 {
@@ -34,17 +74,40 @@ private:
 		return (a4<<24)+(a3<<16)+(a2<<8)+a1;
 	}
 
+	static void PutU16(uint8_t *&ptr, uint32_t v)
+	{
+		*ptr++ = uint8_t(v);
+		*ptr++ = uint8_t(v>>8);
+	}
+
+	static void PutU32(uint8_t *&ptr, uint32_t v)
+	{
+		PutU16(ptr, v);
+		PutU16(ptr, v>>16);
+	}
+
 public:
+	// Audio format codes, in the format chunk
+	static constexpr uint16_t FormatPCM = 1, FormatFloat = 3, FormatExtensible = 0xFFFE;
+
+	// Length of the header written by WriteHeader
+	static constexpr uint32_t headerSize = 44;
+
 	WAVFile()
 	{
 		dataptr = nullptr;
+		data = nullptr;
 		numSamples = 0;
+		numChannels = 0;
+		bitsPerSample = 0;
+		audioFormat = 0;
 		sampleRate = 0;
+		rateRatio = 0;
 		fileSize = 0;
 	}
 
 	// Get raw sample
-	int16_t operator[](uint32_t index)
+	int16_t operator[](uint32_t index) const
 	{
 		if (!dataptr || index >= numSamples)
 		{
@@ -54,30 +117,57 @@ public:
 		return dataptr[index];
 	}
 
-	// Get sample value at fractional position index/256, linearly interpolated.
-	// Interpolation at endpoint assumes that sample is looping
-	int16_t Interp8(uint32_t index)
+	// Native 16-bit mono samples, where stored, or nullptr for other formats
+	const int16_t *Samples() const {return dataptr;}
+
+	// Sample index (all channels mixed), converted to 16-bit, from a file in any supported format.
+	// Slower than operator[], so for converting files to the native format rather than playback.
+	int16_t Converted(uint32_t index) const
 	{
-		if (!dataptr || index >= (numSamples<<8))
+		if (!data || index >= numSamples)
 		{
 			return 0;
 		}
 
-		int32_t r = index & 0xFF;
-		index >>= 8;
-
-		uint32_t nextIndex = index+1;
-		if (nextIndex > numSamples) nextIndex -= numSamples;
-		
-		return (dataptr[index]*(256-r) + dataptr[nextIndex]*r)>>8;
+		uint32_t bytes = bitsPerSample/8;
+		const uint8_t *ptr = data + index*numChannels*bytes;
+		int32_t sum = 0;
+		for (unsigned c=0; c<numChannels; c++, ptr+=bytes)
+		{
+			if (audioFormat == FormatFloat)
+			{
+				float f;
+				memcpy(&f, ptr, 4);
+				f *= 32768.0f;
+				sum += (f >= 32767.0f) ? 32767 : (f <= -32768.0f) ? -32768 : int32_t(f);
+			}
+			else if (bytes == 1)
+			{
+				sum += (ptr[0] - 128) << 8; // 8-bit samples are unsigned
+			}
+			else
+			{
+				// Most significant 16 bits
+				sum += int16_t(ptr[bytes-2] | (ptr[bytes-1] << 8));
+			}
+		}
+		return int16_t(sum / int32_t(numChannels));
 	}
 
-	uint32_t SampleRate() {return sampleRate;}
-	uint32_t FileSize() {return fileSize;}
-	uint32_t NumSamples() {return numSamples;}
-	uint16_t NumChannels() {return numChannels;}
+	uint32_t SampleRate() const {return sampleRate;}
+	uint32_t RateRatio() const {return rateRatio;} // sample rate / 48kHz, as 16.16
+	uint32_t FileSize() const {return fileSize;}
+	uint32_t NumSamples() const {return numSamples;}
+	uint16_t NumChannels() const {return numChannels;}
+	uint16_t BitsPerSample() const {return bitsPerSample;}
 	
-	int Load(uint8_t *startptr)
+	// True if the file can be played where it is stored: 16-bit mono PCM
+	bool IsNative() const {return dataptr != nullptr;}
+
+	// Parse the file's RIFF chunks, in any order, for the format and sample data,
+	// reading no more than maxSize bytes. Returns 0 if the format is supported
+	// (natively or by conversion).
+	int Load(uint8_t *startptr, uint32_t maxSize = UINT32_MAX)
 	{
 		uint8_t *ptr = startptr;
 		uint32_t riffMarker = GetU32(ptr);
@@ -88,53 +178,176 @@ public:
 		uint32_t waveMarker = GetU32(ptr);
 		if (waveMarker != 0x45564157) return 2;
 
-		uint32_t fmtMarker = GetU32(ptr);
-		if (fmtMarker != 0x20746d66) return 3;
-
-		uint32_t subChunkSize = GetU32(ptr);
+		// Walk the chunks within the RIFF chunk, skipping any
+		// that are not needed (such as LIST or cue)
+		uint8_t *end = startptr + std::min(fileSize, maxSize);
+		uint8_t *dataChunk = nullptr;
+		uint32_t dataSize = 0;
+		bool haveFormat = false;
+		while (ptr + 8 <= end && !(haveFormat && dataChunk))
+		{
+			uint32_t chunkID = GetU32(ptr);
+			uint32_t chunkSize = GetU32(ptr);
+			uint8_t *chunk = ptr;
+			uint32_t remaining = uint32_t(end - chunk);
 
-		uint16_t audioFormat = GetU16(ptr);
-		if (audioFormat != 1) return 4; // must be PCM format
+			if (chunkID == 0x20746d66) // 'fmt '
+			{
+				if (chunkSize < 16 || chunkSize > remaining) return 3;
+				audioFormat = GetU16(ptr);
+				numChannels = GetU16(ptr);
+				sampleRate = GetU32(ptr);
+				rateRatio = SampleInterpolator::RateRatio(sampleRate);
+				ptr += 6; // skip 'byte rate' and 'block align' fields
+				bitsPerSample = GetU16(ptr);
 
-		numChannels = GetU16(ptr);
-		if (numChannels != 1) return 5; // must be mono
+				// WAVE_FORMAT_EXTENSIBLE gives the actual format at the start of
+				// the subformat GUID, after the extension size, valid bits and channel mask
+				if (audioFormat == FormatExtensible)
+				{
+					if (chunkSize < 26) return 3;
+					ptr += 8;
+					audioFormat = GetU16(ptr);
+				}
+				haveFormat = true;
+			}
+			else if (chunkID == 0x61746164) // 'data'
+			{
+				dataChunk = chunk;
+				dataSize = std::min(chunkSize, remaining); // may be cut short
+			}
 
-		sampleRate = GetU32(ptr);
+			// Chunks are padded to an even number of bytes
+			if (chunkSize > remaining) break;
+			ptr = chunk + chunkSize + (chunkSize & 1);
+		}
+		if (!haveFormat) return 3;
+		if (!dataChunk) return 7;
 
-		ptr += 6; // skip 'byte rate' and 'block align' fields
-	
-		uint16_t bitsPerSample  = GetU16(ptr);
-		if (bitsPerSample != 16) return 6; // must be 16-bit
+		bool pcm = (audioFormat == FormatPCM) &&
+			(bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+		bool ieeeFloat = (audioFormat == FormatFloat) && (bitsPerSample == 32);
+		if (!pcm && !ieeeFloat) return 4; // unsupported format, such as compressed data
+		if (numChannels == 0 || numChannels > 8) return 5;
 
-		// skip any 'extra params' which may or may not be in the format chunk
-		if (subChunkSize>16) {ptr += subChunkSize-16;}
+		data = dataChunk;
+		numSamples = dataSize / numChannels / (bitsPerSample/8);
 	
-		uint32_t dataMarker = GetU32(ptr);
-		if (dataMarker != 0x61746164) return 7;
-
-		numSamples = GetU32(ptr) / numChannels / (bitsPerSample/8);
-
-		
-		// WAV file format specifies that all data is an even number
-		// of bytes long, so 16-bit samples are aligned, so we can just cast here
-		// (WAV and Arm Cortex M0+ both little endian too)
-		dataptr = (int16_t*)ptr;
+		// Played directly, if 16-bit mono. WAV file format specifies that all
+		// chunks are an even number of bytes long, so 16-bit samples are aligned,
+		// so we can just cast here (WAV and Arm Cortex M0+ both little endian too)
+		bool native = (audioFormat == FormatPCM) && (bitsPerSample == 16) && (numChannels == 1);
+		dataptr = (native && (uintptr_t(data) & 1) == 0) ? (int16_t*)data : nullptr;
 
 		return 0;
 	}
 	
-	int16_t *dataptr;
+	// Write the header of a 16-bit mono PCM WAV file with numSamples
+	// samples, which then follow (headerSize bytes)
+	static void WriteHeader(uint8_t *ptr, uint32_t sampleRate, uint32_t numSamples)
+	{
+		PutU32(ptr, 0x46464952); // 'RIFF'
+		PutU32(ptr, headerSize - 8 + numSamples*2);
+		PutU32(ptr, 0x45564157); // 'WAVE'
+		PutU32(ptr, 0x20746d66); // 'fmt '
+		PutU32(ptr, 16);
+		PutU16(ptr, FormatPCM);
+		PutU16(ptr, 1); // mono
+		PutU32(ptr, sampleRate);
+		PutU32(ptr, sampleRate*2); // byte rate
+		PutU16(ptr, 2); // block align
+		PutU16(ptr, 16); // bits per sample
+		PutU32(ptr, 0x61746164); // 'data'
+		PutU32(ptr, numSamples*2);
+	}
+	
+	int16_t *dataptr; // 16-bit mono samples, if native
+	const uint8_t *data; // sample data, in any format
 	uint32_t numSamples;
 	uint16_t numChannels;
+	uint16_t bitsPerSample;
+	uint16_t audioFormat;
 	uint32_t sampleRate;
+	uint32_t rateRatio;
 	uint32_t fileSize;
 };
 
 
 ////////////////////////////////////////
-// Card that loads and plays WAV files from flash memory
+// A set of WAV files stored in flash, with their names on the USB drive
+
+struct SampleBank
+{
+	std::vector<WAVFile> files;
+	std::vector<uint32_t> addresses; // memory-mapped address of each file
+	std::vector<uint32_t> sizes; // length of each file, in bytes
+	std::vector<std::array<uint8_t, 11>> names; // 8.3 name of each file
+	uint32_t length = 0; // total length of files, in bytes
+};
+
+
+////////////////////////////////////////
+// A WAV file on the USB drive that is not played, such as one with no room to
+// convert it. It stays in flash as written, and on the drive, until deleted.
+
+struct KeptFile
+{
+	enum Reason : uint8_t {Unreadable, NoRoom, Failed, Converting};
+
+	uint32_t address; // memory-mapped address, at the start of a flash sector
+	uint32_t size; // length of the file, in bytes
+	uint8_t name[11]; // 8.3 name of the file
+	Reason reason; // why it is not played (never Converting)
+};
+static_assert(sizeof(KeptFile) == 20, "KeptFile is five words");
+
+
+////////////////////////////////////////
+// Sample catalogue, in the last 4KB sector of flash.
+//
+// The last 256-byte page is the bank header, shared with generate_sample_uf2.html.
+// WAV files uploaded as a UF2 file or over USB serial are stored one after
+// another from the start address. Those written to the USB drive may be
+// anywhere in flash, so are listed in a table before the header, and those
+// that are not played are listed after the header fields.
+
+struct Catalogue
+{
+	static constexpr uint32_t maxFiles = 256;
+	static constexpr uint32_t maxKept = 8;
+
+	// Table of files, if tableMagic is set
+	uint32_t address[maxFiles]; // memory-mapped address of each file
+	uint8_t name[maxFiles][11]; // 8.3 name of each file
+
+	// Bank header
+	uint32_t start; // memory-mapped address of first file
+	uint32_t numFiles;
+	uint32_t crcMagic; // if 'CRC1', the length and CRC of the WAV data follow
+	uint32_t length;
+	uint32_t crc;
+	uint32_t tableMagic; // if 'FTB1', files are listed in the table
+
+	// Files on the USB drive that are not played, if keptMagic is set
+	uint32_t keptMagic; // if 'KPT1', numKept files are listed in kept
+	uint32_t numKept;
+	KeptFile kept[maxKept];
+	uint32_t unused[58 - 2 - maxKept * sizeof(KeptFile) / 4];
+};
+static_assert(sizeof(Catalogue) == 4096, "Catalogue must fill one flash sector");
+
+
+// End of the firmware in flash, from the linker script
+extern char __flash_binary_end;
+
+
+////////////////////////////////////////
+// Card that loads and plays WAV files from flash memory,
+// and receives new WAV files over USB
 //
-// WAV files must all be 16-bit mono
+// WAV files are played as 16-bit mono, at any speed, with a choice of
+// interpolation; those copied to the USB drive in other formats, or at
+// sample rates other than 48kHz, are converted first
 
 class SampleUpload : public ComputerCard
 {
@@ -142,153 +355,1712 @@ public:
 	
 	SampleUpload()
 	{
-		sampleIndex = 0;
-		numFiles = 0;
+		interpolator.Init();
+		increment = 0;
+		incrementSpeed = 0;
+		incrementFile = ~0u;
+		sincBank = 0;
+		stream.Init();
+		streamFile = ~0u;
 		currentFile = 0;
 		switchDownCount = 0;
+		bankState = BankValid; // unless a CRC is found to check
+		flashState = FlashIdle;
+		playFile = 0;
+		playPosition = 0;
+		bridgeStart = 0;
+		bridgeCount = 0;
+		bridgeMisses = 0;
+		uploading = false;
 		LoadWAVsFromFlash();
+		bankVersion = banks.Version();
+
+		// Start the second core, for USB and flash writes
+		multicore_launch_core1(core1);
+	}
+
+	// Boilerplate static function to call member function as second core
+	static void core1()
+	{
+		((SampleUpload *)ThisPtr())->USBCore();
 	}
 
-	// Load WAV files uploaded to the RP2040 using a UF2 from the generate_sample_uf2.html page
+	// Load WAV files uploaded to the RP2040, using the catalogue in the last sector of flash
 	int LoadWAVsFromFlash()
 	{
-		// Look in last 256-byte block of flash to get start address and number of WAV files
-		uint32_t *wavStart = ((uint32_t *)(XIP_BASE+ PICO_FLASH_SIZE_BYTES - 256 )); 
-		uint32_t wavStartAddress = *wavStart;
-		wavStart++; // advance to next 4-byte region
-		numFiles = *wavStart; // get number of WAV files
+		const Catalogue &catalogue = *(const Catalogue *)(XIP_BASE + HeaderSector());
 
-		// If an invalid number of files, probably no valid sample UF2 was uploaded
-		if (numFiles == 0 || numFiles > 256)
+		// Files written to the USB drive are listed in the table. Otherwise, the
+		// bank header in the last 256-byte page gives the start address and number of WAV files
+		bool table = (catalogue.tableMagic == bankTableMagic);
+		SampleBank &bank = banks.Write();
+		int res = table ? LoadBank(catalogue, bank) : LoadBank(catalogue.start, catalogue.numFiles, bank);
+		banks.Publish();
+		if (table)
 		{
-			return -1;
+			LoadKept(catalogue);
+		}
+		if (res)
+		{
+			return res;
 		}
 		
-		// If start address is not in the right range, probably no valid sample UF2 was uploaded
-		if (wavStartAddress < XIP_BASE || wavStartAddress >= XIP_BASE + PICO_FLASH_SIZE_BYTES)
+		// If the sample bank includes a CRC of the sample data, check this
+		// in the background (with DMA) before playing any samples
+		if (!table && catalogue.crcMagic == bankCRCMagic
+			&& catalogue.length <= XIP_BASE + PICO_FLASH_SIZE_BYTES - catalogue.start)
+		{
+			bankCRC = uint16_t(catalogue.crc);
+			if (StartBackgroundCRC((uint8_t *)catalogue.start, catalogue.length))
+			{
+				bankState = BankChecking;
+				LedBlink(5, 200, 100);
+			}
+		}
+
+		return 0; // success
+	}
+	
+	// Fill bank with numFiles WAV files stored one after another from wavStartAddress
+	static int LoadBank(uint32_t wavStartAddress, uint32_t numFiles, SampleBank &bank)
+	{
+		ClearBank(bank);
+
+		// If an invalid number of files, probably no valid sample bank was uploaded
+		if (numFiles == 0 || numFiles > maxFiles)
 		{
 			return -1;
 		}
 
-		// If above tests pass, create list of wav files
-		wavfiles = std::vector<WAVFile>(numFiles);
+		// If start address is not in the right range, probably no valid sample bank was uploaded
+		if (wavStartAddress < XIP_BASE || wavStartAddress >= XIP_BASE + PICO_FLASH_SIZE_BYTES)
+		{
+			return -1;
+		}
 
 		// Loop through wav files, processing each in turn
-		uint8_t *wavptr = ((uint8_t *)(wavStartAddress));
+		uint32_t address = wavStartAddress;
 		for (unsigned i=0; i<numFiles; i++)
 		{
-			int res = wavfiles[i].Load(wavptr);
-			if (res) // if this load failed, give up here
+			if (!AddFile(address, nullptr, UINT32_MAX, bank)) // if this load failed, give up here
 			{
-				numFiles = i;
 				return -2;
 			}
-			else
-			{
-				// Increment file start pointer to next wav file
-				wavptr += wavfiles[i].FileSize();
-			}
+			// Increment file start address to next wav file
+			address += bank.files[i].FileSize();
 		}
 
 		return 0; // success
 	}
-	
-	virtual void ProcessSample()
+
+	// Fill bank with the WAV files listed in the catalogue table
+	static int LoadBank(const Catalogue &catalogue, SampleBank &bank)
 	{
-		////////////////////////////////////////////////////////////////////////////////
-		// If the switch is held down for >2s, reboot into sample upload mode
+		ClearBank(bank);
+		if (catalogue.numFiles == 0 || catalogue.numFiles > maxFiles)
+		{
+			return -1;
+		}
+		for (unsigned i=0; i<catalogue.numFiles; i++)
+		{
+			if (!AddFile(catalogue.address[i], catalogue.name[i], UINT32_MAX, bank))
+			{
+				return -2;
+			}
+		}
+		return 0;
+	}
 
-		// count number of samples that switch is held down
-		switchDownCount = (SwitchVal() == Down) ? switchDownCount + 1 : 0;
+	// Files left on the USB drive without being played, as listed in the catalogue.
+	// BuildVolume checks that each is still in free clusters.
+	void LoadKept(const Catalogue &catalogue)
+	{
+		numKept = 0;
+		if (catalogue.keptMagic != bankKeptMagic || catalogue.numKept > maxKept)
+		{
+			return;
+		}
+		for (uint32_t k = 0; k < catalogue.numKept; k++)
+		{
+			const KeptFile &f = catalogue.kept[k];
+			uint32_t offset = f.address - XIP_BASE;
+			if (f.address >= XIP_BASE && offset % FLASH_SECTOR_SIZE == 0 && offset >= FirmwareEnd()
+				&& offset < HeaderSector() && f.size <= HeaderSector() - offset && f.reason < KeptFile::Converting)
+			{
+				kept[numKept++] = f;
+			}
+		}
+	}
 
-		// Light LEDs as switch is held
-		LedOn(4, switchDownCount>0);
-		LedOn(2, switchDownCount>32000);
-		LedOn(0, switchDownCount>64000);
+	// Add the WAV file at address, of at most size bytes, to bank. The file must
+	// be in the native format, 16-bit mono. If name is nullptr, the file is named
+	// by its position, such as SMP001.WAV.
+	static bool AddFile(uint32_t address, const uint8_t *name, uint32_t size, SampleBank &bank)
+	{
+		uint32_t flashEnd = XIP_BASE + PICO_FLASH_SIZE_BYTES;
+		if (address < XIP_BASE || address >= flashEnd)
+		{
+			return false;
+		}
 
-		// If we reach 2 seconds, exit from this ComputerCard and reboot into USB bootloader
-		if (switchDownCount >= 96000)
+		// Play no further than the end of the file, or of flash
+		size = std::min(size, flashEnd - address);
+		WAVFile wav;
+		if (wav.Load((uint8_t *)address, size) || !wav.IsNative())
 		{
-			Abort();
+			return false;
 		}
 
+		uint32_t dataOffset = uint32_t((uint8_t *)wav.dataptr - (uint8_t *)address);
+		if (dataOffset > size)
+		{
+			return false;
+		}
+		wav.numSamples = std::min(wav.numSamples, (size - dataOffset) / 2);
+		size = std::max(std::min(size, wav.FileSize()), dataOffset + wav.numSamples * 2);
 
-		
-		////////////////////////////////////////////////////////////////////////////////
-		// If we failed to load any WAV files, turn on bottom right LED and 
-		if (numFiles == 0)
+		std::array<uint8_t, 11> fileName;
+		if (name)
 		{
-			LedOn(5);
-			return;
+			memcpy(fileName.data(), name, 11);
+		}
+		else
+		{
+			char base[16];
+			snprintf(base, sizeof(base), "SMP%03u", unsigned(bank.files.size() + 1));
+			FATDirEntry::MakeName(fileName.data(), base, "WAV");
 		}
-		
 
-		////////////////////////////////////////////////////////////////////////////////
-		// Play audio
+		bank.files.push_back(wav);
+		bank.addresses.push_back(address);
+		bank.sizes.push_back(size);
+		bank.names.push_back(fileName);
+		bank.length += size;
+		return true;
+	}
 
-		// Advance sample index to resample from original sample rate to 48kHz
-		// Speed controlled by Knob Y + CV in 2
-		// speed=1024 gives original playback speed
-		uint32_t speed = std::max(0l, KnobVal(Y) + CVIn2());
-		
-		sampleIndex += (speed*wavfiles[currentFile].SampleRate())/(48000<<2);
+	static void CopyFile(const SampleBank &from, uint32_t i, SampleBank &to)
+	{
+		to.files.push_back(from.files[i]);
+		to.addresses.push_back(from.addresses[i]);
+		to.sizes.push_back(from.sizes[i]);
+		to.names.push_back(from.names[i]);
+		to.length += from.sizes[i];
+	}
 
-		
-		// If we go past the end of the file...
-		if (sampleIndex >= (wavfiles[currentFile].NumSamples()<<8))
+	static void ClearBank(SampleBank &bank)
+	{
+		bank.files.clear();
+		bank.addresses.clear();
+		bank.sizes.clear();
+		bank.names.clear();
+		bank.length = 0;
+	}
+
+	static bool SameFiles(const SampleBank &a, const SampleBank &b)
+	{
+		return a.addresses == b.addresses && a.sizes == b.sizes && a.names == b.names;
+	}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// USB upload, on core 1
+	//
+	// Commands from the host are a single byte, followed by any parameters
+	// as 32-bit little-endian values. Replies are one line of JSON.
+	//  'I'                        Information about the card and current samples
+	//  'U' length numFiles crc    Upload length bytes of WAV files (sent next),
+	//                             with the CRC-16-CCITT of the WAV data
+
+	void USBCore()
+	{
+		MeasureInterpolation();
+
+		// Present the current samples on the USB drive, and initialise TinyUSB
+		BuildVolume();
+		tusb_init();
+
+		while (1)
 		{
-			// Wrap the sample index
-			sampleIndex -= wavfiles[currentFile].NumSamples()<<8;
-    
-			// At the end of a sample, if switch is up, advance through samples in turn
-			if (SwitchVal() == Up)
+			tud_task();
+
+			if (receiving)
+			{
+				ReceiveData();
+			}
+			else
+			{
+				ReadCommand();
+
+				// Once the computer has stopped writing to the USB drive, play its files
+				if (driveChanged && time_us_32() - lastDriveWrite > driveIdleTime)
+				{
+					CommitVolume();
+				}
+
+				// Convert files written to the drive in other formats, a sector at a time
+				if (converting)
+				{
+					ConvertCluster();
+				}
+			}
+		}
+	}
+
+	void ReadCommand()
+	{
+		uint8_t c;
+		while (tud_cdc_available() && tud_cdc_read(&c, 1))
+		{
+			lastDataTime = time_us_32();
+
+			// After a failed upload, discard data until the host stops sending
+			if (discarding) continue;
+
+			command[commandLength++] = c;
+			if (command[0] == 'I')
+			{
+				SendInfo();
+				commandLength = 0;
+			}
+			else if (command[0] == 'U')
 			{
-				currentFile++;
-				if (currentFile >= numFiles)
+				if (commandLength == 13)
 				{
-					currentFile = 0;
+					commandLength = 0;
+					StartUpload(GetU32(command + 1), GetU32(command + 5), GetU32(command + 9));
+					return;
 				}
 			}
-			else // If switch not up, select next sample with main knob + CV in 1
+			else
 			{
-				int32_t kb = KnobVal(Main) + CVIn1();
-				if (kb < 0) kb = 0;
-				if (kb > 4095) kb = 4095;
-				
-				currentFile = (numFiles*kb)>>12;
+				commandLength = 0; // ignore anything else, such as line endings
 			}
 		}
+		if (discarding && time_us_32() - lastDataTime > 200000)
+		{
+			discarding = false;
+		}
+	}
 
-		// Look up interpolated sample
-		int16_t sample = wavfiles[currentFile].Interp8(sampleIndex);
+	// Time each interpolation quality, playing a sample from RAM, to give the
+	// cycles per output sample for one voice (including advancing and wrapping
+	// its position). Run before USB starts, while the RAM copy is unused.
+	void MeasureInterpolation()
+	{
+		static constexpr uint32_t measureSamples = 16384;
+		for (uint32_t i = 0; i < bridgeSize; i++)
+		{
+			bridge[i] = int16_t((i * 2654435761u) >> 16);
+		}
 
-		sample >>= 4; // convert from 16-bit WAV to 12-bit DAC output
+		uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+		uint32_t testIncrement = 70000; // a little faster than original speed, so all fractions occur
+		for (int q = 0; q < SampleInterpolator::numQualities; q++)
+		{
+			auto quality = SampleInterpolator::Quality(q);
+			int bank = SampleInterpolator::Bank(testIncrement);
+			SamplePhase position;
+			int32_t sum = 0;
+			uint32_t start = time_us_32();
+			for (uint32_t i = 0; i < measureSamples; i++)
+			{
+				sum += interpolator.InterpolateLoop(bridge, bridgeSize, position, quality, bank);
+				position.Advance(testIncrement);
+				if (position.index >= bridgeSize) position.index -= bridgeSize;
+			}
+			uint32_t elapsed = time_us_32() - start;
+			interpolationCycles[q] = (elapsed * mhz + measureSamples / 2) / measureSamples;
+			measureSink = sum; // keep the result, so the loop is not optimised away
+		}
+	}
 
-		// Output on both audio outputs
-		AudioOut1(sample); 
-		AudioOut2(sample);
+	void SendInfo()
+	{
+		const SampleBank &bank = banks.Read();
+		uint32_t gapAbove, gapBelow;
+		FreeSpace(gapAbove, gapBelow);
+		static const char *states[] = {"checking", "valid", "corrupt"};
+
+		// Voices of each interpolation quality that fit in one 48kHz sample period,
+		// if the whole of ProcessSample were spent on them
+		uint32_t samplePeriod = clock_get_hz(clk_sys) / 48000;
+		uint32_t voices[SampleInterpolator::numQualities];
+		for (int q = 0; q < SampleInterpolator::numQualities; q++)
+		{
+			voices[q] = samplePeriod / std::max<uint32_t>(1, interpolationCycles[q]);
+		}
+
+		// Flash reads since the last reply: blocks read ahead by DMA, samples the
+		// audio interrupt still read from flash, and XIP cache hits and accesses
+		// (all cached flash reads, from either core)
+		uint32_t blocks = stream.Blocks(), misses = stream.Misses();
+		XIPCacheCounters xip = XIPCacheCounters::Read(true);
+
+		char reply[512];
+		snprintf(reply, sizeof(reply),
+				 "{\"flash\":%u,\"firmware\":%u,\"max\":%u,\"maxLive\":%u,\"files\":%u,\"bytes\":%u,\"unplayed\":%u,\"state\":\"%s\","
+				 "\"period\":%u,\"linear\":{\"cycles\":%u,\"voices\":%u},"
+				 "\"hermite\":{\"cycles\":%u,\"voices\":%u},\"sinc\":{\"cycles\":%u,\"voices\":%u},"
+				 "\"stream\":{\"blocks\":%u,\"misses\":%u},\"xip\":{\"hits\":%u,\"accesses\":%u}}",
+				 unsigned(PICO_FLASH_SIZE_BYTES), unsigned(FirmwareEnd()),
+				 unsigned(HeaderSector() - FirmwareEnd()), unsigned(std::max(gapAbove, gapBelow)),
+				 unsigned(bank.files.size()), unsigned(bank.length), unsigned(numKept),
+				 bank.files.size() ? states[bankState] : "empty",
+				 unsigned(samplePeriod),
+				 unsigned(interpolationCycles[0]), unsigned(voices[0]),
+				 unsigned(interpolationCycles[1]), unsigned(voices[1]),
+				 unsigned(interpolationCycles[2]), unsigned(voices[2]),
+				 unsigned(blocks - infoBlocks), unsigned(misses - infoMisses),
+				 unsigned(xip.hits), unsigned(xip.accesses));
+		infoBlocks = blocks;
+		infoMisses = misses;
+		Reply(reply);
 	}
 
-private:
-	uint32_t sampleIndex;
+	void StartUpload(uint32_t length, uint32_t numFiles, uint32_t crc)
+	{
+		if (bankState == BankChecking)
+		{
+			// The background CRC reads flash with DMA, so must finish first
+			Fail("card is still checking samples", true);
+			return;
+		}
+		if (driveChanged || converting)
+		{
+			Fail("USB drive is being written", true);
+			return;
+		}
+		if (length == 0 || numFiles == 0 || numFiles > maxFiles)
+		{
+			Fail("invalid upload", true);
+			return;
+		}
+
+		// Place the new bank beside the bank being played, if there is room,
+		// so that the current samples keep playing until the upload is complete.
+		// Otherwise, stop playback and overwrite them.
+		uint32_t size = (length + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+		uint32_t high = HeaderSector();
+		if (size > high - FirmwareEnd())
+		{
+			Fail("samples too large for this card", true);
+			return;
+		}
+		uint32_t gapAbove, gapBelow, activeStart, activeEnd;
+		FreeSpace(gapAbove, gapBelow);
+		ActiveRange(activeStart, activeEnd);
+		if (gapAbove >= size)
+		{
+			uploadOffset = high - size;
+			uploadLive = true;
+		}
+		else if (gapBelow >= size)
+		{
+			uploadOffset = activeStart - size;
+			uploadLive = true;
+		}
+		else
+		{
+			uploadOffset = high - size;
+			uploadLive = false;
 
-	unsigned numFiles, currentFile;
-	std::vector<WAVFile> wavfiles;
+			// Stop playback, and remove the bank header, so that an interrupted upload
+			// does not leave a header pointing at partly overwritten samples
+			PublishBank(0, 0);
+			EraseFlash(high, FLASH_SECTOR_SIZE);
+		}
 
-	int switchDownCount;
-};
+		// The new bank replaces the files on the drive, including any not played,
+		// whose flash it may overwrite
+		numKept = 0;
 
+		uploadStart = uploadOffset;
+		uploadLength = length;
+		uploadFiles = numFiles;
+		uploadCRC = uint16_t(crc);
+		received = 0;
+		sectorFill = 0;
+		runningCRC = 0xFFFF;
+		startMisses = bridgeMisses;
+		startTime = lastDataTime = time_us_32();
+		receiving = true;
+		uploading = true;
 
-int main()
-{
-	SampleUpload su;
-	su.Run();
+		char reply[96];
+		snprintf(reply, sizeof(reply), "{\"ok\":true,\"address\":%u,\"live\":%s}",
+				 unsigned(XIP_BASE + uploadStart), uploadLive ? "true" : "false");
+		Reply(reply);
+	}
 
-	
-	// We only get here if Abort() called in the SampleUpload ProcessSample().
-	// Reboot into UF2 upload mode
-	rom_reset_usb_boot(1<<11, 0); // pin 11 (top right LED) is USB activity
-	return 0;
-}
+	void ReceiveData()
+	{
+		uint32_t available = tud_cdc_available();
+		if (available == 0)
+		{
+			if (time_us_32() - lastDataTime > 2000000)
+			{
+				Fail("timed out waiting for data", false);
+			}
+			return;
+		}
+
+		uint32_t n = std::min<uint32_t>(available, FLASH_SECTOR_SIZE - sectorFill);
+		n = std::min(n, uploadLength - received);
+		n = tud_cdc_read(sector + sectorFill, n);
+		runningCRC = CRCencode(sector + sectorFill, int(n), runningCRC);
+		sectorFill += n;
+		received += n;
+		lastDataTime = time_us_32();
+
+		// Write each sector as it fills, padding the last
+		if (sectorFill == FLASH_SECTOR_SIZE || received == uploadLength)
+		{
+			memset(sector + sectorFill, 0xFF, FLASH_SECTOR_SIZE - sectorFill);
+			EraseFlash(uploadOffset, FLASH_SECTOR_SIZE);
+			ProgramFlash(uploadOffset, sector, FLASH_SECTOR_SIZE);
+			if (memcmp((const void *)(XIP_NOCACHE_NOALLOC_BASE + uploadOffset), sector, FLASH_SECTOR_SIZE))
+			{
+				Fail("flash verify failed", true);
+				return;
+			}
+			uploadOffset += FLASH_SECTOR_SIZE;
+			sectorFill = 0;
+		}
+
+		if (received == uploadLength)
+		{
+			FinishUpload();
+		}
+	}
 
-  
+	void FinishUpload()
+	{
+		receiving = false;
+
+		if (runningCRC != uploadCRC)
+		{
+			Fail("CRC mismatch", false);
+			return;
+		}
+
+		// Check the WAV files, and play them
+		SampleBank &bank = banks.Write();
+		if (LoadBank(XIP_BASE + uploadStart, uploadFiles, bank) || bank.length > uploadLength)
+		{
+			Fail("invalid WAV file", false);
+			return;
+		}
+		bankState = BankValid;
+		PublishBank();
+
+		// Then write the bank header, in the last page of flash
+		uint32_t header[FLASH_PAGE_SIZE / 4];
+		memset(header, 0xFF, sizeof(header));
+		header[0] = XIP_BASE + uploadStart;
+		header[1] = uploadFiles;
+		header[2] = bankCRCMagic;
+		header[3] = uploadLength;
+		header[4] = uploadCRC;
+		EraseFlash(HeaderSector(), FLASH_SECTOR_SIZE);
+		ProgramFlash(PICO_FLASH_SIZE_BYTES - FLASH_PAGE_SIZE, (const uint8_t *)header, FLASH_PAGE_SIZE);
+		uploading = false;
+		RemountDrive();
+
+		uint32_t ms = (time_us_32() - startTime) / 1000;
+		char reply[160];
+		snprintf(reply, sizeof(reply),
+				 "{\"ok\":true,\"files\":%u,\"bytes\":%u,\"ms\":%u,\"kBps\":%u,\"live\":%s,\"dropouts\":%u}",
+				 unsigned(uploadFiles), unsigned(uploadLength), unsigned(ms),
+				 unsigned(ms ? uploadLength / ms : 0), uploadLive ? "true" : "false",
+				 unsigned(bridgeMisses - startMisses));
+		Reply(reply);
+	}
+
+	// Abandon upload. Samples already playing are unaffected, unless they were being overwritten.
+	// If discard is true, the host may still be sending data, which is ignored.
+	void Fail(const char *reason, bool discard)
+	{
+		// If the upload had started overwriting the samples, the USB drive no longer shows them
+		if (uploading && !uploadLive)
+		{
+			RemountDrive();
+		}
+		receiving = false;
+		uploading = false;
+		discarding = discard;
+		lastDataTime = time_us_32();
+
+		char reply[96];
+		snprintf(reply, sizeof(reply), "{\"error\":\"%s\"}", reason);
+		Reply(reply);
+	}
+
+	// Send one line of JSON. Replies can be longer than the CDC transmit buffer,
+	// so keep USB running until all of it has been queued.
+	void Reply(const char *text)
+	{
+		Write(text, strlen(text));
+		Write("\n", 1);
+		tud_cdc_write_flush();
+	}
+
+	void Write(const char *data, uint32_t length)
+	{
+		while (length && tud_cdc_connected())
+		{
+			uint32_t n = std::min<uint32_t>(length, tud_cdc_write_available());
+			if (n)
+			{
+				n = tud_cdc_write(data, n);
+				data += n;
+				length -= n;
+			}
+			else
+			{
+				tud_cdc_write_flush();
+				tud_task();
+			}
+		}
+	}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// USB drive, on core 1
+	//
+	// The drive's data clusters 2, 3, ... are the flash sectors between the
+	// firmware and the catalogue, so a file the computer writes to free space
+	// is stored in flash exactly as written. A WAV file that starts on a sector
+	// boundary, and shares no sectors with other files, is presented where it
+	// is. Others (such as files uploaded one after another as a UF2 file, or
+	// over USB serial) are presented as clusters after those, each mapped to
+	// the file in flash, and the sectors they occupy are marked bad so that the
+	// computer does not write over them.
+
+	// Generate the drive's filesystem from the samples being played. Only while
+	// the computer is not using the drive: when it is connected, or after the
+	// samples are changed over USB serial.
+	void BuildVolume()
+	{
+		const SampleBank &bank = banks.Read();
+		uint32_t numFiles = bank.files.size();
+		realClusters = (HeaderSector() - FirmwareEnd()) / FLASH_SECTOR_SIZE;
+
+		// Choose where each file is presented, counting the clusters needed
+		// after those in flash (including one for INFO.TXT)
+		bool inPlace[maxFiles];
+		uint32_t numClusters = realClusters + 1;
+		for (uint32_t i = 0; i < numFiles; i++)
+		{
+			uint32_t start, end;
+			FileSectors(bank, i, start, end);
+			inPlace[i] = ((bank.addresses[i] - XIP_BASE) % FLASH_SECTOR_SIZE) == 0
+				&& start >= FirmwareEnd() && end <= HeaderSector();
+			for (uint32_t j = 0; j < numFiles && inPlace[i]; j++)
+			{
+				if (j != i && Overlaps(bank, j, start, end)) inPlace[i] = false;
+			}
+			if (!inPlace[i]) numClusters += SampleVolume::ClustersFor(bank.sizes[i]);
+		}
+
+		volume.Format(numClusters, "COMPUTER", time_us_32());
+		uint32_t next = SampleVolume::firstCluster + realClusters;
+		numAliases = 0;
+		for (uint32_t i = 0; i < numFiles; i++)
+		{
+			uint32_t start, end;
+			FileSectors(bank, i, start, end);
+			if (inPlace[i])
+			{
+				volume.AddFile(bank.names[i].data(), ClusterOf(start), bank.sizes[i]);
+				continue;
+			}
+
+			aliases[numAliases++] = {next, bank.sizes[i], (const uint8_t *)bank.addresses[i]};
+			volume.AddFile(bank.names[i].data(), next, bank.sizes[i]);
+			next += SampleVolume::ClustersFor(bank.sizes[i]);
+			for (uint32_t offset = start; offset < end; offset += FLASH_SECTOR_SIZE)
+			{
+				if (offset >= FirmwareEnd() && offset < HeaderSector())
+				{
+					volume.SetNext(ClusterOf(offset), SampleVolume::Bad);
+				}
+			}
+		}
+
+		// Files that are not played stay where they were written, unless their
+		// clusters have since been used for samples
+		uint32_t numShown = 0;
+		for (uint32_t k = 0; k < numKept; k++)
+		{
+			const KeptFile &f = kept[k];
+			uint32_t first = ClusterOf(f.address - XIP_BASE), n = SampleVolume::ClustersFor(f.size);
+			bool free = true;
+			for (uint32_t c = first; c < first + n && free; c++)
+			{
+				free = (volume.Next(c) == SampleVolume::Free);
+			}
+			if (free && volume.AddFile(f.name, first, f.size))
+			{
+				kept[numShown++] = f;
+			}
+		}
+		numKept = numShown;
+
+		// Text file describing the card, last
+		uint32_t freeClusters = 0;
+		for (uint32_t c = 0; c < realClusters; c++)
+		{
+			if (volume.Next(SampleVolume::firstCluster + c) == SampleVolume::Free) freeClusters++;
+		}
+		int infoLength = snprintf(info, sizeof(info),
+			"Workshop System Computer sample player\r\n\r\n"
+			"%u samples, %u kB. %u kB free.\r\n\r\n"
+			"Copy WAV files here to add samples, and delete files to remove them.\r\n"
+			"Files that are not 16-bit mono 48kHz (stereo; 8, 24 or 32-bit; floating\r\n"
+			"point; or other sample rates) are converted to 16-bit mono 48kHz,\r\n"
+			"replacing the original; files that can't be played are left as they are,\r\n"
+			"and listed below.\r\n"
+			"Samples play in the order they are listed in this folder,\r\n"
+			"starting a second or so after the computer has finished writing.\r\n"
+			"Eject the drive before unplugging the card.\r\n",
+			unsigned(numFiles), unsigned(bank.length / 1024), unsigned(freeClusters * (FLASH_SECTOR_SIZE / 1024)));
+		static const char *reasons[] = {"not a WAV file it can play", "no room to convert it", "conversion failed"};
+		for (uint32_t k = 0; k < numKept && infoLength < int(sizeof(info)); k++)
+		{
+			char fileName[13];
+			PrintName(fileName, kept[k].name);
+			infoLength += snprintf(info + infoLength, sizeof(info) - infoLength, "%sNot played: %s (%s)\r\n",
+								   k ? "" : "\r\n", fileName, reasons[kept[k].reason]);
+		}
+		infoLength = std::min(infoLength, int(sizeof(info)) - 1);
+		uint8_t name[11];
+		FATDirEntry::MakeName(name, "INFO", "TXT");
+		aliases[numAliases++] = {next, uint32_t(infoLength), (const uint8_t *)info};
+		volume.AddFile(name, next, uint32_t(infoLength));
+
+		driveChanged = false;
+		driveWriting = false;
+	}
+
+	// Samples changed over USB serial: show them on the drive, and tell the
+	// computer that the drive has changed, so that it reads the filesystem again
+	void RemountDrive()
+	{
+		BuildVolume();
+		ejected = false;
+		mediaChanged = true;
+	}
+
+	// USB connected: finish any changes from a previous connection, and show the samples
+	void MountDrive()
+	{
+		// Files being converted are shown once converted (see ConvertCluster)
+		if (converting)
+		{
+			ejected = false;
+			return;
+		}
+		if (driveChanged)
+		{
+			CommitVolume();
+		}
+		BuildVolume();
+		ejected = false;
+		mediaChanged = false;
+	}
+
+	// The computer has ejected the drive: play its files now, rather than waiting
+	void EjectDrive()
+	{
+		if (driveChanged && !receiving)
+		{
+			CommitVolume();
+		}
+		ejected = true;
+	}
+
+	// For tud_msc_test_unit_ready_cb: false, with the reason as SCSI sense data, if
+	// the drive cannot be used now
+	bool DriveReady(uint8_t lun)
+	{
+		if (mediaChanged)
+		{
+			mediaChanged = false;
+			tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00); // medium may have changed
+			return false;
+		}
+		if (ejected)
+		{
+			tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00); // medium not present
+			return false;
+		}
+		if (bankState == BankChecking)
+		{
+			tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01); // becoming ready
+			return false;
+		}
+		return true;
+	}
+
+	uint32_t DriveSectors() const {return volume.Sectors();}
+
+	// Read whole 512-byte sectors from the drive, for tud_msc_read10_cb
+	int32_t ReadSectors(uint32_t lba, uint8_t *buffer, uint32_t bufsize)
+	{
+		for (uint32_t done = 0; done + SampleVolume::sectorSize <= bufsize; done += SampleVolume::sectorSize, lba++)
+		{
+			uint32_t cluster, offset;
+			if (volume.DataSector(lba, cluster, offset))
+			{
+				ReadData(cluster, offset, buffer + done);
+			}
+			else
+			{
+				volume.ReadSector(lba, buffer + done);
+			}
+		}
+		return int32_t(bufsize);
+	}
+
+	void ReadData(uint32_t cluster, uint32_t offset, uint8_t *buffer)
+	{
+		const uint8_t *source = nullptr;
+		uint32_t length = 0;
+		if (InFlash(cluster))
+		{
+			source = (const uint8_t *)(XIP_BASE + SectorOf(cluster) + offset);
+			length = SampleVolume::sectorSize;
+		}
+		else if (const Alias *alias = FindAlias(cluster))
+		{
+			uint32_t position = (cluster - alias->cluster) * SampleVolume::clusterSize + offset;
+			if (position < alias->size)
+			{
+				source = alias->data + position;
+				length = std::min(SampleVolume::sectorSize, alias->size - position);
+			}
+		}
+		if (length) memcpy(buffer, source, length);
+		memset(buffer + length, 0, SampleVolume::sectorSize - length);
+	}
+
+	// Write whole 512-byte sectors to the drive, for tud_msc_write10_cb. Returns 0
+	// (busy, so TinyUSB tries again later) while flash is in use for an upload over
+	// USB serial, the CRC check or converting files, or -1 if flash could not be written.
+	int32_t WriteSectors(uint32_t lba, const uint8_t *buffer, uint32_t bufsize)
+	{
+		if (receiving || converting || bankState == BankChecking)
+		{
+			return 0;
+		}
+
+		uint32_t done = 0;
+		while (done + SampleVolume::sectorSize <= bufsize)
+		{
+			uint32_t cluster, offset;
+			if (volume.DataSector(lba, cluster, offset))
+			{
+				// Write the sectors in this cluster together, so a whole cluster is one flash sector
+				uint32_t length = std::min(SampleVolume::clusterSize - offset, bufsize - done);
+				length -= length % SampleVolume::sectorSize;
+				if (!WriteData(cluster, offset, buffer + done, length))
+				{
+					return -1;
+				}
+				done += length;
+				lba += length / SampleVolume::sectorSize;
+			}
+			else
+			{
+				if (volume.WriteSector(lba, buffer + done))
+				{
+					driveChanged = true;
+				}
+				done += SampleVolume::sectorSize;
+				lba++;
+			}
+		}
+		lastDriveWrite = time_us_32();
+		return int32_t(done);
+	}
+
+	// Write part of a cluster to flash. Returns false if it did not verify.
+	bool WriteData(uint32_t cluster, uint32_t offset, const uint8_t *data, uint32_t length)
+	{
+		// Clusters not in flash, or marked bad, belong to files that are read-only
+		if (!InFlash(cluster) || volume.Next(cluster) == SampleVolume::Bad)
+		{
+			return true;
+		}
+		uint32_t flashOffset = SectorOf(cluster);
+		const uint8_t *flash = (const uint8_t *)(XIP_BASE + flashOffset);
+		if (memcmp(flash + offset, data, length) == 0)
+		{
+			return true; // unchanged
+		}
+
+		driveChanged = true;
+		driveWriting = true;
+		ReleaseSector(flashOffset);
+
+		if (length == FLASH_SECTOR_SIZE)
+		{
+			EraseFlash(flashOffset, FLASH_SECTOR_SIZE);
+			ProgramFlash(flashOffset, data, FLASH_SECTOR_SIZE);
+		}
+		else if (Erased(flash + offset, length))
+		{
+			// Part of a sector that is already erased, such as the rest of one
+			// whose first part was just written, can be programmed directly
+			ProgramFlash(flashOffset + offset, data, length);
+		}
+		else
+		{
+			memcpy(sector, flash, FLASH_SECTOR_SIZE);
+			memcpy(sector + offset, data, length);
+			EraseFlash(flashOffset, FLASH_SECTOR_SIZE);
+			ProgramFlash(flashOffset, sector, FLASH_SECTOR_SIZE);
+		}
+		return memcmp((const void *)(XIP_NOCACHE_NOALLOC_BASE + flashOffset + offset), data, length) == 0;
+	}
+
+	static bool Erased(const uint8_t *flash, uint32_t length)
+	{
+		for (uint32_t i = 0; i < length; i++)
+		{
+			if (flash[i] != 0xFF) return false;
+		}
+		return true;
+	}
+
+	// Stop playing any samples stored in this flash sector, which the computer
+	// is writing over (having deleted or changed their files)
+	void ReleaseSector(uint32_t offset)
+	{
+		const SampleBank &bank = banks.Read();
+		uint32_t numFiles = bank.files.size();
+		uint32_t i = 0;
+		while (i < numFiles && !Overlaps(bank, i, offset, offset + FLASH_SECTOR_SIZE)) i++;
+		if (i == numFiles)
+		{
+			return;
+		}
+
+		SampleBank &next = banks.Write();
+		ClearBank(next);
+		for (i = 0; i < numFiles; i++)
+		{
+			if (!Overlaps(bank, i, offset, offset + FLASH_SECTOR_SIZE)) CopyFile(bank, i, next);
+		}
+		PublishBank();
+	}
+
+	// Play the WAV files in the drive's root directory, in order, and list them
+	// in the catalogue. Called once the computer has finished writing, as it
+	// writes each file in several steps (data, FAT, directory) in an order of its choosing.
+	// Files in formats other than 16-bit mono 48kHz are converted first, and played
+	// once converted, when this is called again. Files that can't be played (or
+	// converted) are kept on the drive as written, and listed in INFO.TXT.
+	void CommitVolume()
+	{
+		driveChanged = false;
+		driveWriting = false;
+
+		SampleBank &next = banks.Write();
+		ClearBank(next);
+		KeptFile nextKept[maxKept];
+		uint32_t numNextKept = 0;
+		for (uint32_t i = 0; i < SampleVolume::rootEntries && next.files.size() < maxFiles; i++)
+		{
+			const FATDirEntry &entry = volume.Entry(i);
+			if (entry.IsEnd()) break;
+
+			// Files must be in consecutive clusters, to be played from flash
+			if (!entry.IsFile() || !entry.HasExtension("WAV") || entry.size < 44
+				|| !volume.Contiguous(entry.cluster, entry.size))
+			{
+				continue;
+			}
+			uint32_t last = entry.cluster + SampleVolume::ClustersFor(entry.size) - 1;
+			bool inFlash = InFlash(entry.cluster) && InFlash(last);
+			uint32_t address = 0;
+			if (inFlash)
+			{
+				address = XIP_BASE + SectorOf(entry.cluster);
+			}
+			else if (const Alias *alias = FindAlias(entry.cluster))
+			{
+				if (alias->cluster == entry.cluster) address = uint32_t(uintptr_t(alias->data));
+			}
+			uint32_t size = entry.size;
+			WAVFile wav;
+			KeptFile::Reason reason = KeptFile::Unreadable;
+			if (address && InFlash(entry.cluster) && !wav.Load((uint8_t *)address, size)
+				&& (!wav.IsNative() || wav.RateRatio() != SampleInterpolator::unity))
+			{
+				// A file that is already 16-bit mono plays as it is until its
+				// 48kHz copy is ready (or if there is no room for one)
+				uint32_t converted = ConvertedAddress(entry, wav, size, reason);
+				if (converted || !wav.IsNative()) address = converted;
+			}
+			if (address && AddFile(address, entry.name, size, next))
+			{
+				continue;
+			}
+
+			// Otherwise keep the file on the drive, so that it is not lost when
+			// the drive is next built from the samples being played
+			if (inFlash && reason != KeptFile::Converting && numNextKept < maxKept)
+			{
+				KeptFile &f = nextKept[numNextKept++];
+				f.address = XIP_BASE + SectorOf(entry.cluster);
+				f.size = entry.size;
+				memcpy(f.name, entry.name, 11);
+				f.reason = reason;
+			}
+		}
+
+		bool sameKept = (numNextKept == numKept && memcmp(nextKept, kept, numKept * sizeof(KeptFile)) == 0);
+		memcpy(kept, nextKept, numNextKept * sizeof(KeptFile));
+		numKept = numNextKept;
+		if (!SameFiles(next, banks.Read()))
+		{
+			bankState = BankValid;
+			PublishBank();
+		}
+		else if (sameKept)
+		{
+			return;
+		}
+		WriteCatalogue(banks.Read());
+	}
+
+	// Address of the 16-bit mono 48kHz copy of a WAV file in another format or
+	// at another sample rate, giving its size, or 0 if it is not yet converted. Starts converting it (by
+	// ConvertCluster) into free clusters, if there is room. If 0, reason is Converting
+	// while it is being converted, or otherwise why it can't be.
+	uint32_t ConvertedAddress(const FATDirEntry &entry, const WAVFile &wav, uint32_t &size, KeptFile::Reason &reason)
+	{
+		for (uint32_t i = 0; i < numConversions; i++)
+		{
+			const Conversion &c = conversions[i];
+			if (c.source != entry.cluster) continue;
+			if (c.done != SampleVolume::ClustersFor(c.size))
+			{
+				reason = c.failed ? KeptFile::Failed : KeptFile::Converting;
+				return 0;
+			}
+			size = c.size;
+			return XIP_BASE + SectorOf(c.first);
+		}
+
+		// Samples at 48kHz: those at positions k * RateRatio() within the original
+		reason = KeptFile::NoRoom;
+		uint32_t ratio = wav.RateRatio();
+		if (ratio == 0)
+		{
+			reason = KeptFile::Unreadable;
+			return 0;
+		}
+		uint64_t numSamples = ((uint64_t(wav.NumSamples()) << 16) + ratio - 1) / ratio;
+		if (numSamples > (PICO_FLASH_SIZE_BYTES - WAVFile::headerSize) / 2) return 0;
+		uint32_t convertedSize = WAVFile::headerSize + uint32_t(numSamples) * 2;
+		uint32_t n = SampleVolume::ClustersFor(convertedSize);
+		uint32_t first = FreeClusters(n);
+		if (!first || numConversions == maxFiles)
+		{
+			return 0;
+		}
+
+		// Reserve the clusters, so that they are not used for other files
+		for (uint32_t c = first; c < first + n; c++)
+		{
+			volume.SetNext(c, uint16_t((c + 1 < first + n) ? c + 1 : SampleVolume::EndOfChain));
+		}
+		conversions[numConversions++] = {entry.cluster, first, convertedSize, 0, wav};
+		converting = true;
+		driveWriting = true;
+		reason = KeptFile::Converting;
+		return 0;
+	}
+
+	// First of n consecutive free clusters in flash, or 0 if there are none
+	uint32_t FreeClusters(uint32_t n) const
+	{
+		uint32_t run = 0;
+		for (uint32_t c = SampleVolume::firstCluster; c < SampleVolume::firstCluster + realClusters; c++)
+		{
+			run = (volume.Next(c) == SampleVolume::Free) ? run + 1 : 0;
+			if (run == n) return c + 1 - n;
+		}
+		return 0;
+	}
+
+	// Write the next cluster of a file being converted to 16-bit mono 48kHz. Once
+	// all are written, play them, and show them on the drive in place of the
+	// original files. One cluster at a time, so that USB keeps running.
+	void ConvertCluster()
+	{
+		uint32_t i = 0;
+		while (i < numConversions && conversions[i].Finished()) i++;
+		if (i == numConversions)
+		{
+			converting = false;
+			CommitVolume();
+			numConversions = 0;
+			if (ejected)
+			{
+				BuildVolume();
+			}
+			else
+			{
+				RemountDrive();
+			}
+			return;
+		}
+
+		Conversion &c = conversions[i];
+		uint32_t position = c.done * SampleVolume::clusterSize; // in the converted file
+		uint32_t numSamples = (c.size - WAVFile::headerSize) / 2;
+		uint32_t fill = 0;
+		if (c.done == 0)
+		{
+			WAVFile::WriteHeader(sector, 48000, numSamples);
+			fill = WAVFile::headerSize;
+		}
+		uint32_t sample = (position + fill - WAVFile::headerSize) / 2;
+		for (; fill < SampleVolume::clusterSize && sample < numSamples; fill += 2, sample++)
+		{
+			int16_t v = NextConverted(c);
+			sector[fill] = uint8_t(v);
+			sector[fill + 1] = uint8_t(v >> 8);
+		}
+		memset(sector + fill, 0, SampleVolume::clusterSize - fill);
+
+		uint32_t offset = SectorOf(c.first + c.done);
+		ReleaseSector(offset);
+		EraseFlash(offset, FLASH_SECTOR_SIZE);
+		ProgramFlash(offset, sector, FLASH_SECTOR_SIZE);
+		if (memcmp((const void *)(XIP_NOCACHE_NOALLOC_BASE + offset), sector, FLASH_SECTOR_SIZE))
+		{
+			c.failed = true;
+			return;
+		}
+		c.done++;
+	}
+
+	void WriteCatalogue(const SampleBank &bank)
+	{
+		Catalogue &catalogue = *(Catalogue *)sector;
+		memset(sector, 0xFF, FLASH_SECTOR_SIZE);
+		uint32_t numFiles = bank.files.size();
+		for (uint32_t i = 0; i < numFiles; i++)
+		{
+			catalogue.address[i] = bank.addresses[i];
+			memcpy(catalogue.name[i], bank.names[i].data(), 11);
+		}
+		catalogue.start = numFiles ? bank.addresses[0] : 0;
+		catalogue.numFiles = numFiles;
+		catalogue.tableMagic = bankTableMagic;
+		catalogue.keptMagic = bankKeptMagic;
+		catalogue.numKept = numKept;
+		memcpy(catalogue.kept, kept, numKept * sizeof(KeptFile));
+		EraseFlash(HeaderSector(), FLASH_SECTOR_SIZE);
+		ProgramFlash(HeaderSector(), sector, FLASH_SECTOR_SIZE);
+	}
+
+	// 8.3 name as shown by the computer, such as "KICK.WAV"
+	static void PrintName(char out[13], const uint8_t name[11])
+	{
+		int n = 0;
+		for (int i = 0; i < 8 && name[i] != ' '; i++) out[n++] = char(name[i]);
+		if (name[8] != ' ') out[n++] = '.';
+		for (int i = 8; i < 11 && name[i] != ' '; i++) out[n++] = char(name[i]);
+		out[n] = 0;
+	}
+
+	// Data clusters in flash, and their flash offsets
+	bool InFlash(uint32_t cluster) const
+	{
+		return cluster >= SampleVolume::firstCluster && cluster < SampleVolume::firstCluster + realClusters;
+	}
+	static uint32_t SectorOf(uint32_t cluster) {return FirmwareEnd() + (cluster - SampleVolume::firstCluster) * FLASH_SECTOR_SIZE;}
+	static uint32_t ClusterOf(uint32_t offset) {return SampleVolume::firstCluster + (offset - FirmwareEnd()) / FLASH_SECTOR_SIZE;}
+
+	// Clusters after those in flash, mapped to a file's data
+	struct Alias
+	{
+		uint32_t cluster, size;
+		const uint8_t *data;
+	};
+
+	// A WAV file written to the drive in another format, being converted to
+	// 16-bit mono in free clusters
+	struct Conversion
+	{
+		uint32_t source; // first cluster of the original file
+		uint32_t first, size; // first cluster and length of the converted file
+		uint32_t done; // clusters written
+		WAVFile wav; // the original file
+		SamplePhase position = {}; // next sample to read from the original file
+		bool failed = false;
+
+		bool Finished() const {return failed || done == SampleVolume::ClustersFor(size);}
+	};
+
+	// Next sample of a file being converted, from its position in the original.
+	// Files at other sample rates are resampled to 48kHz here, once, with the
+	// windowed-sinc interpolator (its cutoff lowered to 48kHz's Nyquist frequency
+	// for files at up to 96kHz), rather than while playing.
+	int16_t NextConverted(Conversion &c)
+	{
+		const WAVFile &wav = c.wav;
+		uint32_t ratio = wav.RateRatio();
+		if (ratio == SampleInterpolator::unity)
+		{
+			return wav.Converted(c.position.index++);
+		}
+
+		// Samples read by the interpolator, with silence before the start
+		// (Converted gives silence after the end)
+		constexpr int before = SampleInterpolator::maxBefore;
+		int16_t window[SampleInterpolator::sincTaps];
+		for (int k = 0; k < SampleInterpolator::sincTaps; k++)
+		{
+			uint32_t index = c.position.index + k - before;
+			window[k] = (c.position.index + k >= uint32_t(before)) ? wav.Converted(index) : 0;
+		}
+		int16_t v = interpolator.Interpolate(window + before, c.position.fraction,
+											 SampleInterpolator::Sinc, SampleInterpolator::Bank(ratio));
+		c.position.Advance(ratio);
+		return v;
+	}
+
+	const Alias *FindAlias(uint32_t cluster) const
+	{
+		for (uint32_t i = 0; i < numAliases; i++)
+		{
+			const Alias &alias = aliases[i];
+			if (cluster >= alias.cluster && cluster < alias.cluster + SampleVolume::ClustersFor(alias.size)) return &alias;
+		}
+		return nullptr;
+	}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Flash layout: firmware, then WAV files, then the catalogue (see Catalogue)
+	// in the last sector. Offsets below are from the start of flash.
+
+	static uint32_t FirmwareEnd()
+	{
+		uint32_t end = uint32_t(uintptr_t(&__flash_binary_end) - XIP_BASE);
+		return (end + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	}
+
+	// Uploads over USB keep the last sector for the bank header
+	static uint32_t HeaderSector() {return PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;}
+
+	// Sectors used by the bank being played (empty range at the header sector if none)
+	void ActiveRange(uint32_t &activeStart, uint32_t &activeEnd)
+	{
+		const SampleBank &bank = banks.Read();
+		activeStart = activeEnd = HeaderSector();
+		for (uint32_t i = 0; i < bank.files.size(); i++)
+		{
+			uint32_t start, end;
+			FileSectors(bank, i, start, end);
+			activeStart = (i == 0) ? start : std::min(activeStart, start);
+			activeEnd = (i == 0) ? end : std::max(activeEnd, end);
+		}
+	}
+
+	// Sectors occupied by file i of bank
+	static void FileSectors(const SampleBank &bank, uint32_t i, uint32_t &start, uint32_t &end)
+	{
+		start = (bank.addresses[i] - XIP_BASE) & ~(FLASH_SECTOR_SIZE - 1);
+		end = (bank.addresses[i] - XIP_BASE + bank.sizes[i] + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+	}
+
+	// True if file i of bank has any data between flash offsets start and end
+	static bool Overlaps(const SampleBank &bank, uint32_t i, uint32_t start, uint32_t end)
+	{
+		uint32_t fileStart = bank.addresses[i] - XIP_BASE;
+		return fileStart < end && fileStart + bank.sizes[i] > start;
+	}
+
+	// Space either side of the bank being played, between the firmware and the header sector
+	void FreeSpace(uint32_t &gapAbove, uint32_t &gapBelow)
+	{
+		uint32_t low = FirmwareEnd(), high = HeaderSector();
+		uint32_t activeStart, activeEnd;
+		ActiveRange(activeStart, activeEnd);
+		gapAbove = (activeEnd < high) ? high - std::max(activeEnd, low) : 0;
+		gapBelow = (activeStart > low) ? std::min(activeStart, high) - low : 0;
+	}
+
+	// Make the back buffer of banks the one played, and wait until ProcessSample
+	// has stopped using the previous one, so it can be reused
+	void PublishBank()
+	{
+		banks.Publish();
+		WaitSamples(2);
+	}
+
+	void PublishBank(uint32_t wavStartAddress, uint32_t numFiles)
+	{
+		LoadBank(wavStartAddress, numFiles, banks.Write());
+		PublishBank();
+	}
+
+	void WaitSamples(uint32_t n)
+	{
+		uint32_t start = SampleCounter();
+		while (SampleCounter() - start < n)
+		{
+			tight_loop_contents();
+		}
+	}
+
+	// Erase and program flash, with playback continuing from RAM meanwhile.
+	// Interrupts are disabled on this core only; the audio interrupt on core 0 keeps running.
+	void EraseFlash(uint32_t offset, uint32_t length)
+	{
+		BeginFlashOperation();
+		uint32_t ints = save_and_disable_interrupts();
+		flash_range_erase(offset, length);
+		restore_interrupts(ints);
+		EndFlashOperation();
+	}
+
+	void ProgramFlash(uint32_t offset, const uint8_t *data, uint32_t length)
+	{
+		BeginFlashOperation();
+		uint32_t ints = save_and_disable_interrupts();
+		flash_range_program(offset, data, length);
+		restore_interrupts(ints);
+		EndFlashOperation();
+	}
+
+	// Copy the samples just ahead of the playback position to RAM, and switch
+	// ProcessSample to play from this copy, so that it does not read flash
+	void BeginFlashOperation()
+	{
+		// Stop ProcessSample moving to another file, and wait until it has done so
+		flashState = FlashHold;
+		WaitSamples(2);
+
+		// Let the last block read ahead by DMA finish, as flash can't be read while written
+		while (stream.Busy())
+		{
+			tight_loop_contents();
+		}
+
+		const SampleBank &bank = banks.Read();
+		uint32_t count = 0;
+		if (playFile < bank.files.size() && bank.files[playFile].NumSamples())
+		{
+			const WAVFile &wav = bank.files[playFile];
+			uint32_t numSamples = wav.NumSamples();
+
+			// Start a little before the playback position, for the samples
+			// read before it by the interpolator
+			uint32_t pos = (playPosition < numSamples) ? playPosition : 0;
+			for (int k = 0; k < SampleInterpolator::maxBefore; k++)
+			{
+				pos = (pos > 0) ? pos - 1 : numSamples - 1;
+			}
+			bridgeStart = pos;
+			count = std::min(numSamples, bridgeSize);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				bridge[i] = wav[pos];
+				if (++pos >= numSamples) pos = 0;
+			}
+		}
+		bridgeCount = count;
+
+		__dmb(); // copy complete before ProcessSample uses it
+		flashState = FlashBusy;
+	}
+
+	void EndFlashOperation()
+	{
+		flashState = FlashIdle;
+	}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Audio, on core 0
+
+	// Sample at a fractional position in the current file, from the RAM copy
+	int16_t BridgeInterpolate(SamplePhase position, uint32_t numSamples, SampleInterpolator::Quality quality)
+	{
+		uint32_t before = SampleInterpolator::Before(quality), after = SampleInterpolator::After(quality);
+		if (position.index >= numSamples)
+		{
+			return 0;
+		}
+
+		// Offset in the copy of the first sample read
+		uint32_t i = position.index;
+		for (uint32_t k = 0; k < before; k++)
+		{
+			i = (i > 0) ? i - 1 : numSamples - 1;
+		}
+		uint32_t offset = (i >= bridgeStart) ? i - bridgeStart : i + numSamples - bridgeStart;
+
+		// Past the end of the copy: flash operation took longer than expected
+		if (offset + before + after >= bridgeCount && bridgeCount < numSamples)
+		{
+			bridgeMisses++;
+			return 0;
+		}
+
+		int16_t window[SampleInterpolator::sincTaps];
+		for (uint32_t k = 0; k <= before + after; k++)
+		{
+			window[k] = bridge[offset];
+			if (++offset >= bridgeCount) offset = 0; // whole file copied
+		}
+		return interpolator.Interpolate(window + before, position.fraction, quality, sincBank);
+	}
+
+	virtual void ProcessSample()
+	{
+		////////////////////////////////////////////////////////////////////////////////
+		// If the switch is held down for >2s, reboot into UF2 upload mode
+
+		// count number of samples that switch is held down
+		switchDownCount = (SwitchVal() == Down) ? switchDownCount + 1 : 0;
+
+		// Light LEDs as switch is held
+		LedOn(4, switchDownCount>0);
+		LedOn(2, switchDownCount>32000);
+		LedOn(0, switchDownCount>64000);
+
+		// If we reach 2 seconds, exit from this ComputerCard and reboot into USB bootloader
+		// (not while flash is being written)
+		if (switchDownCount >= 96000 && !uploading && !driveWriting)
+		{
+			Abort();
+		}
+
+		// Top right LED shows USB upload, or writing to the USB drive, in progress
+		LedOn(1, uploading || driveWriting);
+
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Switch to newly uploaded samples
+		const SampleBank &bank = banks.Read();
+		if (banks.Version() != bankVersion)
+		{
+			bankVersion = banks.Version();
+			currentFile = 0;
+			phase = SamplePhase();
+			incrementFile = ~0u; // recalculate increment for the new files
+			streamFile = ~0u; // and read ahead from the new files, even if at the same addresses
+			LedOff(5);
+		}
+		unsigned numFiles = bank.files.size();
+
+		
+		////////////////////////////////////////////////////////////////////////////////
+		// If we failed to load any WAV files, turn on bottom right LED and 
+		if (numFiles == 0)
+		{
+			LedOn(5);
+			return;
+		}
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Wait for the sample data CRC check to finish before playing.
+		// Blink bottom right LED while checking, light it if the check fails.
+		if (bankState == BankChecking)
+		{
+			if (BackgroundCRCBusy())
+			{
+				return;
+			}
+			bankState = (BackgroundCRCResult() == bankCRC) ? BankValid : BankCorrupt;
+			LedOn(5, bankState == BankCorrupt);
+		}
+		if (bankState != BankValid)
+		{
+			return;
+		}
+		
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Play audio
+
+		const WAVFile &wav = bank.files[currentFile];
+
+		// Advance playback position, resampling from original sample rate to 48kHz
+		// Speed controlled by Knob Y + CV in 2
+		// speed=1024 gives original playback speed
+		uint32_t speed = std::max(0l, KnobVal(Y) + CVIn2());
+		
+		// The phase increment (and sinc filter bank) only change with the speed or file,
+		// so are recalculated only then, rather than every sample. At most 8x, the
+		// highest the sinc banks cover (reached only by files above 48kHz).
+		if (speed != incrementSpeed || currentFile != incrementFile)
+		{
+			incrementSpeed = speed;
+			incrementFile = currentFile;
+			increment = std::min(SampleInterpolator::PhaseIncrement(wav.RateRatio(), speed), SampleInterpolator::maxIncrement);
+			sincBank = SampleInterpolator::Bank(increment);
+		}
+		phase.Advance(increment);
+
+		// Interpolation quality set by Knob X: linear, Hermite, then windowed sinc
+		SampleInterpolator::Quality quality = SampleInterpolator::Quality((KnobVal(X) * SampleInterpolator::numQualities) >> 12);
+		
+		// If we go past the end of the file...
+		if (phase.index >= wav.NumSamples())
+		{
+			// Wrap the sample index
+			phase.index -= wav.NumSamples();
+    
+			// Only change file while flash is not being written; otherwise keep
+			// looping the current file, as only its upcoming samples are copied to RAM
+			if (flashState == FlashIdle)
+			{
+				// At the end of a sample, if switch is up, advance through samples in turn
+				if (SwitchVal() == Up)
+				{
+					currentFile++;
+					if (currentFile >= numFiles)
+					{
+						currentFile = 0;
+					}
+				}
+				else // If switch not up, select next sample with main knob + CV in 1
+				{
+					int32_t kb = KnobVal(Main) + CVIn1();
+					if (kb < 0) kb = 0;
+					if (kb > 4095) kb = 4095;
+					
+					currentFile = (numFiles*kb)>>12;
+				}
+			}
+		}
+
+		// Samples are read ahead of the playback position into RAM, by DMA
+		if (currentFile != streamFile)
+		{
+			streamFile = currentFile;
+			stream.Start(0, bank.files[currentFile].Samples(), bank.files[currentFile].NumSamples());
+		}
+
+		// Look up interpolated sample, from the RAM copy if flash is being written.
+		// No more reads ahead once core 1 is about to write flash.
+		int16_t sample;
+		if (flashState == FlashBusy)
+		{
+			sample = BridgeInterpolate(phase, bank.files[currentFile].NumSamples(), quality);
+		}
+		else
+		{
+			if (flashState == FlashIdle) stream.Prefetch();
+			sample = stream.Interpolate(0, interpolator, phase, quality, sincBank);
+		}
+
+		// Playback position, for the RAM copy made by core 1
+		playFile = currentFile;
+		playPosition = phase.index;
+
+		sample >>= 4; // convert from 16-bit WAV to 12-bit DAC output
+
+		// Output on both audio outputs
+		AudioOut1(sample); 
+		AudioOut2(sample);
+	}
+
+private:
+	// Marker word in flash, after WAV start address and number of files,
+	// indicating that sample data length and CRC follow
+	static constexpr uint32_t bankCRCMagic = 0x31435243; // 'CRC1'
+	// Marker word in flash, indicating that files are listed in the catalogue table
+	static constexpr uint32_t bankTableMagic = 0x31425446; // 'FTB1'
+	// Marker word in flash, indicating that files not played are listed in the catalogue
+	static constexpr uint32_t bankKeptMagic = 0x3154504B; // 'KPT1'
+	static constexpr uint32_t maxFiles = Catalogue::maxFiles;
+	static constexpr uint32_t maxKept = Catalogue::maxKept;
+
+	enum BankState {BankChecking, BankValid, BankCorrupt};
+	volatile BankState bankState;
+	uint16_t bankCRC;
+
+	// Samples being played: written by core 1, read by ProcessSample
+	DoubleBuffer<SampleBank> banks;
+	uint32_t bankVersion;
+
+	// Playback position and increment in the current file
+	SamplePhase phase;
+	uint32_t increment, incrementSpeed;
+	unsigned incrementFile;
+	int sincBank;
+	unsigned currentFile;
+
+	// Interpolator, and the cost of each quality measured at startup (static, as too large for the stack)
+	static SampleInterpolator interpolator;
+	uint32_t interpolationCycles[SampleInterpolator::numQualities] = {};
+	volatile int32_t measureSink = 0;
+
+	// Samples read ahead of playback, from flash to RAM (static, as too large for the stack),
+	// and the counts of reads last reported by SendInfo
+	static SampleStream<1> stream;
+	unsigned streamFile;
+	uint32_t infoBlocks = 0, infoMisses = 0;
+
+	int switchDownCount;
+
+	// Flash writing state, set by core 1. While FlashHold, ProcessSample stays on
+	// the current file; while FlashBusy, it also plays from the RAM copy.
+	enum FlashState {FlashIdle, FlashHold, FlashBusy};
+	volatile FlashState flashState;
+	volatile unsigned playFile;
+	volatile uint32_t playPosition;
+
+	// RAM copy of upcoming samples: 170ms at 48kHz and original speed,
+	// longer than the typical 45ms sector erase
+	// (static, as too large for the stack)
+	static constexpr uint32_t bridgeSize = 8192;
+	static int16_t bridge[bridgeSize];
+	volatile uint32_t bridgeStart, bridgeCount;
+	volatile uint32_t bridgeMisses; // samples that were not in the RAM copy
+
+	volatile bool uploading;
+
+	// USB upload state, on core 1
+	uint8_t command[13];
+	uint32_t commandLength = 0;
+	bool receiving = false, discarding = false, uploadLive = false;
+	uint32_t uploadStart = 0, uploadOffset = 0, uploadLength = 0, uploadFiles = 0;
+	uint16_t uploadCRC = 0, runningCRC = 0;
+	uint32_t received = 0, sectorFill = 0;
+	uint32_t startTime = 0, lastDataTime = 0, startMisses = 0;
+	alignas(4) static uint8_t sector[FLASH_SECTOR_SIZE];
+
+	// USB drive, on core 1. Enough clusters for all of flash, and again for
+	// files presented after those in flash (each using at most one extra cluster).
+	static constexpr uint32_t flashSectors = PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE;
+	using SampleVolume = FATVolume<std::max<uint32_t>(4085, 2 * flashSectors + maxFiles + 1)>;
+	static SampleVolume volume;
+	static Alias aliases[maxFiles + 1];
+	static Conversion conversions[maxFiles];
+	static char info[1536];
+	uint32_t realClusters = 0, numAliases = 0, numConversions = 0;
+	KeptFile kept[maxKept]; // files on the drive that are not played
+	uint32_t numKept = 0;
+	static constexpr uint32_t driveIdleTime = 1000000; // us without writes, before files are played
+	uint32_t lastDriveWrite = 0;
+	bool driveChanged = false, ejected = false, mediaChanged = false, converting = false;
+	volatile bool driveWriting = false; // files written but not yet played
+
+	static uint32_t GetU32(const uint8_t *p)
+	{
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+	}
+};
+
+int16_t SampleUpload::bridge[SampleUpload::bridgeSize];
+SampleInterpolator SampleUpload::interpolator;
+SampleStream<1> SampleUpload::stream;
+alignas(4) uint8_t SampleUpload::sector[FLASH_SECTOR_SIZE];
+SampleUpload::SampleVolume SampleUpload::volume;
+SampleUpload::Alias SampleUpload::aliases[SampleUpload::maxFiles + 1];
+SampleUpload::Conversion SampleUpload::conversions[SampleUpload::maxFiles];
+char SampleUpload::info[1536];
+
+
+// TinyUSB mass storage class callbacks, for the USB drive
+
+static SampleUpload *Card()
+{
+	return (SampleUpload *)ComputerCard::ThisPtr();
+}
+
+// Invoked when USB is connected
+void tud_mount_cb(void)
+{
+	Card()->MountDrive();
+}
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
+{
+	(void)lun;
+	memcpy(vendor_id, "MTM     ", 8);
+	memcpy(product_id, "Computer Samples", 16);
+	memcpy(product_rev, "1.0 ", 4);
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun)
+{
+	return Card()->DriveReady(lun);
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
+{
+	(void)lun;
+	*block_count = Card()->DriveSectors();
+	*block_size = 512;
+}
+
+// Invoked for SCSI start/stop unit: eject, when load_eject is set and start is not
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
+{
+	(void)lun;
+	(void)power_condition;
+	if (load_eject && !start)
+	{
+		Card()->EjectDrive();
+	}
+	return true;
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+	(void)lun;
+	(void)offset; // always zero, as the endpoint buffer is a whole number of sectors
+	return Card()->ReadSectors(lba, (uint8_t *)buffer, bufsize);
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+{
+	int32_t result = Card()->WriteSectors(lba, buffer, bufsize);
+	(void)offset;
+	if (result < 0)
+	{
+		tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00); // write error
+	}
+	return result;
+}
+
+// Other SCSI commands: allow the computer to prevent removal, which it does
+// while the drive is mounted, and reject anything else
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, uint16_t bufsize)
+{
+	(void)buffer;
+	(void)bufsize;
+	if (scsi_cmd[0] == SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL)
+	{
+		return 0;
+	}
+	tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00); // invalid command
+	return -1;
+}
+
+
+int main()
+{
+	SampleUpload su;
+	su.Run();
+
+	
+	// We only get here if Abort() called in the SampleUpload ProcessSample().
+	// Reboot into UF2 upload mode
+	rom_reset_usb_boot(1<<11, 0); // pin 11 (top right LED) is USB activity
+	return 0;
+}
@@ -43,12 +43,14 @@ class SecondCore : public ComputerCard
 	// Variables for communication between the two cores
 	volatile int16_t out; // output from slow core to 48kHz core.
 	volatile uint32_t sampleCount; // count of number of audio samples per 'slow core' loop
+	volatile uint32_t loopSamples; // audio samples taken by the last 'slow core' loop, shown on the LEDs
 	
 public:
 	SecondCore()
 	{
 		out = 0;
 		sampleCount = 0;
+		loopSamples = 0;
 		// Start the second core
 		multicore_launch_core1(core1);
 	}
@@ -100,14 +102,10 @@ public:
 				phase -= twopi;
 			}
 
-			// For debugging, turn on LEDs to get some indication of how many
-			// audio samples at 48kHz are taken by each loop of this routine
-			LedOn(0, samplesPassed & 0x01); // Top left LED: up to 1 sample
-			LedOn(1, samplesPassed & 0x02); // Top right LED: up to 3 samples
-			LedOn(2, samplesPassed & 0x04); // Middle left LED: up to 7 samples
-			LedOn(3, samplesPassed & 0x08); // Middle right LED: up to 15 samples
-			LedOn(4, samplesPassed & 0x10); // Bottom left LED: up to 31 samples
-			LedOn(5, samplesPassed & 0x20); // Bottom right LED: up to 63 samples
+			// For debugging, pass the number of audio samples at 48kHz taken by
+			// this loop to ProcessSample, which shows it on the LEDs
+			// (LEDs are set only from ProcessSample's core)
+			loopSamples = samplesPassed;
 		}
 	}
 
@@ -121,6 +119,15 @@ public:
 		AudioOut1(out);
 		AudioOut2(out);
 
+		// Show the samples taken by each loop of the second core, in binary
+		uint32_t samplesPassed = loopSamples;
+		LedOn(0, samplesPassed & 0x01); // Top left LED: up to 1 sample
+		LedOn(1, samplesPassed & 0x02); // Top right LED: up to 3 samples
+		LedOn(2, samplesPassed & 0x04); // Middle left LED: up to 7 samples
+		LedOn(3, samplesPassed & 0x08); // Middle right LED: up to 15 samples
+		LedOn(4, samplesPassed & 0x10); // Bottom left LED: up to 31 samples
+		LedOn(5, samplesPassed & 0x20); // Bottom right LED: up to 63 samples
+
 		// Increment sample count to provide time reference independent
 		// of the execution 
 		sampleCount++;
@@ -0,0 +1,295 @@
+#include "ComputerCard.h"
+#include "pico/multicore.h"
+#include "tusb.h"
+#include "USBAudio.h"
+
+
+
+/*
+
+   ComputerCard USB audio interface example
+
+   The Workshop System Computer acts as a two-in, two-out USB audio
+   interface (USB Audio Class 2.0, 48kHz, 16-bit), which needs no
+   drivers on macOS, Linux, Windows 10 and later, iOS or Android.
+   As the Computer's jacks are DC-coupled, this can also send and
+   receive CV.
+
+   Host to Computer (playback):
+   - Audio out 1 / 2: left / right channel
+   - CV out 1 / 2:    left / right channel, at 16-bit precision, uncalibrated
+
+   Computer to host (recording), chosen by the switch:
+   - Up or middle: Audio in 1 / 2
+   - Down:         CV in 1 / 2
+
+   LEDs:
+   - Top left / right:       playback / recording streams active
+   - Middle left / right:    playback level, left / right
+   - Bottom left:            lit for 0.5s after a playback buffer underrun
+   - Bottom right:           flashes to show the card is running
+
+
+   The Computer's sample rate is set by its own clock, which differs slightly
+   from the host's. Playback uses an asynchronous endpoint: the Computer
+   measures how many of its samples pass per USB frame (USBAudioFeedback),
+   and reports this to the host through the feedback endpoint, so that the
+   host sends audio at the Computer's rate. The playback buffer level is also
+   held at a set latency by a fixed-point sample-rate converter (AsyncResampler),
+   which absorbs any remaining drift. Recording sends, each USB frame, the
+   samples captured since the last, so follows the Computer's clock directly.
+
+   USB is handled on core 1. Samples pass between cores through SPSCQueues.
+
+ */
+
+
+class USBAudioInterface : public ComputerCard
+{
+public:
+	// Playback latency, and the buffer size that holds it (a power of two)
+	static constexpr uint32_t playbackLatency = 96; // frames, 2ms
+	static constexpr uint32_t playbackBufferSize = 512; // frames
+
+	USBAudioInterface()
+	{
+		underrunTimer = 0;
+		lastUnderruns = 0;
+		wasPlaying = false;
+		resampler.SetTargetLevel(playbackLatency);
+
+		// Start the second core
+		multicore_launch_core1(core1);
+	}
+
+	// Boilerplate static function to call member function as second core
+	static void core1()
+	{
+		((USBAudioInterface *)ThisPtr())->USBCore();
+	}
+
+	// Code for second RP2040 core. Blocking.
+	void USBCore()
+	{
+		AudioFrame buffer[48];
+
+		// Initialise TinyUSB, with start-of-frame callbacks for feedback
+		tusb_init();
+		tud_sof_cb_enable(true);
+
+		while (1)
+		{
+			tud_task();
+
+			// Host to Computer: move received frames into the playback buffer.
+			// While stopped, frames are discarded, and ProcessSample empties the buffer.
+			uint32_t available;
+			while ((available = tud_audio_available()) >= sizeof(AudioFrame))
+			{
+				if (available > sizeof(buffer)) available = sizeof(buffer);
+				uint32_t frames = tud_audio_read(buffer, available) / sizeof(AudioFrame);
+				if (!playing) continue;
+				for (uint32_t i = 0; i < frames; i++)
+				{
+					playbackBuffer.Push(buffer[i]);
+				}
+			}
+
+			// Computer to host: send frames captured since the last pass
+			if (recording)
+			{
+				uint32_t frames = 0;
+				while (frames < 48 && recordBuffer.Pop(buffer[frames]))
+				{
+					frames++;
+				}
+				if (frames > 0)
+				{
+					tud_audio_write(buffer, uint16_t(frames * sizeof(AudioFrame)));
+				}
+			}
+		}
+	}
+
+	// 48kHz audio processing function; runs on audio core
+	virtual void ProcessSample()
+	{
+		// Playback
+		AudioFrame out;
+		bool play = playing;
+		if (!play)
+		{
+			// Stream stopped: empty buffer once core 1 has stopped filling it
+			// (playing is set and cleared on core 1, between its pushes), and
+			// wait to refill to the latency
+			if (wasPlaying) playbackBuffer.Clear();
+			resampler.Reset();
+		}
+		wasPlaying = play;
+		resampler.Process(playbackBuffer, out);
+
+		AudioOut1(out.left >> 4);
+		AudioOut2(out.right >> 4);
+		CVOut1Precise(int32_t(out.left) << 3);
+		CVOut2Precise(int32_t(out.right) << 3);
+
+		// Recording
+		if (recording)
+		{
+			AudioFrame in;
+			if (SwitchVal() == Switch::Down)
+			{
+				in.left = int16_t(CVIn1() << 4);
+				in.right = int16_t(CVIn2() << 4);
+			}
+			else
+			{
+				in.left = int16_t(AudioIn1() << 4);
+				in.right = int16_t(AudioIn2() << 4);
+			}
+			recordBuffer.Push(in);
+		}
+
+		// LEDs
+		if (resampler.Underruns() != lastUnderruns)
+		{
+			lastUnderruns = resampler.Underruns();
+			underrunTimer = 24000;
+		}
+		if (underrunTimer > 0)
+		{
+			underrunTimer--;
+		}
+		LedOn(0, playing);
+		LedOn(1, recording);
+		LedBrightness(2, uint16_t(abs(out.left) >> 3));
+		LedBrightness(3, uint16_t(abs(out.right) >> 3));
+		LedOn(4, underrunTimer > 0);
+
+		static int32_t frame = 0;
+		LedOn(5, (frame >> 13) & 1);
+		frame++;
+	}
+
+	// Streaming state, set by the USB core
+	static volatile bool playing, recording;
+
+	// Feedback, measured on the USB core at each start of frame
+	static USBAudioFeedback<> feedback;
+
+private:
+	// Host to Computer: written by USB core, read by audio core
+	SPSCQueue<AudioFrame, playbackBufferSize> playbackBuffer;
+	AsyncResampler resampler;
+
+	// Computer to host: written by audio core, read by USB core
+	SPSCQueue<AudioFrame, 256> recordBuffer;
+
+	uint32_t underrunTimer, lastUnderruns;
+	bool wasPlaying;
+};
+
+volatile bool USBAudioInterface::playing = false;
+volatile bool USBAudioInterface::recording = false;
+USBAudioFeedback<> USBAudioInterface::feedback;
+
+
+// TinyUSB audio class callbacks
+
+// Invoked at each USB start of frame (1ms)
+void tud_sof_cb(uint32_t frame_count)
+{
+	(void)frame_count;
+	if (USBAudioInterface::feedback.Frame(ComputerCard::ThisPtr()->SampleCounter()))
+	{
+		tud_audio_fb_set(USBAudioInterface::feedback.Value());
+	}
+}
+
+// Feedback value is set by tud_sof_cb, rather than calculated by TinyUSB
+void tud_audio_feedback_params_cb(uint8_t func_id, uint8_t alt_itf, audio_feedback_params_t *feedback_param)
+{
+	(void)func_id;
+	(void)alt_itf;
+	feedback_param->method = AUDIO_FEEDBACK_METHOD_DISABLED;
+}
+
+// Invoked when host selects a streaming interface alternate setting: 1 to start, 0 to stop
+bool tud_audio_set_itf_cb(uint8_t rhport, tusb_control_request_t const *p_request)
+{
+	(void)rhport;
+	uint8_t itf = uint8_t(tu_u16_low(p_request->wIndex));
+	bool streaming = tu_u16_low(p_request->wValue) != 0;
+
+	if (itf == ITF_NUM_AUDIO_STREAMING_OUT)
+	{
+		USBAudioInterface::playing = streaming;
+		if (streaming)
+		{
+			USBAudioInterface::feedback.Reset();
+			tud_audio_fb_set(USBAudioInterface::feedback.Value());
+		}
+	}
+	else if (itf == ITF_NUM_AUDIO_STREAMING_IN)
+	{
+		USBAudioInterface::recording = streaming;
+	}
+	return true;
+}
+
+bool tud_audio_set_itf_close_EP_cb(uint8_t rhport, tusb_control_request_t const *p_request)
+{
+	(void)rhport;
+	uint8_t itf = uint8_t(tu_u16_low(p_request->wIndex));
+	if (itf == ITF_NUM_AUDIO_STREAMING_OUT) USBAudioInterface::playing = false;
+	if (itf == ITF_NUM_AUDIO_STREAMING_IN) USBAudioInterface::recording = false;
+	return true;
+}
+
+// Invoked for GET requests to the clock source: fixed 48kHz sample rate, always valid
+bool tud_audio_get_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p_request)
+{
+	audio_control_request_t const *request = (audio_control_request_t const *)p_request;
+
+	if (request->bEntityID != UAC2_ENTITY_CLOCK) return false;
+
+	if (request->bControlSelector == AUDIO_CS_CTRL_SAM_FREQ)
+	{
+		if (request->bRequest == AUDIO_CS_REQ_CUR)
+		{
+			audio_control_cur_4_t rate = {(int32_t)tu_htole32(CFG_TUD_AUDIO_FUNC_1_SAMPLE_RATE)};
+			return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &rate, sizeof(rate));
+		}
+		if (request->bRequest == AUDIO_CS_REQ_RANGE)
+		{
+			audio_control_range_4_n_t(1) range;
+			range.wNumSubRanges = tu_htole16(1);
+			range.subrange[0].bMin = (int32_t)tu_htole32(CFG_TUD_AUDIO_FUNC_1_SAMPLE_RATE);
+			range.subrange[0].bMax = (int32_t)tu_htole32(CFG_TUD_AUDIO_FUNC_1_SAMPLE_RATE);
+			range.subrange[0].bRes = 0;
+			return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &range, sizeof(range));
+		}
+	}
+	else if (request->bControlSelector == AUDIO_CS_CTRL_CLK_VALID && request->bRequest == AUDIO_CS_REQ_CUR)
+	{
+		audio_control_cur_1_t valid = {1};
+		return tud_audio_buffer_and_schedule_control_xfer(rhport, p_request, &valid, sizeof(valid));
+	}
+	return false;
+}
+
+// Invoked for SET requests; there are no settable controls
+bool tud_audio_set_req_entity_cb(uint8_t rhport, tusb_control_request_t const *p_request, uint8_t *pBuff)
+{
+	(void)rhport;
+	(void)p_request;
+	(void)pBuff;
+	return false;
+}
+
+
+int main()
+{
+	USBAudioInterface ua;
+	ua.Run();
+}
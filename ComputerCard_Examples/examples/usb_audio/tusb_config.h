@@ -0,0 +1,144 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef _TUSB_CONFIG_H_
+#define _TUSB_CONFIG_H_
+
+#include "usb_descriptors.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------
+// COMMON CONFIGURATION
+//--------------------------------------------------------------------
+
+// defined by board.mk
+#ifndef CFG_TUSB_MCU
+  #error CFG_TUSB_MCU must be defined
+#endif
+
+// RHPort number used for device can be defined by board.mk, default to port 0
+#ifndef BOARD_DEVICE_RHPORT_NUM
+  #define BOARD_DEVICE_RHPORT_NUM     0
+#endif
+
+// RHPort max operational speed can defined by board.mk
+// Default to Highspeed for MCU with internal HighSpeed PHY (can be port specific), otherwise FullSpeed
+#ifndef BOARD_DEVICE_RHPORT_SPEED
+  #if (CFG_TUSB_MCU == OPT_MCU_LPC18XX || CFG_TUSB_MCU == OPT_MCU_LPC43XX || CFG_TUSB_MCU == OPT_MCU_MIMXRT10XX || \
+       CFG_TUSB_MCU == OPT_MCU_NUC505  || CFG_TUSB_MCU == OPT_MCU_CXD56 || CFG_TUSB_MCU == OPT_MCU_SAMX7X)
+    #define BOARD_DEVICE_RHPORT_SPEED   OPT_MODE_HIGH_SPEED
+  #else
+    #define BOARD_DEVICE_RHPORT_SPEED   OPT_MODE_FULL_SPEED
+  #endif
+#endif
+
+// Device mode with rhport and speed defined by board.mk
+#if   BOARD_DEVICE_RHPORT_NUM == 0
+  #define CFG_TUSB_RHPORT0_MODE     (OPT_MODE_DEVICE | BOARD_DEVICE_RHPORT_SPEED)
+#elif BOARD_DEVICE_RHPORT_NUM == 1
+  #define CFG_TUSB_RHPORT1_MODE     (OPT_MODE_DEVICE | BOARD_DEVICE_RHPORT_SPEED)
+#else
+  #error "Incorrect RHPort configuration"
+#endif
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS               OPT_OS_NONE
+#endif
+
+// CFG_TUSB_DEBUG is defined by compiler in DEBUG build
+// #define CFG_TUSB_DEBUG           0
+
+/* USB DMA on some MCUs can only access a specific SRAM region with restriction on alignment.
+ * Tinyusb use follows macros to declare transferring memory so that they can be put
+ * into those specific section.
+ * e.g
+ * - CFG_TUSB_MEM SECTION : __attribute__ (( section(".usb_ram") ))
+ * - CFG_TUSB_MEM_ALIGN   : __attribute__ ((aligned(4)))
+ */
+#ifndef CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION
+#endif
+
+#ifndef CFG_TUSB_MEM_ALIGN
+#define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(4)))
+#endif
+
+//--------------------------------------------------------------------
+// DEVICE CONFIGURATION
+//--------------------------------------------------------------------
+
+#ifndef CFG_TUD_ENDPOINT0_SIZE
+#define CFG_TUD_ENDPOINT0_SIZE    64
+#endif
+
+//------------- CLASS -------------//
+#define CFG_TUD_HID               0
+#define CFG_TUD_CDC               0
+#define CFG_TUD_MSC               0
+#define CFG_TUD_MIDI              0
+#define CFG_TUD_VENDOR            0
+#define CFG_TUD_AUDIO             1
+
+//--------------------------------------------------------------------
+// AUDIO CLASS DRIVER CONFIGURATION (TinyUSB 0.18 and later)
+//--------------------------------------------------------------------
+
+// 48kHz, 16-bit, two channels in each direction
+#define CFG_TUD_AUDIO_FUNC_1_SAMPLE_RATE             48000
+#define CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX           2
+#define CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX           2
+#define CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_TX   2
+#define CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_RX   2
+#define CFG_TUD_AUDIO_FUNC_1_RESOLUTION_TX           16
+#define CFG_TUD_AUDIO_FUNC_1_RESOLUTION_RX           16
+
+#define CFG_TUD_AUDIO_FUNC_1_DESC_LEN                TUD_AUDIO_COMPUTER_DESC_LEN
+#define CFG_TUD_AUDIO_FUNC_1_N_AS_INT                2
+#define CFG_TUD_AUDIO_FUNC_1_CTRL_BUF_SZ             64
+
+// Largest packet: one more sample per 1ms frame than nominal, for clock drift
+#define AUDIO_EP_SIZE(_channels, _bytes)             ((CFG_TUD_AUDIO_FUNC_1_SAMPLE_RATE / 1000 + 1) * (_channels) * (_bytes))
+
+// Computer to host
+#define CFG_TUD_AUDIO_ENABLE_EP_IN                   1
+#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX            AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX, CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_TX)
+#define CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ         (4 * CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX)
+// Asynchronous: each packet holds the samples written since the last, as paced by the Computer's clock
+#define CFG_TUD_AUDIO_EP_IN_FLOW_CONTROL             0
+
+// Host to Computer, with feedback endpoint
+#define CFG_TUD_AUDIO_ENABLE_EP_OUT                  1
+#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX           AUDIO_EP_SIZE(CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX, CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_RX)
+#define CFG_TUD_AUDIO_FUNC_1_EP_OUT_SW_BUF_SZ        (4 * CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX)
+#define CFG_TUD_AUDIO_ENABLE_FEEDBACK_EP             1
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_CONFIG_H_ */
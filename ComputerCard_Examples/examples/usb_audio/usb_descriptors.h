@@ -0,0 +1,95 @@
+#ifndef USB_DESCRIPTORS_H_
+#define USB_DESCRIPTORS_H_
+
+/*
+  USB Audio Class 2.0 descriptors: two channels from host to Computer, with
+  an asynchronous feedback endpoint, and two channels from Computer to host,
+  both clocked by the Computer's internal 48kHz clock.
+ */
+
+// Unit and terminal IDs
+#define UAC2_ENTITY_CLOCK               0x04
+#define UAC2_ENTITY_OUT_INPUT_TERMINAL  0x01 // USB stream from host
+#define UAC2_ENTITY_OUT_OUTPUT_TERMINAL 0x02 // Computer outputs
+#define UAC2_ENTITY_IN_INPUT_TERMINAL   0x11 // Computer inputs
+#define UAC2_ENTITY_IN_OUTPUT_TERMINAL  0x13 // USB stream to host
+
+enum
+{
+	ITF_NUM_AUDIO_CONTROL = 0,
+	ITF_NUM_AUDIO_STREAMING_OUT,
+	ITF_NUM_AUDIO_STREAMING_IN,
+	ITF_NUM_TOTAL
+};
+
+#define TUD_AUDIO_COMPUTER_DESC_LEN (TUD_AUDIO_DESC_IAD_LEN\
+	+ TUD_AUDIO_DESC_STD_AC_LEN\
+	+ TUD_AUDIO_DESC_CS_AC_LEN\
+	+ TUD_AUDIO_DESC_CLK_SRC_LEN\
+	+ TUD_AUDIO_DESC_INPUT_TERM_LEN\
+	+ TUD_AUDIO_DESC_OUTPUT_TERM_LEN\
+	+ TUD_AUDIO_DESC_INPUT_TERM_LEN\
+	+ TUD_AUDIO_DESC_OUTPUT_TERM_LEN\
+	/* Host to Computer: alternate 0 (no bandwidth) and 1 (streaming) */\
+	+ TUD_AUDIO_DESC_STD_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_STD_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_CS_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_TYPE_I_FORMAT_LEN\
+	+ TUD_AUDIO_DESC_STD_AS_ISO_EP_LEN\
+	+ TUD_AUDIO_DESC_CS_AS_ISO_EP_LEN\
+	+ TUD_AUDIO_DESC_STD_AS_ISO_FB_EP_LEN\
+	/* Computer to host: alternate 0 (no bandwidth) and 1 (streaming) */\
+	+ TUD_AUDIO_DESC_STD_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_STD_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_CS_AS_INT_LEN\
+	+ TUD_AUDIO_DESC_TYPE_I_FORMAT_LEN\
+	+ TUD_AUDIO_DESC_STD_AS_ISO_EP_LEN\
+	+ TUD_AUDIO_DESC_CS_AS_ISO_EP_LEN)
+
+#define TUD_AUDIO_COMPUTER_DESCRIPTOR(_stridx, _epout, _epfb, _epin) \
+	/* Standard Interface Association Descriptor (IAD) */\
+	TUD_AUDIO_DESC_IAD(/*_firstitf*/ ITF_NUM_AUDIO_CONTROL, /*_nitfs*/ ITF_NUM_TOTAL, /*_stridx*/ 0x00),\
+	/* Standard AC Interface Descriptor(4.7.1) */\
+	TUD_AUDIO_DESC_STD_AC(/*_itfnum*/ ITF_NUM_AUDIO_CONTROL, /*_nEPs*/ 0x00, /*_stridx*/ _stridx),\
+	/* Class-Specific AC Interface Header Descriptor(4.7.2) */\
+	TUD_AUDIO_DESC_CS_AC(/*_bcdADC*/ 0x0200, /*_category*/ AUDIO_FUNC_IO_BOX, /*_totallen*/ TUD_AUDIO_DESC_CLK_SRC_LEN + 2 * TUD_AUDIO_DESC_INPUT_TERM_LEN + 2 * TUD_AUDIO_DESC_OUTPUT_TERM_LEN, /*_ctrl*/ 0x00),\
+	/* Clock Source Descriptor(4.7.2.1): internal fixed clock, with read-only frequency and validity */\
+	TUD_AUDIO_DESC_CLK_SRC(/*_clkid*/ UAC2_ENTITY_CLOCK, /*_attr*/ AUDIO_CLOCK_SOURCE_ATT_INT_FIX_CLK, /*_ctrl*/ (AUDIO_CTRL_R << AUDIO_CLOCK_SOURCE_CTRL_CLK_FRQ_POS) | (AUDIO_CTRL_R << AUDIO_CLOCK_SOURCE_CTRL_CLK_VAL_POS), /*_assocTerm*/ 0x00, /*_stridx*/ 0x00),\
+	/* Input Terminal Descriptor(4.7.2.4): USB stream from host */\
+	TUD_AUDIO_DESC_INPUT_TERM(/*_termid*/ UAC2_ENTITY_OUT_INPUT_TERMINAL, /*_termtype*/ AUDIO_TERM_TYPE_USB_STREAMING, /*_assocTerm*/ 0x00, /*_clkid*/ UAC2_ENTITY_CLOCK, /*_nchannelslogical*/ CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX, /*_channelcfg*/ AUDIO_CHANNEL_CONFIG_NON_PREDEFINED, /*_idxchannelnames*/ 0x00, /*_ctrl*/ 0x0000, /*_stridx*/ 0x00),\
+	/* Output Terminal Descriptor(4.7.2.5): Computer outputs */\
+	TUD_AUDIO_DESC_OUTPUT_TERM(/*_termid*/ UAC2_ENTITY_OUT_OUTPUT_TERMINAL, /*_termtype*/ AUDIO_TERM_TYPE_OUT_GENERIC_SPEAKER, /*_assocTerm*/ 0x00, /*_srcid*/ UAC2_ENTITY_OUT_INPUT_TERMINAL, /*_clkid*/ UAC2_ENTITY_CLOCK, /*_ctrl*/ 0x0000, /*_stridx*/ 0x00),\
+	/* Input Terminal Descriptor(4.7.2.4): Computer inputs */\
+	TUD_AUDIO_DESC_INPUT_TERM(/*_termid*/ UAC2_ENTITY_IN_INPUT_TERMINAL, /*_termtype*/ AUDIO_TERM_TYPE_IN_GENERIC_MIC, /*_assocTerm*/ 0x00, /*_clkid*/ UAC2_ENTITY_CLOCK, /*_nchannelslogical*/ CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX, /*_channelcfg*/ AUDIO_CHANNEL_CONFIG_NON_PREDEFINED, /*_idxchannelnames*/ 0x00, /*_ctrl*/ 0x0000, /*_stridx*/ 0x00),\
+	/* Output Terminal Descriptor(4.7.2.5): USB stream to host */\
+	TUD_AUDIO_DESC_OUTPUT_TERM(/*_termid*/ UAC2_ENTITY_IN_OUTPUT_TERMINAL, /*_termtype*/ AUDIO_TERM_TYPE_USB_STREAMING, /*_assocTerm*/ 0x00, /*_srcid*/ UAC2_ENTITY_IN_INPUT_TERMINAL, /*_clkid*/ UAC2_ENTITY_CLOCK, /*_ctrl*/ 0x0000, /*_stridx*/ 0x00),\
+	\
+	/* Host to Computer. Standard AS Interface Descriptor(4.9.1): alternate 0, no bandwidth */\
+	TUD_AUDIO_DESC_STD_AS_INT(/*_itfnum*/ ITF_NUM_AUDIO_STREAMING_OUT, /*_altset*/ 0x00, /*_nEPs*/ 0x00, /*_stridx*/ 0x00),\
+	/* Standard AS Interface Descriptor(4.9.1): alternate 1, streaming */\
+	TUD_AUDIO_DESC_STD_AS_INT(/*_itfnum*/ ITF_NUM_AUDIO_STREAMING_OUT, /*_altset*/ 0x01, /*_nEPs*/ 0x02, /*_stridx*/ 0x00),\
+	/* Class-Specific AS Interface Descriptor(4.9.2) */\
+	TUD_AUDIO_DESC_CS_AS_INT(/*_termid*/ UAC2_ENTITY_OUT_INPUT_TERMINAL, /*_ctrl*/ AUDIO_CTRL_NONE, /*_formattype*/ AUDIO_FORMAT_TYPE_I, /*_formats*/ AUDIO_DATA_FORMAT_TYPE_I_PCM, /*_nchannelsphysical*/ CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_RX, /*_channelcfg*/ AUDIO_CHANNEL_CONFIG_NON_PREDEFINED, /*_stridx*/ 0x00),\
+	/* Type I Format Type Descriptor(2.3.1.6 - Audio Formats) */\
+	TUD_AUDIO_DESC_TYPE_I_FORMAT(CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_RX, CFG_TUD_AUDIO_FUNC_1_RESOLUTION_RX),\
+	/* Standard AS Isochronous Audio Data Endpoint Descriptor(4.10.1.1): asynchronous */\
+	TUD_AUDIO_DESC_STD_AS_ISO_EP(/*_ep*/ _epout, /*_attr*/ (uint8_t)((uint8_t)TUSB_XFER_ISOCHRONOUS | (uint8_t)TUSB_ISO_EP_ATT_ASYNCHRONOUS | (uint8_t)TUSB_ISO_EP_ATT_DATA), /*_maxEPsize*/ CFG_TUD_AUDIO_FUNC_1_EP_OUT_SZ_MAX, /*_interval*/ 0x01),\
+	/* Class-Specific AS Isochronous Audio Data Endpoint Descriptor(4.10.1.2) */\
+	TUD_AUDIO_DESC_CS_AS_ISO_EP(/*_attr*/ AUDIO_CS_AS_ISO_DATA_EP_ATT_NON_MAX_PACKETS_OK, /*_ctrl*/ AUDIO_CTRL_NONE, /*_lockdelayunit*/ AUDIO_CS_AS_ISO_DATA_EP_LOCK_DELAY_UNIT_UNDEFINED, /*_lockdelay*/ 0x0000),\
+	/* Standard AS Isochronous Feedback Endpoint Descriptor(4.10.2.1): 10.14 samples per frame, every frame */\
+	TUD_AUDIO_DESC_STD_AS_ISO_FB_EP(/*_ep*/ _epfb, /*_epsize*/ 3, /*_interval*/ 0x01),\
+	\
+	/* Computer to host. Standard AS Interface Descriptor(4.9.1): alternate 0, no bandwidth */\
+	TUD_AUDIO_DESC_STD_AS_INT(/*_itfnum*/ ITF_NUM_AUDIO_STREAMING_IN, /*_altset*/ 0x00, /*_nEPs*/ 0x00, /*_stridx*/ 0x00),\
+	/* Standard AS Interface Descriptor(4.9.1): alternate 1, streaming */\
+	TUD_AUDIO_DESC_STD_AS_INT(/*_itfnum*/ ITF_NUM_AUDIO_STREAMING_IN, /*_altset*/ 0x01, /*_nEPs*/ 0x01, /*_stridx*/ 0x00),\
+	/* Class-Specific AS Interface Descriptor(4.9.2) */\
+	TUD_AUDIO_DESC_CS_AS_INT(/*_termid*/ UAC2_ENTITY_IN_OUTPUT_TERMINAL, /*_ctrl*/ AUDIO_CTRL_NONE, /*_formattype*/ AUDIO_FORMAT_TYPE_I, /*_formats*/ AUDIO_DATA_FORMAT_TYPE_I_PCM, /*_nchannelsphysical*/ CFG_TUD_AUDIO_FUNC_1_N_CHANNELS_TX, /*_channelcfg*/ AUDIO_CHANNEL_CONFIG_NON_PREDEFINED, /*_stridx*/ 0x00),\
+	/* Type I Format Type Descriptor(2.3.1.6 - Audio Formats) */\
+	TUD_AUDIO_DESC_TYPE_I_FORMAT(CFG_TUD_AUDIO_FUNC_1_N_BYTES_PER_SAMPLE_TX, CFG_TUD_AUDIO_FUNC_1_RESOLUTION_TX),\
+	/* Standard AS Isochronous Audio Data Endpoint Descriptor(4.10.1.1): asynchronous */\
+	TUD_AUDIO_DESC_STD_AS_ISO_EP(/*_ep*/ _epin, /*_attr*/ (uint8_t)((uint8_t)TUSB_XFER_ISOCHRONOUS | (uint8_t)TUSB_ISO_EP_ATT_ASYNCHRONOUS | (uint8_t)TUSB_ISO_EP_ATT_DATA), /*_maxEPsize*/ CFG_TUD_AUDIO_FUNC_1_EP_IN_SZ_MAX, /*_interval*/ 0x01),\
+	/* Class-Specific AS Isochronous Audio Data Endpoint Descriptor(4.10.1.2) */\
+	TUD_AUDIO_DESC_CS_AS_ISO_EP(/*_attr*/ AUDIO_CS_AS_ISO_DATA_EP_ATT_NON_MAX_PACKETS_OK, /*_ctrl*/ AUDIO_CTRL_NONE, /*_lockdelayunit*/ AUDIO_CS_AS_ISO_DATA_EP_LOCK_DELAY_UNIT_UNDEFINED, /*_lockdelay*/ 0x0000)
+
+#endif
@@ -0,0 +1,606 @@
+// USB drive player example
+//
+// Plays WAV files straight from a USB flash drive plugged into the Computer,
+// which acts as a USB host (as in the midi_host example), so samples of any
+// length can be played without first loading them into flash.
+//
+// The drive must be formatted FAT16 or FAT32 (as almost all are); the WAV
+// files in its top-level folder are played, in the order listed there.
+// Files must be 16-bit PCM, mono or stereo (the first two channels of any
+// more), at sample rates up to 96kHz.
+//
+// Controls:
+//   - switch up: files are played in sequence
+//   - switch middle or down: main knob + CV in 1 select the file, which
+//     starts straight away when the selection changes, and then repeats.
+//     The selection has some hysteresis, so that a knob or CV resting near
+//     the boundary between two files doesn't restart the file over and over
+//   - knob Y + CV in 2: playback speed, up to twice the original
+//   - pulse in 1: restart the file from the beginning
+// Outputs:
+//   - audio out 1 and 2: left and right channels (a mono file on both)
+//   - pulse out 1: a short pulse at the start of each file
+// LEDs:
+//   - top left: a drive with WAV files is connected (blinking if the drive
+//     can't be read, or has no WAV files)
+//   - top right: read-ahead level
+//   - middle: output levels
+//   - bottom left: lit for half a second after an underrun
+//
+// USB and the filesystem run on core 1. The drive is read with the TinyUSB
+// mass storage host driver, and its files found by FATReader (in
+// FATReader.h), reading 4KB at a time. Core 1 converts the samples to
+// stereo frames and queues them in a read-ahead buffer, an SPSCQueue, which
+// ProcessSample plays from.
+//
+// Flash drives usually complete a 4KB read in a few milliseconds, but
+// occasionally take far longer (for wear levelling and garbage collection
+// inside the drive, or waking from power saving), typically up to a couple
+// of hundred milliseconds. The read-ahead is sized so that playback at
+// 48kHz continues through any single read taking up to maxStallMs.
+
+#include "ComputerCard.h"
+
+#include "pico/multicore.h"
+#include "bsp/board.h"
+#include "tusb.h"
+#include "FATReader.h"
+#include "MIDIOutput.h"
+
+
+// Block device for FATReader: sectors of the USB drive, read with the TinyUSB
+// mass storage host driver. Reads block, running tuh_task, until the transfer
+// completes or the drive is removed.
+class USBDrive
+{
+public:
+	// Device address of the drive, or 0 if none is mounted. Set by the mount callbacks.
+	volatile uint8_t address = 0;
+
+	bool ReadSectors(uint32_t sector, uint8_t *buffer, uint32_t count)
+	{
+		uint8_t addr = address;
+		if (!addr) return false;
+
+		status = Busy;
+		if (!tuh_msc_read10(addr, 0, buffer, sector, uint16_t(count), ReadComplete, uintptr_t(this)))
+			return false;
+
+		while (status == Busy && address == addr)
+			tuh_task();
+
+		return status == Done && address == addr;
+	}
+
+private:
+	enum Status {Busy, Done, Failed};
+	volatile Status status = Done;
+
+	static bool ReadComplete(uint8_t dev_addr, tuh_msc_complete_data_t const *cb_data)
+	{
+		(void)dev_addr;
+		USBDrive *drive = (USBDrive *)cb_data->user_arg;
+		drive->status = (cb_data->csw->status == MSC_CSW_STATUS_PASSED) ? Done : Failed;
+		return true;
+	}
+};
+
+
+class USBDrivePlayer : public ComputerCard
+{
+public:
+	static constexpr uint32_t maxTracks = 256; // WAV files played from one drive
+	static constexpr uint32_t maxChannels = 8;
+
+	// Sectors read from the drive at a time (4KB): at most 2048 frames, for a mono file
+	static constexpr uint32_t readSectors = 8;
+	static constexpr uint32_t readFrames = readSectors * 512 / 2;
+
+	// Read-ahead: 16384 stereo frames (64KB), 341ms at 48kHz. Core 1 reads
+	// whenever there is space for the frames of a whole read, so the read-ahead
+	// holds at least ringFrames - readFrames when a read starts, which lasts
+	// maxStallMs at 48kHz and the original speed (half that at twice the speed).
+	static constexpr uint32_t ringFrames = 16384;
+	static constexpr uint32_t maxStallMs = 250;
+	static_assert(ringFrames - readFrames - 1 >= 48 * maxStallMs, "Read-ahead too small for longest read");
+
+	// Frames queued before playback starts, after a restart or underrun (43ms at 48kHz)
+	static constexpr uint32_t prefillFrames = 2048;
+
+	struct Frame
+	{
+		int16_t left, right;
+	};
+
+	// Queued by core 1 before the first frame of each file
+	struct TrackStart
+	{
+		uint32_t frame; // count of frames queued before this file's first
+		uint32_t sampleRate;
+		uint32_t track;
+	};
+
+	// A WAV file on the drive
+	struct Track
+	{
+		FATFile file;
+		uint32_t dataStart, dataEnd; // byte offsets in file of the sample data
+		uint32_t sampleRate;
+		uint32_t channels;
+	};
+
+	enum DriveState {NoDrive, DriveUnusable, DrivePlaying};
+
+	USBDrivePlayer()
+	{
+		driveState = NoDrive;
+		numTracks = 0;
+		sequence = true;
+		requestedTrack = selectedTrack = 0;
+		restartRequest = restartAck = restartDone = 0;
+
+		playing = false;
+		phase = 0;
+		sampleRate = 48000;
+		playingTrack = 0;
+		framesPopped = 0;
+		previous = current = {0, 0};
+		underrunLED = 0;
+		startPulse = 0;
+
+		// Start the second core
+		multicore_launch_core1(core1);
+	}
+
+	// Boilerplate to call member function as second core
+	static void core1()
+	{
+		((USBDrivePlayer *)ThisPtr())->USBCore();
+	}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// USB and filesystem, on core 1
+
+	void USBCore()
+	{
+		// Initialise TinyUSB
+		board_init();
+		tusb_init();
+
+		while (1)
+		{
+			tuh_task();
+
+			if (!drive.address)
+			{
+				// Drive removed: frames already queued play out
+				if (driveState != NoDrive)
+				{
+					fat.Unmount();
+					numTracks = 0;
+					driveState = NoDrive;
+				}
+				continue;
+			}
+
+			if (driveState == NoDrive)
+			{
+				if (FindTracks())
+				{
+					StartTrack(sequence ? 0 : selectedTrack % numTracks);
+					driveState = DrivePlaying;
+				}
+				else
+				{
+					driveState = DriveUnusable;
+				}
+			}
+
+			if (driveState == DrivePlaying)
+			{
+				ReadAhead();
+			}
+		}
+	}
+
+	// Mount the drive's filesystem, and list the WAV files in its root directory
+	bool FindTracks()
+	{
+		if (tuh_msc_get_block_size(drive.address, 0) != FATReader<USBDrive>::sectorSize || !fat.Mount())
+			return false;
+
+		uint32_t n = 0;
+		FATDirEntry entry;
+		for (uint32_t i = 0; n < maxTracks && fat.ReadEntry(i, entry) && !entry.IsEnd(); i++)
+		{
+			if (entry.IsFile() && entry.HasExtension("WAV") && ParseWAV(entry, tracks[n]))
+			{
+				n++;
+			}
+		}
+		numTracks = n;
+		return n > 0;
+	}
+
+	// Find the format and sample data of a WAV file, by walking its RIFF chunks
+	bool ParseWAV(const FATDirEntry &entry, Track &t)
+	{
+		fat.Open(entry, t.file);
+		headerSector = noSector;
+
+		uint8_t h[16];
+		if (t.file.size < 12 || !ReadBytes(t.file, 0, h, 12) || Get32(h) != 0x46464952 || Get32(h + 8) != 0x45564157) // 'RIFF', 'WAVE'
+			return false;
+
+		bool haveFormat = false;
+		uint32_t offset = 12;
+		for (int chunk = 0; chunk < 64 && offset + 8 <= t.file.size; chunk++)
+		{
+			if (!ReadBytes(t.file, offset, h, 8)) return false;
+			uint32_t id = Get32(h);
+			uint32_t size = Get32(h + 4);
+
+			if (id == 0x20746d66) // 'fmt '
+			{
+				if (size < 16 || !ReadBytes(t.file, offset + 8, h, 16)) return false;
+				uint32_t format = Get16(h);
+				t.channels = Get16(h + 2);
+				t.sampleRate = Get32(h + 4);
+				uint32_t bitsPerSample = Get16(h + 14);
+				if (format != 1 || bitsPerSample != 16) return false; // must be 16-bit PCM
+				if (t.channels == 0 || t.channels > maxChannels || t.sampleRate == 0 || t.sampleRate > 96000) return false;
+				haveFormat = true;
+			}
+			else if (id == 0x61746164) // 'data'
+			{
+				if (!haveFormat) return false;
+				t.dataStart = offset + 8;
+				// Sample data may be cut short, by a file copy that didn't finish
+				t.dataEnd = (size <= t.file.size - t.dataStart) ? t.dataStart + size : t.file.size;
+				return t.dataEnd - t.dataStart >= 2 * t.channels;
+			}
+
+			// Chunks are padded to an even length
+			if (size > t.file.size) return false;
+			offset += 8 + size + (size & 1);
+		}
+		return false;
+	}
+
+	// Copy n bytes of file from offset, reading one sector at a time into readBuffer
+	bool ReadBytes(FATFile &file, uint32_t offset, uint8_t *dest, uint32_t n)
+	{
+		while (n > 0)
+		{
+			uint32_t sector = offset / 512;
+			if (sector != headerSector)
+			{
+				headerSector = noSector;
+				if (!fat.Seek(file, offset) || fat.Read(file, readBuffer, 1) == 0) return false;
+				headerSector = sector;
+			}
+			uint32_t i = offset % 512;
+			uint32_t k = (n < 512 - i) ? n : 512 - i;
+			memcpy(dest, readBuffer + i, k);
+			dest += k;
+			offset += k;
+			n -= k;
+		}
+		return true;
+	}
+
+	// Start reading track i from the beginning of its sample data
+	void StartTrack(uint32_t i)
+	{
+		readTrack = i;
+		Track &t = tracks[i];
+		readPosition = t.dataStart;
+		fat.Seek(t.file, readPosition);
+		carryBytes = 0;
+		startQueued = false;
+	}
+
+	// The track to read after the end of the current one
+	void NextTrack()
+	{
+		uint32_t n = numTracks;
+		StartTrack(sequence ? (readTrack + 1) % n : selectedTrack % n);
+	}
+
+	// Read the next sectors of the current track into the read-ahead, if there is space
+	void ReadAhead()
+	{
+		// On a restart, stop queueing frames of the previous track, and wait for
+		// ProcessSample to discard those already queued. Nothing is pushed to
+		// ring or starts between restartAck and restartDone, so ProcessSample
+		// can clear them, as SPSCQueue::Clear requires.
+		uint32_t request = restartRequest;
+		if (request != restartAck)
+		{
+			__dmb(); // request read before the track requested
+			StartTrack(requestedTrack % numTracks);
+			framesPushed = 0;
+			__dmb();
+			restartAck = request;
+		}
+		if (restartDone != restartAck) return;
+		__dmb(); // queues cleared before any more frames are pushed
+
+		Track &t = tracks[readTrack];
+		if (!startQueued)
+		{
+			if (!starts.Push({framesPushed, t.sampleRate, readTrack})) return;
+			startQueued = true;
+		}
+
+		if (ring.Space() <= readFrames) return;
+
+		if (readPosition >= t.dataEnd)
+		{
+			NextTrack();
+			return;
+		}
+
+		// Reads start at a sector boundary, so the first of a track may begin
+		// part-way into a sector
+		uint32_t skip = readPosition % 512;
+		uint32_t bytes = fat.Read(t.file, readBuffer, readSectors);
+		if (bytes == 0)
+		{
+			// Read failed, or the file's cluster chain is corrupt
+			NextTrack();
+			return;
+		}
+		uint32_t end = readPosition - skip + bytes;
+		if (end > t.dataEnd) end = t.dataEnd;
+		if (end > readPosition) QueueFrames(readBuffer + skip, end - readPosition, t.channels);
+		readPosition = end;
+	}
+
+	// Convert 16-bit samples to stereo frames, and queue them for ProcessSample.
+	// A frame split between two reads is completed from the second.
+	void QueueFrames(const uint8_t *p, uint32_t n, uint32_t channels)
+	{
+		uint32_t frameBytes = 2 * channels;
+		while (carryBytes > 0 && n > 0)
+		{
+			carry[carryBytes++] = *p++;
+			n--;
+			if (carryBytes == frameBytes)
+			{
+				QueueFrame(carry, channels);
+				carryBytes = 0;
+			}
+		}
+		for (; n >= frameBytes; p += frameBytes, n -= frameBytes)
+		{
+			QueueFrame(p, channels);
+		}
+		while (n > 0)
+		{
+			carry[carryBytes++] = *p++;
+			n--;
+		}
+	}
+
+	void QueueFrame(const uint8_t *p, uint32_t channels)
+	{
+		Frame f;
+		f.left = int16_t(p[0] | (p[1] << 8));
+		f.right = (channels > 1) ? int16_t(p[2] | (p[3] << 8)) : f.left;
+		ring.Push(f);
+		framesPushed++;
+	}
+
+	static uint32_t Get16(const uint8_t *p) {return p[0] | (p[1] << 8);}
+	static uint32_t Get32(const uint8_t *p) {return Get16(p) | (Get16(p + 2) << 16);}
+
+
+	////////////////////////////////////////////////////////////////////////////////
+	// Audio, on core 0
+
+	// Ask core 1 to start reading track from its beginning
+	void Restart(uint32_t track)
+	{
+		requestedTrack = track;
+		__dmb(); // track written before the request
+		restartRequest = restartRequest + 1;
+	}
+
+	virtual void ProcessSample()
+	{
+		uint32_t n = numTracks;
+		bool seq = SwitchVal() == Up;
+		sequence = seq;
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Select and restart files
+		if (n > 0)
+		{
+			int32_t kb = KnobVal(Main) + CVIn1();
+			if (kb < 0) kb = 0;
+			if (kb > 4095) kb = 4095;
+			if (n != selectTracks)
+			{
+				// Margin of about 16 knob steps, at most a quarter of each file's range
+				selectTracks = n;
+				trackSelect = Hysteresis(12, int32_t(n < 64 ? n * 16 : 1024));
+			}
+			trackSelect.Update(int32_t(n) * kb);
+			uint32_t selected = uint32_t(trackSelect.Value());
+
+			bool restart = PulseIn1RisingEdge();
+			if (!seq && selected != selectedTrack)
+			{
+				selectedTrack = selected;
+				restart = true;
+			}
+			if (restart)
+			{
+				Restart(seq ? playingTrack : selected);
+			}
+		}
+
+		// Once core 1 has stopped queueing frames from before the restart, discard
+		// them. Core 1 pushes nothing more until restartDone is set.
+		uint32_t request = restartRequest;
+		if (restartDone != request && restartAck == request)
+		{
+			ring.Clear();
+			starts.Clear();
+			framesPopped = 0;
+			playing = false;
+			__dmb(); // cleared before core 1 queues more
+			restartDone = request;
+		}
+
+
+		////////////////////////////////////////////////////////////////////////////////
+		// Play from the read-ahead
+
+		// After a restart or underrun, wait until some frames are queued
+		if (!playing && ring.Count() >= prefillFrames)
+		{
+			playing = true;
+			phase = 0;
+		}
+
+		if (playing)
+		{
+			// Speed controlled by Knob Y + CV in 2, limited to twice the original
+			// speed. speed=1024 gives original playback speed.
+			int32_t speed = KnobVal(Y) + CVIn2();
+			if (speed < 0) speed = 0;
+			if (speed > 2048) speed = 2048;
+
+			// Advance phase (in 1/256ths of a frame) to resample from the file's sample rate to 48kHz
+			phase += (uint32_t(speed) * sampleRate) / (48000 << 2);
+			while (phase >= 256)
+			{
+				phase -= 256;
+
+				// Take the sample rate of each new file as its first frame is reached
+				TrackStart s;
+				while (starts.Peek(s) && s.frame == framesPopped)
+				{
+					starts.Pop(s);
+					sampleRate = s.sampleRate;
+					playingTrack = s.track;
+					startPulse = 480;
+				}
+
+				previous = current;
+				if (!ring.Pop(current))
+				{
+					// Underrun, unless the drive has been removed or has ended
+					if (driveState == DrivePlaying)
+					{
+						underrunLED = 24000;
+					}
+					current = {0, 0};
+					playing = false;
+					break;
+				}
+				framesPopped++;
+			}
+		}
+		else
+		{
+			previous = current = {0, 0};
+		}
+
+		// Linear interpolation between frames
+		int32_t r = int32_t(phase);
+		int32_t left = (previous.left * (256 - r) + current.left * r) >> 8;
+		int32_t right = (previous.right * (256 - r) + current.right * r) >> 8;
+
+		// Convert from 16-bit WAV to 12-bit DAC output
+		AudioOut1(int16_t(left >> 4));
+		AudioOut2(int16_t(right >> 4));
+
+		PulseOut1(startPulse > 0);
+		if (startPulse > 0) startPulse--;
+
+
+		////////////////////////////////////////////////////////////////////////////////
+		// LEDs
+		DriveState state = driveState;
+		LedOn(0, state == DrivePlaying || (state == DriveUnusable && (SampleCounter() & 0x4000)));
+		LedBrightness(1, uint16_t(ring.Count() * 4095 / ringFrames));
+		LedBrightness(2, uint16_t((left < 0 ? -left : left) >> 3));
+		LedBrightness(3, uint16_t((right < 0 ? -right : right) >> 3));
+		LedOn(4, underrunLED > 0);
+		if (underrunLED > 0) underrunLED--;
+	}
+
+	static USBDrive drive;
+
+private:
+	static constexpr uint32_t noSector = 0xFFFFFFFF;
+
+	// Filesystem and files, used on core 1
+	static FATReader<USBDrive> fat;
+	static Track tracks[maxTracks];
+	alignas(4) static uint8_t readBuffer[readSectors * 512];
+
+	// Read-ahead, from core 1 to ProcessSample
+	static SPSCQueue<Frame, ringFrames> ring;
+	static SPSCQueue<TrackStart, 16> starts;
+
+	// Shared between cores
+	volatile DriveState driveState;
+	volatile uint32_t numTracks;
+	volatile bool sequence;
+	volatile uint32_t selectedTrack, requestedTrack;
+	// Restart handshake: ProcessSample increments restartRequest; core 1 sets
+	// restartAck to match once it has stopped queueing the previous track, then
+	// ProcessSample clears the read-ahead and sets restartDone to match.
+	volatile uint32_t restartRequest, restartAck, restartDone;
+
+	// Core 1 only
+	uint32_t readTrack, readPosition; // byte offset in file of the next sample data to read
+	uint32_t framesPushed;
+	bool startQueued;
+	uint32_t headerSector;
+	uint8_t carry[2 * maxChannels];
+	uint32_t carryBytes;
+
+	// ProcessSample only
+	bool playing;
+	Hysteresis trackSelect;
+	uint32_t selectTracks = 0;
+	uint32_t phase, sampleRate, playingTrack, framesPopped;
+	Frame previous, current;
+	uint32_t underrunLED, startPulse;
+};
+
+USBDrive USBDrivePlayer::drive;
+FATReader<USBDrive> USBDrivePlayer::fat(USBDrivePlayer::drive);
+USBDrivePlayer::Track USBDrivePlayer::tracks[maxTracks];
+alignas(4) uint8_t USBDrivePlayer::readBuffer[readSectors * 512];
+SPSCQueue<USBDrivePlayer::Frame, USBDrivePlayer::ringFrames> USBDrivePlayer::ring;
+SPSCQueue<USBDrivePlayer::TrackStart, 16> USBDrivePlayer::starts;
+
+
+// TinyUSB mass storage host callbacks, run from tuh_task on core 1.
+// One drive is played at a time: the first connected.
+
+void tuh_msc_mount_cb(uint8_t dev_addr)
+{
+	if (!USBDrivePlayer::drive.address)
+		USBDrivePlayer::drive.address = dev_addr;
+}
+
+void tuh_msc_umount_cb(uint8_t dev_addr)
+{
+	if (USBDrivePlayer::drive.address == dev_addr)
+		USBDrivePlayer::drive.address = 0;
+}
+
+
+int main()
+{
+	USBDrivePlayer dp;
+	dp.Run();
+}
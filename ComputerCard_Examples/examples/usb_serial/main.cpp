@@ -1,5 +1,4 @@
 #include "ComputerCard.h"
-#include "pico/multicore.h"
 #include "pico/stdlib.h" // for sleep_ms and printf
 #include <cstdio>
 
@@ -7,16 +6,25 @@
 
 Output of data over a USB serial port, for e.g. debugging
 
-This requires multicore processing, as USB is too slow to execute in ProcessSample.
-Furthermore, because the RPi Pico SDK implementation of sending stdout to a USB
-serial port runs code on core 0, we must run the ComputerCard ProcessSample loop on core 1.
+USB is too slow to use in ProcessSample. Furthermore, the RPi Pico SDK
+implementation of sending stdout to a USB serial port runs code on core 0,
+the same core as ComputerCard. So, the printing is done in BackgroundTask,
+which ComputerCard calls on core 0 between audio samples, and which is
+interrupted by ProcessSample when necessary. Core 1 is left unused.
 
 To use, connect USB to a computer and run a serial terminal at 115200 baud
+
+Values are passed from ProcessSample to BackgroundTask through a lock-free
+queue, so that the knob and CV values printed are always a matching pair,
+and none are lost if USB is briefly delayed.
  */
 
 
-// Variables for communication between the two cores
-volatile uint32_t v1, v2;
+// Pair of values sent from ProcessSample to BackgroundTask
+struct Reading
+{
+	int32_t knob, cv;
+};
 
 
 class USBSerial : public ComputerCard
@@ -26,42 +34,44 @@ public:
 	// 48kHz audio processing function
 	virtual void ProcessSample()
 	{
-		// Copy the main knob and CV input 1 into v1 and v2, for transmission to printf
-		v1 = KnobVal(Main);
-		v2 = CVIn1();
+		// Every 480 samples (10ms), send the main knob and CV input 1 for transmission to printf
+		if (++sampleCount >= 480)
+		{
+			sampleCount = 0;
+			readings.Push({KnobVal(Main), CVIn1()});
+		}
+	}
+
+	// Called on core 0 outside the audio interrupt,
+	// displaying knob and CV input values as they arrive (every ~10ms)
+	virtual void BackgroundTask()
+	{
+		Reading r;
+		while (readings.Pop(r))
+		{
+			printf("%ld\t%ld\n", r.knob, r.cv);
+		}
 	}
+
+private:
+	int sampleCount = 0;
+
+	// Queue for communication between ProcessSample and BackgroundTask
+	SPSCQueue<Reading, 64> readings;
 };
 
-// Core 1 is used to launch the ComputerCard progrma
-void core1()
-{
-	USBSerial usbs;
-	usbs.Run();
-}
 
 int main()
 {
 	// Sleep commands not essential, but give some serial terminal programs
 	// time to notice the new virtual COM port / TTY, and connect to it.
-    sleep_ms(500);
+	sleep_ms(500);
 	
-	// Turn on USB serial. As far as I can tell, the RP2040 stdio USB serial port
-	// must be initialised, and have code running on, core 0. This means that we
-	// have to run ComputerCard on core 1.
+	// Turn on USB serial
 	stdio_init_all();
 	
 	sleep_ms(500);
 
-	// Launch the other core. Does not block
-	multicore_launch_core1(core1);
-	
-	// Continue on core 0 with USB serial activity,
-	// displaying CV input values every ~10ms
-	while (1)
-	{
-		printf("%ld\t%ld\n", v1, v2);
-		sleep_ms(10);
-	}
+	USBSerial usbs;
+	usbs.Run();
 }
-
-  
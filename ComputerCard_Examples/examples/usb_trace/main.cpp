@@ -0,0 +1,100 @@
+#include "ComputerCard.h"
+#include "TraceStream.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+#include "pico/stdio_usb.h"
+
+/*
+
+Streaming of signals from ProcessSample over USB serial, at the full 48kHz
+sample rate, for debugging DSP code.
+
+ProcessSample puts the values of four channels into a TraceStream every
+sample. ComputerCard runs on core 1, and core 0 sends the trace to the USB
+serial port as compact binary packets. (The usb_serial example instead prints
+from BackgroundTask, on the same core as ComputerCard; a full-rate trace is
+far more data, so here USB has a core to itself.) On the host computer,
+trace_decode.py decodes these into CSV or multichannel WAV files:
+
+  python3 trace_decode.py /dev/ttyACM0 --seconds 5 --wav trace.wav --csv trace.csv
+
+The card itself is a simple one-pole lowpass filter, with the four traced
+channels being its input, output, coefficient and the pulse 1 input.
+
+
+User interface:
+---------------
+
+Audio in 1:             Filter input
+Main knob:              Cutoff frequency
+Audio out 1:            Filter output
+Pulse in 1:             Traced, to mark events in the trace
+Top left LED:           Lit if trace frames have been lost
+
+ */
+
+// Four traced channels
+enum TraceChannel {TraceIn, TraceOut, TraceCoeff, TracePulse, NumTraceChannels};
+TraceStream<NumTraceChannels> trace;
+
+
+class USBTrace : public ComputerCard
+{
+	int32_t state = 0; // filter state, 12.16 fixed point
+
+public:
+	// 48kHz audio processing function
+	virtual void ProcessSample()
+	{
+		int32_t in = AudioIn1();
+		int32_t coeff = KnobVal(Knob::Main) + 1; // 1 to 4096, /65536
+
+		state += int32_t((int64_t(coeff) * ((in << 16) - state)) >> 16);
+		int16_t out = int16_t(state >> 16);
+		AudioOut1(out);
+
+		trace.Set(TraceIn, int16_t(in));
+		trace.Set(TraceOut, out);
+		trace.Set(TraceCoeff, int16_t(coeff));
+		trace.Set(TracePulse, PulseIn1());
+		trace.Commit();
+
+		LedOn(0, trace.Dropped() > 0);
+	}
+};
+
+// Core 1 is used to run the ComputerCard
+void core1()
+{
+	USBTrace ut;
+	ut.Run();
+}
+
+// Send a trace packet to the USB serial port, without any newline translation
+void WritePacket(const uint8_t *data, uint32_t length)
+{
+	stdio_usb.out_chars((const char *)data, int(length));
+}
+
+int main()
+{
+	// USB serial runs on core 0 (where the Pico SDK runs its USB code), and ComputerCard on core 1
+	stdio_init_all();
+	sleep_ms(500);
+
+	multicore_launch_core1(core1);
+
+	while (1)
+	{
+		if (stdio_usb_connected())
+		{
+			trace.Drain(WritePacket);
+		}
+		else
+		{
+			// Discard frames while no host is connected
+			trace.Drain([](const uint8_t *, uint32_t) {});
+		}
+		sleep_us(500);
+	}
+}
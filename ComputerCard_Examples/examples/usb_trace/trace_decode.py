@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""
+Decode a TraceStream binary trace (see TraceStream.h) into CSV and/or WAV files.
+
+Reads from a USB serial port (requires pyserial) or from a file of captured data:
+
+  python3 trace_decode.py /dev/ttyACM0 --seconds 5 --csv trace.csv --wav trace.wav
+  python3 trace_decode.py capture.bin --csv trace.csv
+
+The WAV file has one channel per traced channel, at 48kHz. Values are scaled
+by 16, so that the 12-bit range of ComputerCard audio fills the 16-bit range.
+Frames lost on the card are filled with zeros, and reported.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import wave
+
+SAMPLE_RATE = 48000
+HEADER_SIZE = 8
+
+
+def decode(data):
+    """Yield (sequence, channels, frames) for each valid packet in data,
+    where frames is a list of tuples of channel values."""
+    pos = 0
+    while True:
+        pos = data.find(b'TC', pos)
+        if pos < 0 or pos + HEADER_SIZE > len(data):
+            return
+        channels, num_frames = data[pos + 2], data[pos + 3]
+        length = HEADER_SIZE + channels * num_frames * 2
+        if channels == 0 or num_frames == 0 or pos + length + 2 > len(data):
+            pos += 1
+            continue
+        checksum = struct.unpack_from('<H', data, pos + length)[0]
+        if checksum != sum(data[pos:pos + length]) & 0xFFFF:
+            # Not a real packet, or corrupted: resynchronise from next byte
+            pos += 1
+            continue
+        sequence = struct.unpack_from('<I', data, pos + 4)[0]
+        values = struct.unpack_from('<%dh' % (channels * num_frames), data, pos + HEADER_SIZE)
+        frames = [values[i:i + channels] for i in range(0, len(values), channels)]
+        yield sequence, channels, frames
+        pos += length + 2
+
+
+def read_serial(port, seconds):
+    try:
+        import serial
+    except ImportError:
+        sys.exit('Reading from a serial port requires pyserial (pip install pyserial)')
+    # 4 channels at 48kHz is ~400kB/s; read in large chunks
+    with serial.Serial(port, timeout=0.1) as s:
+        s.reset_input_buffer()
+        data = bytearray()
+        end = time.time() + seconds
+        while time.time() < end:
+            data += s.read(65536)
+        return bytes(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('source', help='serial port, or file of captured data')
+    parser.add_argument('--seconds', type=float, default=5.0, help='time to record from serial port (default 5)')
+    parser.add_argument('--csv', help='output CSV file')
+    parser.add_argument('--wav', help='output WAV file')
+    parser.add_argument('--raw', help='also save raw captured data to this file')
+    parser.add_argument('--names', help='comma-separated channel names for CSV header')
+    args = parser.parse_args()
+
+    if os.path.isfile(args.source):
+        with open(args.source, 'rb') as f:
+            data = f.read()
+    else:
+        data = read_serial(args.source, args.seconds)
+
+    if args.raw:
+        with open(args.raw, 'wb') as f:
+            f.write(data)
+
+    frames = []
+    channels = None
+    first = None
+    lost = 0
+    for sequence, ch, packet_frames in decode(data):
+        if channels is None:
+            channels = ch
+            first = sequence
+        if ch != channels:
+            continue
+        # Fill any lost frames with zeros
+        gap = (sequence - first - len(frames)) & 0xFFFFFFFF
+        if 0 < gap < SAMPLE_RATE * 60:
+            frames.extend([(0,) * channels] * gap)
+            lost += gap
+        frames.extend(packet_frames)
+
+    if channels is None:
+        sys.exit('No trace packets found')
+
+    print('%d channels, %d frames (%.2f s), %d frames lost' %
+          (channels, len(frames), len(frames) / SAMPLE_RATE, lost))
+
+    if args.csv:
+        names = args.names.split(',') if args.names else ['ch%d' % i for i in range(channels)]
+        with open(args.csv, 'w') as f:
+            f.write('sample,' + ','.join(names[:channels]) + '\n')
+            for i, frame in enumerate(frames):
+                f.write('%d,%s\n' % (first + i, ','.join(str(v) for v in frame)))
+
+    if args.wav:
+        with wave.open(args.wav, 'wb') as w:
+            w.setnchannels(channels)
+            w.setsampwidth(2)
+            w.setframerate(SAMPLE_RATE)
+            out = bytearray()
+            for frame in frames:
+                for v in frame:
+                    out += struct.pack('<h', max(-32768, min(32767, v * 16)))
+            w.writeframes(bytes(out))
+
+
+if __name__ == '__main__':
+    main()
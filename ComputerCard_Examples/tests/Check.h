@@ -0,0 +1,45 @@
+/*
+Check - minimal assertions for the host tests
+
+Each test is a program returning nonzero if any CHECK failed.
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+static int checkFailures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			checkFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		long long checkA = (long long)(a), checkB = (long long)(b); \
+		if (checkA != checkB) \
+		{ \
+			std::printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, checkA, checkB); \
+			checkFailures++; \
+		} \
+	} while (0)
+
+/// Report and return the exit status, from main
+static int CheckResult(const char *name)
+{
+	if (checkFailures)
+	{
+		std::printf("%s: %d failed\n", name, checkFailures);
+		return 1;
+	}
+	std::printf("%s: passed\n", name);
+	return 0;
+}
+
+#endif
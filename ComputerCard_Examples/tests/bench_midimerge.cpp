@@ -0,0 +1,74 @@
+// Host benchmark of MIDIMerge: four controllers each streaming 16 CCs per ms,
+// as USB-MIDI packets through MIDIParser::ParseUSBPacket, merged with the
+// 48-sample latency used by midi_host. Checks that events come out in
+// timestamp order, each source's in sequence, with no overflows.
+
+#include "MIDIMerge.h"
+#include "Check.h"
+
+#include <chrono>
+
+static constexpr int sources = 4;
+static constexpr uint32_t latency = 48; // samples, as midi_host
+static constexpr uint32_t numSamples = 48000 * 20; // 20s at 48kHz
+
+// Time for each event, pushed and popped, that leaves most of a 48kHz sample
+// period for everything else if every source sent a CC every sample
+static constexpr double maxNsPerEvent = 500.0;
+
+static MIDIMerge<sources> merge;
+
+int main()
+{
+	MIDIParser<> parsers[sources];
+	for (int s = 0; s < sources; s++) parsers[s].SetPort(uint8_t(s));
+
+	uint32_t sent[sources] = {}, received[sources] = {};
+	uint32_t lastTimestamp = 0, events = 0;
+	int lastSource = 0;
+	MIDIEvent e = {};
+	int source;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t now = 0; now < numSamples; now++)
+	{
+		// Every third sample from each source (16 per ms), at staggered times:
+		// controller and value give each event's place in its source's sequence
+		for (int s = 0; s < sources; s++)
+		{
+			if ((now + s) % 3 != 0) continue;
+			uint32_t n = sent[s]++;
+			const uint8_t packet[4] = {0x0B, uint8_t(0xB0 | s), uint8_t((n >> 7) & 0x7F), uint8_t(n & 0x7F)};
+			parsers[s].ParseUSBPacket(packet, merge.Queue(s), now);
+		}
+
+		while (merge.PopDue(now, latency, e, source))
+		{
+			CHECK(int32_t(now - e.timestamp) >= int32_t(latency));
+			CHECK(e.timestamp > lastTimestamp || (e.timestamp == lastTimestamp && source >= lastSource) || events == 0);
+			CHECK_EQ(e.port, source);
+			uint32_t n = received[source]++;
+			CHECK(e.type == MIDIEvent::ControlChange && e.channel == source);
+			CHECK_EQ(e.Controller(), (n >> 7) & 0x7F);
+			CHECK_EQ(e.Value(), n & 0x7F);
+			lastTimestamp = e.timestamp;
+			lastSource = source;
+			events++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// All but the last latency's worth delivered, and none lost
+	CHECK_EQ(merge.Overflows(), 0);
+	for (int s = 0; s < sources; s++)
+	{
+		CHECK(received[s] + latency / 3 + 1 >= sent[s]);
+		CHECK_EQ(sent[s], numSamples / 3);
+	}
+
+	double ns = seconds * 1e9 / events;
+	std::printf("bench_midimerge: %u events, %.1fns per event (including parsing, and polling every sample)\n",
+				unsigned(events), ns);
+	CHECK(ns <= maxNsPerEvent);
+	return CheckResult("bench_midimerge");
+}
@@ -0,0 +1,61 @@
+// Host benchmark of MIDIParser: messages parsed per second, from a stream of
+// notes, controllers (mostly by running status) and clock bytes, into a queue
+
+#include "MIDIParser.h"
+#include "SPSCQueue.h"
+#include "Check.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Far more than USB MIDI can deliver (full-speed USB-MIDI tops out at
+// about 250k messages/s), so a failure means the parser has become slow
+static constexpr double minMessagesPerSecond = 5e6;
+
+int main()
+{
+	std::mt19937 rng(1);
+	std::vector<uint8_t> bytes;
+	uint32_t numMessages = 0;
+	while (numMessages < 1000000)
+	{
+		uint32_t r = rng() % 8;
+		if (r == 0)
+		{
+			bytes.push_back(0xF8);
+		}
+		else
+		{
+			if (r < 3) bytes.push_back(uint8_t((r == 1 ? 0x90 : 0xB0) | (rng() % 16)));
+			bytes.push_back(uint8_t(rng() % 128));
+			bytes.push_back(uint8_t(rng() % 128));
+		}
+		numMessages++;
+	}
+
+	MIDIParser<> p;
+	SPSCQueue<MIDIEvent, 256> q;
+	MIDIEvent e;
+	uint32_t parsed = 0, popped = 0;
+	const int passes = 20;
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (size_t i = 0; i < bytes.size(); i += 64)
+		{
+			uint32_t length = uint32_t(std::min<size_t>(64, bytes.size() - i));
+			parsed += p.Parse(bytes.data() + i, length, q);
+			while (q.Pop(e)) popped++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// The first bytes, before any status, are ignored
+	CHECK(parsed >= uint32_t(passes) * (numMessages - 10));
+	CHECK_EQ(popped, parsed);
+	double rate = parsed / seconds;
+	std::printf("bench_midiparser: %.1fM messages/s (%.1fns per message)\n", rate * 1e-6, 1e9 / rate);
+	CHECK(rate >= minMessagesPerSecond);
+	return CheckResult("bench_midiparser");
+}
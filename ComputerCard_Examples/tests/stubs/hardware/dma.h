@@ -0,0 +1,96 @@
+/*
+Host stand-in for the DMA channels used by SampleStream.h
+
+Each transfer is copied when it completes: dma_channel_is_busy returns true
+for the first hostDMALatency calls after it starts (so, polled once per
+sample, it takes that many sample periods). Reads from XIP_AUX_BASE come
+from the XIP stream address, and reads through the non-allocating XIP alias
+from the flash at XIP_BASE.
+*/
+
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+#include "pico.h"
+#include "hardware/structs/xip_ctrl.h"
+
+#include <cstring>
+
+enum dma_channel_transfer_size {DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2};
+#define DREQ_XIP_STREAM 37
+
+struct dma_channel_config
+{
+	bool readIncrement, writeIncrement;
+	uint dreq;
+};
+
+struct HostDMA
+{
+	bool claimed, busy;
+	uint32_t polls;
+	volatile void *write;
+	const volatile void *read;
+	uint32_t count;
+};
+
+inline HostDMA hostDMA[12] = {};
+inline uint32_t hostDMALatency = 1;
+inline uint32_t hostDMATransfers = 0;
+
+inline int dma_claim_unused_channel(bool)
+{
+	for (int c = 0; c < 12; c++)
+	{
+		if (!hostDMA[c].claimed)
+		{
+			hostDMA[c].claimed = true;
+			return c;
+		}
+	}
+	return -1;
+}
+
+inline dma_channel_config dma_channel_get_default_config(uint)
+{
+	return {true, false, 0x3F};
+}
+
+inline void channel_config_set_transfer_data_size(dma_channel_config *, dma_channel_transfer_size) {}
+inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) {c->readIncrement = incr;}
+inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) {c->writeIncrement = incr;}
+inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) {c->dreq = dreq;}
+
+inline void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write,
+								  const volatile void *read, uint count, bool trigger)
+{
+	HostDMA &d = hostDMA[channel];
+	uintptr_t source = uintptr_t(read);
+	if (!config->readIncrement && source == XIP_AUX_BASE)
+	{
+		source = xip_ctrl_hw->stream_addr; // streaming FIFO
+	}
+	else if (source >= XIP_NOCACHE_NOALLOC_BASE && source < XIP_NOCACHE_NOALLOC_BASE + PICO_FLASH_SIZE_BYTES)
+	{
+		source = source - XIP_NOCACHE_NOALLOC_BASE + XIP_BASE;
+	}
+	d.write = write;
+	d.read = (const volatile void *)source;
+	d.count = count;
+	d.busy = trigger;
+	d.polls = 0;
+}
+
+inline bool dma_channel_is_busy(uint channel)
+{
+	HostDMA &d = hostDMA[channel];
+	if (d.busy && ++d.polls > hostDMALatency)
+	{
+		memcpy((void *)d.write, (const void *)d.read, d.count * 4);
+		d.busy = false;
+		hostDMATransfers++;
+	}
+	return d.busy;
+}
+
+#endif
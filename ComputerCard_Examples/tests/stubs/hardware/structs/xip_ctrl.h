@@ -0,0 +1,20 @@
+// Host stand-in for the XIP control registers: the streaming FIFO is always
+// empty (the emulated DMA reads the stream itself), and the cache counters
+// count nothing
+
+#ifndef HOST_HARDWARE_STRUCTS_XIP_CTRL_H
+#define HOST_HARDWARE_STRUCTS_XIP_CTRL_H
+
+#include "pico.h"
+
+#define XIP_STAT_FIFO_EMPTY_BITS 0x00000002u
+
+struct xip_ctrl_hw_t
+{
+	uint32_t ctrl, flush, stat, ctr_hit, ctr_acc, stream_addr, stream_ctr, stream_fifo;
+};
+
+inline xip_ctrl_hw_t hostXIPCtrl = {0, 0, XIP_STAT_FIFO_EMPTY_BITS, 0, 0, 0, 0, 0};
+#define xip_ctrl_hw (&hostXIPCtrl)
+
+#endif
@@ -0,0 +1,23 @@
+/*
+Host stand-ins for the parts of the Pico SDK used by SampleStream.h
+
+The flash is memory-mapped at XIP_BASE, as on the card: a host test maps
+its flash image there (see test_samplestream.cpp), so that addresses still
+fit in 32 bits.
+*/
+
+#ifndef HOST_PICO_H
+#define HOST_PICO_H
+
+#include <cstdint>
+
+typedef unsigned int uint;
+
+#define __not_in_flash_func(f) f
+
+#define XIP_BASE ((uintptr_t)0x10000000)
+#define XIP_NOCACHE_NOALLOC_BASE ((uintptr_t)0x13000000)
+#define XIP_AUX_BASE ((uintptr_t)0x50400000)
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+#endif
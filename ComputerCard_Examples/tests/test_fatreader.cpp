@@ -0,0 +1,382 @@
+// Host tests of FATReader, on FAT16 and FAT32 images built in memory, and
+// on the volume FATVolume presents
+
+#include "FATReader.h"
+#include "Check.h"
+
+#include <cstdio>
+#include <vector>
+
+// Block device: an image in memory, counting reads
+struct MemoryDevice
+{
+	std::vector<uint8_t> image;
+	uint32_t reads = 0, sectorsRead = 0;
+	bool fail = false;
+
+	bool ReadSectors(uint32_t sector, uint8_t *buffer, uint32_t count)
+	{
+		if (fail || (uint64_t(sector) + count) * 512 > image.size()) return false;
+		memcpy(buffer, image.data() + size_t(sector) * 512, size_t(count) * 512);
+		reads++;
+		sectorsRead += count;
+		return true;
+	}
+};
+
+static void Put16(uint8_t *p, uint32_t v) {p[0] = uint8_t(v); p[1] = uint8_t(v >> 8);}
+static void Put32(uint8_t *p, uint32_t v) {Put16(p, v); Put16(p + 2, v >> 16);}
+
+// Byte i of test file f
+static uint8_t Pattern(uint32_t f, uint32_t i) {return uint8_t(i * 7 + (i >> 9) + f * 31);}
+
+// A FAT16 or FAT32 volume, optionally after an MBR partition table
+class ImageBuilder
+{
+public:
+	MemoryDevice device;
+	uint32_t clusters;
+
+	ImageBuilder(bool isFAT32, uint32_t numClusters, uint32_t spc, uint32_t partitionStart)
+		: clusters(numClusters), fat32(isFAT32), sectorsPerCluster(spc), start(partitionStart)
+	{
+		uint32_t reserved = fat32 ? 32 : 1;
+		uint32_t rootEntries = fat32 ? 0 : 512;
+		fatSize = ((clusters + 2) * (fat32 ? 4 : 2) + 511) / 512;
+		fatStart = start + reserved;
+		rootStart = fatStart + 2 * fatSize;
+		dataStart = rootStart + rootEntries * 32 / 512;
+		uint32_t total = dataStart - start + clusters * spc;
+		device.image.assign(size_t(start + total) * 512, 0);
+
+		if (start)
+		{
+			uint8_t *m = Sector(0);
+			uint8_t *p = m + 446;
+			p[4] = fat32 ? 0x0C : 0x06;
+			Put32(p + 8, start);
+			Put32(p + 12, total);
+			m[510] = 0x55;
+			m[511] = 0xAA;
+		}
+
+		uint8_t *b = Sector(start);
+		b[0] = 0xEB;
+		Put16(b + 11, 512);
+		b[13] = uint8_t(spc);
+		Put16(b + 14, reserved);
+		b[16] = 2;
+		Put16(b + 17, rootEntries);
+		Put32(b + 32, total);
+		if (fat32)
+		{
+			Put32(b + 36, fatSize);
+			Put32(b + 44, 2); // root directory cluster
+			SetNext(2, endOfChain);
+			rootChain.push_back(2);
+		}
+		else
+		{
+			Put16(b + 22, fatSize);
+		}
+		b[510] = 0x55;
+		b[511] = 0xAA;
+	}
+
+	uint8_t *Sector(uint32_t s) {return device.image.data() + size_t(s) * 512;}
+	uint8_t *Cluster(uint32_t c) {return Sector(dataStart + (c - 2) * sectorsPerCluster);}
+
+	void SetNext(uint32_t cluster, uint32_t next)
+	{
+		uint8_t *fat = Sector(fatStart);
+		if (fat32)
+			Put32(fat + 4 * cluster, next);
+		else
+			Put16(fat + 2 * cluster, next);
+	}
+
+	// Extend the FAT32 root directory with another cluster
+	void GrowRoot(uint32_t cluster)
+	{
+		SetNext(rootChain.back(), cluster);
+		SetNext(cluster, endOfChain);
+		rootChain.push_back(cluster);
+	}
+
+	// Add a directory entry, and write size bytes of test file f to the
+	// chain of clusters given (ending early if the chain is too short)
+	void AddFile(const char *base, const char *ext, uint32_t f, uint32_t size, std::vector<uint32_t> chain,
+				 uint8_t attr = FATDirEntry::Archive)
+	{
+		FATDirEntry e = {};
+		FATDirEntry::MakeName(e.name, base, ext);
+		e.attr = attr;
+		e.size = size;
+		if (!chain.empty())
+		{
+			e.cluster = uint16_t(chain[0]);
+			e.clusterHigh = uint16_t(chain[0] >> 16);
+		}
+		AddEntry(e);
+
+		uint32_t clusterBytes = sectorsPerCluster * 512;
+		for (size_t k = 0; k < chain.size(); k++)
+		{
+			SetNext(chain[k], (k + 1 < chain.size()) ? chain[k + 1] : endOfChain);
+			for (uint32_t i = 0; i < clusterBytes && k * clusterBytes + i < size; i++)
+			{
+				Cluster(chain[k])[i] = Pattern(f, uint32_t(k * clusterBytes + i));
+			}
+		}
+	}
+
+	void AddEntry(const FATDirEntry &e)
+	{
+		uint32_t perSector = 512 / 32;
+		uint32_t sector = entries / perSector;
+		uint8_t *s = fat32 ? Cluster(rootChain[sector / sectorsPerCluster]) + (sector % sectorsPerCluster) * 512
+						   : Sector(rootStart + sector);
+		memcpy(s + (entries % perSector) * 32, &e, 32);
+		entries++;
+	}
+
+private:
+	bool fat32;
+	uint32_t sectorsPerCluster, start;
+	uint32_t fatSize = 0, fatStart = 0, rootStart = 0, dataStart = 0;
+	uint32_t entries = 0;
+	uint32_t endOfChain = fat32 ? 0x0FFFFFFF : 0xFFFF;
+	std::vector<uint32_t> rootChain;
+};
+
+// Read a whole file maxSectors at a time, checking it against the test pattern
+static bool ReadAndCompare(FATReader<MemoryDevice> &fat, FATFile &file, uint32_t f, uint32_t maxSectors)
+{
+	static uint8_t buffer[64 * 512];
+	uint32_t offset = file.position;
+	while (!file.AtEnd())
+	{
+		uint32_t bytes = fat.Read(file, buffer, maxSectors);
+		if (bytes == 0) return false;
+		for (uint32_t i = 0; i < bytes; i++)
+		{
+			if (buffer[i] != Pattern(f, offset + i)) return false;
+		}
+		offset += bytes;
+	}
+	return offset == file.size;
+}
+
+// Find a file by name in the root directory
+static bool Find(FATReader<MemoryDevice> &fat, const char *base, const char *ext, FATDirEntry &entry)
+{
+	uint8_t name[11];
+	FATDirEntry::MakeName(name, base, ext);
+	for (uint32_t i = 0; fat.ReadEntry(i, entry) && !entry.IsEnd(); i++)
+	{
+		if (entry.IsFile() && memcmp(entry.name, name, 11) == 0) return true;
+	}
+	return false;
+}
+
+// FAT16 in a partition: listing, contiguous and fragmented files, seeking
+static void TestFAT16()
+{
+	ImageBuilder image(false, 5000, 4, 63);
+	FATDirEntry label = {};
+	FATDirEntry::MakeName(label.name, "DRIVE", "");
+	label.attr = FATDirEntry::VolumeLabel;
+	image.AddEntry(label);
+	image.AddFile("ONE", "WAV", 1, 10000, {10, 11, 12, 13, 14});
+	image.AddFile("GONE", "WAV", 2, 100, {20});
+	image.AddFile("SUB", "", 3, 0, {21}, FATDirEntry::Directory);
+	image.AddFile("TWO", "WAV", 4, 7000, {30, 31, 50, 51});
+	image.AddFile("EMPTY", "TXT", 5, 0, {});
+	FATDirEntry deleted = {};
+	FATDirEntry::MakeName(deleted.name, "XGONE", "WAV");
+	deleted.name[0] = FATDirEntry::Deleted;
+	image.AddEntry(deleted);
+
+	FATReader<MemoryDevice> fat(image.device);
+	CHECK(fat.Mount());
+	CHECK(!fat.IsFAT32());
+	CHECK_EQ(fat.ClusterSize(), 2048);
+
+	uint32_t files = 0, wavs = 0;
+	FATDirEntry entry;
+	for (uint32_t i = 0; fat.ReadEntry(i, entry) && !entry.IsEnd(); i++)
+	{
+		if (entry.IsFile()) files++;
+		if (entry.IsFile() && entry.HasExtension("WAV")) wavs++;
+	}
+	CHECK_EQ(files, 4);
+	CHECK_EQ(wavs, 3);
+	CHECK(!fat.ReadEntry(512, entry)); // past the end of the FAT16 root directory
+
+	// Contiguous file: reads of up to 8 sectors run on across clusters
+	FATFile file;
+	CHECK(Find(fat, "ONE", "WAV", entry));
+	fat.Open(entry, file);
+	image.device.reads = 0;
+	CHECK(ReadAndCompare(fat, file, 1, 8));
+	CHECK_EQ(image.device.reads, 4); // 20 sectors: 8, 8, 4, and a FAT sector
+	CHECK(file.AtEnd());
+
+	// Fragmented file: a read stops at the break in the chain
+	CHECK(Find(fat, "TWO", "WAV", entry));
+	fat.Open(entry, file);
+	static uint8_t buffer[16 * 512];
+	CHECK_EQ(fat.Read(file, buffer, 16), 4096);
+	CHECK_EQ(fat.Read(file, buffer, 16), 7000 - 4096);
+	CHECK(file.AtEnd());
+	CHECK_EQ(fat.Read(file, buffer, 16), 0);
+
+	// Seek back, into the second fragment, and forward again from there
+	CHECK(fat.Seek(file, 5000));
+	CHECK_EQ(file.position, 4608);
+	CHECK(ReadAndCompare(fat, file, 4, 1));
+	CHECK(fat.Seek(file, 1));
+	CHECK_EQ(file.position, 0);
+	CHECK(fat.Seek(file, 2100));
+	CHECK(ReadAndCompare(fat, file, 4, 3));
+	CHECK(fat.Seek(file, 999999)); // the start of the last sector
+	CHECK_EQ(file.position, 6656);
+	CHECK(ReadAndCompare(fat, file, 4, 1));
+
+	CHECK(Find(fat, "EMPTY", "TXT", entry));
+	fat.Open(entry, file);
+	CHECK(file.AtEnd());
+	CHECK_EQ(fat.Read(file, buffer, 1), 0);
+
+	// A failed device read returns no bytes, and the file can be read again
+	CHECK(Find(fat, "ONE", "WAV", entry));
+	fat.Open(entry, file);
+	image.device.fail = true;
+	CHECK_EQ(fat.Read(file, buffer, 8), 0);
+	CHECK(!file.AtEnd());
+	image.device.fail = false;
+	CHECK(ReadAndCompare(fat, file, 1, 5));
+}
+
+// FAT32 without a partition table: root directory over several clusters,
+// a file filling its last cluster exactly, and a corrupt chain
+static void TestFAT32()
+{
+	ImageBuilder image(true, 66000, 1, 0);
+	image.GrowRoot(100);
+	image.GrowRoot(50);
+	for (uint32_t i = 0; i < 40; i++)
+	{
+		char base[9];
+		snprintf(base, sizeof(base), "F%u", i);
+		image.AddFile(base, "BIN", 0, 0, {});
+	}
+	image.AddFile("LAST", "WAV", 6, 1536, {65000, 65001, 65002});
+	image.AddFile("HIGH", "WAV", 7, 1000, {65600, 65601}); // first cluster above 16 bits
+	image.AddFile("BROKEN", "WAV", 8, 2048, {200, 201});
+	image.SetNext(201, 0); // chain ends (free) before the end of the file
+
+	FATReader<MemoryDevice> fat(image.device);
+	CHECK(fat.Mount());
+	CHECK(fat.IsFAT32());
+	CHECK_EQ(fat.ClusterSize(), 512);
+
+	FATDirEntry entry;
+	FATFile file;
+	CHECK(Find(fat, "LAST", "WAV", entry)); // entry 40, in the third root cluster
+	fat.Open(entry, file);
+	CHECK(ReadAndCompare(fat, file, 6, 2));
+	CHECK(fat.Seek(file, 1536)); // end of a file filling its last cluster
+	CHECK(file.AtEnd());
+	CHECK(fat.Seek(file, 512));
+	CHECK(ReadAndCompare(fat, file, 6, 8));
+
+	// Entries read out of order follow the root chain from the start again
+	CHECK(fat.ReadEntry(35, entry));
+	CHECK(fat.ReadEntry(3, entry));
+	CHECK_EQ(entry.name[1], '3');
+
+	CHECK(Find(fat, "HIGH", "WAV", entry));
+	CHECK_EQ(entry.clusterHigh, 1);
+	fat.Open(entry, file);
+	CHECK(ReadAndCompare(fat, file, 7, 4));
+
+	CHECK(Find(fat, "BROKEN", "WAV", entry));
+	fat.Open(entry, file);
+	static uint8_t buffer[8 * 512];
+	CHECK_EQ(fat.Read(file, buffer, 8), 1024);
+	CHECK_EQ(fat.Read(file, buffer, 8), 0);
+	CHECK(!file.AtEnd());
+	CHECK(!fat.Seek(file, 1536));
+}
+
+// Volumes that must not mount
+static void TestMountFailures()
+{
+	ImageBuilder fat12(false, 4000, 1, 0); // too few clusters for FAT16
+	FATReader<MemoryDevice> a(fat12.device);
+	CHECK(!a.Mount());
+
+	ImageBuilder blank(false, 5000, 1, 0);
+	memset(blank.Sector(0), 0, 512);
+	FATReader<MemoryDevice> b(blank.device);
+	CHECK(!b.Mount());
+	CHECK(!b.Mounted());
+	FATDirEntry entry;
+	CHECK(!b.ReadEntry(0, entry));
+
+	ImageBuilder good(false, 5000, 1, 0);
+	FATReader<MemoryDevice> c(good.device);
+	good.device.fail = true;
+	CHECK(!c.Mount());
+	good.device.fail = false;
+	CHECK(c.Mount());
+	c.Unmount();
+	CHECK(!c.ReadEntry(0, entry));
+}
+
+// The volume FATVolume presents, as sample_upload does, read back
+static void TestFATVolume()
+{
+	static FATVolume<4096, 64> volume;
+	volume.Format(4096, "SAMPLES", 0x1234);
+	uint8_t name[11];
+	FATDirEntry::MakeName(name, "S1", "WAV");
+	volume.AddFile(name, 2, 9000);
+	FATDirEntry::MakeName(name, "S2", "WAV");
+	volume.AddFile(name, 5, 4096);
+
+	MemoryDevice device;
+	device.image.assign(size_t(volume.Sectors()) * 512, 0);
+	for (uint32_t s = 0; s < volume.Sectors(); s++)
+	{
+		uint32_t cluster, offset;
+		if (!volume.DataSector(s, cluster, offset)) volume.ReadSector(s, device.image.data() + size_t(s) * 512);
+	}
+	uint32_t firstData = volume.Sectors() - volume.Clusters() * volume.sectorsPerCluster;
+	for (uint32_t i = 0; i < 9000; i++) device.image[size_t(firstData) * 512 + i] = Pattern(1, i);
+	for (uint32_t i = 0; i < 4096; i++) device.image[size_t(firstData + 3 * 8) * 512 + i] = Pattern(2, i);
+
+	FATReader<MemoryDevice> fat(device);
+	CHECK(fat.Mount());
+	CHECK(!fat.IsFAT32());
+	CHECK_EQ(fat.ClusterSize(), volume.clusterSize);
+
+	FATDirEntry entry;
+	FATFile file;
+	CHECK(Find(fat, "S1", "WAV", entry));
+	fat.Open(entry, file);
+	CHECK(ReadAndCompare(fat, file, 1, 8));
+	CHECK(Find(fat, "S2", "WAV", entry));
+	fat.Open(entry, file);
+	CHECK(ReadAndCompare(fat, file, 2, 8));
+}
+
+int main()
+{
+	TestFAT16();
+	TestFAT32();
+	TestMountFailures();
+	TestFATVolume();
+	return CheckResult("test_fatreader");
+}
@@ -0,0 +1,237 @@
+// Host test of MIDIClock: lock to a steady and a jittered clock, pulse
+// spacing at each rate, tempo changes, transport and loss of clock
+
+#include "MIDIClock.h"
+#include "Check.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static MIDIEvent Message(MIDIEvent::Type type, uint16_t beats = 0)
+{
+	MIDIEvent e = {};
+	e.type = type;
+	e.data1 = uint8_t(beats & 0x7F);
+	e.data2 = uint8_t(beats >> 7);
+	return e;
+}
+
+// Runs a MIDIClock one sample at a time, recording the samples at which
+// pulses start at a given rate
+struct Follower
+{
+	MIDIClock clock;
+	uint32_t now = 0;
+	double nextTick = 0; // time of next clock from the sender
+	int rate = 24;
+	std::vector<uint32_t> pulses;
+	uint32_t gateSamples = 0, starts = 0;
+
+	void Run(uint32_t samples)
+	{
+		for (uint32_t i = 0; i < samples; i++)
+		{
+			clock.Process();
+			if (clock.Pulse(rate)) pulses.push_back(now);
+			if (clock.Gate(rate)) gateSamples++;
+			if (clock.StartPulse()) starts++;
+			now++;
+		}
+	}
+
+	// Receive count clock ticks, interval samples apart, each delayed by up to jitter samples
+	void Ticks(uint32_t count, double interval, uint32_t jitter = 0, std::mt19937 *rng = nullptr)
+	{
+		for (uint32_t k = 0; k < count; k++)
+		{
+			uint32_t due = uint32_t(std::lround(nextTick)) + (jitter ? (*rng)() % (jitter + 1) : 0);
+			if (due > now) Run(due - now);
+			clock.Event(Message(MIDIEvent::Clock));
+			nextTick += interval;
+		}
+	}
+};
+
+// Largest difference of pulse spacing from the ideal, over pulses from index first
+static double MaxSpacingError(const std::vector<uint32_t> &pulses, size_t first, double ideal)
+{
+	double worst = 0;
+	for (size_t i = first + 1; i < pulses.size(); i++)
+	{
+		worst = std::fmax(worst, std::fabs(double(pulses[i] - pulses[i - 1]) - ideal));
+	}
+	return worst;
+}
+
+// Steady 120 BPM clock (1000 samples per tick): exact pulse counts at each rate
+static void TestSteady()
+{
+	static const int rates[] = {1, 2, 3, 4, 6, 8, 12, 24, 48, 96};
+	for (int rate : rates)
+	{
+		Follower f;
+		f.rate = rate;
+		f.Ticks(48, 1000.0); // clock runs before Start, as it usually does
+		f.Run(500);
+		f.clock.Event(Message(MIDIEvent::Start));
+		uint32_t start = f.now + 500;
+		f.Ticks(24 * 16, 1000.0); // 16 quarter notes
+		f.Run(999); // up to where the next tick would be
+		CHECK(f.clock.Locked());
+		CHECK(std::fabs(f.clock.BPM() - 120.0f) < 0.1f);
+		CHECK_EQ(f.clock.SongPositionTicks(), 24 * 16 - 1);
+		CHECK_EQ(f.pulses.size(), size_t(16 * rate));
+		CHECK_EQ(f.pulses.empty() ? 0 : f.pulses[0], start); // first pulse on the first clock after Start
+		CHECK(MaxSpacingError(f.pulses, 0, 24000.0 / rate) <= 1.0);
+		CHECK_EQ(f.starts, 1);
+
+		// 50% duty cycle
+		CHECK(std::abs(int32_t(f.gateSamples) - int32_t(f.now - start) / 2) <= 16 * rate);
+	}
+}
+
+// Clock delivered up to 1ms (48 samples) late, as over USB: output pulses are far
+// more even than the received clock, and the tempo is measured accurately
+static void TestJitter()
+{
+	static const double intervals[] = {1000.0, 1234.5, 403.2, 2400.0}; // 120, 97.2, 297.6, 50 BPM
+	for (double interval : intervals)
+	{
+		std::mt19937 rng(static_cast<uint32_t>(interval));
+		Follower f;
+		f.rate = 24;
+		f.clock.Event(Message(MIDIEvent::Start));
+		f.Ticks(24 * 32, interval, 48, &rng);
+		f.Run(uint32_t(interval / 2));
+
+		size_t settled = f.pulses.size() / 2;
+		double error = MaxSpacingError(f.pulses, settled, interval);
+		float bpm = float(48000.0 * 60.0 / 24.0 / interval);
+		std::printf("  %.1f samples per tick: pulse spacing within %.1f samples, %.2f BPM\n", interval, error, double(f.clock.BPM()));
+		CHECK(f.clock.Locked());
+		CHECK(std::fabs(f.clock.BPM() - bpm) < bpm * 0.005f);
+		CHECK(error < 12.0); // vs. up to 48 for the received clock
+		CHECK_EQ(f.pulses.size(), 24 * 32);
+
+		// Multiplied clock stays monotonic, with even spacing
+		Follower g;
+		g.rate = 96;
+		rng.seed(uint32_t(interval));
+		g.clock.Event(Message(MIDIEvent::Start));
+		g.Ticks(24 * 32, interval, 48, &rng);
+		g.Run(uint32_t(interval) - 1);
+		double subError = MaxSpacingError(g.pulses, g.pulses.size() / 2, interval / 4);
+		CHECK(subError < 12.0);
+		CHECK(g.pulses.size() >= size_t(24 * 32 * 4 - 4));
+	}
+}
+
+// Tempo changes, gradual and sudden: relocks without losing or adding ticks
+static void TestTempoChange()
+{
+	std::mt19937 rng(7);
+	Follower f;
+	f.clock.Event(Message(MIDIEvent::Start));
+	f.Ticks(24 * 8, 1000.0, 48, &rng);
+	for (int i = 0; i < 24 * 8; i++) f.Ticks(1, 1000.0 - i * 1.0, 48, &rng); // accelerate to ~250 BPM
+	f.Ticks(24 * 8, 400.0, 48, &rng); // sudden change to 300 BPM
+	CHECK(std::fabs(f.clock.BPM() - 300.0f) < 3.0f);
+	f.Ticks(24 * 8, 4000.0, 48, &rng); // and to 30 BPM
+	f.Run(2000);
+	CHECK(std::fabs(f.clock.BPM() - 30.0f) < 0.15f);
+	CHECK_EQ(f.clock.SongPositionTicks(), 24 * 32 - 1);
+	CHECK_EQ(f.pulses.size(), 24 * 32);
+	for (size_t i = 1; i < f.pulses.size(); i++) CHECK(f.pulses[i] > f.pulses[i - 1]);
+}
+
+// Start, stop, continue and song position
+static void TestTransport()
+{
+	Follower f;
+	f.rate = 24;
+
+	// Clock before Start: locks, but no pulses
+	f.Ticks(48, 1000.0);
+	CHECK(f.clock.Locked());
+	CHECK(!f.clock.Running());
+	CHECK(f.pulses.empty());
+
+	f.clock.Event(Message(MIDIEvent::Start));
+	CHECK(f.clock.Running());
+	f.Ticks(30, 1000.0);
+	f.Run(500);
+	CHECK_EQ(f.starts, 1);
+	CHECK_EQ(f.pulses.size(), 30);
+	CHECK_EQ(f.clock.SongPositionTicks(), 29);
+
+	// Stop: no more pulses, though clock continues
+	f.clock.Event(Message(MIDIEvent::Stop));
+	f.Ticks(24, 1000.0);
+	CHECK(!f.clock.Running());
+	CHECK_EQ(f.pulses.size(), 30);
+
+	// Continue from the tick after the last
+	f.clock.Event(Message(MIDIEvent::Continue));
+	f.Ticks(10, 1000.0);
+	f.Run(500);
+	CHECK_EQ(f.starts, 2);
+	CHECK_EQ(f.pulses.size(), 40);
+	CHECK_EQ(f.clock.SongPositionTicks(), 39);
+
+	// Song position pointer, in sixteenth notes
+	f.clock.Event(Message(MIDIEvent::Stop));
+	f.clock.Event(Message(MIDIEvent::SongPosition, 200));
+	f.clock.Event(Message(MIDIEvent::Continue));
+	f.Ticks(6, 1000.0);
+	f.Run(500);
+	CHECK_EQ(f.clock.SongPositionTicks(), 1205);
+
+	// Quarter notes resume on the beat: tick 1206 is the next multiple of 6
+	Follower q;
+	q.rate = 4;
+	q.clock.Event(Message(MIDIEvent::SongPosition, 3));
+	q.clock.Event(Message(MIDIEvent::Continue));
+	q.Ticks(12, 1000.0);
+	q.Run(500);
+	CHECK_EQ(q.pulses.size(), 2); // ticks 18 and 24
+	CHECK_EQ(q.pulses.size() == 2 ? q.pulses[1] - q.pulses[0] : 0, 6000);
+}
+
+// Clock stops without a Stop message: at most one more tick, then lock is lost
+static void TestClockLost()
+{
+	Follower f;
+	f.rate = 96;
+	f.clock.Event(Message(MIDIEvent::Start));
+	f.Ticks(48, 1000.0);
+	f.Run(500);
+	uint32_t ticks = f.clock.SongPositionTicks();
+	f.Run(1000 * 10);
+	CHECK(f.clock.SongPositionTicks() <= ticks + 1);
+	CHECK(!f.clock.Locked());
+	size_t pulses = f.pulses.size();
+	f.Run(48000);
+	CHECK_EQ(f.pulses.size(), pulses);
+	CHECK(f.clock.Running());
+
+	// Clock resumes: locks at the second tick
+	f.nextTick = f.now;
+	f.Ticks(1, 1000.0);
+	CHECK(!f.clock.Locked());
+	f.Ticks(1, 1000.0);
+	CHECK(f.clock.Locked());
+	f.Ticks(22, 1000.0);
+	CHECK(std::fabs(f.clock.BPM() - 120.0f) < 0.1f);
+}
+
+int main()
+{
+	TestSteady();
+	TestJitter();
+	TestTempoChange();
+	TestTransport();
+	TestClockLost();
+	return CheckResult("test_midiclock");
+}
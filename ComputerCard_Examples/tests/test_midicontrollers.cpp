@@ -0,0 +1,121 @@
+// Host tests of MIDIControllers: 14-bit pairs, NRPN/RPN, MPE zones and channel mode messages
+
+#include "MIDIControllers.h"
+#include "Check.h"
+
+static MIDIEvent CC(uint8_t channel, uint8_t number, uint8_t value)
+{
+	MIDIEvent e = {};
+	e.type = MIDIEvent::ControlChange;
+	e.channel = channel;
+	e.data1 = number;
+	e.data2 = value;
+	return e;
+}
+
+static void TestController14()
+{
+	MIDIControllers m;
+	MIDIControllerChange c;
+
+	CHECK(m.Decode(CC(0, 1, 0x40), c));
+	CHECK(c.type == MIDIControllerChange::Controller14);
+	CHECK_EQ(c.number, 1);
+	CHECK_EQ(c.value, 0x2000);
+	CHECK(m.Decode(CC(0, 33, 0x15), c));
+	CHECK_EQ(c.number, 1);
+	CHECK_EQ(c.value, 0x2015);
+	CHECK_EQ(m.Controller14(0, 1), 0x2015);
+
+	// An MSB alone resets the LSB
+	CHECK(m.Decode(CC(0, 1, 0x41), c));
+	CHECK_EQ(c.value, 0x2080);
+
+	// Other 7-bit controllers are scaled to the full range
+	CHECK(m.Decode(CC(2, 74, 127), c));
+	CHECK(c.type == MIDIControllerChange::Controller);
+	CHECK_EQ(c.value, 16383);
+	CHECK_EQ(m.Timbre(2), 16383);
+	CHECK_EQ(c.Unipolar(), 262143);
+}
+
+static void TestParameters()
+{
+	MIDIControllers m;
+	MIDIControllerChange c;
+
+	// NRPN 0x0102 = 0x1234, then incremented
+	CHECK(!m.Decode(CC(3, 99, 0x02), c));
+	CHECK(!m.Decode(CC(3, 98, 0x02), c));
+	CHECK(m.Decode(CC(3, 6, 0x24), c));
+	CHECK(m.Decode(CC(3, 38, 0x34), c));
+	CHECK(c.type == MIDIControllerChange::NRPN);
+	CHECK_EQ(c.number, 0x0102);
+	CHECK_EQ(c.value, 0x1234);
+	CHECK(m.Decode(CC(3, 96, 0), c));
+	CHECK_EQ(c.value, 0x1235);
+
+	// RPN 0: pitch bend range of 12 semitones 50 cents, then RPN null
+	CHECK(!m.Decode(CC(3, 101, 0), c));
+	CHECK(!m.Decode(CC(3, 100, 0), c));
+	CHECK(m.Decode(CC(3, 6, 12), c));
+	CHECK(m.Decode(CC(3, 38, 50), c));
+	CHECK_EQ(m.BendRangeCents(3), 1250);
+	CHECK(!m.Decode(CC(3, 101, 127), c));
+	CHECK(!m.Decode(CC(3, 100, 127), c));
+	CHECK(!m.Decode(CC(3, 6, 1), c));
+	CHECK_EQ(m.BendRangeCents(3), 1250);
+}
+
+static void TestMPE()
+{
+	MIDIControllers m;
+	MIDIControllerChange c;
+
+	// Lower zone with 7 member channels (2-8)
+	m.Decode(CC(0, 101, 0), c);
+	m.Decode(CC(0, 100, 6), c);
+	CHECK(m.Decode(CC(0, 6, 7), c));
+	CHECK_EQ(m.MPEMaster(1), 0);
+	CHECK_EQ(m.MPEMaster(7), 0);
+	CHECK_EQ(m.MPEMaster(8), -1);
+	CHECK_EQ(m.BendRangeCents(4), 4800);
+	CHECK_EQ(m.BendRangeCents(0), 200);
+
+	// Full bend up on a member channel, and the master: 48 + 2 semitones
+	MIDIEvent bend = {};
+	bend.type = MIDIEvent::PitchBend;
+	bend.data1 = 0;
+	bend.data2 = 0x60; // 0x3000, half of full range up
+	bend.channel = 4;
+	CHECK(m.Decode(bend, c));
+	CHECK(c.type == MIDIControllerChange::PitchBend);
+	bend.channel = 0;
+	CHECK(m.Decode(bend, c));
+	CHECK_EQ(m.NotePitch(60, 4), (60 << 8) + 24 * 256 + 1 * 256);
+}
+
+// Channel mode messages are not controllers
+static void TestChannelMode()
+{
+	MIDIControllers m;
+	MIDIControllerChange c;
+	for (uint8_t number = 120; number < 128; number++)
+	{
+		CHECK(!m.Decode(CC(0, number, 0), c));
+	}
+	CHECK(m.Decode(CC(0, 119, 0), c));
+
+	MIDIEvent note = {};
+	note.type = MIDIEvent::NoteOn;
+	CHECK(!m.Decode(note, c));
+}
+
+int main()
+{
+	TestController14();
+	TestParameters();
+	TestMPE();
+	TestChannelMode();
+	return CheckResult("test_midicontrollers");
+}
@@ -0,0 +1,172 @@
+// Host test of MIDIOutput and Hysteresis: USB transfers for 10s of knob input
+// (a sweep, then held with noise on a step boundary) and some notes, sent
+// naively, with coalescing, and with coalescing and hysteresis
+
+#include "MIDIOutput.h"
+#include "MIDIParser.h"
+#include "Check.h"
+
+#include <random>
+
+static constexpr uint32_t numSamples = 480000; // 10s at 48kHz
+static constexpr uint32_t sweepSamples = 96000; // 2s sweep, then held at a step boundary
+static constexpr uint32_t noteInterval = 9600; // a note on, then off, every 0.2s: 100 messages
+
+// 12-bit knob reading: sweep from 0 to 2048 (the boundary between MIDI values 63 and 64),
+// with about 1.5 LSB rms noise throughout
+static int32_t Knob(uint32_t n, std::mt19937 &rng)
+{
+	int32_t position = (n < sweepSamples) ? int32_t(uint64_t(n) * 2048 / sweepSamples) : 2048;
+	int32_t noise = 0;
+	for (int i = 0; i < 12; i++) noise += int32_t(rng() % 1001) - 500; // sum of uniforms: ~1000 * 1 rms
+	position += (noise * 3 / 2 + (noise >= 0 ? 500 : -500)) / 1000;
+	if (position < 0) position = 0;
+	if (position > 4095) position = 4095;
+	return position;
+}
+
+// MIDI receiver at the other end of the USB cable
+struct Receiver
+{
+	MIDIParser<> parser;
+	uint32_t transfers = 0, notes = 0, controllers = 0;
+	int32_t value = -1; // last CC 1 value received
+
+	void Receive(const uint8_t *bytes, uint32_t length)
+	{
+		transfers++;
+		MIDIEvent e;
+		for (uint32_t i = 0; i < length; i++)
+		{
+			if (!parser.Parse(bytes[i], e)) continue;
+			if (e.type == MIDIEvent::ControlChange && e.Controller() == 1)
+			{
+				value = e.Value();
+				controllers++;
+			}
+			else if (e.type == MIDIEvent::NoteOn || e.type == MIDIEvent::NoteOff)
+			{
+				notes++;
+			}
+		}
+	}
+};
+
+// Send a note on or off, if one is due at sample n
+template <typename Send>
+static void Notes(uint32_t n, Send &&send)
+{
+	if (n % (noteInterval / 2) == 0) send((n / (noteInterval / 2)) % 2 == 0);
+}
+
+static void TestNaive()
+{
+	// One write per message, for every change of knob >> 5
+	std::mt19937 rng(1);
+	Receiver r;
+	int32_t last = -1;
+	for (uint32_t n = 0; n < numSamples; n++)
+	{
+		int32_t v = Knob(n, rng) >> 5;
+		if (v != last)
+		{
+			const uint8_t cc[] = {0xB0, 1, uint8_t(v)};
+			r.Receive(cc, 3);
+			last = v;
+		}
+		Notes(n, [&](bool on) {
+			const uint8_t note[] = {uint8_t(on ? 0x90 : 0x80), 60, 100};
+			r.Receive(note, 3);
+		});
+	}
+	std::printf("naive: %u transfers\n", unsigned(r.transfers));
+	CHECK_EQ(r.notes, 100);
+	CHECK_EQ(r.value, last);
+	CHECK(r.transfers > 50000);
+}
+
+// MIDIOutput flushed every sample, as from the USB loop. Returns transfers.
+static uint32_t TestMIDIOutput(bool hysteresis, uint32_t expectTransfers, uint32_t expectCoalesced)
+{
+	std::mt19937 rng(1);
+	Receiver r;
+	MIDIOutput<> out;
+	Hysteresis knob;
+	auto write = [&](const uint8_t *bytes, uint32_t length) {r.Receive(bytes, length);};
+	int32_t last = -1;
+	for (uint32_t n = 0; n < numSamples; n++)
+	{
+		int32_t k = Knob(n, rng);
+		if (hysteresis)
+		{
+			if (knob.Update(k)) out.ControlChange(0, 1, uint8_t(knob.Value()));
+			last = knob.Value();
+		}
+		else
+		{
+			last = k >> 5;
+			out.ControlChange(0, 1, uint8_t(last));
+		}
+		Notes(n, [&](bool on) {
+			if (on) out.NoteOn(0, 60, 100);
+			else out.NoteOff(0, 60);
+		});
+		out.Flush(n, write);
+	}
+
+	// Then until the last value has been sent
+	for (uint32_t n = numSamples; out.Pending() && n < numSamples + 4800; n++)
+	{
+		out.Flush(n, write);
+	}
+
+	std::printf("%s: %u transfers, %u messages, %u coalesced\n", hysteresis ? "coalescing and hysteresis" : "coalescing",
+				unsigned(out.Transfers()), unsigned(out.Messages()), unsigned(out.Coalesced()));
+	CHECK(!out.Pending());
+	CHECK_EQ(r.notes, 100);
+	CHECK_EQ(r.value, last);
+	CHECK_EQ(r.transfers, out.Transfers());
+	CHECK_EQ(out.Messages(), r.notes + r.controllers);
+	CHECK_EQ(out.Overflows(), 0);
+
+	// Seeded, so the counts are exact
+	CHECK_EQ(out.Transfers(), expectTransfers);
+	CHECK_EQ(out.Coalesced(), expectCoalesced);
+
+	// At most one transfer per 1ms flush interval
+	CHECK(out.Transfers() <= numSamples / 48 + 1);
+	return out.Transfers();
+}
+
+static void TestHysteresis()
+{
+	// 12-bit to 7-bit, with a margin of 8
+	Hysteresis h;
+	CHECK_EQ(h.Value(), -1);
+	CHECK(h.Update(2048));
+	CHECK_EQ(h.Value(), 64);
+	CHECK(!h.Update(2047));
+	CHECK(!h.Update(2040));
+	CHECK(h.Update(2039));
+	CHECK_EQ(h.Value(), 63);
+	CHECK(!h.Update(2048 + 7));
+	CHECK(h.Update(2048 + 8));
+	CHECK_EQ(h.Value(), 64);
+
+	// Large jumps change at once
+	CHECK(h.Update(4095));
+	CHECK_EQ(h.Value(), 127);
+	CHECK(h.Update(0));
+	CHECK_EQ(h.Value(), 0);
+	CHECK(!h.Update(-100));
+}
+
+int main()
+{
+	TestHysteresis();
+	TestNaive();
+	uint32_t coalescing = TestMIDIOutput(false, 8254, 193053);
+	uint32_t both = TestMIDIOutput(true, 163, 0);
+	CHECK(both < coalescing);
+	return CheckResult("test_midioutput");
+}
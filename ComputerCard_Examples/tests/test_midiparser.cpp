@@ -0,0 +1,409 @@
+// Host tests of MIDIParser: running status, real-time bytes, SysEx, USB packets and timing
+
+#include "MIDIParser.h"
+#include "SPSCQueue.h"
+#include "Check.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+typedef SPSCQueue<MIDIEvent, 64> EventQueue;
+
+static uint32_t ParseAll(MIDIParser<> &p, std::initializer_list<uint8_t> bytes, EventQueue &q)
+{
+	return p.Parse(bytes.begin(), uint32_t(bytes.size()), q);
+}
+
+static void TestChannelMessages()
+{
+	MIDIParser<> p;
+	EventQueue q;
+	MIDIEvent e;
+
+	// Note on, then two more by running status, the last with velocity 0
+	CHECK_EQ(ParseAll(p, {0x93, 60, 100, 62, 90, 60, 0}, q), 3);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOn);
+	CHECK_EQ(e.channel, 3);
+	CHECK_EQ(e.Note(), 60);
+	CHECK_EQ(e.Velocity(), 100);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOn);
+	CHECK_EQ(e.Note(), 62);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOff);
+	CHECK_EQ(e.Note(), 60);
+
+	// One data byte: program change and channel pressure
+	CHECK_EQ(ParseAll(p, {0xC0, 5, 6, 0xDF, 77}, q), 3);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::ProgramChange);
+	CHECK_EQ(e.Program(), 5);
+	CHECK(q.Pop(e));
+	CHECK_EQ(e.Program(), 6);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::ChannelPressure);
+	CHECK_EQ(e.channel, 15);
+	CHECK_EQ(e.Pressure(), 77);
+
+	// Pitch bend extremes
+	CHECK_EQ(ParseAll(p, {0xE0, 0, 0, 0x7F, 0x7F, 0, 0x40}, q), 3);
+	CHECK(q.Pop(e));
+	CHECK_EQ(e.Bend(), -8192);
+	CHECK(q.Pop(e));
+	CHECK_EQ(e.Bend(), 8191);
+	CHECK(q.Pop(e));
+	CHECK_EQ(e.Bend(), 0);
+
+	// Data bytes with no status are ignored
+	MIDIParser<> fresh;
+	CHECK_EQ(ParseAll(fresh, {60, 100, 0xB1, 7, 127}, q), 1);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::ControlChange);
+	CHECK_EQ(e.channel, 1);
+	CHECK_EQ(e.Controller(), 7);
+	CHECK_EQ(e.Value(), 127);
+}
+
+static void TestRealTimeAndSystemCommon()
+{
+	MIDIParser<> p;
+	EventQueue q;
+	MIDIEvent e;
+
+	// Clock in the middle of a note on, which still completes; undefined 0xF9 ignored
+	CHECK_EQ(ParseAll(p, {0x90, 0xF8, 64, 0xF9, 127}, q), 2);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::Clock);
+	CHECK(e.IsRealTime());
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOn);
+	CHECK_EQ(e.Note(), 64);
+
+	// Song position cancels running status
+	CHECK_EQ(ParseAll(p, {0xF2, 0x10, 0x01, 65, 100}, q), 1);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::SongPosition);
+	CHECK_EQ(e.Beats(), 0x90);
+	CHECK(!e.IsChannelMessage());
+
+	CHECK_EQ(ParseAll(p, {0xF3, 4, 0xF6, 0xFA, 0xFC}, q), 4);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::SongSelect);
+	CHECK_EQ(e.data1, 4);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::TuneRequest);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::Start);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::Stop);
+}
+
+static void TestSysEx()
+{
+	MIDIParser<4> p;
+	SPSCQueue<MIDIEvent, 8> q;
+	MIDIEvent e;
+
+	// Real-time byte inside SysEx doesn't interrupt it
+	const uint8_t msg[] = {0xF0, 0x7E, 0xF8, 0x01, 0x02, 0xF7};
+	CHECK_EQ(p.Parse(msg, sizeof(msg), q), 2);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::Clock);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::SysEx);
+	CHECK_EQ(e.sysExLength, 3);
+	CHECK_EQ(p.SysExData()[0], 0x7E);
+	CHECK_EQ(p.SysExData()[2], 0x02);
+	CHECK(!p.SysExOverflow());
+
+	// Longer than the buffer, and ended by a note on rather than 0xF7
+	const uint8_t longMsg[] = {0xF0, 1, 2, 3, 4, 5, 6, 0x90, 60, 1};
+	CHECK_EQ(p.Parse(longMsg, sizeof(longMsg), q), 2);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::SysEx);
+	CHECK_EQ(e.sysExLength, 4);
+	CHECK(p.SysExOverflow());
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOn);
+}
+
+static void TestUSBPackets()
+{
+	MIDIParser<> p;
+	EventQueue q;
+	MIDIEvent e;
+
+	const uint8_t noteOn[] = {0x09, 0x92, 48, 0};
+	CHECK_EQ(p.ParseUSBPacket(noteOn, q, 1234), 1);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::NoteOff);
+	CHECK_EQ(e.channel, 2);
+	CHECK_EQ(e.timestamp, 1234);
+
+	// SysEx over three packets: start, continue, end with one byte
+	const uint8_t sysEx[3][4] = {{0x04, 0xF0, 0x41, 0x10}, {0x04, 0x42, 0x12, 0x40}, {0x05, 0xF7, 0, 0}};
+	CHECK_EQ(p.ParseUSBPacket(sysEx[0], q), 0);
+	CHECK_EQ(p.ParseUSBPacket(sysEx[1], q), 0);
+	CHECK_EQ(p.ParseUSBPacket(sysEx[2], q), 1);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::SysEx);
+	CHECK_EQ(e.sysExLength, 5);
+
+	// Clock packet; the padding bytes are not parsed
+	const uint8_t clock[] = {0x0F, 0xF8, 0x90, 0x40};
+	CHECK_EQ(p.ParseUSBPacket(clock, q), 1);
+	CHECK(q.Pop(e));
+	CHECK(e.type == MIDIEvent::Clock);
+	CHECK(q.Empty());
+}
+
+static void TestDueEvents()
+{
+	MIDIParser<> p;
+	EventQueue q;
+	MIDIEvent e;
+
+	p.SetPort(3);
+	const uint8_t notes[] = {0x90, 60, 100};
+	p.Parse(notes, sizeof(notes), q, 0xFFFFFFF0); // about to wrap round
+	p.Parse(notes, sizeof(notes), q, 0x00000010);
+
+	CHECK(!PopDueMIDIEvent(q, 0xFFFFFFF0, 16, e));
+	CHECK(PopDueMIDIEvent(q, 0x00000000, 16, e));
+	CHECK_EQ(e.port, 3);
+	CHECK(!PopDueMIDIEvent(q, 0x0000001F, 16, e));
+	CHECK(PopDueMIDIEvent(q, 0x00000020, 16, e));
+	CHECK(q.Empty());
+}
+
+// Random stream of messages, with the events it should give: the reference
+// model for TestRandomStream. Uses running status, SysEx (some longer than the
+// buffer, or ended by the next status byte), system common messages, stray data
+// bytes, and 0xF8 clock bytes anywhere, including inside other messages.
+class RandomStream
+{
+public:
+	static constexpr int sysExSize = 64;
+
+	struct Expected
+	{
+		MIDIEvent event;
+		std::vector<uint8_t> sysEx; // data bytes kept in the buffer
+		bool overflow;
+	};
+
+	std::vector<uint8_t> bytes;
+	std::vector<Expected> expected;
+
+	explicit RandomStream(uint32_t seed) : rng(seed) {}
+
+	void Generate(uint32_t numMessages)
+	{
+		for (uint32_t i = 0; i < numMessages; i++)
+		{
+			uint32_t r = Random(16);
+			if (r < 10 || pendingSysEx) ChannelMessage();
+			else if (r < 12) SysEx();
+			else if (r < 14) SystemCommon();
+			else if (r < 15 && !running) Byte(uint8_t(Random(128))); // ignored
+			else
+			{
+				Status(uint8_t(0xF4 + Random(2))); // undefined: cancels running status
+				running = 0;
+			}
+		}
+		if (pendingSysEx) Status(0xF7);
+	}
+
+private:
+	std::mt19937 rng;
+	uint8_t running = 0;
+	bool pendingSysEx = false;
+	Expected pending;
+
+	uint32_t Random(uint32_t n) {return rng() % n;}
+
+	void Expect(MIDIEvent::Type type, uint8_t channel, uint8_t data1, uint8_t data2)
+	{
+		Expected e = {};
+		e.event.type = type;
+		e.event.channel = channel;
+		e.event.data1 = data1;
+		e.event.data2 = data2;
+		expected.push_back(e);
+	}
+
+	// Any byte, sometimes after a clock byte
+	void Byte(uint8_t b)
+	{
+		if (Random(8) == 0)
+		{
+			bytes.push_back(0xF8);
+			Expect(MIDIEvent::Clock, 0, 0, 0);
+		}
+		bytes.push_back(b);
+	}
+
+	// A status byte, which ends any SysEx in progress
+	void Status(uint8_t b)
+	{
+		Byte(b);
+		if (pendingSysEx)
+		{
+			expected.push_back(pending);
+			pendingSysEx = false;
+		}
+	}
+
+	void ChannelMessage()
+	{
+		uint8_t status = uint8_t(0x80 + 0x10 * Random(7) + Random(16));
+		if (running && Random(2))
+		{
+			status = running;
+		}
+		else
+		{
+			Status(status);
+			running = status;
+		}
+		bool twoBytes = (status & 0xE0) != 0xC0;
+		uint8_t data1 = uint8_t(Random(128));
+		uint8_t data2 = twoBytes ? uint8_t(Random(4) ? Random(128) : 0) : 0;
+		Byte(data1);
+		if (twoBytes) Byte(data2);
+
+		MIDIEvent::Type type = MIDIEvent::Type(status & 0xF0);
+		if (type == MIDIEvent::NoteOn && data2 == 0) type = MIDIEvent::NoteOff;
+		Expect(type, status & 0x0F, data1, data2);
+	}
+
+	void SysEx()
+	{
+		Status(0xF0);
+		running = 0;
+		uint32_t length = Random(100);
+		Expected e = {};
+		e.event.type = MIDIEvent::SysEx;
+		e.event.sysExLength = uint16_t(std::min<uint32_t>(length, sysExSize));
+		e.overflow = length > sysExSize;
+		for (uint32_t i = 0; i < length; i++)
+		{
+			uint8_t b = uint8_t(Random(128));
+			if (i < sysExSize) e.sysEx.push_back(b);
+			Byte(b);
+		}
+
+		// Usually ended by 0xF7, otherwise by the next status byte
+		pending = e;
+		pendingSysEx = true;
+		if (Random(4)) Status(0xF7);
+	}
+
+	void SystemCommon()
+	{
+		static const uint8_t types[] = {0xF1, 0xF2, 0xF3, 0xF6};
+		uint8_t status = types[Random(4)];
+		Status(status);
+		running = 0;
+		uint32_t needed = (status == 0xF2) ? 2 : (status == 0xF6) ? 0 : 1;
+		uint8_t data[2] = {0, 0};
+		for (uint32_t i = 0; i < needed; i++)
+		{
+			data[i] = uint8_t(Random(128));
+			Byte(data[i]);
+		}
+		Expect(MIDIEvent::Type(status), 0, data[0], data[1]);
+	}
+};
+
+static bool SameEvent(const MIDIEvent &a, const MIDIEvent &b)
+{
+	return a.type == b.type && a.channel == b.channel && a.data1 == b.data1 && a.data2 == b.data2
+		&& (a.type != MIDIEvent::SysEx || a.sysExLength == b.sysExLength);
+}
+
+static void TestRandomStream()
+{
+	for (uint32_t seed = 1; seed <= 20; seed++)
+	{
+		RandomStream stream(seed);
+		stream.Generate(5000);
+
+		// One byte at a time, checking SysEx data as each message ends
+		MIDIParser<RandomStream::sysExSize> p;
+		MIDIEvent e;
+		size_t n = 0;
+		int failures = checkFailures;
+		for (uint8_t b : stream.bytes)
+		{
+			if (!p.Parse(b, e)) continue;
+			CHECK(n < stream.expected.size());
+			if (n >= stream.expected.size()) break;
+			const RandomStream::Expected &x = stream.expected[n++];
+			CHECK(SameEvent(e, x.event));
+			if (x.event.type == MIDIEvent::SysEx)
+			{
+				CHECK(std::equal(x.sysEx.begin(), x.sysEx.end(), p.SysExData()));
+				CHECK_EQ(p.SysExOverflow(), x.overflow);
+			}
+			if (checkFailures != failures)
+			{
+				std::printf("seed %u, event %zu\n", unsigned(seed), n - 1);
+				return;
+			}
+		}
+		CHECK_EQ(n, stream.expected.size());
+
+		// The same stream in random lengths, into a queue
+		MIDIParser<RandomStream::sysExSize> q;
+		std::mt19937 rng(seed);
+		n = 0;
+		for (size_t i = 0; i < stream.bytes.size(); )
+		{
+			EventQueue events;
+			uint32_t length = std::min<uint32_t>(1 + rng() % 20, uint32_t(stream.bytes.size() - i));
+			q.Parse(stream.bytes.data() + i, length, events);
+			i += length;
+			while (events.Pop(e))
+			{
+				CHECK(n < stream.expected.size() && SameEvent(e, stream.expected[n].event));
+				n++;
+			}
+		}
+		CHECK_EQ(n, stream.expected.size());
+	}
+}
+
+// Any bytes at all: events are always well formed
+static void TestRandomBytes()
+{
+	std::mt19937 rng(12345);
+	MIDIParser<16> p;
+	MIDIEvent e;
+	uint32_t events = 0;
+	for (uint32_t i = 0; i < 1000000; i++)
+	{
+		if (!p.Parse(uint8_t(rng()), e)) continue;
+		events++;
+		CHECK(e.type != MIDIEvent::None);
+		CHECK(e.channel < 16 && e.data1 < 128 && e.data2 < 128);
+		if (e.type == MIDIEvent::SysEx) CHECK(e.sysExLength <= 16);
+	}
+	CHECK(events > 0);
+}
+
+int main()
+{
+	TestChannelMessages();
+	TestRealTimeAndSystemCommon();
+	TestSysEx();
+	TestUSBPackets();
+	TestDueEvents();
+	TestRandomStream();
+	TestRandomBytes();
+	return CheckResult("test_midiparser");
+}
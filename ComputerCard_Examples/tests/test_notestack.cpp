@@ -0,0 +1,324 @@
+// Host test of NoteStack and VoiceAllocator: held note order and lookup
+// against a simple model, each allocation mode on fixed note sequences, and
+// voice invariants over random sequences in every mode
+
+#include "NoteStack.h"
+#include "Check.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using Allocator = VoiceAllocator<2>;
+
+// Notes played by open gates, in voice order, with -1 for a closed gate
+static std::vector<int> Playing(const Allocator &a)
+{
+	std::vector<int> p;
+	for (int v = 0; v < 2; v++) p.push_back(a.Gate(v) ? a.Note(v) : -1);
+	return p;
+}
+
+static bool Is(const Allocator &a, int note0, int note1)
+{
+	return Playing(a) == std::vector<int>{note0, note1};
+}
+
+static void TestNoteStack()
+{
+	NoteStack s;
+	CHECK_EQ(s.Count(), 0);
+	CHECK_EQ(s.Last(), -1);
+	CHECK_EQ(s.Lowest(), -1);
+	CHECK_EQ(s.Highest(), -1);
+
+	s.NoteOn(64, 100);
+	s.NoteOn(0, 1);
+	s.NoteOn(127, 127);
+	s.NoteOn(31, 50);
+	s.NoteOn(32, 60);
+	CHECK_EQ(s.Count(), 5);
+	CHECK_EQ(s.Last(), 32);
+	CHECK_EQ(s.Previous(32), 31);
+	CHECK_EQ(s.Previous(64), -1);
+	CHECK_EQ(s.Lowest(), 0);
+	CHECK_EQ(s.Highest(), 127);
+	CHECK_EQ(s.LowestAbove(0), 31);
+	CHECK_EQ(s.LowestAbove(31), 32);
+	CHECK_EQ(s.LowestAbove(64), 127);
+	CHECK_EQ(s.LowestAbove(127), -1);
+	CHECK_EQ(s.HighestBelow(127), 64);
+	CHECK_EQ(s.HighestBelow(32), 31);
+	CHECK_EQ(s.HighestBelow(0), -1);
+	CHECK_EQ(s.Velocity(31), 50);
+
+	// Pressing a held note again moves it to the top, with its new velocity
+	s.NoteOn(64, 10);
+	CHECK_EQ(s.Count(), 5);
+	CHECK_EQ(s.Last(), 64);
+	CHECK_EQ(s.Previous(64), 32);
+	CHECK_EQ(s.Previous(0), -1);
+	CHECK_EQ(s.Velocity(64), 10);
+
+	// Releasing returns to the previous held note
+	CHECK(s.NoteOff(64));
+	CHECK(!s.NoteOff(64));
+	CHECK(!s.NoteOff(1));
+	CHECK_EQ(s.Last(), 32);
+	CHECK(s.NoteOff(0));
+	CHECK_EQ(s.Lowest(), 31);
+	CHECK_EQ(s.Previous(127), -1);
+	CHECK_EQ(s.Count(), 3);
+
+	s.Clear();
+	CHECK_EQ(s.Count(), 0);
+	CHECK_EQ(s.Last(), -1);
+	CHECK(!s.Held(31));
+}
+
+// Random presses and releases, compared with a list of held notes in pressed order
+static void TestNoteStackRandom()
+{
+	for (uint32_t seed = 1; seed <= 10; seed++)
+	{
+		std::mt19937 rng(seed);
+		NoteStack s;
+		std::vector<int> model; // oldest first
+		for (int i = 0; i < 20000; i++)
+		{
+			int note = int(rng() % 24) + ((seed & 1) ? 0 : 52); // few notes, so many are held
+			auto found = std::find(model.begin(), model.end(), note);
+			if (rng() % 2)
+			{
+				s.NoteOn(uint8_t(note), uint8_t(i & 0x7F));
+				if (found != model.end()) model.erase(found);
+				model.push_back(note);
+			}
+			else
+			{
+				CHECK_EQ(s.NoteOff(uint8_t(note)), found != model.end());
+				if (found != model.end()) model.erase(found);
+			}
+
+			CHECK_EQ(s.Count(), int(model.size()));
+			CHECK_EQ(s.Last(), model.empty() ? -1 : model.back());
+			CHECK_EQ(s.Lowest(), model.empty() ? -1 : *std::min_element(model.begin(), model.end()));
+			CHECK_EQ(s.Highest(), model.empty() ? -1 : *std::max_element(model.begin(), model.end()));
+			if (i % 100 == 0)
+			{
+				// Walk the whole stack
+				int n = s.Last();
+				for (auto m = model.rbegin(); m != model.rend(); ++m)
+				{
+					CHECK_EQ(n, *m);
+					if (n < 0) break;
+					n = s.Previous(uint8_t(n));
+				}
+				CHECK_EQ(n, -1);
+			}
+		}
+	}
+}
+
+static void TestPriority()
+{
+	// Last note priority: the two most recent notes; releasing returns to older notes
+	Allocator a;
+	a.NoteOn(60);
+	CHECK(Is(a, 60, -1));
+	CHECK(a.Retrigger(0));
+	a.NoteOn(64);
+	a.NoteOn(67);
+	CHECK(Is(a, 67, 64)); // voice 1 keeps 64
+	CHECK(a.Retrigger(0));
+	CHECK(a.Retrigger(1));
+	CHECK(!a.Retrigger(1));
+	a.NoteOff(67);
+	CHECK(Is(a, 60, 64));
+	CHECK(!a.Retrigger(0)); // returning to a held note doesn't retrigger
+	a.NoteOff(60);
+	a.NoteOff(64);
+	CHECK(Is(a, -1, -1));
+	CHECK_EQ(a.Note(0), 60); // kept for the envelope release
+
+	// Low note priority
+	a.SetMode(Allocator::LowPriority);
+	a.NoteOn(67);
+	a.NoteOn(60);
+	a.NoteOn(64);
+	CHECK(Is(a, 67, 60) == false);
+	CHECK(Is(a, 64, 60));
+	a.NoteOn(72); // not among the two lowest
+	CHECK(Is(a, 64, 60));
+	a.NoteOff(60);
+	CHECK(Is(a, 64, 67));
+	a.NoteOn(48);
+	CHECK(Is(a, 64, 48));
+
+	// Changing mode reassigns the held notes (48, 64, 67, 72) at once
+	a.SetMode(Allocator::HighPriority);
+	CHECK(Is(a, 72, 67));
+	a.NoteOff(72);
+	CHECK(Is(a, 64, 67));
+	a.SetMode(Allocator::LastPriority);
+	CHECK(Is(a, 64, 48)); // 67, 64, 48 in pressed order
+
+	a.AllNotesOff();
+	CHECK(Is(a, -1, -1));
+	CHECK_EQ(a.Notes().Count(), 0);
+
+	// One voice: a monophonic synth
+	VoiceAllocator<1> mono;
+	mono.NoteOn(60);
+	mono.NoteOn(62);
+	mono.NoteOn(64);
+	mono.NoteOff(64);
+	CHECK(mono.Gate(0) && mono.Note(0) == 62);
+	mono.NoteOff(60);
+	CHECK(mono.Gate(0) && mono.Note(0) == 62);
+	mono.NoteOff(62);
+	CHECK(!mono.Gate(0));
+}
+
+static void TestRoundRobin()
+{
+	Allocator a;
+	a.SetMode(Allocator::RoundRobin);
+	a.NoteOn(60);
+	a.NoteOn(64);
+	CHECK(Is(a, 60, 64));
+	a.NoteOff(60);
+	a.NoteOn(67); // voice 0 is the only free voice
+	CHECK(Is(a, 67, 64));
+	a.NoteOn(69); // none free: steal the next in turn
+	CHECK(Is(a, 67, 69));
+	a.NoteOn(71);
+	CHECK(Is(a, 71, 69));
+	a.Retrigger(0);
+	a.Retrigger(1);
+
+	// Pressing a playing note again retriggers its voice
+	a.NoteOn(69, 30);
+	CHECK(Is(a, 71, 69));
+	CHECK(a.Retrigger(1));
+	CHECK_EQ(a.Velocity(1), 30);
+	CHECK(!a.Retrigger(0));
+
+	// Releasing returns to the most recent stolen note (67, then 64)
+	a.NoteOff(71);
+	CHECK(Is(a, 67, 69));
+	CHECK(!a.Retrigger(0));
+	a.NoteOff(69);
+	CHECK(Is(a, 67, 64));
+	a.NoteOff(67);
+	CHECK(Is(a, -1, 64));
+	a.NoteOff(60); // already released: no change
+	CHECK(Is(a, -1, 64));
+
+	// Free voices are used in turn, not always the first
+	Allocator b;
+	b.SetMode(Allocator::RoundRobin);
+	for (int i = 0; i < 4; i++)
+	{
+		b.NoteOn(uint8_t(60 + i));
+		CHECK(b.Gate(i % 2) && b.Note(i % 2) == 60 + i);
+		b.NoteOff(uint8_t(60 + i));
+	}
+}
+
+static void TestStealOldest()
+{
+	Allocator a;
+	a.SetMode(Allocator::StealOldest);
+	a.NoteOn(60);
+	a.NoteOn(64);
+	a.NoteOn(67); // steals 60, the oldest
+	CHECK(Is(a, 67, 64));
+	a.NoteOn(69); // steals 64
+	CHECK(Is(a, 67, 69));
+	a.NoteOn(67); // pressed again: restarts, so 69 is now the oldest
+	a.NoteOn(71);
+	CHECK(Is(a, 67, 71));
+	a.NoteOff(71); // returns to most recent stolen note
+	CHECK(Is(a, 67, 69));
+
+	// Free voice released longest ago
+	a.AllNotesOff();
+	a.NoteOn(60);
+	a.NoteOn(64);
+	a.NoteOff(64);
+	a.NoteOff(60);
+	a.NoteOn(72);
+	CHECK(Is(a, -1, 72));
+	a.NoteOn(74);
+	CHECK(Is(a, 74, 72));
+}
+
+// Random sequences in every mode: open gates play distinct held notes, as many as
+// possible, and in the priority modes exactly the highest priority held notes
+static void TestAllocatorRandom()
+{
+	for (int mode = Allocator::LastPriority; mode <= Allocator::StealOldest; mode++)
+	{
+		std::mt19937 rng(uint32_t(100 + mode));
+		VoiceAllocator<4> a;
+		a.SetMode(VoiceAllocator<4>::Mode(mode));
+		std::vector<int> model; // held notes, oldest first
+		for (int i = 0; i < 50000; i++)
+		{
+			int note = 48 + int(rng() % 12);
+			auto found = std::find(model.begin(), model.end(), note);
+			if (found != model.end()) model.erase(found);
+			uint32_t r = rng() % 64;
+			if (r == 0)
+			{
+				a.AllNotesOff();
+				model.clear();
+			}
+			else if (r < 30)
+			{
+				a.NoteOn(uint8_t(note));
+				model.push_back(note);
+			}
+			else
+			{
+				a.NoteOff(uint8_t(note));
+			}
+
+			std::vector<int> playing;
+			for (int v = 0; v < 4; v++)
+			{
+				if (a.Gate(v))
+				{
+					CHECK(std::find(model.begin(), model.end(), a.Note(v)) != model.end());
+					playing.push_back(a.Note(v));
+				}
+			}
+			std::sort(playing.begin(), playing.end());
+			CHECK(std::adjacent_find(playing.begin(), playing.end()) == playing.end());
+			CHECK_EQ(playing.size(), std::min<size_t>(model.size(), 4));
+
+			if (mode <= Allocator::HighPriority)
+			{
+				std::vector<int> wanted = model;
+				if (mode == Allocator::LastPriority) std::reverse(wanted.begin(), wanted.end());
+				else if (mode == Allocator::LowPriority) std::sort(wanted.begin(), wanted.end());
+				else std::sort(wanted.rbegin(), wanted.rend());
+				if (wanted.size() > 4) wanted.resize(4);
+				std::sort(wanted.begin(), wanted.end());
+				CHECK(playing == wanted);
+			}
+		}
+	}
+}
+
+int main()
+{
+	TestNoteStack();
+	TestNoteStackRandom();
+	TestPriority();
+	TestRoundRobin();
+	TestStealOldest();
+	TestAllocatorRandom();
+	return CheckResult("test_notestack");
+}
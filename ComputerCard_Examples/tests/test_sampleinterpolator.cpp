@@ -0,0 +1,154 @@
+// Host tests of SampleInterpolator: DC gain, linear and Hermite endpoints,
+// bank selection, looping reads, and the stopband of each sinc bank
+
+#include "SampleInterpolator.h"
+#include "Check.h"
+
+#include <complex>
+
+typedef SampleInterpolator SI;
+
+static SI interpolator; // 56KB of tables
+
+static void TestDCGain()
+{
+	int16_t s[32];
+	for (int16_t level : {int16_t(-32768), int16_t(-1000), int16_t(0), int16_t(1), int16_t(12345), int16_t(32767)})
+	{
+		for (int i = 0; i < 32; i++) s[i] = level;
+		for (uint32_t fraction = 0; fraction < 65536; fraction += 4099)
+		{
+			CHECK_EQ(interpolator.Interpolate(s + 16, fraction, SI::Linear), level);
+			CHECK_EQ(interpolator.Interpolate(s + 16, fraction, SI::Hermite), level);
+			for (int b = 0; b < SI::sincBanks; b++)
+			{
+				CHECK_EQ(interpolator.Interpolate(s + 16, fraction, SI::Sinc, b), level);
+			}
+		}
+	}
+}
+
+static void TestEndpoints()
+{
+	const int16_t s[] = {-20000, 3000, -7000, 25000, 100};
+	const int16_t *p = s + 1;
+
+	// At fraction 0, every quality gives the sample itself
+	CHECK_EQ(interpolator.Interpolate(p, 0, SI::Linear), 3000);
+	CHECK_EQ(interpolator.Interpolate(p, 0, SI::Hermite), 3000);
+	CHECK_EQ(interpolator.Interpolate(p + 1, 0, SI::Hermite), -7000);
+
+	// Approaching the next sample
+	CHECK(std::abs(interpolator.Interpolate(p, 65535, SI::Linear) - (-7000)) <= 1);
+	CHECK(std::abs(interpolator.Interpolate(p, 65535, SI::Hermite) - (-7000)) <= 2);
+
+	// Linear halfway; Hermite halfway is (-s[-1] + 9 s[0] + 9 s[1] - s[2]) / 16
+	CHECK_EQ(interpolator.Interpolate(p, 32768, SI::Linear), -2000);
+	CHECK(std::abs(interpolator.Interpolate(p, 32768, SI::Hermite) - (20000 + 9 * 3000 - 9 * 7000 - 25000) / 16) <= 1);
+
+	// Hermite overshoot is clipped rather than wrapping
+	const int16_t steep[] = {-32768, -32768, 32767, 32767};
+	CHECK(interpolator.Interpolate(steep + 1, 16384, SI::Hermite) < 0);
+	const int16_t edge[] = {32767, 32767, 32767, -32768};
+	CHECK_EQ(interpolator.Interpolate(edge + 1, 32768, SI::Hermite), 32767);
+}
+
+static void TestBanks()
+{
+	CHECK_EQ(SI::Bank(0), 0);
+	CHECK_EQ(SI::Bank(SI::unity), 0);
+	CHECK_EQ(SI::Bank(SI::unity + 1), 1);
+	CHECK_EQ(SI::Bank(2 * SI::unity), 2);
+	CHECK_EQ(SI::Bank(2 * SI::unity + 1), 3);
+	CHECK_EQ(SI::Bank(4 * SI::unity), 4);
+	CHECK_EQ(SI::Bank(6 * SI::unity), SI::sincBanks - 1);
+	CHECK_EQ(SI::Bank(SI::maxIncrement), SI::sincBanks - 1);
+	CHECK_EQ(SI::Bank(0xFFFFFFFF), SI::sincBanks - 1);
+
+	CHECK_EQ(SI::RateRatio(96000), 2 * SI::unity);
+	CHECK_EQ(SI::PhaseIncrement(SI::RateRatio(24000), 2048), SI::unity);
+}
+
+static void TestLoop()
+{
+	// Reads around the ends of a looping sample wrap to the other end
+	int16_t data[20];
+	for (int i = 0; i < 20; i++) data[i] = int16_t(i * 100);
+	SamplePhase phase;
+	phase.index = 19;
+	phase.fraction = 32768;
+	CHECK_EQ(interpolator.InterpolateLoop(data, 20, phase, SI::Linear), (1900 + 0) / 2);
+
+	int16_t unrolled[40];
+	for (int i = 0; i < 40; i++) unrolled[i] = data[(i + 10) % 20];
+	for (uint32_t index : {0u, 3u, 17u, 19u})
+	{
+		phase.index = index;
+		phase.fraction = 12345;
+		CHECK_EQ(interpolator.InterpolateLoop(data, 20, phase, SI::Sinc, 2),
+				 interpolator.Interpolate(unrolled + ((index + 10) % 20), 12345, SI::Sinc, 2));
+	}
+}
+
+// Highest (or lowest) gain of a sinc bank, over all phases, from frequency f0
+// to f1 (as fractions of the Nyquist frequency of the sample), in dB
+static double GainDB(int bank, double f0, double f1, bool highest = true)
+{
+	double worst = highest ? 0.0 : 1e9;
+	for (uint32_t p = 0; p < SI::sincPhases; p++)
+	{
+		// Coefficients, as the response to each tap in turn
+		double h[SI::sincTaps];
+		for (int k = 0; k < SI::sincTaps; k++)
+		{
+			int16_t s[SI::sincTaps] = {};
+			s[k] = 32767;
+			h[k] = interpolator.Interpolate(s + SI::maxBefore, p << 8, SI::Sinc, bank) / 32768.0;
+		}
+		for (int i = 0; i <= 100; i++)
+		{
+			double f = f0 + (f1 - f0) * i / 100;
+			std::complex<double> response = 0.0;
+			for (int k = 0; k < SI::sincTaps; k++)
+			{
+				response += h[k] * std::polar(1.0, -M_PI * f * (k - SI::maxBefore));
+			}
+			worst = highest ? std::max(worst, std::abs(response)) : std::min(worst, std::abs(response));
+		}
+	}
+	return 20.0 * std::log10(worst);
+}
+
+static void TestStopband()
+{
+	// From the bank's highest increment R, content at f > 1/R folds back. The
+	// filters are at least 55dB down from (stop / R): 1.5 times the output
+	// Nyquist frequency up to 2x, widening to 3 times at 8x. Bank 0 (no
+	// pitching up) only removes images, beyond Nyquist.
+	const double stop[SI::sincBanks] = {1.0, 1.25, 1.5, 2.0, 2.0, 3.0, 3.0};
+	for (int b = 0; b < SI::sincBanks; b++)
+	{
+		double R = std::pow(2.0, 0.5 * b);
+		if (b > 0)
+		{
+			double db = GainDB(b, stop[b] / R, 1.0);
+			if (db > -55.0) std::printf("bank %d: %.1fdB from %.3f\n", b, db, stop[b] / R);
+			CHECK(db <= -55.0);
+		}
+
+		// Passband: a quarter of the output Nyquist frequency is passed within 0.5dB
+		CHECK(GainDB(b, 0.0, 0.25 / R, false) > -0.5);
+		CHECK(GainDB(b, 0.0, 0.25 / R) < 0.5);
+	}
+}
+
+int main()
+{
+	interpolator.Init();
+	TestDCGain();
+	TestEndpoints();
+	TestBanks();
+	TestLoop();
+	TestStopband();
+	return CheckResult("test_sampleinterpolator");
+}
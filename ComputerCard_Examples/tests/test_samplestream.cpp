@@ -0,0 +1,109 @@
+// Host test of SampleStream, with the DMA and XIP streaming FIFO emulated
+// (tests/stubs): 8 voices at 0.5x to 4x read only from RAM once started,
+// with each block transfer taking up to two sample periods, and give
+// exactly the same output as reading flash directly.
+//
+// A 256-byte transfer takes well under one sample period on the card. At
+// three, the voices are served one block every 32 samples in turn, which
+// is only just enough at 4x, and the fastest voice falls behind at its loop.
+
+#include "SampleStream.h"
+#include "Check.h"
+
+#include <random>
+#include <sys/mman.h>
+
+static SampleInterpolator interpolator;
+static SampleStream<8> stream;
+
+// Increments of the voices: 0.5x to 4x
+static const uint32_t increments[8] = {32768, 49152, 65536, 81920, 98304, 131072, 196608, 262144};
+
+// Flash image, at XIP_BASE as on the card, so that addresses fit in 32 bits
+static int16_t *MapFlash()
+{
+	void *p = mmap((void *)XIP_BASE, PICO_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	return (p == (void *)XIP_BASE) ? (int16_t *)p : nullptr;
+}
+
+// Play numOut samples on every voice, checking each against the same
+// interpolation read directly from flash. Returns misses after startup samples.
+static uint32_t Play(int16_t *const data[8], const uint32_t numSamples[8], SampleInterpolator::Quality q,
+					 uint32_t numOut, uint32_t startup)
+{
+	SamplePhase phase[8];
+	for (int v = 0; v < 8; v++)
+	{
+		stream.Start(v, data[v], numSamples[v]);
+		phase[v].index = numSamples[v] / 3; // not at a block boundary
+		phase[v].fraction = 1234;
+	}
+
+	uint32_t startMisses = 0;
+	int failures = checkFailures;
+	for (uint32_t n = 0; n < numOut; n++)
+	{
+		if (n == startup) startMisses = stream.Misses();
+		for (int v = 0; v < 8; v++)
+		{
+			int bank = SampleInterpolator::Bank(increments[v]);
+			int16_t s = stream.Interpolate(v, interpolator, phase[v], q, bank);
+			CHECK_EQ(s, interpolator.InterpolateLoop(data[v], numSamples[v], phase[v], q, bank));
+			if (checkFailures != failures)
+			{
+				std::printf("voice %d, output sample %u\n", v, unsigned(n));
+				return 0;
+			}
+			phase[v].Advance(increments[v]);
+			phase[v].index %= numSamples[v];
+		}
+		stream.Prefetch();
+	}
+	return stream.Misses() - startMisses;
+}
+
+int main()
+{
+	int16_t *flash = MapFlash();
+	if (!flash)
+	{
+		std::printf("test_samplestream: skipped, could not map the flash image at 0x%x\n", unsigned(XIP_BASE));
+		return 0;
+	}
+
+	// A sample per voice, of various lengths (some shorter than a voice's
+	// ring, so it holds the whole loop), not starting on block boundaries
+	std::mt19937 rng(1);
+	int16_t *data[8];
+	uint32_t numSamples[8] = {20000, 33333, 777, 48000, 150, 9001, 60000, 12345};
+	int16_t *next = flash + 17;
+	for (int v = 0; v < 8; v++)
+	{
+		data[v] = next;
+		for (uint32_t i = 0; i < numSamples[v]; i++) data[v][i] = int16_t(rng());
+		next += numSamples[v] + 101;
+	}
+
+	interpolator.Init();
+	for (bool useStreamFIFO : {true, false})
+	{
+		stream.Init(useStreamFIFO);
+		for (uint32_t latency : {1u, 2u})
+		{
+			hostDMALatency = latency;
+			for (int q = 0; q < SampleInterpolator::numQualities; q++)
+			{
+				// One pass of the ring per voice (8 voices, a block each, and
+				// the transfer time) is the start-up; after that, no misses
+				uint32_t startup = 8 * 8 * (latency + 1);
+				uint32_t misses = Play(data, numSamples, SampleInterpolator::Quality(q), 48000, startup);
+				if (misses) std::printf("FIFO %d, latency %u, quality %d: %u misses\n", useStreamFIFO, unsigned(latency), q, unsigned(misses));
+				CHECK_EQ(misses, 0);
+			}
+		}
+	}
+	CHECK(stream.Blocks() > 0);
+	CHECK(!stream.Busy() || hostDMATransfers > 0);
+	return CheckResult("test_samplestream");
+}
@@ -0,0 +1,123 @@
+// Host tests of SPSCQueue: ordering, full/empty, Clear, and two threads
+
+#include "SPSCQueue.h"
+#include "Check.h"
+
+#include <thread>
+
+static void TestSingleThread()
+{
+	SPSCQueue<int, 4> q;
+	int v = 0;
+	CHECK(q.Empty());
+	CHECK(!q.Pop(v));
+	CHECK_EQ(q.Capacity(), 4);
+
+	for (int i = 0; i < 4; i++) CHECK(q.Push(i));
+	CHECK(q.Full());
+	CHECK(!q.Push(99));
+	CHECK_EQ(q.Overflows(), 1);
+	CHECK_EQ(q.Count(), 4);
+	CHECK_EQ(q.Space(), 0);
+
+	CHECK(q.Peek(v));
+	CHECK_EQ(v, 0);
+	for (int i = 0; i < 4; i++)
+	{
+		CHECK(q.Pop(v));
+		CHECK_EQ(v, i);
+	}
+	CHECK(!q.Pop(v));
+
+	// Wrap round the buffer many times
+	for (int i = 0; i < 1000; i++)
+	{
+		CHECK(q.Push(i));
+		CHECK(q.Push(-i));
+		CHECK(q.Pop(v));
+		CHECK_EQ(v, i);
+		CHECK(q.Pop(v));
+		CHECK_EQ(v, -i);
+	}
+}
+
+// After Clear, Pop must return only values pushed since, even though the
+// consumer had earlier seen the head further on than the tail
+static void TestClear()
+{
+	SPSCQueue<int, 8> q;
+	int v = 0;
+	for (int i = 0; i < 6; i++) q.Push(i);
+	CHECK(q.Pop(v)); // consumer now caches head = 6
+	q.Clear();
+	CHECK(q.Empty());
+	CHECK(!q.Pop(v));
+
+	q.Push(100);
+	CHECK_EQ(q.Count(), 1);
+	CHECK(q.Pop(v));
+	CHECK_EQ(v, 100);
+	CHECK(!q.Pop(v));
+
+	// Clear of an empty queue, and after filling it
+	q.Clear();
+	CHECK(q.Empty());
+	for (int i = 0; i < 8; i++) q.Push(i);
+	q.Clear();
+	CHECK_EQ(q.Space(), 8);
+	CHECK(!q.Pop(v));
+	for (int i = 0; i < 8; i++) CHECK(q.Push(200 + i));
+	for (int i = 0; i < 8; i++)
+	{
+		CHECK(q.Pop(v));
+		CHECK_EQ(v, 200 + i);
+	}
+}
+
+// Values larger than a word arrive whole and in order between threads
+static void TestThreads()
+{
+	struct Frame
+	{
+		uint32_t a, b, c;
+	};
+	static SPSCQueue<Frame, 64> q;
+	const uint32_t n = 200000;
+
+	std::thread producer([] {
+		for (uint32_t i = 0; i < n;)
+		{
+			if (q.Push({i, ~i, i * 3}))
+				i++;
+			else
+				std::this_thread::yield();
+		}
+	});
+
+	uint32_t expected = 0, torn = 0;
+	Frame f;
+	while (expected < n)
+	{
+		if (q.Pop(f))
+		{
+			if (f.a != expected || f.b != ~expected || f.c != expected * 3) torn++;
+			expected++;
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+
+	CHECK_EQ(torn, 0);
+	CHECK(q.Empty());
+}
+
+int main()
+{
+	TestSingleThread();
+	TestClear();
+	TestThreads();
+	return CheckResult("test_spscqueue");
+}
@@ -0,0 +1,170 @@
+// Host simulation of USB audio clock drift correction: a host sending audio
+// each 1ms USB frame by its own clock, and the card playing it by its own,
+// through an SPSCQueue, with USBAudioFeedback and AsyncResampler
+
+#include "USBAudio.h"
+#include "SPSCQueue.h"
+#include "Check.h"
+
+#include <cmath>
+#include <cstdlib>
+
+typedef SPSCQueue<AudioFrame, 512> PlaybackBuffer;
+
+struct Simulation
+{
+	double hostPPM; // host clock, relative to the card's
+	bool useFeedback; // host sends the number of samples set by the feedback endpoint
+	bool alternating = false; // full-scale signal alternating in sign each frame
+
+	PlaybackBuffer buffer;
+	USBAudioFeedback<> feedback;
+	AsyncResampler resampler;
+
+	uint32_t sample = 0; // card sample counter
+	double nextSOF = 0; // time of next USB frame, in card samples
+	uint32_t sent = 0; // frames sent by host
+	uint32_t sendFrac = 0; // 16.16 remainder of frames to send
+	bool streaming = true;
+
+	// Over the last Run: queue level, and the largest change in magnitude
+	// between consecutive outputs
+	uint64_t levelSum = 0;
+	uint32_t levelMin = 0, levelMax = 0;
+	int32_t maxStep = 0;
+
+	explicit Simulation(double ppm, bool fb) : hostPPM(ppm), useFeedback(fb)
+	{
+		resampler.SetTargetLevel(96);
+	}
+
+	// One USB frame from the host: 48 frames by the host's clock, or as fed back
+	void HostFrame()
+	{
+		feedback.Frame(sample);
+		uint32_t n = 48;
+		if (useFeedback)
+		{
+			sendFrac += feedback.Value();
+			n = sendFrac >> 16;
+			sendFrac &= 0xFFFF;
+		}
+		for (uint32_t i = 0; i < n && streaming; i++)
+		{
+			int16_t v = alternating ? ((sent & 1) ? -32767 : 32767) : int16_t(10000 * std::sin(sent * 0.01));
+			buffer.Push({v, v});
+			sent++;
+		}
+	}
+
+	void Run(uint32_t samples)
+	{
+		levelSum = 0;
+		levelMin = 0xFFFFFFFF;
+		levelMax = 0;
+		maxStep = 0;
+		int32_t last = -1;
+		for (uint32_t n = 0; n < samples; n++, sample++)
+		{
+			while (sample >= nextSOF)
+			{
+				HostFrame();
+				nextSOF += 48.0 / (1 + hostPPM * 1e-6);
+			}
+
+			uint32_t level = buffer.Count();
+			levelSum += level;
+			if (level < levelMin) levelMin = level;
+			if (level > levelMax) levelMax = level;
+
+			AudioFrame out;
+			if (resampler.Process(buffer, out))
+			{
+				int32_t m = std::abs(out.left);
+				if (last >= 0 && std::abs(m - last) > maxStep) maxStep = std::abs(m - last);
+				last = m;
+			}
+		}
+	}
+
+	double MeanLevel(uint32_t samples) const {return double(levelSum) / samples;}
+};
+
+// Host ignoring feedback: the resampler alone takes up the drift
+static void TestResamplerLocks(double ppm)
+{
+	Simulation s(ppm, false);
+	s.Run(48000 * 20); // settle
+	s.Run(48000 * 5);
+
+	CHECK(s.resampler.Running());
+	CHECK_EQ(s.resampler.Underruns(), 0);
+	CHECK_EQ(s.buffer.Overflows(), 0);
+	CHECK(std::fabs(s.resampler.RatioPPM() - ppm) < 30);
+	CHECK(std::fabs(s.MeanLevel(48000 * 5) - 96) < 4);
+	CHECK(s.levelMax < 200);
+}
+
+// Host following the feedback endpoint: its rate matches the card's, and
+// the resampler needs little correction
+static void TestFeedback(double ppm)
+{
+	Simulation s(ppm, true);
+	s.Run(48000 * 20);
+	s.Run(48000 * 5);
+
+	double expected = 48.0 / (1 + ppm * 1e-6) * 65536;
+	CHECK(std::fabs(s.feedback.Value() - expected) < 100); // 35ppm
+	CHECK_EQ(s.resampler.Underruns(), 0);
+	CHECK_EQ(s.buffer.Overflows(), 0);
+	CHECK(std::abs(s.resampler.RatioPPM()) < 50);
+	CHECK(std::fabs(s.MeanLevel(48000 * 5) - 96) < 4);
+}
+
+// Stream stopped and started again: one underrun, the buffer cleared, and
+// playback resumes locked at the target level
+static void TestStopStart()
+{
+	Simulation s(300, false);
+	s.Run(48000 * 10);
+
+	s.streaming = false;
+	s.Run(4800);
+	CHECK(!s.resampler.Running());
+	CHECK_EQ(s.resampler.Underruns(), 1);
+	s.buffer.Clear();
+	s.resampler.Reset();
+
+	s.streaming = true;
+	s.Run(48000 * 20);
+	s.Run(48000 * 5);
+	CHECK(s.resampler.Running());
+	CHECK_EQ(s.resampler.Underruns(), 1);
+	CHECK(std::fabs(s.resampler.RatioPPM() - 300) < 30);
+	CHECK(std::fabs(s.MeanLevel(48000 * 5) - 96) < 4);
+}
+
+// Full-scale input, alternating in sign, interpolated at every fraction as
+// the read position drifts: the output envelope changes smoothly, with no
+// overflow in the interpolator
+static void TestFullScale()
+{
+	Simulation s(-700, false);
+	s.alternating = true;
+	s.Run(48000 * 20);
+	s.Run(48000 * 5);
+	CHECK_EQ(s.resampler.Underruns(), 0);
+	CHECK(s.maxStep < 500);
+}
+
+int main()
+{
+	TestResamplerLocks(500);
+	TestResamplerLocks(-800);
+	TestResamplerLocks(0);
+	TestFeedback(400);
+	TestFeedback(-250);
+	TestStopStart();
+	TestFullScale();
+	return CheckResult("test_usbaudio");
+}
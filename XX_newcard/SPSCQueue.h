@@ -0,0 +1,135 @@
+/*
+SPSCQueue - lock-free single-producer, single-consumer queue
+
+Part of ComputerCard, see ComputerCard.h and README.md
+
+Included by ComputerCard.h. Allocation-free, and needs nothing from the
+Pico SDK but its memory barrier and RAM placement of functions, so that
+it can also be built on a host computer, as in tests/.
+*/
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <cstdint>
+
+#if __has_include("hardware/sync.h")
+#include "hardware/sync.h"
+#else
+#define SPSCQUEUE_HOST
+#ifndef __not_in_flash_func
+#define __not_in_flash_func(func_name) func_name
+#endif
+#endif
+
+/** \brief Lock-free single-producer, single-consumer queue
+
+    For passing values between cores, or between ProcessSample and the rest
+    of the program, without losing or tearing values.
+    Exactly one core/context may call Push, and exactly one may call Pop.
+
+    Size must be a power of two. Head and tail are free-running counters,
+    each written by only one side; memory barriers order the data accesses
+    with the counter updates.
+*/
+template <typename T, uint32_t Size>
+class SPSCQueue
+{
+	static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "SPSCQueue size must be a power of two");
+	static constexpr uint32_t mask = Size - 1;
+
+public:
+	/// Add value to queue. Returns false (and counts an overflow) if full. Producer only.
+	bool __not_in_flash_func(Push)(const T &value)
+	{
+		uint32_t h = head;
+		if (h - tailCache >= Size)
+		{
+			tailCache = tail;
+			if (h - tailCache >= Size)
+			{
+				overflows++;
+				return false;
+			}
+		}
+		buffer[h & mask] = value;
+		Barrier(); // data written before head published
+		head = h + 1;
+		return true;
+	}
+
+	/// Remove value from queue. Returns false if empty. Consumer only.
+	bool __not_in_flash_func(Pop)(T &value)
+	{
+		uint32_t t = tail;
+		if (t == headCache)
+		{
+			headCache = head;
+			if (t == headCache)
+				return false;
+		}
+		Barrier(); // head read before data
+		value = buffer[t & mask];
+		Barrier(); // data read before slot released
+		tail = t + 1;
+		return true;
+	}
+
+	/// Read next value without removing it. Returns false if empty. Consumer only.
+	bool __not_in_flash_func(Peek)(T &value)
+	{
+		uint32_t t = tail;
+		if (t == head)
+			return false;
+		Barrier();
+		value = buffer[t & mask];
+		return true;
+	}
+
+	/// Number of values in queue
+	uint32_t __not_in_flash_func(Count)() const {return head - tail;}
+
+	/// Number of free slots in queue
+	uint32_t __not_in_flash_func(Space)() const {return Size - (head - tail);}
+
+	bool __not_in_flash_func(Empty)() const {return head == tail;}
+	bool __not_in_flash_func(Full)() const {return head - tail >= Size;}
+
+	/// Number of values rejected by Push because the queue was full
+	uint32_t Overflows() const {return overflows;}
+
+	/// Discard all values. Consumer only; the producer must be stopped
+	/// (not calling Push) while Clear runs.
+	void Clear()
+	{
+		uint32_t h = head;
+		headCache = h; // else Pop would read stale slots, up to the old head
+		tail = h;
+	}
+
+	static constexpr uint32_t Capacity() {return Size;}
+
+private:
+	T buffer[Size];
+
+	// Written by producer only
+	volatile uint32_t head = 0;
+	uint32_t tailCache = 0;
+	volatile uint32_t overflows = 0;
+
+	// Written by consumer only
+	volatile uint32_t tail = 0;
+	uint32_t headCache = 0;
+
+	// Memory barrier: the Cortex-M0+ DMB instruction on the card
+	static void __not_in_flash_func(Barrier)()
+	{
+#ifdef SPSCQUEUE_HOST
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#else
+		__dmb();
+#endif
+	}
+};
+
+#endif